@@ -0,0 +1,193 @@
+#include "HostTypes.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+
+#include "Epoch.h"
+#include "ClientsIndex.h"
+
+namespace {
+    constexpr ULONG ClientAlive = 0xA11FE;
+    constexpr ULONG ClientFreed = 0xDEAD;
+
+    struct CLIENT {
+        volatile ULONG Magic;
+        volatile ULONG Id; // Changes when the slot is reused
+        ULONG Type;
+        UINT64 ProcessId;
+    };
+
+    constexpr ULONG TypesCount = 4;
+    constexpr ULONG MaxClients = 32;
+
+    using CLIENTS_SNAPSHOT = ClientsIndex<CLIENT, TypesCount, MaxClients>;
+
+    VOID Yield() { std::this_thread::yield(); }
+
+    // Publication of CommPort::ClientsList: the spare version is built from the live clients
+    // except 'Excluded' and published, then removed clients may be freed:
+    VOID Publish(EpochSnapshot<CLIENTS_SNAPSHOT>& Published, std::vector<CLIENT*>& Live, const CLIENT* Excluded = NULL)
+    {
+        CLIENTS_SNAPSHOT::Range Source(Live.data(), Live.data() + Live.size());
+        Published.GetSpare()->Build(
+            Source,
+            [](const CLIENT& Client) -> ULONG { return Client.Type; },
+            [](const CLIENT& Client, OUT UINT64* ProcessId) -> BOOLEAN {
+                *ProcessId = Client.ProcessId;
+                return Client.ProcessId != 0;
+            },
+            Excluded
+        );
+        Published.Publish(Yield);
+    }
+
+    bool TestPublishWaitsForReaders()
+    {
+        static EpochSnapshot<CLIENTS_SNAPSHOT> Published;
+        CLIENT Client = { ClientAlive, 1, 0, 100 };
+        std::vector<CLIENT*> Live = { &Client };
+
+        EpochSnapshot<CLIENTS_SNAPSHOT>::READER OldReader = 0;
+        const CLIENTS_SNAPSHOT* OldVersion = Published.Enter(0, &OldReader);
+        KB_CHECK(OldVersion->GetCount() == 0);
+
+        std::atomic<bool> Returned(false);
+        std::thread Publisher([&]() {
+            Publish(Published, Live);
+            Returned = true;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        bool ReturnedEarly = Returned.load();
+
+        // Readers of the new version don't prolong the wait for the old one:
+        EpochSnapshot<CLIENTS_SNAPSHOT>::READER NewReader = 0;
+        const CLIENTS_SNAPSHOT* NewVersion = Published.Enter(1, &NewReader);
+
+        Published.Leave(OldReader);
+        Publisher.join();
+
+        KB_CHECK(!ReturnedEarly);
+        KB_CHECK(Returned.load());
+        KB_CHECK(NewVersion != OldVersion);
+        KB_CHECK(NewVersion->GetCount() == 1);
+        KB_CHECK(NewVersion->IsProcessPresent(100));
+
+        Published.Leave(NewReader);
+        return true;
+    }
+
+    // Readers walk their snapshot twice with a yield between walks while publishers
+    // connect and disconnect clients and free them right after the publication:
+    // a reader must never see a freed or reused client, nor a version that is rebuilt under it.
+    bool TestReadersAndPublishersStress()
+    {
+        constexpr ULONG ReadersCount = 3;
+        constexpr ULONG PublishersCount = 2;
+        constexpr ULONG OperationsPerPublisher = 3000;
+
+        static EpochSnapshot<CLIENTS_SNAPSHOT> Published;
+        static CLIENT Slots[MaxClients * 2];
+
+        std::mutex WritersLock;
+        std::vector<CLIENT*> Live;
+        ULONG NextId = 0;
+        for (auto& Slot : Slots) Slot.Magic = ClientFreed;
+
+        std::atomic<ULONG> PublishersFinished(0);
+        std::atomic<ULONG> Violations(0);
+        std::atomic<UINT64> Reads(0);
+
+        std::vector<std::thread> Threads;
+        for (ULONG Reader = 0; Reader < ReadersCount; Reader++) {
+            Threads.emplace_back([&, Reader]() {
+                const CLIENT* Seen[MaxClients];
+                ULONG SeenIds[MaxClients];
+                while (PublishersFinished.load() != PublishersCount) {
+                    EpochSnapshot<CLIENTS_SNAPSHOT>::READER Cookie = 0;
+                    const CLIENTS_SNAPSHOT* Clients = Published.Enter(Reader, &Cookie);
+
+                    ULONG Count = 0, Typed = 0;
+                    for (const auto& Client : Clients->GetAll()) {
+                        if (Client.Magic != ClientAlive || !Clients->IsProcessPresent(Client.ProcessId)) Violations++;
+                        if (Client.Type < TypesCount) Typed++;
+                        Seen[Count] = &Client;
+                        SeenIds[Count] = Client.Id;
+                        Count++;
+                    }
+                    for (ULONG Type = 0; Type < TypesCount; Type++) {
+                        for (const auto& Client : Clients->GetOfType(Type)) {
+                            if (Client.Type != Type) Violations++;
+                            Typed--;
+                        }
+                    }
+                    if (Typed != 0) Violations++;
+
+                    Yield();
+
+                    ULONG Index = 0;
+                    for (const auto& Client : Clients->GetAll()) {
+                        if (Index >= Count || Seen[Index] != &Client || SeenIds[Index] != Client.Id || Client.Magic != ClientAlive) Violations++;
+                        Index++;
+                    }
+                    if (Index != Count) Violations++;
+
+                    Published.Leave(Cookie);
+                    Reads++;
+                }
+            });
+        }
+
+        for (ULONG Publisher = 0; Publisher < PublishersCount; Publisher++) {
+            Threads.emplace_back([&, Publisher]() {
+                std::mt19937 Random(Publisher);
+                for (ULONG i = 0; i < OperationsPerPublisher; i++) {
+                    std::lock_guard<std::mutex> Guard(WritersLock);
+                    bool Connect = Live.empty() || (Live.size() < MaxClients && (Random() & 1));
+                    if (Connect) {
+                        CLIENT* Client = NULL;
+                        for (auto& Slot : Slots) {
+                            if (Slot.Magic == ClientFreed) {
+                                Client = &Slot;
+                                break;
+                            }
+                        }
+                        Client->Id = ++NextId;
+                        Client->Type = Random() % (TypesCount + 1); // TypesCount is "no type"
+                        Client->ProcessId = 1 + Random() % 8;
+                        Client->Magic = ClientAlive;
+                        Live.push_back(Client);
+                        Publish(Published, Live);
+                    } else {
+                        size_t Index = Random() % Live.size();
+                        CLIENT* Client = Live[Index];
+                        Publish(Published, Live, Client);
+                        Live.erase(Live.begin() + static_cast<std::ptrdiff_t>(Index));
+                        Client->Magic = ClientFreed;
+                        Client->Id = 0;
+                    }
+                }
+                PublishersFinished++;
+            });
+        }
+
+        for (auto& Thread : Threads) Thread.join();
+
+        KB_CHECK(Violations.load() == 0);
+        std::printf("\t%llu reads, %u publications\n", static_cast<unsigned long long>(Reads.load()), PublishersCount * OperationsPerPublisher);
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "Epoch: publication waits for readers of the previous version", TestPublishWaitsForReaders },
+        { "Epoch: readers and publishers of clients snapshots", TestReadersAndPublishersStress },
+    });
+}
@@ -0,0 +1,116 @@
+#include "HostTypes.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "EventQueue.h"
+
+namespace {
+    struct EVENT {
+        ULONG Producer;
+        ULONG Sequence;
+        UINT64 Checksum;
+    };
+
+    UINT64 GetChecksum(ULONG Producer, ULONG Sequence)
+    {
+        return (static_cast<UINT64>(Producer) << 32 | Sequence) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    bool TestFifoAndOverflow()
+    {
+        static EventQueue<EVENT, 8> Queue;
+        EVENT Event = {};
+
+        // Several rounds, so cells are reused with sequences of next rounds:
+        for (ULONG Round = 0; Round < 5; Round++) {
+            KB_CHECK(Queue.IsEmpty());
+            KB_CHECK(!Queue.Pop(&Event));
+
+            for (ULONG i = 0; i < Queue.GetCapacity(); i++) {
+                KB_CHECK(Queue.Push({ 0, Round * 100 + i, 0 }));
+            }
+            KB_CHECK(!Queue.Push({ 0, 0, 0 }));
+            KB_CHECK(!Queue.Push({ 0, 0, 0 }));
+            KB_CHECK(Queue.TakeDropped() == 2);
+            KB_CHECK(Queue.TakeDropped() == 0);
+
+            for (ULONG i = 0; i < Queue.GetCapacity(); i++) {
+                KB_CHECK(!Queue.IsEmpty());
+                KB_CHECK(Queue.Pop(&Event));
+                KB_CHECK(Event.Sequence == Round * 100 + i);
+            }
+        }
+        return true;
+    }
+
+    // Producers push numbered events while the consumer pops them, every event
+    // must be either received exactly once in order of its producer or counted as dropped:
+    bool TestProducersStress()
+    {
+        constexpr ULONG ProducersCount = 4;
+        constexpr ULONG EventsPerProducer = 200000;
+
+        static EventQueue<EVENT, 256> Queue;
+        std::vector<ULONG> Pushed(ProducersCount), Received(ProducersCount);
+        std::vector<LONG64> Last(ProducersCount, -1);
+        std::atomic<ULONG> Finished(0);
+        UINT64 Dropped = 0;
+        bool Valid = true;
+
+        std::vector<std::thread> Producers;
+        for (ULONG Producer = 0; Producer < ProducersCount; Producer++) {
+            Producers.emplace_back([&, Producer]() {
+                for (ULONG i = 0; i < EventsPerProducer; i++) {
+                    if (Queue.Push({ Producer, i, GetChecksum(Producer, i) })) Pushed[Producer]++;
+                    if ((i & 1023) == 0) std::this_thread::yield();
+                }
+                Finished++;
+            });
+        }
+
+        auto Drain = [&]() {
+            EVENT Event = {};
+            while (Queue.Pop(&Event)) {
+                if (Event.Producer >= ProducersCount || Event.Checksum != GetChecksum(Event.Producer, Event.Sequence)
+                    || static_cast<LONG64>(Event.Sequence) <= Last[Event.Producer])
+                {
+                    Valid = false;
+                    continue;
+                }
+                Last[Event.Producer] = Event.Sequence;
+                Received[Event.Producer]++;
+            }
+            Dropped += Queue.TakeDropped();
+        };
+
+        while (Finished.load() != ProducersCount) {
+            Drain();
+            std::this_thread::yield();
+        }
+        for (auto& Thread : Producers) Thread.join();
+        Drain();
+
+        KB_CHECK(Valid);
+        KB_CHECK(Queue.IsEmpty());
+
+        UINT64 TotalPushed = 0;
+        for (ULONG Producer = 0; Producer < ProducersCount; Producer++) {
+            KB_CHECK(Received[Producer] == Pushed[Producer]);
+            TotalPushed += Pushed[Producer];
+        }
+        KB_CHECK(TotalPushed + Dropped == static_cast<UINT64>(ProducersCount) * EventsPerProducer);
+        std::printf("\tpushed %llu, dropped %llu\n", static_cast<unsigned long long>(TotalPushed), static_cast<unsigned long long>(Dropped));
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "EventQueue: FIFO and overflow", TestFifoAndOverflow },
+        { "EventQueue: producers stress", TestProducersStress },
+    });
+}
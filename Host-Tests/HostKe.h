@@ -0,0 +1,162 @@
+#pragma once
+
+// Kernel routines that Locks.h wraps, implemented for the host:
+// IRQL is a per-thread value that is only recorded, every thread is its own processor,
+// spin locks (queued ones too) spin on the spin lock of HostWdm.h.
+// Mutexes, ERESOURCE and Interlocked* of Atomic32/64 are declared only,
+// so Locks.h compiles, but tests that call them don't link.
+
+#include "HostWdm.h"
+
+#if !defined(_MSC_VER)
+    #define __declspec(Attributes)
+    #define UNREFERENCED_PARAMETER(Parameter) (void)(Parameter)
+
+    #define _IRQL_requires_(Irql)
+    #define _IRQL_requires_max_(Irql)
+    #define _IRQL_raises_(Irql)
+    #define _IRQL_saves_
+    #define _IRQL_restores_
+    #define _IRQL_saves_global_(Kind, Parameter)
+    #define _IRQL_restores_global_(Kind, Parameter)
+
+    LONG InterlockedCompareExchange(volatile LONG* Destination, LONG Exchange, LONG Comparand);
+    LONG InterlockedExchange(volatile LONG* Target, LONG Value);
+    LONG InterlockedAdd(volatile LONG* Addend, LONG Value);
+    LONG InterlockedIncrement(volatile LONG* Addend);
+    LONG InterlockedDecrement(volatile LONG* Addend);
+    LONG InterlockedAnd(volatile LONG* Destination, LONG Value);
+    LONG InterlockedOr(volatile LONG* Destination, LONG Value);
+    LONG InterlockedXor(volatile LONG* Destination, LONG Value);
+    BOOLEAN InterlockedBitTestAndSet(volatile LONG* Base, LONG Offset);
+    BOOLEAN InterlockedBitTestAndReset(volatile LONG* Base, LONG Offset);
+    LONG64 InterlockedCompareExchange64(volatile LONG64* Destination, LONG64 Exchange, LONG64 Comparand);
+    LONG64 InterlockedExchange64(volatile LONG64* Target, LONG64 Value);
+    LONG64 InterlockedAdd64(volatile LONG64* Addend, LONG64 Value);
+    LONG64 InterlockedIncrement64(volatile LONG64* Addend);
+    LONG64 InterlockedDecrement64(volatile LONG64* Addend);
+    LONG64 InterlockedAnd64(volatile LONG64* Destination, LONG64 Value);
+    LONG64 InterlockedOr64(volatile LONG64* Destination, LONG64 Value);
+    LONG64 InterlockedXor64(volatile LONG64* Destination, LONG64 Value);
+    PVOID InterlockedCompareExchangePointer(PVOID volatile* Destination, PVOID Exchange, PVOID Comparand);
+    PVOID InterlockedExchangePointer(PVOID volatile* Target, PVOID Value);
+#endif
+
+using NTSTATUS = LONG;
+using KIRQL = UCHAR;
+using PKIRQL = KIRQL*;
+using PETHREAD = struct _ETHREAD*;
+
+#define PASSIVE_LEVEL 0
+#define APC_LEVEL 1
+#define DISPATCH_LEVEL 2
+
+inline thread_local KIRQL HostIrql = PASSIVE_LEVEL;
+
+inline KIRQL KeGetCurrentIrql() {
+    return HostIrql;
+}
+
+inline KIRQL KeRaiseIrqlToDpcLevel() {
+    KIRQL OldIrql = HostIrql;
+    HostIrql = DISPATCH_LEVEL;
+    return OldIrql;
+}
+
+inline VOID KeLowerIrql(KIRQL NewIrql) {
+    HostIrql = NewIrql;
+}
+
+inline ULONG KeGetCurrentProcessorNumberEx(PVOID ProcNumber) {
+    static volatile LONG ProcessorsCount = 0;
+    static thread_local ULONG Processor = static_cast<ULONG>(KB_ATOMIC_INCREMENT(ProcessorsCount) - 1);
+    (void)ProcNumber;
+    return Processor;
+}
+
+inline PETHREAD PsGetCurrentThread() {
+    static thread_local UCHAR Thread;
+    return reinterpret_cast<PETHREAD>(&Thread);
+}
+
+inline VOID KeEnterCriticalRegion() {}
+inline VOID KeLeaveCriticalRegion() {}
+inline VOID KeEnterGuardedRegion() {}
+inline VOID KeLeaveGuardedRegion() {}
+
+inline VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, OUT PKIRQL OldIrql) {
+    *OldIrql = KeRaiseIrqlToDpcLevel();
+    HostAcquireSpinLock(SpinLock);
+}
+
+inline VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql) {
+    HostReleaseSpinLock(SpinLock);
+    KeLowerIrql(NewIrql);
+}
+
+inline VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock) {
+    HostAcquireSpinLock(SpinLock);
+}
+
+inline VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock) {
+    HostReleaseSpinLock(SpinLock);
+}
+
+inline BOOLEAN KeTryToAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock) {
+    return KB_ATOMIC_EXCHANGE(*SpinLock, 1) == 0;
+}
+
+using KLOCK_QUEUE_HANDLE = struct _KLOCK_QUEUE_HANDLE {
+    PKSPIN_LOCK Lock;
+    KIRQL OldIrql;
+};
+using PKLOCK_QUEUE_HANDLE = KLOCK_QUEUE_HANDLE*;
+
+inline VOID KeAcquireInStackQueuedSpinLock(PKSPIN_LOCK SpinLock, OUT PKLOCK_QUEUE_HANDLE LockHandle) {
+    LockHandle->Lock = SpinLock;
+    KeAcquireSpinLock(SpinLock, &LockHandle->OldIrql);
+}
+
+inline VOID KeReleaseInStackQueuedSpinLock(PKLOCK_QUEUE_HANDLE LockHandle) {
+    KeReleaseSpinLock(LockHandle->Lock, LockHandle->OldIrql);
+}
+
+inline VOID KeAcquireInStackQueuedSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock, OUT PKLOCK_QUEUE_HANDLE LockHandle) {
+    LockHandle->Lock = SpinLock;
+    HostAcquireSpinLock(SpinLock);
+}
+
+inline VOID KeReleaseInStackQueuedSpinLockFromDpcLevel(PKLOCK_QUEUE_HANDLE LockHandle) {
+    HostReleaseSpinLock(LockHandle->Lock);
+}
+
+using FAST_MUTEX = struct _FAST_MUTEX { PVOID Reserved; };
+using KGUARDED_MUTEX = struct _KGUARDED_MUTEX { PVOID Reserved; };
+using ERESOURCE = struct _ERESOURCE { PVOID Reserved; };
+
+VOID ExInitializeFastMutex(FAST_MUTEX* Mutex);
+VOID ExAcquireFastMutex(FAST_MUTEX* Mutex);
+VOID ExReleaseFastMutex(FAST_MUTEX* Mutex);
+VOID ExAcquireFastMutexUnsafe(FAST_MUTEX* Mutex);
+VOID ExReleaseFastMutexUnsafe(FAST_MUTEX* Mutex);
+BOOLEAN ExTryToAcquireFastMutex(FAST_MUTEX* Mutex);
+
+VOID KeInitializeGuardedMutex(KGUARDED_MUTEX* Mutex);
+VOID KeAcquireGuardedMutex(KGUARDED_MUTEX* Mutex);
+VOID KeReleaseGuardedMutex(KGUARDED_MUTEX* Mutex);
+VOID KeAcquireGuardedMutexUnsafe(KGUARDED_MUTEX* Mutex);
+VOID KeReleaseGuardedMutexUnsafe(KGUARDED_MUTEX* Mutex);
+BOOLEAN KeTryToAcquireGuardedMutex(KGUARDED_MUTEX* Mutex);
+
+NTSTATUS ExInitializeResourceLite(ERESOURCE* Resource);
+NTSTATUS ExReinitializeResourceLite(ERESOURCE* Resource);
+NTSTATUS ExDeleteResourceLite(ERESOURCE* Resource);
+BOOLEAN ExAcquireResourceSharedLite(ERESOURCE* Resource, BOOLEAN Wait);
+BOOLEAN ExAcquireResourceExclusiveLite(ERESOURCE* Resource, BOOLEAN Wait);
+VOID ExReleaseResourceLite(ERESOURCE* Resource);
+VOID ExConvertExclusiveToSharedLite(ERESOURCE* Resource);
+ULONG ExIsResourceAcquiredLite(ERESOURCE* Resource);
+ULONG ExIsResourceAcquiredSharedLite(ERESOURCE* Resource);
+BOOLEAN ExIsResourceAcquiredExclusiveLite(ERESOURCE* Resource);
+ULONG ExGetSharedWaiterCount(ERESOURCE* Resource);
+ULONG ExGetExclusiveWaiterCount(ERESOURCE* Resource);
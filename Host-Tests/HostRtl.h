@@ -0,0 +1,130 @@
+#pragma once
+
+// Routines of ntdll that the strings headers (UnicodeCase.h, StringAllocators.h, StringsAPI.h)
+// use in usermode, implemented for the host (winternl.h provides them with MSVC).
+// Conversions between ANSI and Unicode strings are Latin-1, case conversions are ASCII only.
+
+#include "HostTypes.h"
+
+#include <cstring>
+#include <cstdarg>
+#include <cstdio>
+
+#if defined(_MSC_VER)
+    #include <winternl.h>
+    #include <intrin.h>
+#else
+    #include <emmintrin.h>
+
+    using BYTE = uint8_t;
+    using NTSTATUS = LONG;
+
+    #define NTSYSAPI
+    #define NTAPI
+    #define __cdecl
+    #define UNREFERENCED_PARAMETER(Parameter) (void)(Parameter)
+
+    #define RtlCopyMemory(Destination, Source, Length) std::memcpy((Destination), (Source), (Length))
+    #define RtlMoveMemory(Destination, Source, Length) std::memmove((Destination), (Source), (Length))
+    #define RtlZeroMemory(Destination, Length) std::memset((Destination), 0, (Length))
+    #define RtlEqualMemory(Destination, Source, Length) (std::memcmp((Destination), (Source), (Length)) == 0)
+
+    using UNICODE_STRING = struct _UNICODE_STRING {
+        USHORT Length;
+        USHORT MaximumLength;
+        WCHAR* Buffer;
+    };
+    using PUNICODE_STRING = UNICODE_STRING*;
+    using PCUNICODE_STRING = const UNICODE_STRING*;
+
+    using ANSI_STRING = struct _STRING {
+        USHORT Length;
+        USHORT MaximumLength;
+        CHAR* Buffer;
+    };
+    using PANSI_STRING = ANSI_STRING*;
+    using PCANSI_STRING = const ANSI_STRING*;
+
+    inline VOID RtlInitAnsiString(PANSI_STRING Dest, const CHAR* Source) {
+        Dest->Buffer = const_cast<CHAR*>(Source);
+        Dest->Length = static_cast<USHORT>(Source ? std::strlen(Source) : 0);
+        Dest->MaximumLength = static_cast<USHORT>(Source ? Dest->Length + 1 : 0);
+    }
+
+    inline VOID RtlInitUnicodeString(PUNICODE_STRING Dest, const WCHAR* Source) {
+        size_t Characters = 0;
+        if (Source) while (Source[Characters]) Characters++;
+        Dest->Buffer = const_cast<WCHAR*>(Source);
+        Dest->Length = static_cast<USHORT>(Characters * sizeof(WCHAR));
+        Dest->MaximumLength = static_cast<USHORT>(Source ? Dest->Length + sizeof(WCHAR) : 0);
+    }
+
+    inline NTSTATUS RtlAnsiStringToUnicodeString(PUNICODE_STRING Dest, PCANSI_STRING Source, BOOLEAN AllocateDest) {
+        if (AllocateDest) Dest->Buffer = new WCHAR[Source->Length + 1];
+        for (USHORT i = 0; i < Source->Length; i++) Dest->Buffer[i] = static_cast<UCHAR>(Source->Buffer[i]);
+        Dest->Buffer[Source->Length] = 0;
+        Dest->Length = static_cast<USHORT>(Source->Length * sizeof(WCHAR));
+        Dest->MaximumLength = static_cast<USHORT>(Dest->Length + sizeof(WCHAR));
+        return 0;
+    }
+
+    inline NTSTATUS RtlUnicodeStringToAnsiString(PANSI_STRING Dest, PCUNICODE_STRING Source, BOOLEAN AllocateDest) {
+        USHORT Characters = static_cast<USHORT>(Source->Length / sizeof(WCHAR));
+        if (AllocateDest) Dest->Buffer = new CHAR[Characters + 1];
+        for (USHORT i = 0; i < Characters; i++) {
+            WCHAR Char = Source->Buffer[i];
+            Dest->Buffer[i] = static_cast<CHAR>(Char > 0xFF ? '?' : Char);
+        }
+        Dest->Buffer[Characters] = '\0';
+        Dest->Length = Characters;
+        Dest->MaximumLength = static_cast<USHORT>(Characters + 1);
+        return 0;
+    }
+
+    inline VOID RtlFreeUnicodeString(PUNICODE_STRING Str) {
+        delete[] Str->Buffer;
+        Str->Buffer = NULL;
+    }
+
+    inline VOID RtlFreeAnsiString(PANSI_STRING Str) {
+        delete[] Str->Buffer;
+        Str->Buffer = NULL;
+    }
+
+    extern "C" inline NTSTATUS RtlDowncaseUnicodeString(PUNICODE_STRING Dest, PCUNICODE_STRING Source, BOOLEAN AllocateDest) {
+        UNREFERENCED_PARAMETER(AllocateDest);
+        for (USHORT i = 0; i < Source->Length / sizeof(WCHAR); i++) {
+            WCHAR Char = Source->Buffer[i];
+            Dest->Buffer[i] = Char >= 'A' && Char <= 'Z' ? static_cast<WCHAR>(Char + ('a' - 'A')) : Char;
+        }
+        Dest->Length = Source->Length;
+        return 0;
+    }
+
+    extern "C" inline NTSTATUS RtlUpcaseUnicodeString(PUNICODE_STRING Dest, PCUNICODE_STRING Source, BOOLEAN AllocateDest) {
+        UNREFERENCED_PARAMETER(AllocateDest);
+        for (USHORT i = 0; i < Source->Length / sizeof(WCHAR); i++) {
+            WCHAR Char = Source->Buffer[i];
+            Dest->Buffer[i] = Char >= 'a' && Char <= 'z' ? static_cast<WCHAR>(Char - ('a' - 'A')) : Char;
+        }
+        Dest->Length = Source->Length;
+        return 0;
+    }
+
+    // Return -1 on truncation like the CRT of MSVC with _TRUNCATE:
+    extern "C" inline int _vsnprintf_s(char* Dest, size_t Size, size_t MaxCount, const char* Format, va_list Args) {
+        UNREFERENCED_PARAMETER(MaxCount);
+        int Written = std::vsnprintf(Dest, Size, Format, Args);
+        return Written >= 0 && static_cast<size_t>(Written) < Size ? Written : -1;
+    }
+
+    // Formatting of wide strings isn't available with 2-byte WCHAR:
+    extern "C" inline int _vsnwprintf_s(WCHAR* Dest, size_t Size, size_t MaxCount, const WCHAR* Format, va_list Args) {
+        UNREFERENCED_PARAMETER(Dest);
+        UNREFERENCED_PARAMETER(Size);
+        UNREFERENCED_PARAMETER(MaxCount);
+        UNREFERENCED_PARAMETER(Format);
+        UNREFERENCED_PARAMETER(Args);
+        return -1;
+    }
+#endif
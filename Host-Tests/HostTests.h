@@ -0,0 +1,35 @@
+#pragma once
+
+// Every test is a function that returns false at the first failed check,
+// main() of a test executable runs them and returns the count of failures:
+//
+//   int main() {
+//       return RunTests({ { "Name", Function }, ... });
+//   }
+
+#include <cstdio>
+#include <initializer_list>
+
+#define KB_CHECK(Expression)                                                            \
+    do {                                                                                \
+        if (!(Expression)) {                                                            \
+            std::printf("\t%s(%d): check failed: %s\n", __FILE__, __LINE__, #Expression); \
+            return false;                                                               \
+        }                                                                               \
+    } while (false)
+
+struct HostTest {
+    const char* Name;
+    bool (*Run)();
+};
+
+inline int RunTests(std::initializer_list<HostTest> Tests)
+{
+    int Failed = 0;
+    for (const auto& Test : Tests) {
+        bool Passed = Test.Run();
+        std::printf("[ %s ] %s\n", Passed ? "PASSED" : "FAILED", Test.Name);
+        if (!Passed) Failed++;
+    }
+    return Failed;
+}
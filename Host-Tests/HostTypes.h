@@ -0,0 +1,55 @@
+#pragma once
+
+// Types of winnt.h that portable headers of the driver use, so they can be built
+// for the host without the WDK (Windows.h provides them with MSVC):
+
+#if defined(_MSC_VER)
+    #define WIN32_LEAN_AND_MEAN
+    #include <Windows.h>
+#else
+    #include <cstdint>
+    #include <cstddef>
+
+    using CHAR = char;
+    using UCHAR = uint8_t;
+    using PUCHAR = UCHAR*;
+    using WCHAR = wchar_t; // -fshort-wchar
+    using SHORT = int16_t;
+    using USHORT = uint16_t;
+    using LONG = int32_t;
+    using ULONG = uint32_t;
+    using PULONG = ULONG*;
+    using LONG64 = int64_t;
+    using LONGLONG = int64_t;
+    using ULONGLONG = uint64_t;
+    using UINT32 = uint32_t;
+    using UINT64 = uint64_t;
+    using INT64 = int64_t;
+    using SIZE_T = size_t;
+    using BOOLEAN = UCHAR;
+    using PBOOLEAN = BOOLEAN*;
+    using LONG_PTR = intptr_t;
+    using ULONG_PTR = uintptr_t;
+    using VOID = void;
+    using PVOID = void*;
+    using LPCSTR = const CHAR*;
+    using LPCWSTR = const WCHAR*;
+
+    using LIST_ENTRY = struct _LIST_ENTRY {
+        _LIST_ENTRY* Flink;
+        _LIST_ENTRY* Blink;
+    };
+    using PLIST_ENTRY = LIST_ENTRY*;
+
+    #define MEMORY_ALLOCATION_ALIGNMENT (2 * sizeof(PVOID))
+    #define MAXUSHORT 0xFFFF
+    #define MAXULONG 0xFFFFFFFF
+
+    #define TRUE 1
+    #define FALSE 0
+    #define IN
+    #define OUT
+    #define OPTIONAL
+#endif
+
+#include "Atomics.h"
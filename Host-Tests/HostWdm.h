@@ -0,0 +1,91 @@
+#pragma once
+
+// Routines of wdm.h that are used by headers under test (list chains and spin locks),
+// implemented for the host. Spin locks only serialize threads, there is no IRQL.
+
+#include "HostTypes.h"
+
+using KSPIN_LOCK = volatile LONG;
+using PKSPIN_LOCK = KSPIN_LOCK*;
+
+inline VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock) {
+    *SpinLock = 0;
+}
+
+inline VOID HostAcquireSpinLock(PKSPIN_LOCK SpinLock) {
+    while (KB_ATOMIC_EXCHANGE(*SpinLock, 1)) {
+        while (KB_ATOMIC_LOAD_RELAXED(*SpinLock)) KB_CPU_PAUSE();
+    }
+}
+
+inline VOID HostReleaseSpinLock(PKSPIN_LOCK SpinLock) {
+    KB_ATOMIC_STORE_RELEASE(*SpinLock, 0);
+}
+
+inline VOID InitializeListHead(PLIST_ENTRY Head) {
+    Head->Flink = Head->Blink = Head;
+}
+
+inline BOOLEAN IsListEmpty(const LIST_ENTRY* Head) {
+    return Head->Flink == Head;
+}
+
+inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry) {
+    PLIST_ENTRY Next = Entry->Flink;
+    PLIST_ENTRY Previous = Entry->Blink;
+    Previous->Flink = Next;
+    Next->Blink = Previous;
+    return Next == Previous;
+}
+
+inline PLIST_ENTRY RemoveHeadList(PLIST_ENTRY Head) {
+    PLIST_ENTRY Entry = Head->Flink;
+    RemoveEntryList(Entry);
+    return Entry;
+}
+
+inline PLIST_ENTRY RemoveTailList(PLIST_ENTRY Head) {
+    PLIST_ENTRY Entry = Head->Blink;
+    RemoveEntryList(Entry);
+    return Entry;
+}
+
+inline VOID InsertTailList(PLIST_ENTRY Head, PLIST_ENTRY Entry) {
+    PLIST_ENTRY Previous = Head->Blink;
+    Entry->Flink = Head;
+    Entry->Blink = Previous;
+    Previous->Flink = Entry;
+    Head->Blink = Entry;
+}
+
+inline VOID InsertHeadList(PLIST_ENTRY Head, PLIST_ENTRY Entry) {
+    PLIST_ENTRY Next = Head->Flink;
+    Entry->Flink = Next;
+    Entry->Blink = Head;
+    Next->Blink = Entry;
+    Head->Flink = Entry;
+}
+
+// Return the previous head (tail) or NULL if the list was empty, like in wdm.h:
+inline PLIST_ENTRY ExInterlockedInsertTailList(PLIST_ENTRY Head, PLIST_ENTRY Entry, PKSPIN_LOCK SpinLock) {
+    HostAcquireSpinLock(SpinLock);
+    PLIST_ENTRY Previous = IsListEmpty(Head) ? NULL : Head->Blink;
+    InsertTailList(Head, Entry);
+    HostReleaseSpinLock(SpinLock);
+    return Previous;
+}
+
+inline PLIST_ENTRY ExInterlockedInsertHeadList(PLIST_ENTRY Head, PLIST_ENTRY Entry, PKSPIN_LOCK SpinLock) {
+    HostAcquireSpinLock(SpinLock);
+    PLIST_ENTRY Next = IsListEmpty(Head) ? NULL : Head->Flink;
+    InsertHeadList(Head, Entry);
+    HostReleaseSpinLock(SpinLock);
+    return Next;
+}
+
+inline PLIST_ENTRY ExInterlockedRemoveHeadList(PLIST_ENTRY Head, PKSPIN_LOCK SpinLock) {
+    HostAcquireSpinLock(SpinLock);
+    PLIST_ENTRY Entry = IsListEmpty(Head) ? NULL : RemoveHeadList(Head);
+    HostReleaseSpinLock(SpinLock);
+    return Entry;
+}
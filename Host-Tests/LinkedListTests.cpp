@@ -0,0 +1,166 @@
+#include "HostWdm.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <type_traits>
+
+#include "LinkedList.h"
+
+namespace {
+    struct ITEM {
+        ULONG Key;
+        LIST_ENTRY Link;
+        LONG Value;
+    };
+
+    using ITEMS_LIST = IntrusiveList<ITEM, &ITEM::Link>;
+
+    struct VALUE {
+        LONG Value;
+    };
+
+    static_assert(std::is_same<decltype(*ITEMS_LIST::const_iterator()), const ITEM&>::value, "const iteration yields const elements");
+    static_assert(std::is_same<decltype(*PooledList<VALUE, 4>::const_iterator()), const VALUE&>::value, "const iteration yields const elements");
+
+    // Compares the list with 'Expected' forwards (through const iterators) and backwards from --end():
+    template <typename TList>
+    bool IsEqual(const TList& List, std::initializer_list<LONG> Expected)
+    {
+        auto Iterator = List.cbegin();
+        for (LONG Value : Expected) {
+            if (Iterator == List.cend() || Iterator->Value != Value) return false;
+            Iterator++;
+        }
+        if (Iterator != List.cend()) return false;
+
+        for (auto Value = Expected.end(); Value != Expected.begin();) {
+            --Value;
+            if (Iterator == List.cbegin() || (*--Iterator).Value != *Value) return false;
+        }
+        return Iterator == List.cbegin();
+    }
+
+    bool TestIntrusiveList()
+    {
+        ITEM Items[4] = { { 0, {}, 10 }, { 1, {}, 11 }, { 2, {}, 12 }, { 3, {}, 13 } };
+        ITEMS_LIST List;
+        KB_CHECK(List.IsEmpty());
+        KB_CHECK(List.begin() == List.end());
+        KB_CHECK(IsEqual(List, {}));
+
+        List.InsertTail(Items[1]);
+        List.InsertTail(Items[2]);
+        List.InsertHead(Items[0]);
+        List.InsertTail(Items[3]);
+        KB_CHECK(List.GetCount() == 4);
+        KB_CHECK(IsEqual(List, { 10, 11, 12, 13 }));
+
+        // Postfix operators return the previous position:
+        auto Iterator = List.begin();
+        KB_CHECK((Iterator++)->Key == 0);
+        KB_CHECK(Iterator->Key == 1);
+        KB_CHECK((Iterator--)->Key == 1);
+        KB_CHECK(Iterator == List.begin());
+
+        // Elements are mutable through non-const iterators and the list links them in place:
+        for (auto& Item : List) Item.Value += 10;
+        KB_CHECK(Items[3].Value == 23);
+        KB_CHECK(ITEMS_LIST::FromLink(&Items[2].Link) == &Items[2]);
+        KB_CHECK((--List.end())->Key == 3);
+
+        List.Remove(Items[2]);
+        KB_CHECK(IsEqual(List, { 20, 21, 23 }));
+        KB_CHECK(List.RemoveHead() == &Items[0]);
+        KB_CHECK(List.RemoveTail() == &Items[3]);
+        KB_CHECK(List.GetHead() == &Items[1] && List.GetTail() == &Items[1]);
+        KB_CHECK(List.GetCount() == 1);
+
+        List.Clear();
+        KB_CHECK(List.IsEmpty() && List.GetCount() == 0);
+        KB_CHECK(List.RemoveHead() == NULL && List.RemoveTail() == NULL);
+        return true;
+    }
+
+    bool TestPooledList()
+    {
+        PooledList<VALUE, 3> List;
+        KB_CHECK(List.GetCapacity() == 3);
+        KB_CHECK(IsEqual(List, {}));
+
+        VALUE* Second = List.InsertTail({ 2 });
+        KB_CHECK(List.InsertHead({ 1 }) != NULL);
+        KB_CHECK(List.InsertTail({ 3 }) != NULL);
+        KB_CHECK(List.IsFull());
+        KB_CHECK(List.InsertTail({ 4 }) == NULL);
+        KB_CHECK(IsEqual(List, { 1, 2, 3 }));
+
+        // The node of a removed value goes back to the pool:
+        List.Remove(Second);
+        KB_CHECK(!List.IsFull());
+        KB_CHECK(IsEqual(List, { 1, 3 }));
+        KB_CHECK(List.InsertHead({ 0 }) == Second);
+        KB_CHECK(IsEqual(List, { 0, 1, 3 }));
+
+        List.RemoveTail();
+        List.RemoveHead();
+        KB_CHECK(IsEqual(List, { 1 }));
+        KB_CHECK(List.GetCount() == 1);
+
+        List.Clear();
+        KB_CHECK(List.IsEmpty());
+        KB_CHECK(List.begin() == List.end());
+        return true;
+    }
+
+    bool TestLinkedList()
+    {
+        LinkedList<VALUE> List;
+        KB_CHECK(IsEqual(List, {}));
+        List.RemoveHead();
+        List.RemoveTail();
+        List.InterlockedRemoveHead();
+
+        auto Middle = List.InsertTail({ 2 });
+        List.InsertHead({ 1 });
+        List.InsertTail({ 3 });
+        KB_CHECK(IsEqual(List, { 1, 2, 3 }));
+        List.Remove(Middle);
+        KB_CHECK(IsEqual(List, { 1, 3 }));
+        List.Clear();
+
+        // Interlocked insertions from several threads:
+        constexpr LONG ThreadsCount = 4;
+        constexpr LONG ValuesPerThread = 1000;
+        std::vector<std::thread> Threads;
+        for (LONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Threads.emplace_back([&List, Thread]() {
+                for (LONG i = 0; i < ValuesPerThread; i++) {
+                    if (i & 1) List.InterlockedInsertHead({ Thread * ValuesPerThread + i });
+                    else List.InterlockedInsertTail({ Thread * ValuesPerThread + i });
+                }
+            });
+        }
+        for (auto& Thread : Threads) Thread.join();
+
+        std::vector<bool> Seen(ThreadsCount * ValuesPerThread);
+        for (const auto& Value : List) {
+            KB_CHECK(Value.Value >= 0 && Value.Value < ThreadsCount * ValuesPerThread);
+            KB_CHECK(!Seen[Value.Value]);
+            Seen[Value.Value] = true;
+        }
+        for (bool Present : Seen) KB_CHECK(Present);
+
+        while (!List.IsEmpty()) List.InterlockedRemoveHead();
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "IntrusiveList", TestIntrusiveList },
+        { "PooledList", TestPooledList },
+        { "LinkedList", TestLinkedList },
+    });
+}
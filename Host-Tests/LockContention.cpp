@@ -0,0 +1,123 @@
+#include "HostWdm.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+
+#include "SpinLocks.h"
+
+// Contention benchmark of McsLock against the test-and-test-and-set spin lock of HostWdm.h
+// and std::mutex: threads take the lock for a fixed time, update a few shared words under it
+// and do some work of their own between acquisitions. It prints acquisitions per second
+// and the share of the slowest thread, and fails if the guarded counter lost an update.
+//   LockContention [milliseconds per run, 50 by default]
+// Results mean something only while the threads count doesn't exceed the CPUs count:
+// with more threads lock holders and queued MCS waiters are preempted, which measures
+// the scheduler and not the cache traffic of the lock.
+// QueuedSpinLock of Locks.h isn't measured here: on the host it runs on the spin lock
+// of HostKe.h, its queue is the one of the kernel.
+
+namespace {
+    constexpr ULONG SharedWordsCount = 16; // Two cache lines written by every owner
+    constexpr ULONG PrivateWork = 64;
+
+    struct SHARED {
+        volatile ULONG Counter;
+        volatile ULONG Words[SharedWordsCount];
+    };
+
+    struct RESULT {
+        UINT64 Acquisitions;
+        UINT64 Slowest; // Acquisitions of the thread that got the lock least often
+        bool Consistent;
+    };
+
+    template <typename TLock>
+    RESULT Measure(ULONG ThreadsCount, std::chrono::milliseconds Duration, TLock Lock)
+    {
+        static SHARED Shared;
+        Shared = {};
+        std::atomic<bool> Start(false), Stop(false);
+        std::vector<UINT64> Acquisitions(ThreadsCount);
+
+        std::vector<std::thread> Threads;
+        for (ULONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Threads.emplace_back([&, Thread]() {
+                while (!Start.load()) std::this_thread::yield();
+                volatile ULONG Private = 0;
+                UINT64 Count = 0;
+                while (!Stop.load()) {
+                    Lock([]() {
+                        Shared.Counter = Shared.Counter + 1;
+                        for (auto& Word : Shared.Words) Word = Word + 1;
+                    });
+                    for (ULONG i = 0; i < PrivateWork; i++) Private = Private + i;
+                    Count++;
+                }
+                Acquisitions[Thread] = Count;
+            });
+        }
+
+        Start = true;
+        std::this_thread::sleep_for(Duration);
+        Stop = true;
+        for (auto& Thread : Threads) Thread.join();
+
+        RESULT Result = { 0, Acquisitions[0], true };
+        for (UINT64 Count : Acquisitions) {
+            Result.Acquisitions += Count;
+            if (Count < Result.Slowest) Result.Slowest = Count;
+        }
+        Result.Consistent = Shared.Counter == static_cast<ULONG>(Result.Acquisitions);
+        for (auto Word : Shared.Words) Result.Consistent &= Word == Shared.Counter;
+        return Result;
+    }
+
+    bool Report(const char* Name, ULONG ThreadsCount, std::chrono::milliseconds Duration, const RESULT& Result)
+    {
+        double Seconds = std::chrono::duration<double>(Duration).count();
+        double Share = Result.Acquisitions ? 100.0 * Result.Slowest * ThreadsCount / Result.Acquisitions : 0.0;
+        std::printf("\t%-12s %2u threads: %10.0f acquisitions/s, slowest thread %5.1f%% of a fair share%s\n",
+            Name, ThreadsCount, Result.Acquisitions / Seconds, Share, Result.Consistent ? "" : ", LOST UPDATES");
+        return Result.Consistent;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::chrono::milliseconds Duration(argc > 1 ? std::atoi(argv[1]) : 50);
+    std::printf("%u CPUs reported by the host, %lld ms per run\n",
+        std::thread::hardware_concurrency(), static_cast<long long>(Duration.count()));
+
+    int Failed = 0;
+    for (ULONG ThreadsCount : { 1, 2, 4, 8 }) {
+        static McsLock Mcs;
+        static KSPIN_LOCK SpinLock = 0;
+        static std::mutex Mutex;
+
+        RESULT Result = Measure(ThreadsCount, Duration, [](auto Update) {
+            McsLock::Guard Guard(Mcs);
+            Update();
+        });
+        if (!Report("McsLock", ThreadsCount, Duration, Result)) Failed++;
+
+        Result = Measure(ThreadsCount, Duration, [](auto Update) {
+            HostAcquireSpinLock(&SpinLock);
+            Update();
+            HostReleaseSpinLock(&SpinLock);
+        });
+        if (!Report("TTAS", ThreadsCount, Duration, Result)) Failed++;
+
+        Result = Measure(ThreadsCount, Duration, [](auto Update) {
+            std::lock_guard<std::mutex> Guard(Mutex);
+            Update();
+        });
+        if (!Report("std::mutex", ThreadsCount, Duration, Result)) Failed++;
+    }
+    std::printf("[ %s ] Lock contention\n", Failed ? "FAILED" : "PASSED");
+    return Failed;
+}
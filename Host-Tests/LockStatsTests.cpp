@@ -0,0 +1,168 @@
+#include "HostTypes.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "WdkTypes.h"
+#include "LockStatsTypes.h"
+#include "LockStats.h"
+
+namespace {
+    bool TestBuckets()
+    {
+        KB_CHECK(LockStats::GetBucket(0) == 0);
+        KB_CHECK(LockStats::GetBucket(1) == 0);
+
+        // Bucket N is [2^N, 2^(N + 1)), both bounds are checked for every bounded bucket:
+        for (ULONG Bucket = 1; Bucket < LockStats::BucketsCount - 1; Bucket++) {
+            UINT64 Lower = 1ULL << Bucket;
+            UINT64 Limit = LockStats::GetBucketLimit(Bucket);
+            KB_CHECK(Limit == Lower * 2);
+            KB_CHECK(LockStats::GetBucket(Lower) == Bucket);
+            KB_CHECK(LockStats::GetBucket(Limit - 1) == Bucket);
+            KB_CHECK(LockStats::GetBucket(Limit) == Bucket + 1);
+        }
+
+        // The last bucket takes everything above:
+        constexpr ULONG Last = LockStats::BucketsCount - 1;
+        KB_CHECK(LockStats::GetBucket(1ULL << Last) == Last);
+        KB_CHECK(LockStats::GetBucket(1ULL << 40) == Last);
+        KB_CHECK(LockStats::GetBucket(~0ULL) == Last);
+        KB_CHECK(LockStats::GetBucketLimit(Last) == ~0ULL);
+
+        KB_LOCK_STATS Stats = {};
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 50) == 0);
+        Stats.WaitHistogram[LockStats::GetBucket(100)] = 9; // [64, 128)
+        Stats.WaitHistogram[LockStats::GetBucket(5000)] = 1; // [4096, 8192)
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 50) == 128);
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 90) == 128);
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 91) == 8192);
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 0) == 128);
+        KB_CHECK(LockStats::GetWaitPercentile(&Stats, 200) == 8192);
+        return true;
+    }
+
+    bool TestGetDelta()
+    {
+        KB_LOCK_STATS Previous = {}, Current = {}, Delta = {};
+        std::strcpy(Current.Name, "Clients");
+        Previous.Acquires = 100;
+        Previous.Contended = 10;
+        Previous.TotalWait = 5000;
+        Previous.MaxHold = 700;
+        Previous.WaitHistogram[3] = 4;
+        Previous.WaitHistogram[7] = 6;
+
+        Current.Acquires = 150;
+        Current.Contended = 12;
+        Current.TotalWait = 5600;
+        Current.MaxHold = 300;
+        Current.WaitHistogram[3] = 5;
+        Current.WaitHistogram[7] = 7;
+
+        LockStats::GetDelta(&Delta, &Current, &Previous);
+        KB_CHECK(std::strcmp(Delta.Name, "Clients") == 0);
+        KB_CHECK(Delta.Acquires == 50 && Delta.Contended == 2 && Delta.TotalWait == 600);
+        KB_CHECK(Delta.MaxHold == 300);
+        KB_CHECK(Delta.WaitHistogram[3] == 1 && Delta.WaitHistogram[7] == 1);
+
+        // Counters below the previous snapshot were reset in between, they count from zero:
+        Current.Acquires = 30;
+        Current.WaitHistogram[7] = 2;
+        LockStats::GetDelta(&Delta, &Current, &Previous);
+        KB_CHECK(Delta.Acquires == 30);
+        KB_CHECK(Delta.WaitHistogram[7] == 2);
+        KB_CHECK(Delta.Contended == 2);
+
+        // Snapshots of the same name from several drivers are summed, MaxHold is the maximum:
+        KB_LOCK_STATS Sum = {};
+        LockStats::Accumulate(&Sum, &Previous);
+        LockStats::Accumulate(&Sum, &Current);
+        KB_CHECK(Sum.Acquires == 130 && Sum.MaxHold == 700);
+        KB_CHECK(Sum.WaitHistogram[3] == 9);
+        return true;
+    }
+
+    bool TestResetOnRead()
+    {
+        static LockStatsRegistry<4> Registry;
+        LockStatsSlot* Slot = Registry.Find("Clients");
+        KB_CHECK(Slot != NULL);
+        KB_CHECK(Registry.Find("Clients") == Slot);
+        KB_CHECK(Registry.GetCount() == 1);
+
+        Slot->RecordAcquire(FALSE, 0);
+        Slot->RecordAcquire(TRUE, 100);
+        Slot->RecordAcquire(TRUE, 3);
+        Slot->RecordHold(500);
+        Slot->RecordHold(200);
+
+        KB_LOCK_STATS Stats = {};
+        Slot->Read(&Stats);
+        KB_CHECK(std::strcmp(Stats.Name, "Clients") == 0);
+        KB_CHECK(Stats.Acquires == 3 && Stats.Contended == 2 && Stats.TotalWait == 103);
+        KB_CHECK(Stats.MaxHold == 500);
+        KB_CHECK(Stats.WaitHistogram[6] == 1 && Stats.WaitHistogram[1] == 1);
+
+        // A plain read doesn't change the counters, a read with 'Reset' returns and zeroes them:
+        KB_LOCK_STATS Again = {};
+        Slot->Read(&Again, TRUE);
+        KB_CHECK(std::memcmp(&Again, &Stats, sizeof(Stats)) == 0);
+        Slot->Read(&Again);
+        KB_CHECK(std::strcmp(Again.Name, "Clients") == 0);
+        KB_CHECK(Again.Acquires == 0 && Again.Contended == 0 && Again.TotalWait == 0 && Again.MaxHold == 0);
+        for (auto Count : Again.WaitHistogram) KB_CHECK(Count == 0);
+
+        // Records that race with resets are returned by exactly one read.
+        // Writers record for a fixed time into every bucket, so every counter is raced:
+        constexpr ULONG ThreadsCount = 3;
+        std::atomic<bool> Stop(false);
+        UINT64 Records[ThreadsCount] = {}, Waits[ThreadsCount] = {};
+        std::vector<std::thread> Threads;
+        for (ULONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Threads.emplace_back([&, Thread]() {
+                while (!Stop.load()) {
+                    UINT64 Wait = 1ULL << (Records[Thread] % LockStats::BucketsCount);
+                    Slot->RecordAcquire(TRUE, Wait);
+                    Records[Thread]++;
+                    Waits[Thread] += Wait;
+                }
+            });
+        }
+
+        KB_LOCK_STATS Sum = {};
+        auto Collect = [&]() {
+            KB_LOCK_STATS Taken = {};
+            Slot->Read(&Taken, TRUE);
+            LockStats::Accumulate(&Sum, &Taken);
+        };
+        auto Deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+        while (std::chrono::steady_clock::now() < Deadline) Collect();
+        Stop = true;
+        for (auto& Thread : Threads) Thread.join();
+        Collect();
+
+        UINT64 Total = 0, TotalWait = 0, InBuckets = 0;
+        for (ULONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Total += Records[Thread];
+            TotalWait += Waits[Thread];
+        }
+        for (auto Count : Sum.WaitHistogram) InBuckets += Count;
+        KB_CHECK(Sum.Acquires == Total && Sum.Contended == Total && InBuckets == Total);
+        KB_CHECK(Sum.TotalWait == TotalWait);
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "LockStats: histogram buckets and percentiles", TestBuckets },
+        { "LockStats: delta and sum of snapshots", TestGetDelta },
+        { "LockStatsSlot: reset on read", TestResetOnRead },
+    });
+}
@@ -0,0 +1,80 @@
+#include "HostKe.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "SpinLocks.h"
+#include "Locks.h"
+
+namespace {
+    bool TestQueuedSpinLockExclusion()
+    {
+        constexpr ULONG ThreadsCount = 4;
+        constexpr ULONG LocksPerThread = 50000;
+
+        static QueuedSpinLock Lock;
+        volatile ULONG Counter = 0; // Not atomic, guarded by the lock
+        std::atomic<LONG> Owners(0);
+        std::atomic<ULONG> Violations(0);
+
+        std::vector<std::thread> Threads;
+        for (ULONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Threads.emplace_back([&, Thread]() {
+                for (ULONG i = 0; i < LocksPerThread; i++) {
+                    // Guard at PASSIVE_LEVEL and the explicit pair at DISPATCH_LEVEL take turns:
+                    if (i & 1) {
+                        QueuedSpinLock::Guard Guard(Lock);
+                        if (Owners++ != 0 || KeGetCurrentIrql() != DISPATCH_LEVEL) Violations++;
+                        Counter = Counter + 1;
+                        if (((i + Thread) & 255) == 1) std::this_thread::yield();
+                        Owners--;
+                    } else {
+                        KIRQL Irql = KeRaiseIrqlToDpcLevel();
+                        KLOCK_QUEUE_HANDLE LockHandle = {};
+                        Lock.LockAtDpc(&LockHandle);
+                        if (Owners++ != 0) Violations++;
+                        Counter = Counter + 1;
+                        Owners--;
+                        Lock.UnlockFromDpc(&LockHandle);
+                        if (KeGetCurrentIrql() != DISPATCH_LEVEL) Violations++;
+                        KeLowerIrql(Irql);
+                    }
+                    if (KeGetCurrentIrql() != PASSIVE_LEVEL) Violations++;
+                }
+            });
+        }
+        for (auto& Thread : Threads) Thread.join();
+
+        KB_CHECK(Violations.load() == 0);
+        KB_CHECK(Counter == ThreadsCount * LocksPerThread);
+        return true;
+    }
+
+    bool TestQueuedSpinLockRestoresIrql()
+    {
+        static QueuedSpinLock Lock;
+
+        // Handles of nested locks keep their own previous IRQL:
+        KLOCK_QUEUE_HANDLE Outer = {}, Inner = {};
+        QueuedSpinLock Other;
+        Lock.Lock(&Outer);
+        KB_CHECK(KeGetCurrentIrql() == DISPATCH_LEVEL);
+        Other.Lock(&Inner);
+        KB_CHECK(Outer.OldIrql == PASSIVE_LEVEL && Inner.OldIrql == DISPATCH_LEVEL);
+        Other.Unlock(&Inner);
+        KB_CHECK(KeGetCurrentIrql() == DISPATCH_LEVEL);
+        Lock.Unlock(&Outer);
+        KB_CHECK(KeGetCurrentIrql() == PASSIVE_LEVEL);
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "QueuedSpinLock: mutual exclusion", TestQueuedSpinLockExclusion },
+        { "QueuedSpinLock: previous IRQL is kept in the handle", TestQueuedSpinLockRestoresIrql },
+    });
+}
@@ -0,0 +1,272 @@
+#include "HostTypes.h"
+#include "HostTests.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include "SpinLocks.h"
+
+namespace {
+    // Every word of a snapshot holds the same value, a torn read mixes two writes.
+    // The copy is long enough to be preempted by writers even on a single CPU:
+    struct SNAPSHOT {
+        ULONG Words[1023];
+        UINT64 Checksum;
+    };
+
+    SNAPSHOT MakeSnapshot(ULONG Value)
+    {
+        SNAPSHOT Snapshot = {};
+        for (auto& Word : Snapshot.Words) Word = Value;
+        Snapshot.Checksum = Value * 0x9E3779B97F4A7C15ULL;
+        return Snapshot;
+    }
+
+    bool IsConsistent(const SNAPSHOT& Snapshot)
+    {
+        for (auto Word : Snapshot.Words) {
+            if (Word != Snapshot.Words[0]) return false;
+        }
+        return Snapshot.Checksum == Snapshot.Words[0] * 0x9E3779B97F4A7C15ULL;
+    }
+
+    bool TestSequenceLockTornReads()
+    {
+        constexpr ULONG WritersCount = 2;
+        constexpr ULONG ReadersCount = 3;
+        constexpr ULONG WritesPerWriter = 10000;
+
+        static SequenceLockCore<SNAPSHOT> Lock;
+        Lock.Write(MakeSnapshot(0));
+        ULONG InitialVersion = Lock.GetVersion();
+
+        std::atomic<ULONG> WritersFinished(0);
+        std::atomic<ULONG> Violations(0);
+        std::atomic<UINT64> Reads(0);
+
+        std::vector<std::thread> Threads;
+        for (ULONG Reader = 0; Reader < ReadersCount; Reader++) {
+            Threads.emplace_back([&]() {
+                ULONG LastVersion = 0;
+                while (WritersFinished.load() != WritersCount) {
+                    SNAPSHOT Snapshot = {};
+                    Lock.Read(&Snapshot);
+                    if (!IsConsistent(Snapshot)) Violations++;
+                    ULONG Version = Lock.GetVersion();
+                    if (Version < LastVersion) Violations++;
+                    LastVersion = Version;
+                    Reads++;
+                }
+            });
+        }
+
+        // Writers are serialized by the sequence, values of every writer grow:
+        for (ULONG Writer = 0; Writer < WritersCount; Writer++) {
+            Threads.emplace_back([&, Writer]() {
+                for (ULONG i = 1; i <= WritesPerWriter; i++) {
+                    Lock.Write(MakeSnapshot(i * WritersCount + Writer));
+                }
+                WritersFinished++;
+            });
+        }
+
+        for (auto& Thread : Threads) Thread.join();
+
+        SNAPSHOT Last = {};
+        KB_CHECK(Lock.TryRead(&Last));
+        KB_CHECK(IsConsistent(Last));
+        KB_CHECK(Last.Words[0] / WritersCount == WritesPerWriter);
+        KB_CHECK(Lock.GetVersion() - InitialVersion == WritersCount * WritesPerWriter);
+        KB_CHECK(Violations.load() == 0);
+        std::printf("\t%llu reads\n", static_cast<unsigned long long>(Reads.load()));
+        return true;
+    }
+
+    bool TestSharedLockExclusion()
+    {
+        constexpr ULONG WritersCount = 2;
+        constexpr ULONG ReadersCount = 4;
+        constexpr ULONG WritesPerWriter = 20000;
+
+        static SharedSpinLockCore<> Lock;
+        volatile ULONG First = 0, Second = 0; // Equal outside of exclusive sections
+        std::atomic<LONG> Readers(0), Writers(0);
+        std::atomic<ULONG> WritersFinished(0);
+        std::atomic<ULONG> Violations(0);
+
+        std::vector<std::thread> Threads;
+        for (ULONG Reader = 0; Reader < ReadersCount; Reader++) {
+            Threads.emplace_back([&, Reader]() {
+                while (WritersFinished.load() != WritersCount) {
+                    Lock.LockShared(Reader);
+                    Readers++;
+                    if (Writers.load() != 0 || First != Second) Violations++;
+                    std::this_thread::yield();
+                    if (Writers.load() != 0 || First != Second) Violations++;
+                    Readers--;
+                    Lock.UnlockShared(Reader);
+                }
+            });
+        }
+
+        for (ULONG Writer = 0; Writer < WritersCount; Writer++) {
+            Threads.emplace_back([&]() {
+                for (ULONG i = 0; i < WritesPerWriter; i++) {
+                    Lock.LockExclusive();
+                    if (Writers++ != 0 || Readers.load() != 0) Violations++;
+                    First = First + 1;
+                    if ((i & 63) == 0) std::this_thread::yield();
+                    Second = Second + 1;
+                    Writers--;
+                    Lock.UnlockExclusive();
+                }
+                WritersFinished++;
+            });
+        }
+
+        for (auto& Thread : Threads) Thread.join();
+
+        KB_CHECK(Violations.load() == 0);
+        KB_CHECK(First == WritersCount * WritesPerWriter && Second == First);
+        return true;
+    }
+
+    bool TestSharedLockPrefersWriter()
+    {
+        static SharedSpinLockCore<> Lock;
+
+        KB_CHECK(Lock.TryLockShared(0));
+        KB_CHECK(Lock.TryLockShared(1));
+        // A failed exclusive attempt doesn't stop readers:
+        KB_CHECK(!Lock.TryLockExclusive());
+        Lock.UnlockShared(1);
+        KB_CHECK(Lock.TryLockShared(1));
+        Lock.UnlockShared(1);
+
+        std::atomic<bool> Acquired(false), Release(false);
+        std::thread Writer([&]() {
+            Lock.LockExclusive();
+            Acquired = true;
+            while (!Release.load()) std::this_thread::yield();
+            Lock.UnlockExclusive();
+        });
+
+        // The writer waits for the reader and new readers wait for the writer:
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        bool AcquiredEarly = Acquired.load();
+        bool ReaderAdmitted = Lock.TryLockShared(1);
+        if (ReaderAdmitted) Lock.UnlockShared(1);
+
+        Lock.UnlockShared(0);
+        while (!Acquired.load()) std::this_thread::yield();
+        bool ReaderAdmittedToWriter = Lock.TryLockShared(1);
+        if (ReaderAdmittedToWriter) Lock.UnlockShared(1);
+        Release = true;
+        Writer.join();
+
+        KB_CHECK(!AcquiredEarly);
+        KB_CHECK(!ReaderAdmitted);
+        KB_CHECK(!ReaderAdmittedToWriter);
+
+        KB_CHECK(Lock.TryLockShared(1));
+        Lock.UnlockShared(1);
+        KB_CHECK(Lock.TryLockExclusive());
+        Lock.UnlockExclusive();
+        return true;
+    }
+
+    // Threads lock for a fixed time: on an oversubscribed host every handoff waits
+    // for the preempted next owner to be scheduled, so a fixed count could take minutes:
+    bool TestMcsLockExclusion()
+    {
+        constexpr ULONG ThreadsCount = 4;
+
+        static McsLock Lock;
+        volatile ULONG Counter = 0; // Not atomic, guarded by the lock
+        std::atomic<LONG> Owners(0);
+        std::atomic<ULONG> Violations(0);
+        std::atomic<bool> Stop(false);
+        ULONG Acquisitions[ThreadsCount] = {};
+
+        std::vector<std::thread> Threads;
+        for (ULONG Thread = 0; Thread < ThreadsCount; Thread++) {
+            Threads.emplace_back([&, Thread]() {
+                for (ULONG i = 0; !Stop.load(); i++) {
+                    McsLock::NODE Node = {};
+                    // Every fourth acquisition tries first, so TryLock() races with Lock():
+                    if ((i & 3) != 0 || !Lock.TryLock(&Node)) Lock.Lock(&Node);
+                    if (Owners++ != 0 || !Lock.IsLocked()) Violations++;
+                    Counter = Counter + 1;
+                    if (((i + Thread) & 255) == 0) std::this_thread::yield();
+                    Owners--;
+                    Lock.Unlock(&Node);
+                    Acquisitions[Thread]++;
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        Stop = true;
+        for (auto& Thread : Threads) Thread.join();
+
+        ULONG Total = 0;
+        for (ULONG Count : Acquisitions) Total += Count;
+        KB_CHECK(Violations.load() == 0);
+        KB_CHECK(Total > ThreadsCount && Counter == Total);
+        KB_CHECK(!Lock.IsLocked());
+        std::printf("\t%u acquisitions\n", Total);
+        return true;
+    }
+
+    bool TestMcsLockHandoffOrder()
+    {
+        constexpr ULONG WaitersCount = 4;
+
+        static McsLock Lock;
+        McsLock::NODE Node = {};
+        KB_CHECK(!Lock.IsLocked());
+        KB_CHECK(Lock.TryLock(&Node));
+        KB_CHECK(Lock.IsLocked());
+
+        McsLock::NODE Other = {};
+        KB_CHECK(!Lock.TryLock(&Other));
+
+        // Waiters queue one by one behind the owner and get the lock in order of arrival:
+        std::vector<ULONG> Order;
+        std::vector<std::thread> Waiters;
+        for (ULONG Waiter = 0; Waiter < WaitersCount; Waiter++) {
+            std::atomic<bool> Arrived(false);
+            Waiters.emplace_back([&, Waiter]() {
+                Arrived = true;
+                McsLock::Guard Guard(Lock);
+                Order.push_back(Waiter);
+            });
+            while (!Arrived.load()) std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        bool StillLocked = Order.empty();
+        Lock.Unlock(&Node);
+        for (auto& Waiter : Waiters) Waiter.join();
+
+        KB_CHECK(StillLocked);
+        KB_CHECK(Order.size() == WaitersCount);
+        for (ULONG Waiter = 0; Waiter < WaitersCount; Waiter++) KB_CHECK(Order[Waiter] == Waiter);
+        KB_CHECK(!Lock.IsLocked());
+        KB_CHECK(Lock.TryLock(&Other));
+        Lock.Unlock(&Other);
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "SequenceLockCore: torn reads", TestSequenceLockTornReads },
+        { "SharedSpinLockCore: mutual exclusion", TestSharedLockExclusion },
+        { "SharedSpinLockCore: pending writer stops new readers", TestSharedLockPrefersWriter },
+        { "McsLock: mutual exclusion", TestMcsLockExclusion },
+        { "McsLock: handoff in order of arrival", TestMcsLockHandoffOrder },
+    });
+}
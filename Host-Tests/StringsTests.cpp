@@ -0,0 +1,99 @@
+#include "HostRtl.h"
+#include "HostTests.h"
+
+#include <string>
+
+#include "UnicodeCase.h"
+#include "StringAllocators.h"
+#include "UtfTypes.h"
+#include "StringsAPI.h"
+
+namespace {
+    bool IsEqual(const String<CHAR>& Str, const std::string& Expected)
+    {
+        return Str.GetLength() == Expected.size() && std::string(Str.GetConstData(), Str.GetLength()) == Expected;
+    }
+
+    std::string Repeat(const std::string& Piece, size_t Count)
+    {
+        std::string Result;
+        for (size_t i = 0; i < Count; i++) Result += Piece;
+        return Result;
+    }
+
+    bool TestReplace()
+    {
+        String<CHAR> Str("aXXabXXabc");
+        unsigned int Count = 0;
+        Str.Replace(StringView<CHAR>("a"), StringView<CHAR>("abc"), true, &Count);
+        KB_CHECK(IsEqual(Str, "abcXXabcbXXabc"));
+        KB_CHECK(Count == 2);
+
+        // More replacements than remembered by the first pass, the result grows in place and reallocates:
+        for (size_t Matches : { 3, 16, 17, 40 }) {
+            String<CHAR> Growing(Repeat("x.", Matches).c_str());
+            Growing.Replace(StringView<CHAR>("."), StringView<CHAR>("--"), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Growing, Repeat("x--", Matches)));
+
+            String<CHAR> Shrinking(Repeat("x..", Matches).c_str());
+            Shrinking.Replace(StringView<CHAR>(".."), StringView<CHAR>("-"), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Shrinking, Repeat("x-", Matches)));
+        }
+        return true;
+    }
+
+    // Views of a part of the string itself are read while the string is rewritten:
+    bool TestSelfAliasedReplace()
+    {
+        for (size_t Matches : { 3, 16, 17, 20, 40 }) {
+            std::string Source = Repeat("xa", Matches) + "x";
+
+            String<CHAR> Str(Source.c_str());
+            unsigned int Count = 0;
+            Str.Replace(Str.GetView().Substr(0, 2), StringView<CHAR>("q"), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Str, Repeat("q", Matches) + "x"));
+
+            // The replacement is a part of the string:
+            String<CHAR> Replacer(Source.c_str());
+            Replacer.Replace(StringView<CHAR>("a"), Replacer.GetView().Substr(0, 1), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Replacer, std::string(Source.size(), 'x')));
+
+            String<CHAR> Growing(Source.c_str());
+            Growing.Replace(StringView<CHAR>("a"), Growing.GetView().Substr(0, 3), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Growing, Repeat("xxax", Matches) + "x"));
+
+            // Both of them:
+            String<CHAR> Both(Source.c_str());
+            Both.Replace(Both.GetView().Substr(1, 1), Both.GetView().Substr(0, 2), false, &Count);
+            KB_CHECK(Count == Matches);
+            KB_CHECK(IsEqual(Both, Repeat("xxa", Matches) + "x"));
+        }
+        return true;
+    }
+
+    bool TestSelfAliasedAppendAndInsert()
+    {
+        String<CHAR> Str(Repeat("ab", 40).c_str());
+        Str += Str.GetView().Substr(0, 60);
+        KB_CHECK(IsEqual(Str, Repeat("ab", 40) + Repeat("ab", 30)));
+
+        String<CHAR> Inserted(Repeat("cd", 40).c_str());
+        Inserted.Insert(1, Inserted.GetView().Substr(0, 70));
+        KB_CHECK(IsEqual(Inserted, "c" + Repeat("cd", 35) + Repeat("dc", 39) + "d"));
+        return true;
+    }
+}
+
+int main()
+{
+    return RunTests({
+        { "String: Replace", TestReplace },
+        { "String: Replace with views of the string itself", TestSelfAliasedReplace },
+        { "String: append and insert of views of the string itself", TestSelfAliasedAppendAndInsert },
+    });
+}
@@ -5,6 +5,7 @@
 
 #include <WdkTypes.h>
 #include <CtlTypes.h>
+#include <LockStatsTypes.h>
 #include <User-Bridge.h>
 
 #include <list>
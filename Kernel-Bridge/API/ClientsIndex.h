@@ -0,0 +1,116 @@
+#pragma once
+
+// Immutable index of connected clients, built by the writer of a snapshot and read without locks:
+//   - clients of every type are contiguous (counting sort by type),
+//     so dispatching visits subscribers of the event type only;
+//   - process ids of clients are in an open-addressing hash set,
+//     so the check whether the current process is one of clients is O(1).
+
+// 'TypesCount' is the count of dispatch types, clients with Type >= TypesCount are listed in all clients only:
+template <typename TClient, ULONG TypesCount, ULONG Capacity>
+class ClientsIndex final {
+public:
+    class Iterator {
+    private:
+        TClient* const* Current;
+    public:
+        explicit Iterator(TClient* const* Client) : Current(Client) {}
+        Iterator& operator ++ () { ++Current; return *this; }
+        TClient& operator * () const { return **Current; }
+        TClient* operator -> () const { return *Current; }
+        bool operator == (const Iterator& Another) const { return Current == Another.Current; }
+        bool operator != (const Iterator& Another) const { return Current != Another.Current; }
+    };
+
+    class Range {
+    private:
+        TClient* const* First;
+        TClient* const* Last;
+    public:
+        Range(TClient* const* Begin, TClient* const* End) : First(Begin), Last(End) {}
+        ULONG GetCount() const { return static_cast<ULONG>(Last - First); }
+        Iterator begin() const { return Iterator(First); }
+        Iterator end() const { return Iterator(Last); }
+    };
+
+private:
+    // Power of 2 with the load factor <= 1/2, zero is an empty cell:
+    static constexpr ULONG GetHashSize() {
+        ULONG Size = 1;
+        while (Size < Capacity * 2) Size <<= 1;
+        return Size;
+    }
+    static constexpr ULONG HashSize = GetHashSize();
+
+    ULONG Count;
+    ULONG TypeFirst[TypesCount + 1]; // Clients of the Type are ByType[TypeFirst[Type]..TypeFirst[Type + 1])
+    BOOLEAN HasZeroProcess;
+    TClient* Clients[Capacity];
+    TClient* ByType[Capacity];
+    UINT64 Processes[HashSize];
+
+    static ULONG GetCell(UINT64 ProcessId) {
+        return static_cast<ULONG>((ProcessId * 0x9E3779B97F4A7C15ULL) >> 32) & (HashSize - 1);
+    }
+
+    VOID InsertProcess(UINT64 ProcessId) {
+        if (!ProcessId) {
+            HasZeroProcess = TRUE;
+            return;
+        }
+        ULONG Cell = GetCell(ProcessId);
+        while (Processes[Cell] && Processes[Cell] != ProcessId) Cell = (Cell + 1) & (HashSize - 1);
+        Processes[Cell] = ProcessId;
+    }
+public:
+    ClientsIndex() : Count(0), TypeFirst(), HasZeroProcess(FALSE), Clients(), ByType(), Processes() {}
+    ~ClientsIndex() = default;
+
+    // 'GetType(const TClient&)' returns ULONG, 'GetProcessId(const TClient&, OUT UINT64*)' returns
+    // FALSE if the client has no process, 'Excluded' (e.g. the client being removed) is skipped,
+    // at most Capacity clients are indexed:
+    template <typename TRange, typename TGetType, typename TGetProcessId>
+    VOID Build(TRange& Source, TGetType GetType, TGetProcessId GetProcessId, OPTIONAL const TClient* Excluded = NULL) {
+        Count = 0;
+        HasZeroProcess = FALSE;
+        for (ULONG i = 0; i < HashSize; i++) Processes[i] = 0;
+        for (ULONG i = 0; i <= TypesCount; i++) TypeFirst[i] = 0;
+
+        UINT64 ProcessId = 0;
+        for (auto& Client : Source) {
+            if (&Client == Excluded) continue;
+            if (Count == Capacity) break;
+            Clients[Count++] = &Client;
+            ULONG Type = GetType(static_cast<const TClient&>(Client));
+            if (Type < TypesCount) TypeFirst[Type + 1]++;
+            if (GetProcessId(static_cast<const TClient&>(Client), &ProcessId)) InsertProcess(ProcessId);
+        }
+
+        for (ULONG i = 1; i <= TypesCount; i++) TypeFirst[i] += TypeFirst[i - 1];
+
+        // Clients keep their order inside of the type:
+        ULONG Next[TypesCount];
+        for (ULONG i = 0; i < TypesCount; i++) Next[i] = TypeFirst[i];
+        for (ULONG i = 0; i < Count; i++) {
+            ULONG Type = GetType(static_cast<const TClient&>(*Clients[i]));
+            if (Type < TypesCount) ByType[Next[Type]++] = Clients[i];
+        }
+    }
+
+    ULONG GetCount() const { return Count; }
+
+    Range GetAll() const { return Range(Clients, Clients + Count); }
+
+    Range GetOfType(ULONG Type) const {
+        if (Type >= TypesCount) return Range(ByType, ByType);
+        return Range(ByType + TypeFirst[Type], ByType + TypeFirst[Type + 1]);
+    }
+
+    BOOLEAN IsProcessPresent(UINT64 ProcessId) const {
+        if (!ProcessId) return HasZeroProcess;
+        for (ULONG Cell = GetCell(ProcessId); Processes[Cell]; Cell = (Cell + 1) & (HashSize - 1)) {
+            if (Processes[Cell] == ProcessId) return TRUE;
+        }
+        return FALSE;
+    }
+};
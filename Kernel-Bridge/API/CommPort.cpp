@@ -1,13 +1,21 @@
 #include <fltKernel.h>
 
+#include "WdkTypes.h"
+#include "Atomics.h"
+#include "LockStatsTypes.h"
+
 #include "MemoryUtils.h"
 
+#include "SpinLocks.h"
+#include "LockStats.h"
 #include "Locks.h"
 #include "LinkedList.h"
+#include "Epoch.h"
+#include "ClientsIndex.h"
 #include "CommPort.h"
 
 CommPort::CommPort() 
-: ParentFilter(NULL), ServerCookie({}), ServerPort(NULL), Clients(), OnMessageCallback(NULL) {}
+: ParentFilter(NULL), ServerCookie({}), ServerPort(NULL), Clients(), OnMessageCallback(NULL), OnConnectCallback(NULL), OnDisconnectCallback(NULL) {}
 
 CommPort::~CommPort() {
     StopServer();
@@ -20,12 +28,17 @@ NTSTATUS CommPort::StartServer(
     LPCWSTR PortName,
     _OnMessage OnMessage,
     LONG MaxConnections,
-    OPTIONAL PVOID Cookie
+    OPTIONAL PVOID Cookie,
+    OPTIONAL _OnConnect OnConnect,
+    OPTIONAL _OnDisconnect OnDisconnect
 )  {
     if (ServerPort) StopServer();
+    if (MaxConnections > MaxClients) MaxConnections = MaxClients;
 
     ParentFilter = Filter;
     OnMessageCallback = OnMessage;
+    OnConnectCallback = OnConnect;
+    OnDisconnectCallback = OnDisconnect;
 
     ServerCookie.ServerInstance = this;
     ServerCookie.UserCookie = Cookie;
@@ -67,12 +80,33 @@ NTSTATUS CommPort::StartServer(
 VOID CommPort::StopServer() {
     if (ServerPort) FltCloseCommunicationPort(ServerPort);
     // Disconnecting all connected clients:
-    Clients.LockExclusive();
-    for (auto& Client : Clients) {
+    Clients.RemoveAll([this](CLIENT_INFO& Client) {
+        if (OnDisconnectCallback) OnDisconnectCallback(Client);
         FltCloseClientPort(ParentFilter, &Client.ClientPort);
-    }
-    Clients.Clear();
-    Clients.Unlock();
+    });
+}
+
+
+
+VOID CommPort::ClientsList::WaitForReaders() {
+    LARGE_INTEGER Interval;
+    Interval.QuadPart = -10 * 1000; // 1 msec, relative time is negative
+    KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+}
+
+CommPort::CLIENT_INFO* CommPort::ClientsList::Insert(const CLIENT_INFO& Client) {
+    WritersLock.LockExclusive();
+    CLIENT_INFO* Inserted = Pool.InsertTail(Client);
+    if (Inserted) Publish(Pool);
+    WritersLock.Unlock();
+    return Inserted;
+}
+
+VOID CommPort::ClientsList::Remove(CLIENT_INFO* Client) {
+    WritersLock.LockExclusive();
+    Publish(Pool, Client);
+    Pool.Remove(Client);
+    WritersLock.Unlock();
 }
 
 
@@ -91,20 +125,37 @@ NTSTATUS CommPort::OnConnectInternal(
     CLIENT_INFO Client = {};
     Client.ServerInstance = ServerCookie->ServerInstance;
     Client.ClientPort = ClientPort;
+    Client.Type = NoClientType;
     
     if (ConnectionContext && SizeOfContext) { 
         PVOID ContextBuffer = VirtualMemory::AllocFromPool(SizeOfContext);
+        if (!ContextBuffer) return STATUS_MEMORY_NOT_ALLOCATED;
         RtlCopyMemory(ContextBuffer, ConnectionContext, SizeOfContext);
         Client.ConnectionContext = ContextBuffer;
         Client.SizeOfContext = SizeOfContext;
     }
 
-    // Add 'Client' to clients list:
     auto ServerInstance = static_cast<CommPort*>(ServerCookie->ServerInstance);
-    ServerInstance->Clients.LockExclusive();
-    *ConnectionPortCookie = static_cast<PVOID>(ServerInstance->Clients.InsertTail(Client));
-    ServerInstance->Clients.Unlock();
 
+    // Validate the captured copy of context, so the client can't change it after the check:
+    if (ServerInstance->OnConnectCallback) {
+        NTSTATUS Status = ServerInstance->OnConnectCallback(Client);
+        if (!NT_SUCCESS(Status)) {
+            if (Client.ConnectionContext) VirtualMemory::FreePoolMemory(Client.ConnectionContext);
+            return Status;
+        }
+    }
+
+    // Add 'Client' to clients list, the pool is exhausted only if MaxConnections is exceeded:
+    CLIENT_INFO* Inserted = ServerInstance->Clients.Insert(Client);
+
+    if (!Inserted) {
+        if (ServerInstance->OnDisconnectCallback) ServerInstance->OnDisconnectCallback(Client);
+        if (Client.ConnectionContext) VirtualMemory::FreePoolMemory(Client.ConnectionContext);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *ConnectionPortCookie = static_cast<PVOID>(Inserted);
     return STATUS_SUCCESS;
 }
 
@@ -113,19 +164,21 @@ VOID CommPort::OnDisconnectInternal(
 ) {
     KdPrint(("[Kernel-Bridge]: Comm.Port OnDisconnect\r\n"));
 
-    // Free client-specific info:
-    auto ClientEntry = static_cast<ClientsList::ListEntry*>(ConnectionContext);
-    if (ClientEntry->GetValue()->ClientPort) 
-        FltCloseClientPort(ClientEntry->GetValue()->ServerInstance->ParentFilter, &ClientEntry->GetValue()->ClientPort);
-    if (ClientEntry->GetValue()->ConnectionContext && ClientEntry->GetValue()->SizeOfContext) {
-        VirtualMemory::FreePoolMemory(ClientEntry->GetValue()->ConnectionContext);
-    }
+    auto ClientEntry = static_cast<CLIENT_INFO*>(ConnectionContext);
+    CLIENT_INFO Client = *ClientEntry;
 
-    // Unlink client from clients list:
-    CommPort* ServerInstance = ClientEntry->GetValue()->ServerInstance;
-    ServerInstance->Clients.LockExclusive();
+    // Unlink client from clients list first, so nobody can send to it after closing of the port:
+    CommPort* ServerInstance = Client.ServerInstance;
     ServerInstance->Clients.Remove(ClientEntry);
-    ServerInstance->Clients.Unlock();
+
+    if (ServerInstance->OnDisconnectCallback) ServerInstance->OnDisconnectCallback(Client);
+
+    // Free client-specific info:
+    if (Client.ClientPort) 
+        FltCloseClientPort(ServerInstance->ParentFilter, &Client.ClientPort);
+    if (Client.ConnectionContext && Client.SizeOfContext) {
+        VirtualMemory::FreePoolMemory(Client.ConnectionContext);
+    }
 }
 
 NTSTATUS CommPort::OnMessageInternal(
@@ -136,15 +189,15 @@ NTSTATUS CommPort::OnMessageInternal(
     IN ULONG OutputBufferLength,
     OUT PULONG ReturnOutputBufferLength
 ) {
-    auto ClientEntry = static_cast<ClientsList::ListEntry*>(PortCookie);
-    _OnMessage Handler = ClientEntry->GetValue()->ServerInstance->OnMessageCallback;
+    auto ClientEntry = static_cast<CLIENT_INFO*>(PortCookie);
+    _OnMessage Handler = ClientEntry->ServerInstance->OnMessageCallback;
     if (Handler) { 
         CLIENT_REQUEST Request = {};
         Request.InputBuffer = InputBuffer;
         Request.InputSize = InputBufferLength;
         Request.OutputBuffer = OutputBuffer;
         Request.OutputSize = OutputBufferLength;
-        return Handler(*ClientEntry->GetValue(), Request, ReturnOutputBufferLength);
+        return Handler(*ClientEntry, Request, ReturnOutputBufferLength);
     }
     return STATUS_SUCCESS;
 }
@@ -2,17 +2,124 @@
 
 class CommPort {
 public:
+    // Clients live in a fixed pool, so connecting never allocates list nodes:
+    static constexpr LONG MaxClients = 128;
+
+    // Clients are indexed by their dispatch type:
+    static constexpr ULONG MaxClientTypes = 32;
+    static constexpr ULONG NoClientType = MaxClientTypes;
+
     using CLIENT_INFO = struct {
         CommPort* ServerInstance;
         PFLT_PORT ClientPort;
         PVOID ConnectionContext;
         ULONG SizeOfContext;
+        PVOID ServerContext; // Per-client data of the server, owned by OnConnect/OnDisconnect callbacks
+        ULONG Type; // Dispatch type (< MaxClientTypes) set by OnConnect, NoClientType by default
+        UINT64 ProcessId; // Owner process set by OnConnect, zero if unknown
     };
 
-    class ClientsList : public EResource, public LinkedList<CLIENT_INFO> {
+    // Readers (every filter callback) take an immutable snapshot of connected clients
+    // without locks, connection and disconnection publish a new snapshot and wait for
+    // readers of the previous one, so a client is valid until its reader leaves:
+    class ClientsList {
+    public:
+        using CLIENTS_SNAPSHOT = ClientsIndex<CLIENT_INFO, MaxClientTypes, MaxClients>;
+
+        class Snapshot {
+        private:
+            ClientsList* List;
+            EpochSnapshot<CLIENTS_SNAPSHOT>::READER Reader;
+            const CLIENTS_SNAPSHOT* Clients;
+        public:
+            using Iterator = CLIENTS_SNAPSHOT::Iterator;
+            using Range = CLIENTS_SNAPSHOT::Range;
+
+            Snapshot(const Snapshot&) = delete;
+            Snapshot(Snapshot&&) = delete;
+            Snapshot& operator = (const Snapshot&) = delete;
+            Snapshot& operator = (Snapshot&&) = delete;
+
+            // Enters a critical region, so the reader can't be suspended and block writers:
+            _IRQL_requires_max_(APC_LEVEL)
+            explicit Snapshot(ClientsList& Source) : List(&Source), Reader(0), Clients(NULL) {
+                KeEnterCriticalRegion();
+                Clients = Source.Published.Enter(KeGetCurrentProcessorNumberEx(NULL), &Reader);
+            }
+
+            ~Snapshot() { Unlock(); }
+
+            // Clients mustn't be used after Unlock():
+            VOID Unlock() {
+                if (!List) return;
+                List->Published.Leave(Reader);
+                KeLeaveCriticalRegion();
+                List = NULL;
+            }
+
+            ULONG GetCount() const { return Clients->GetCount(); }
+
+            Iterator begin() const { return Clients->GetAll().begin(); }
+            Iterator end() const { return Clients->GetAll().end(); }
+
+            // Clients of the type in order of connection:
+            Range OfType(ULONG Type) const { return Clients->GetOfType(Type); }
+
+            BOOLEAN IsProcessPresent(UINT64 ProcessId) const { return Clients->IsProcessPresent(ProcessId); }
+        };
+
+    private:
+        EResource WritersLock;
+        PooledList<CLIENT_INFO, MaxClients> Pool;
+        EpochSnapshot<CLIENTS_SNAPSHOT> Published;
+
+        // Sleeps between checks of readers, they may wait for the reply of a client:
+        static VOID WaitForReaders();
+
+        // Under the WritersLock, indexes clients of 'Source' except 'Excluded'
+        // and returns when no readers see the previous snapshot:
+        template <typename TRange>
+        VOID Publish(TRange& Source, OPTIONAL const CLIENT_INFO* Excluded = NULL) {
+            Published.GetSpare()->Build(
+                Source,
+                [](const CLIENT_INFO& Client) -> ULONG { return Client.Type; },
+                [](const CLIENT_INFO& Client, OUT UINT64* ProcessId) -> BOOLEAN {
+                    *ProcessId = Client.ProcessId;
+                    return Client.ProcessId != 0;
+                },
+                Excluded
+            );
+            Published.Publish(WaitForReaders);
+        }
+
     public:
-        ClientsList() : EResource(), LinkedList<CLIENT_INFO>() {}
+        ClientsList() : WritersLock("CommPort.Clients"), Pool(), Published() {}
         ~ClientsList() = default;
+
+        ClientsList(const ClientsList&) = delete;
+        ClientsList(ClientsList&&) = delete;
+        ClientsList& operator = (const ClientsList&) = delete;
+        ClientsList& operator = (ClientsList&&) = delete;
+
+        // Returns NULL if there are MaxClients clients already:
+        _IRQL_requires_max_(APC_LEVEL)
+        CLIENT_INFO* Insert(const CLIENT_INFO& Client);
+
+        // Returns when no readers see the client:
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID Remove(CLIENT_INFO* Client);
+
+        // Unpublishes all clients and calls 'OnClient(CLIENT_INFO&)' for each of them:
+        template <typename TOnClient>
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID RemoveAll(TOnClient OnClient) {
+            WritersLock.LockExclusive();
+            CLIENTS_SNAPSHOT::Range Empty(NULL, NULL);
+            Publish(Empty);
+            for (auto& Client : Pool) OnClient(Client);
+            Pool.Clear();
+            WritersLock.Unlock();
+        }
     };
     
     using CLIENT_REQUEST = struct {
@@ -24,6 +131,13 @@ public:
     
     using _OnMessage = NTSTATUS(NTAPI*)(CLIENT_INFO& Client, CLIENT_REQUEST& Request, OUT PULONG ReturnLength);
 
+    // Checks the connection context of a new client and may set its ServerContext,
+    // failure status refuses the connection:
+    using _OnConnect = NTSTATUS(NTAPI*)(IN OUT CLIENT_INFO& Client);
+
+    // Called after the client is removed from the clients list and before its port is closed:
+    using _OnDisconnect = VOID(NTAPI*)(CLIENT_INFO& Client);
+
 private:
     PFLT_FILTER ParentFilter;
 
@@ -38,6 +152,8 @@ private:
     ClientsList Clients;
 
     _OnMessage OnMessageCallback;
+    _OnConnect OnConnectCallback;
+    _OnDisconnect OnDisconnectCallback;
 
     static NTSTATUS OnConnectInternal(
         IN PFLT_PORT ClientPort,
@@ -73,8 +189,10 @@ public:
         PFLT_FILTER Filter, 
         LPCWSTR PortName, 
         _OnMessage OnMessage,
-        LONG MaxConnections = 128,
-        OPTIONAL PVOID Cookie = NULL
+        LONG MaxConnections = MaxClients, // Clamped to MaxClients
+        OPTIONAL PVOID Cookie = NULL,
+        OPTIONAL _OnConnect OnConnect = NULL,
+        OPTIONAL _OnDisconnect OnDisconnect = NULL
     );
 
     VOID StopServer();
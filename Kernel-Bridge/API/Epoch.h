@@ -0,0 +1,120 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Epoch-based reclamation for read-mostly data (sleepable RCU):
+// readers announce themselves in one of two counters of their slot (the CPU number in the driver)
+// and never write shared cache lines, writer publishes a new version and waits for readers
+// that could see the previous one.
+//
+// Every slot has two counters, readers enter the counter of the current phase:
+//   - Synchronize() waits until the counters of the other phase are drained,
+//     flips the phase, so new readers don't prolong the wait, and waits until
+//     the counters of the previous phase are drained.
+//   - Both phases are drained after the publication, so a reader that has loaded
+//     the previous version (after its increment) has left when Synchronize() returns.
+//
+// Readers may sleep and migrate between CPUs, the slot is remembered in the READER cookie.
+
+// 'SlotsCount' must be a power of 2, readers with the same slot share its cache line:
+template <ULONG SlotsCount = 64>
+class EpochDomain final {
+private:
+    static_assert(SlotsCount && (SlotsCount & (SlotsCount - 1)) == 0, "SlotsCount must be a power of 2");
+
+    static constexpr ULONG CacheLine = 64;
+
+    using SLOT = struct {
+        volatile LONG Readers[2]; // Per phase
+        UCHAR Reserved[CacheLine - 2 * sizeof(LONG)];
+    };
+
+    volatile LONG Phase;
+    UCHAR Reserved0[CacheLine - sizeof(LONG)];
+    SLOT Slots[SlotsCount];
+
+    BOOLEAN IsPhaseActive(ULONG PhaseIndex) const {
+        for (ULONG i = 0; i < SlotsCount; i++) {
+            if (KB_ATOMIC_LOAD(Slots[i].Readers[PhaseIndex])) return TRUE;
+        }
+        return FALSE;
+    }
+public:
+    // Slot and phase of the reader:
+    using READER = ULONG;
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain(EpochDomain&&) = delete;
+    EpochDomain& operator = (const EpochDomain&) = delete;
+    EpochDomain& operator = (EpochDomain&&) = delete;
+
+    EpochDomain() : Phase(0), Reserved0(), Slots() {}
+    ~EpochDomain() = default;
+
+    // Any thread, 'Hint' selects the slot (e.g. the current CPU number),
+    // data published before the call is visible after it:
+    READER Enter(ULONG Hint) {
+        ULONG Slot = Hint & (SlotsCount - 1);
+        ULONG PhaseIndex = static_cast<ULONG>(KB_ATOMIC_LOAD(Phase)) & 1;
+        KB_ATOMIC_INCREMENT(Slots[Slot].Readers[PhaseIndex]);
+        return (Slot << 1) | PhaseIndex;
+    }
+
+    VOID Leave(READER Reader) {
+        KB_ATOMIC_DECREMENT(Slots[Reader >> 1].Readers[Reader & 1]);
+    }
+
+    // Waits for all readers entered before the call, 'Wait()' is called between checks
+    // (sleeps or yields), calls must be serialized by the caller:
+    template <typename TWait>
+    VOID Synchronize(TWait Wait) {
+        ULONG PhaseIndex = static_cast<ULONG>(KB_ATOMIC_LOAD(Phase)) & 1;
+        while (IsPhaseActive(PhaseIndex ^ 1)) Wait();
+        KB_ATOMIC_EXCHANGE(Phase, PhaseIndex ^ 1);
+        while (IsPhaseActive(PhaseIndex)) Wait();
+    }
+};
+
+// Double-buffered immutable snapshot: readers get the current version without locks,
+// the single writer (serialized by the caller) fills the spare version and publishes it,
+// the previous version becomes spare when no readers can see it:
+template <typename T, ULONG SlotsCount = 64>
+class EpochSnapshot final {
+private:
+    EpochDomain<SlotsCount> Domain;
+    T Versions[2];
+    T* volatile Current;
+public:
+    using READER = typename EpochDomain<SlotsCount>::READER;
+
+    EpochSnapshot(const EpochSnapshot&) = delete;
+    EpochSnapshot(EpochSnapshot&&) = delete;
+    EpochSnapshot& operator = (const EpochSnapshot&) = delete;
+    EpochSnapshot& operator = (EpochSnapshot&&) = delete;
+
+    EpochSnapshot() : Domain(), Versions(), Current(&Versions[0]) {}
+    ~EpochSnapshot() = default;
+
+    // The version is valid until Leave():
+    const T* Enter(ULONG Hint, OUT READER* Reader) {
+        *Reader = Domain.Enter(Hint);
+        return static_cast<const T*>(KB_ATOMIC_LOAD_POINTER(Current));
+    }
+
+    VOID Leave(READER Reader) {
+        Domain.Leave(Reader);
+    }
+
+    // Writer only, the version isn't seen by readers until Publish():
+    T* GetSpare() {
+        return Current == &Versions[0] ? &Versions[1] : &Versions[0];
+    }
+
+    // Writer only, returns when readers of the previous version have left:
+    template <typename TWait>
+    VOID Publish(TWait Wait) {
+        KB_ATOMIC_STORE_POINTER(Current, GetSpare());
+        Domain.Synchronize(Wait);
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Bounded lock-free multi-producer/single-consumer queue of fixed-size events.
+// Producers never wait: if the queue is full, the event is dropped and counted,
+// so the consumer can report the count of lost events.
+//
+// Every cell has a sequence number (free-running 32-bit counters, slot is Counter & Mask):
+//   - Cell at Position is free for producer when Sequence == Position,
+//     producer claims Position by CAS and publishes the cell with Sequence = Position + 1.
+//   - Cell is ready for consumer when Sequence == Position + 1,
+//     consumer releases it for the next round with Sequence = Position + Capacity.
+
+// 'EventType' must be trivially copyable, 'Capacity' must be a power of 2:
+template <typename EventType, ULONG Capacity>
+class EventQueue final {
+private:
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+    static_assert(Capacity < 0x80000000UL, "Capacity is too large");
+
+    static constexpr ULONG Mask = Capacity - 1;
+    static constexpr ULONG CacheLine = 64;
+
+    using CELL = struct {
+        volatile LONG Sequence;
+        EventType Event;
+    };
+
+    // Producers and consumer positions are on separate cache lines:
+    volatile LONG EnqueuePosition;
+    UCHAR Reserved0[CacheLine - sizeof(LONG)];
+    volatile LONG DequeuePosition;
+    UCHAR Reserved1[CacheLine - sizeof(LONG)];
+    volatile LONG Dropped;
+    UCHAR Reserved2[CacheLine - sizeof(LONG)];
+
+    CELL Cells[Capacity];
+
+    // Signed distance between free-running counters:
+    static LONG Distance(ULONG From, LONG To) {
+        return static_cast<LONG>(static_cast<ULONG>(To) - From);
+    }
+public:
+    EventQueue(const EventQueue&) = delete;
+    EventQueue(EventQueue&&) = delete;
+    EventQueue& operator = (const EventQueue&) = delete;
+    EventQueue& operator = (EventQueue&&) = delete;
+
+    EventQueue() : EnqueuePosition(0), Reserved0(), DequeuePosition(0), Reserved1(), Dropped(0), Reserved2(), Cells() {
+        for (ULONG i = 0; i < Capacity; i++) {
+            Cells[i].Sequence = static_cast<LONG>(i);
+        }
+    }
+
+    ~EventQueue() = default;
+
+    ULONG GetCapacity() const { return Capacity; }
+
+    // Any thread, returns FALSE and counts the event as dropped if the queue is full:
+    BOOLEAN Push(const EventType& Event)
+    {
+        LONG Position = KB_ATOMIC_LOAD_ACQUIRE(EnqueuePosition);
+        CELL* Cell = NULL;
+        for (;;) {
+            Cell = &Cells[static_cast<ULONG>(Position) & Mask];
+            LONG Difference = Distance(static_cast<ULONG>(Position), KB_ATOMIC_LOAD_ACQUIRE(Cell->Sequence));
+            if (Difference == 0) {
+                LONG Previous = KB_ATOMIC_COMPARE_EXCHANGE(EnqueuePosition, static_cast<ULONG>(Position) + 1, Position);
+                if (Previous == Position) break;
+                Position = Previous;
+            } else if (Difference < 0) {
+                // Consumer hasn't released the cell from the previous round yet:
+                KB_ATOMIC_INCREMENT(Dropped);
+                return FALSE;
+            } else {
+                // Another producer has claimed this position:
+                Position = KB_ATOMIC_LOAD_ACQUIRE(EnqueuePosition);
+            }
+        }
+
+        Cell->Event = Event;
+        KB_ATOMIC_STORE_RELEASE(Cell->Sequence, static_cast<ULONG>(Position) + 1);
+        return TRUE;
+    }
+
+    // Consumer thread only, returns FALSE if the queue is empty
+    // (or the next event is claimed but not published yet):
+    BOOLEAN Pop(OUT EventType* Event)
+    {
+        LONG Position = DequeuePosition;
+        CELL* Cell = &Cells[static_cast<ULONG>(Position) & Mask];
+        if (Distance(static_cast<ULONG>(Position) + 1, KB_ATOMIC_LOAD_ACQUIRE(Cell->Sequence)) < 0) return FALSE;
+
+        *Event = Cell->Event;
+        KB_ATOMIC_STORE_RELEASE(Cell->Sequence, static_cast<ULONG>(Position) + Capacity);
+        DequeuePosition = static_cast<LONG>(static_cast<ULONG>(Position) + 1);
+        return TRUE;
+    }
+
+    // Consumer thread only:
+    BOOLEAN IsEmpty() const
+    {
+        LONG Position = DequeuePosition;
+        const CELL* Cell = &Cells[static_cast<ULONG>(Position) & Mask];
+        return Distance(static_cast<ULONG>(Position) + 1, KB_ATOMIC_LOAD_ACQUIRE(Cell->Sequence)) < 0;
+    }
+
+    // Returns the count of dropped events since the previous call:
+    ULONG TakeDropped()
+    {
+        return static_cast<ULONG>(KB_ATOMIC_EXCHANGE(Dropped, 0));
+    }
+};
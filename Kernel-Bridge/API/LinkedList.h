@@ -1,88 +1,293 @@
 #pragma once
 
-/* 
+/*
   Depends on:
    - wdm.h
 */
 
-template <typename T>
-class LinkedList {
+// Three doubly-linked lists over LIST_ENTRY chains:
+//   LinkedList<T>             - owns copies of values in nodes allocated by 'new' on every insertion;
+//   IntrusiveList<T, &T::Link> - LIST_ENTRY lives inside of T, insertions never allocate and never fail,
+//                                elements are owned by the caller and must outlive their membership;
+//   PooledList<T, Capacity>   - copies of values in a fixed array of nodes inside of the list,
+//                                insertions never allocate and fail when the pool is exhausted.
+// None of them is synchronized except of Interlocked* methods of LinkedList.
+// Iterators are bidirectional: --end() is the last element, so lists may be walked backwards.
+
+// Bidirectional iterator over a LIST_ENTRY chain, the end is the head of the list itself.
+// 'TTraits::GetValue(PLIST_ENTRY)' returns the element of the link, 'TValue' is const for const iteration.
+// iterator_category is omitted: the kernel has no <iterator>.
+template <typename TValue, typename TTraits>
+class ListChainIterator {
 private:
-    using _Entry = struct {
-        LIST_ENTRY ChainEntry;
-        PVOID EntryObject;
-        T Value;
-    };
+    PLIST_ENTRY Current;
 public:
-    class ListEntry {
-    private:
-        _Entry Entry;
-    public:
-        ListEntry(const T& Value) : Entry({}) {
-            InitializeListHead(&Entry.ChainEntry);
-            Entry.EntryObject = this;
-            Entry.Value = Value;
-        }
+    using value_type = TValue;
+    using reference = TValue&;
+    using pointer = TValue*;
+    using difference_type = LONG_PTR;
 
-        ~ListEntry() = default;
+    ListChainIterator() : Current(NULL) {}
+    explicit ListChainIterator(const LIST_ENTRY* Link) : Current(const_cast<PLIST_ENTRY>(Link)) {}
+    ~ListChainIterator() = default;
 
-        PLIST_ENTRY GetChainEntry() { return &Entry.ChainEntry; }
-        T* GetValue() { return &Entry.Value; }
-        ListEntry* GetInstance() { return static_cast<ListEntry*>(Entry.EntryObject); }
-        _Entry* GetEntry() { return &Entry; }
-    };
+    PLIST_ENTRY GetLink() const { return Current; }
 
-    class ListIterator {
-    private:
-        PLIST_ENTRY ListHead;
-        _Entry* Current;
-    public:
-        ListIterator() : Current(NULL) {}
-        ListIterator(PLIST_ENTRY Head, ListEntry* Entry) : ListHead(Head), Current(Entry->GetEntry()) {}
-        ~ListIterator() = default;
+    reference operator * () const { return *TTraits::GetValue(Current); }
+    pointer operator -> () const { return TTraits::GetValue(Current); }
 
-        ListEntry* GetEntry() { return static_cast<ListEntry*>(Current->EntryObject); }
+    ListChainIterator& operator ++ () {
+        Current = Current->Flink;
+        return *this;
+    }
 
-        ListIterator& operator ++ () {
-            Current = Current->ChainEntry.Flink != ListHead
-                ? reinterpret_cast<_Entry*>(Current->ChainEntry.Flink)
-                : NULL;
-            return *this;
-        }
+    ListChainIterator& operator -- () {
+        Current = Current->Blink;
+        return *this;
+    }
+
+    ListChainIterator operator ++ (int) {
+        ListChainIterator Previous = *this;
+        Current = Current->Flink;
+        return Previous;
+    }
+
+    ListChainIterator operator -- (int) {
+        ListChainIterator Previous = *this;
+        Current = Current->Blink;
+        return Previous;
+    }
 
-        ListIterator& operator -- () {
-            Current = Current->ChainEntry.Flink != ListHead
-                ? reinterpret_cast<_Entry*>(Current->ChainEntry.Blink)
-                : NULL;
-            return *this;
+    bool operator == (const ListChainIterator& Iterator) const { return Current == Iterator.Current; }
+    bool operator != (const ListChainIterator& Iterator) const { return Current != Iterator.Current; }
+};
+
+template <typename T, LIST_ENTRY T::*Link>
+class IntrusiveList {
+private:
+    // Offset of the link inside of T (as FIELD_OFFSET does):
+    static SIZE_T GetLinkOffset() {
+        return reinterpret_cast<SIZE_T>(&(reinterpret_cast<T*>(MEMORY_ALLOCATION_ALIGNMENT)->*Link)) - MEMORY_ALLOCATION_ALIGNMENT;
+    }
+
+    struct Traits {
+        static T* GetValue(PLIST_ENTRY Entry) {
+            return reinterpret_cast<T*>(reinterpret_cast<PUCHAR>(Entry) - GetLinkOffset());
         }
+    };
+
+    LIST_ENTRY Head;
+    SIZE_T Count;
+public:
+    using iterator = ListChainIterator<T, Traits>;
+    using const_iterator = ListChainIterator<const T, Traits>;
+
+    IntrusiveList(const IntrusiveList&) = delete;
+    IntrusiveList(IntrusiveList&&) = delete;
+    IntrusiveList& operator = (const IntrusiveList&) = delete;
+    IntrusiveList& operator = (IntrusiveList&&) = delete;
+
+    IntrusiveList() : Head({}), Count(0) {
+        InitializeListHead(&Head);
+    }
+
+    // Elements aren't owned, so they are only unlinked:
+    ~IntrusiveList() {
+        Clear();
+    }
+
+    static T* FromLink(PLIST_ENTRY Entry) {
+        return Traits::GetValue(Entry);
+    }
+
+    VOID InsertTail(T& Element) {
+        InsertTailList(&Head, &(Element.*Link));
+        ++Count;
+    }
+
+    VOID InsertHead(T& Element) {
+        InsertHeadList(&Head, &(Element.*Link));
+        ++Count;
+    }
+
+    // Element must be in this list:
+    VOID Remove(T& Element) {
+        RemoveEntryList(&(Element.*Link));
+        --Count;
+    }
+
+    T* RemoveHead() {
+        if (IsEmpty()) return NULL;
+        --Count;
+        return FromLink(RemoveHeadList(&Head));
+    }
+
+    T* RemoveTail() {
+        if (IsEmpty()) return NULL;
+        --Count;
+        return FromLink(RemoveTailList(&Head));
+    }
+
+    T* GetHead() { return IsEmpty() ? NULL : FromLink(Head.Flink); }
+    T* GetTail() { return IsEmpty() ? NULL : FromLink(Head.Blink); }
+
+    VOID Clear() {
+        while (RemoveHead());
+    }
+
+    bool IsEmpty() const {
+        return IsListEmpty(&Head);
+    }
+
+    SIZE_T GetCount() const {
+        return Count;
+    }
+
+    iterator begin() { return iterator(Head.Flink); }
+    iterator end() { return iterator(&Head); }
+    const_iterator begin() const { return const_iterator(Head.Flink); }
+    const_iterator end() const { return const_iterator(&Head); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+};
 
-        T& operator * () { return Current->Value; }
+// 'T' must be default-constructible and copy-assignable, unused nodes hold default values:
+template <typename T, ULONG Capacity>
+class PooledList {
+private:
+    static_assert(Capacity > 0, "Capacity must be positive");
 
-        bool operator == (const ListIterator& Iterator) const {
-            return !Iterator.Current || !Current
-                ? Iterator.Current == Current
-                : Iterator.Current->EntryObject == Current->EntryObject;
+    using NODE = struct {
+        LIST_ENTRY Link;
+        T Value;
+    };
+
+    struct Traits {
+        static T* GetValue(PLIST_ENTRY Entry) {
+            return &reinterpret_cast<NODE*>(Entry)->Value;
         }
+    };
+
+    NODE Nodes[Capacity];
+    IntrusiveList<NODE, &NODE::Link> Used;
+    IntrusiveList<NODE, &NODE::Link> Free;
+
+    static NODE* GetNode(T* Value) {
+        return reinterpret_cast<NODE*>(reinterpret_cast<PUCHAR>(Value) - reinterpret_cast<SIZE_T>(&reinterpret_cast<NODE*>(0)->Value));
+    }
+
+    NODE* Allocate(const T& Value) {
+        NODE* Node = Free.RemoveHead();
+        if (Node) Node->Value = Value;
+        return Node;
+    }
+
+    VOID Release(NODE* Node) {
+        Node->Value = T();
+        Free.InsertHead(*Node);
+    }
+public:
+    using iterator = ListChainIterator<T, Traits>;
+    using const_iterator = ListChainIterator<const T, Traits>;
+
+    PooledList(const PooledList&) = delete;
+    PooledList(PooledList&&) = delete;
+    PooledList& operator = (const PooledList&) = delete;
+    PooledList& operator = (PooledList&&) = delete;
+
+    PooledList() : Nodes(), Used(), Free() {
+        for (ULONG i = 0; i < Capacity; i++) Free.InsertTail(Nodes[i]);
+    }
+
+    ~PooledList() = default;
+
+    // Returns the copy of 'Value' in the list or NULL if the pool is exhausted:
+    T* InsertTail(const T& Value) {
+        NODE* Node = Allocate(Value);
+        if (!Node) return NULL;
+        Used.InsertTail(*Node);
+        return &Node->Value;
+    }
 
-        bool operator != (const ListIterator& Iterator) const {
-            return !Iterator.Current || !Current
-                ? Iterator.Current != Current
-                : Iterator.Current->EntryObject != Current->EntryObject;
+    T* InsertHead(const T& Value) {
+        NODE* Node = Allocate(Value);
+        if (!Node) return NULL;
+        Used.InsertHead(*Node);
+        return &Node->Value;
+    }
+
+    // 'Value' must be returned by Insert* of this list:
+    VOID Remove(T* Value) {
+        NODE* Node = GetNode(Value);
+        Used.Remove(*Node);
+        Release(Node);
+    }
+
+    VOID RemoveHead() {
+        if (NODE* Node = Used.RemoveHead()) Release(Node);
+    }
+
+    VOID RemoveTail() {
+        if (NODE* Node = Used.RemoveTail()) Release(Node);
+    }
+
+    VOID Clear() {
+        while (!IsEmpty()) RemoveHead();
+    }
+
+    bool IsEmpty() const { return Used.IsEmpty(); }
+    bool IsFull() const { return Free.IsEmpty(); }
+    SIZE_T GetCount() const { return Used.GetCount(); }
+    static constexpr ULONG GetCapacity() { return Capacity; }
+
+    iterator begin() { return iterator(Used.begin().GetLink()); }
+    iterator end() { return iterator(Used.end().GetLink()); }
+    const_iterator begin() const { return const_iterator(Used.begin().GetLink()); }
+    const_iterator end() const { return const_iterator(Used.end().GetLink()); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+};
+
+template <typename T>
+class LinkedList {
+public:
+    class ListEntry {
+    private:
+        LIST_ENTRY ChainEntry;
+        T Value;
+    public:
+        ListEntry(const T& Data) : ChainEntry({}), Value(Data) {
+            InitializeListHead(&ChainEntry);
         }
+
+        ~ListEntry() = default;
+
+        static ListEntry* FromChainEntry(PLIST_ENTRY Entry) { return reinterpret_cast<ListEntry*>(Entry); }
+
+        PLIST_ENTRY GetChainEntry() { return &ChainEntry; }
+        T* GetValue() { return &Value; }
     };
 private:
-    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) KSPIN_LOCK SpinLock;
-    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) LIST_ENTRY Head;
+    struct Traits {
+        static T* GetValue(PLIST_ENTRY Entry) {
+            return ListEntry::FromChainEntry(Entry)->GetValue();
+        }
+    };
 
-    ListIterator Finalizer;
+    alignas(MEMORY_ALLOCATION_ALIGNMENT) KSPIN_LOCK SpinLock;
+    alignas(MEMORY_ALLOCATION_ALIGNMENT) LIST_ENTRY Head;
 public:
+    using ListIterator = ListChainIterator<T, Traits>;
+    using ConstListIterator = ListChainIterator<const T, Traits>;
+    using iterator = ListIterator;
+    using const_iterator = ConstListIterator;
+
     LinkedList(const LinkedList&) = delete;
     LinkedList(LinkedList&&) = delete;
     LinkedList& operator = (const LinkedList&) = delete;
     LinkedList& operator = (LinkedList&&) = delete;
 
-    LinkedList() : Head({}), Finalizer() {
+    LinkedList() : Head({}) {
         KeInitializeSpinLock(&SpinLock);
         InitializeListHead(&Head);
     }
@@ -92,13 +297,7 @@ public:
     }
 
     void Clear() {
-        if (IsEmpty()) return;
-        ListIterator it = begin();
-        while (it != end()) {
-            auto Entry = it.GetEntry();
-            ++it;
-            Remove(Entry);
-        }
+        while (!IsEmpty()) RemoveHead();
     }
 
     void InterlockedInsertTail(const T& Value) {
@@ -112,8 +311,8 @@ public:
     }
 
     void InterlockedRemoveHead() {
-        auto Entry = ExInterlockedRemoveHeadList(&Head, &SpinLock);
-        delete Entry;
+        PLIST_ENTRY Entry = ExInterlockedRemoveHeadList(&Head, &SpinLock);
+        if (Entry) delete ListEntry::FromChainEntry(Entry);
     }
 
     ListEntry* InsertTail(const T& Value) {
@@ -124,32 +323,31 @@ public:
 
     ListEntry* InsertHead(const T& Value) {
         auto Entry = new ListEntry(Value);
-        InsertTailList(&Head, Entry->GetChainEntry());
+        InsertHeadList(&Head, Entry->GetChainEntry());
         return Entry;
     }
 
     void Remove(ListEntry* Entry) {
         RemoveEntryList(Entry->GetChainEntry());
-        delete Entry->GetInstance();
+        delete Entry;
     }
 
     void RemoveHead() {
-        RemoveHeadList(&Head);
+        if (!IsEmpty()) delete ListEntry::FromChainEntry(RemoveHeadList(&Head));
     }
 
     void RemoveTail() {
-        RemoveTailList(&Head);
+        if (!IsEmpty()) delete ListEntry::FromChainEntry(RemoveTailList(&Head));
     }
 
     bool IsEmpty() const {
         return IsListEmpty(&Head);
     }
 
-    ListIterator begin() {
-        return ListIterator(&Head, static_cast<ListEntry*>((reinterpret_cast<_Entry*>(Head.Flink))->EntryObject));
-    }
-
-    ListIterator end() {
-        return Finalizer;
-    }
-};
\ No newline at end of file
+    ListIterator begin() { return ListIterator(Head.Flink); }
+    ListIterator end() { return ListIterator(&Head); }
+    ConstListIterator begin() const { return ConstListIterator(Head.Flink); }
+    ConstListIterator end() const { return ConstListIterator(&Head); }
+    ConstListIterator cbegin() const { return begin(); }
+    ConstListIterator cend() const { return end(); }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+// - LockStatsTypes.h
+
+// Contention statistics of named locks (see LockStatsTypes.h for the exported format):
+//   - LockStatsSlot: counters of all locks with the same name, updated with interlocked
+//     operations, mostly by owners of locks, so they rarely contend with each other.
+//   - LockStatsRegistry: fixed array of slots, a name takes the first free slot and keeps it
+//     forever, so readers never race with the destruction of locks.
+//   - LockStatsProbe: measures acquisitions of one lock: the wait of contended acquisitions
+//     and the ownership of the exclusive owner.
+//
+// Locks.h embeds probes into its locks if the driver is built with KB_LOCKS_INSTRUMENTED.
+
+class LockStatsSlot final {
+private:
+    const CHAR* volatile Name; // NULL if the slot is free
+    volatile LONG64 Acquires;
+    volatile LONG64 Contended;
+    volatile LONG64 TotalWait;
+    volatile LONG64 MaxHold;
+    volatile LONG64 WaitHistogram[LockStats::BucketsCount];
+
+    UINT64 Take(volatile LONG64& Counter, BOOLEAN Reset) {
+        return static_cast<UINT64>(Reset ? KB_ATOMIC_EXCHANGE64_RELAXED(Counter, 0) : KB_ATOMIC_LOAD64_RELAXED(Counter));
+    }
+public:
+    LockStatsSlot(const LockStatsSlot&) = delete;
+    LockStatsSlot(LockStatsSlot&&) = delete;
+    LockStatsSlot& operator = (const LockStatsSlot&) = delete;
+    LockStatsSlot& operator = (LockStatsSlot&&) = delete;
+
+    // Constant-initialized, so the registry is ready before constructors of global locks:
+    constexpr LockStatsSlot() : Name(NULL), Acquires(0), Contended(0), TotalWait(0), MaxHold(0), WaitHistogram() {}
+    ~LockStatsSlot() = default;
+
+    const CHAR* GetName() {
+        return static_cast<const CHAR*>(KB_ATOMIC_LOAD_POINTER_ACQUIRE(Name));
+    }
+
+    // Returns FALSE if the slot is already taken:
+    BOOLEAN Claim(const CHAR* LockName) {
+        return KB_ATOMIC_COMPARE_EXCHANGE_POINTER(Name, const_cast<CHAR*>(LockName), static_cast<CHAR*>(NULL)) == NULL;
+    }
+
+    // 'WaitCycles' is counted for contended acquisitions only:
+    VOID RecordAcquire(BOOLEAN IsContended, UINT64 WaitCycles) {
+        KB_ATOMIC_ADD64_RELAXED(Acquires, 1);
+        if (!IsContended) return;
+        KB_ATOMIC_ADD64_RELAXED(Contended, 1);
+        KB_ATOMIC_ADD64_RELAXED(TotalWait, WaitCycles);
+        KB_ATOMIC_ADD64_RELAXED(WaitHistogram[LockStats::GetBucket(WaitCycles)], 1);
+    }
+
+    VOID RecordHold(UINT64 HoldCycles) {
+        LONG64 Current = KB_ATOMIC_LOAD64_RELAXED(MaxHold);
+        while (static_cast<LONG64>(HoldCycles) > Current) {
+            LONG64 Previous = KB_ATOMIC_COMPARE_EXCHANGE64(MaxHold, HoldCycles, Current);
+            if (Previous == Current) break;
+            Current = Previous;
+        }
+    }
+
+    // Counters are read one by one, so they may be slightly inconsistent with each other,
+    // 'Reset' zeroes every counter atomically with its read:
+    VOID Read(OUT PKB_LOCK_STATS Stats, BOOLEAN Reset = FALSE) {
+        const CHAR* LockName = GetName();
+        ULONG Length = 0;
+        if (LockName) {
+            while (Length < LockStats::MaxNameLength - 1 && LockName[Length]) {
+                Stats->Name[Length] = LockName[Length];
+                Length++;
+            }
+        }
+        for (ULONG i = Length; i < LockStats::MaxNameLength; i++) Stats->Name[i] = '\0';
+
+        Stats->Acquires = Take(Acquires, Reset);
+        Stats->Contended = Take(Contended, Reset);
+        Stats->TotalWait = Take(TotalWait, Reset);
+        Stats->MaxHold = Take(MaxHold, Reset);
+        for (ULONG i = 0; i < LockStats::BucketsCount; i++) {
+            Stats->WaitHistogram[i] = Take(WaitHistogram[i], Reset);
+        }
+    }
+};
+
+template <ULONG Capacity = 64>
+class LockStatsRegistry final {
+private:
+    LockStatsSlot Slots[Capacity];
+
+    // Names are compared up to the exported length:
+    static BOOLEAN IsSameName(const CHAR* First, const CHAR* Second) {
+        for (ULONG i = 0; i < LockStats::MaxNameLength - 1; i++) {
+            if (First[i] != Second[i]) return FALSE;
+            if (!First[i]) return TRUE;
+        }
+        return TRUE;
+    }
+public:
+    LockStatsRegistry(const LockStatsRegistry&) = delete;
+    LockStatsRegistry(LockStatsRegistry&&) = delete;
+    LockStatsRegistry& operator = (const LockStatsRegistry&) = delete;
+    LockStatsRegistry& operator = (LockStatsRegistry&&) = delete;
+
+    constexpr LockStatsRegistry() : Slots() {}
+    ~LockStatsRegistry() = default;
+
+    // Any thread, 'Name' must live as long as the registry (e.g. a string literal).
+    // Slots are taken in order and never released, so concurrent callers
+    // with the same name get the same slot, returns NULL if all slots are taken:
+    LockStatsSlot* Find(const CHAR* Name) {
+        if (!Name) return NULL;
+        for (ULONG i = 0; i < Capacity; i++) {
+            const CHAR* SlotName = Slots[i].GetName();
+            if (!SlotName) {
+                if (Slots[i].Claim(Name)) return &Slots[i];
+                SlotName = Slots[i].GetName(); // Taken by another thread just now
+            }
+            if (IsSameName(SlotName, Name)) return &Slots[i];
+        }
+        return NULL;
+    }
+
+    ULONG GetCount() {
+        ULONG Count = 0;
+        while (Count < Capacity && Slots[Count].GetName()) Count++;
+        return Count;
+    }
+
+    // Returns the count of entries written to 'Stats':
+    ULONG Read(OUT PKB_LOCK_STATS Stats, ULONG Count, BOOLEAN Reset = FALSE) {
+        ULONG Written = 0;
+        while (Written < Count && Written < Capacity && Slots[Written].GetName()) {
+            Slots[Written].Read(&Stats[Written], Reset);
+            Written++;
+        }
+        return Written;
+    }
+};
+
+// Probe of one lock, does nothing if the lock has no slot (unnamed or the registry is full).
+// Owners call it around acquisitions and before releases:
+class LockStatsProbe final {
+private:
+    LockStatsSlot* Slot;
+    UINT64 AcquiredAt; // By the exclusive owner, zero otherwise
+
+    VOID OnAcquired(BOOLEAN IsContended, UINT64 WaitCycles, BOOLEAN Exclusive) {
+        Slot->RecordAcquire(IsContended, WaitCycles);
+        if (Exclusive && !AcquiredAt) AcquiredAt = KB_CPU_TIMESTAMP();
+    }
+public:
+    // Acquisitions without a try-lock are contended if they took longer,
+    // an uncontended acquisition is a few interlocked operations:
+    static constexpr UINT64 UncontendedCycles = 1024;
+
+    LockStatsProbe(const LockStatsProbe&) = delete;
+    LockStatsProbe(LockStatsProbe&&) = delete;
+    LockStatsProbe& operator = (const LockStatsProbe&) = delete;
+    LockStatsProbe& operator = (LockStatsProbe&&) = delete;
+
+    explicit LockStatsProbe(OPTIONAL LockStatsSlot* StatsSlot) : Slot(StatsSlot), AcquiredAt(0) {}
+    ~LockStatsProbe() = default;
+
+    // 'TryLock()' returns TRUE if the lock is acquired without waiting,
+    // otherwise the acquisition is contended and 'Lock()' waits for the lock:
+    template <typename TTryLock, typename TLock>
+    VOID Acquire(TTryLock TryLock, TLock Lock, BOOLEAN Exclusive = TRUE) {
+        if (!Slot) {
+            Lock();
+            return;
+        }
+        if (TryLock()) {
+            OnAcquired(FALSE, 0, Exclusive);
+            return;
+        }
+        UINT64 Start = KB_CPU_TIMESTAMP();
+        Lock();
+        UINT64 End = KB_CPU_TIMESTAMP();
+        OnAcquired(TRUE, End > Start ? End - Start : 0, Exclusive);
+    }
+
+    // For locks without a suitable try-lock:
+    template <typename TLock>
+    VOID AcquireTimed(TLock Lock, BOOLEAN Exclusive = TRUE) {
+        if (!Slot) {
+            Lock();
+            return;
+        }
+        UINT64 Start = KB_CPU_TIMESTAMP();
+        Lock();
+        UINT64 End = KB_CPU_TIMESTAMP();
+        UINT64 Wait = End > Start ? End - Start : 0;
+        OnAcquired(Wait > UncontendedCycles, Wait, Exclusive);
+    }
+
+    // Failed tries aren't acquisitions, so they aren't counted:
+    template <typename TTryLock>
+    BOOLEAN TryAcquire(TTryLock TryLock, BOOLEAN Exclusive = TRUE) {
+        if (!TryLock()) return FALSE;
+        if (Slot) OnAcquired(FALSE, 0, Exclusive);
+        return TRUE;
+    }
+
+    // Before the lock is released, the ownership is recorded for the exclusive owner only,
+    // a recursive exclusive ownership is recorded up to the first release:
+    VOID Release() {
+        if (!Slot || !AcquiredAt) return;
+        UINT64 End = KB_CPU_TIMESTAMP();
+        UINT64 Start = AcquiredAt;
+        AcquiredAt = 0;
+        Slot->RecordHold(End > Start ? End - Start : 0);
+    }
+};
@@ -2,6 +2,8 @@
 
 // Dependencies:
 // - wdm.h (or fltKernel.h)
+// - SpinLocks.h
+// - LockStatsTypes.h and LockStats.h (if KB_LOCKS_INSTRUMENTED is defined)
 
 // ENTER_***_REGION are callable from IRQL <= APC_LEVEL
 
@@ -16,12 +18,75 @@
 
 #define ALIGNED __declspec(align(MEMORY_ALLOCATION_ALIGNMENT))
 
+// Locks take an optional name, if the driver is built with KB_LOCKS_INSTRUMENTED,
+// all locks with the same name share their statistics (KbGetLockStats),
+// otherwise the name is ignored and LockProbe is an empty base:
+#ifdef KB_LOCKS_INSTRUMENTED
+inline LockStatsRegistry<> KbLockStats;
+
+class LockProbe {
+private:
+    LockStatsProbe Probe;
+protected:
+    explicit LockProbe(OPTIONAL const CHAR* Name) : Probe(KbLockStats.Find(Name)) {}
+    ~LockProbe() = default;
+
+    template <typename TTryLock, typename TLock>
+    VOID Acquire(TTryLock TryLock, TLock Lock, BOOLEAN Exclusive = TRUE) {
+        Probe.Acquire(TryLock, Lock, Exclusive);
+    }
+
+    template <typename TLock>
+    VOID AcquireTimed(TLock Lock, BOOLEAN Exclusive = TRUE) {
+        Probe.AcquireTimed(Lock, Exclusive);
+    }
+
+    template <typename TTryLock>
+    BOOLEAN TryAcquire(TTryLock TryLock, BOOLEAN Exclusive = TRUE) {
+        return Probe.TryAcquire(TryLock, Exclusive);
+    }
+
+    VOID Release() {
+        Probe.Release();
+    }
+};
+#else
+class LockProbe {
+protected:
+    explicit LockProbe(OPTIONAL const CHAR* Name) {
+        UNREFERENCED_PARAMETER(Name);
+    }
+    ~LockProbe() = default;
+
+    template <typename TTryLock, typename TLock>
+    VOID Acquire(TTryLock TryLock, TLock Lock, BOOLEAN Exclusive = TRUE) {
+        UNREFERENCED_PARAMETER(TryLock);
+        UNREFERENCED_PARAMETER(Exclusive);
+        Lock();
+    }
+
+    template <typename TLock>
+    VOID AcquireTimed(TLock Lock, BOOLEAN Exclusive = TRUE) {
+        UNREFERENCED_PARAMETER(Exclusive);
+        Lock();
+    }
+
+    template <typename TTryLock>
+    BOOLEAN TryAcquire(TTryLock TryLock, BOOLEAN Exclusive = TRUE) {
+        UNREFERENCED_PARAMETER(Exclusive);
+        return TryLock();
+    }
+
+    VOID Release() {}
+};
+#endif
+
 // Lock() and Unlock() raises IRQL to APC_LEVEL and acquires the mutex,
 // LockAtApc() and UnlockAtApc() not raises an IRQL and assumes that thread
 // is already in APC_LEVEL or in critical region or in call of FsRtlEnterFileSystem.
 // TryToAcquire() raises IRQL to APC_LEVEL if acquiring was successful.
 
-class FastMutex final {
+class FastMutex final : private LockProbe {
 private:
     ALIGNED FAST_MUTEX Mutex;
 public:
@@ -31,7 +96,7 @@ public:
     FastMutex& operator = (FastMutex&&) = delete;
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    FastMutex() : Mutex({}) {
+    explicit FastMutex(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Mutex({}) {
         ExInitializeFastMutex(&Mutex);
     }
 
@@ -40,33 +105,35 @@ public:
     _IRQL_raises_(APC_LEVEL)
     _IRQL_saves_global_(OldIrql, Mutex)
     VOID Lock() {
-        ExAcquireFastMutex(&Mutex);
+        Acquire([this] { return ExTryToAcquireFastMutex(&Mutex); }, [this] { ExAcquireFastMutex(&Mutex); });
     };
 
     _IRQL_requires_(APC_LEVEL)
     _IRQL_restores_global_(OldIrql, Mutex)
     VOID Unlock() {
+        Release();
         ExReleaseFastMutex(&Mutex);
     };
 
     _IRQL_requires_(APC_LEVEL)
     VOID LockAtApc() {
-        ExAcquireFastMutexUnsafe(&Mutex);
+        AcquireTimed([this] { ExAcquireFastMutexUnsafe(&Mutex); });
     };
 
     _IRQL_requires_(APC_LEVEL)
     VOID UnlockFromApc() {
+        Release();
         ExReleaseFastMutexUnsafe(&Mutex);
     };
 
     _IRQL_raises_(APC_LEVEL)
     _IRQL_saves_global_(OldIrql, Mutex)
     BOOLEAN TryToAcquire() {
-        return ExTryToAcquireFastMutex(&Mutex);
+        return TryAcquire([this] { return ExTryToAcquireFastMutex(&Mutex); });
     }
 };
 
-class GuardedMutex final {
+class GuardedMutex final : private LockProbe {
 private:
     ALIGNED KGUARDED_MUTEX Mutex;
 public:
@@ -76,7 +143,7 @@ public:
     GuardedMutex& operator = (GuardedMutex&&) = delete;
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    GuardedMutex() : Mutex({}) {
+    explicit GuardedMutex(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Mutex({}) {
         KeInitializeGuardedMutex(&Mutex);
     }
 
@@ -84,75 +151,279 @@ public:
     
     _IRQL_requires_max_(APC_LEVEL)
     VOID Lock() {
-        KeAcquireGuardedMutex(&Mutex);
+        Acquire([this] { return KeTryToAcquireGuardedMutex(&Mutex); }, [this] { KeAcquireGuardedMutex(&Mutex); });
     };
 
     _IRQL_requires_max_(APC_LEVEL)
     VOID Unlock() {
+        Release();
         KeReleaseGuardedMutex(&Mutex);
     };
 
     _IRQL_requires_(APC_LEVEL)
     VOID LockAtApc() {
-        KeAcquireGuardedMutexUnsafe(&Mutex);
+        AcquireTimed([this] { KeAcquireGuardedMutexUnsafe(&Mutex); });
     };
 
     _IRQL_requires_(APC_LEVEL)
     VOID UnlockFromApc() {
+        Release();
         KeReleaseGuardedMutexUnsafe(&Mutex);
     };
 
     _IRQL_requires_max_(APC_LEVEL)
     BOOLEAN TryToAcquire() {
-        return KeTryToAcquireGuardedMutex(&Mutex);
+        return TryAcquire([this] { return KeTryToAcquireGuardedMutex(&Mutex); });
     }
 };
 
 
 // SpinLock raises IRQL to DISPATCH_LEVEL and acquires a spinlock.
-// If thread is already at DISPATCH_LEVEL, you can use LockAtDpc()/UnlockFromDpc():
-class SpinLock final {
+// If thread is already at DISPATCH_LEVEL, you can use LockAtDpc()/UnlockFromDpc().
+// Lock() keeps the previous IRQL in the lock, it is written by the owner only.
+// Contended locks should be QueuedSpinLock: a KSPIN_LOCK must not be acquired
+// both ways, so the modes are separate classes.
+class SpinLock final : private LockProbe {
 private:
     ALIGNED KSPIN_LOCK Spinlock;
-    KLOCK_QUEUE_HANDLE LockHandle;
+    KIRQL OldIrql; // Of the owner acquired by Lock()
 public:
     SpinLock(const SpinLock&) = delete;
     SpinLock(SpinLock&&) = delete;
     SpinLock& operator = (const SpinLock&) = delete;
     SpinLock& operator = (SpinLock&&) = delete;
 
-    SpinLock() : Spinlock(0), LockHandle({}) {
+    explicit SpinLock(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Spinlock(0), OldIrql(PASSIVE_LEVEL) {
         KeInitializeSpinLock(&Spinlock);
     }
 
     ~SpinLock() = default;
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    _IRQL_saves_global_(QueuedSpinLock,LockHandle)
+    _IRQL_saves_global_(OldIrql,OldIrql)
     _IRQL_raises_(DISPATCH_LEVEL)
     VOID Lock() {
-        KeAcquireInStackQueuedSpinLock(&Spinlock, &LockHandle);
+        KIRQL Irql = PASSIVE_LEVEL;
+        AcquireTimed([&] { KeAcquireSpinLock(&Spinlock, &Irql); });
+        OldIrql = Irql;
     }
 
     _IRQL_requires_(DISPATCH_LEVEL)
-    _IRQL_restores_global_(QueuedSpinLock,LockHandle)
+    _IRQL_restores_global_(OldIrql,OldIrql)
     VOID Unlock() {
-        KeReleaseInStackQueuedSpinLock(&LockHandle);
+        Release();
+        KeReleaseSpinLock(&Spinlock, OldIrql);
     }
 
     _IRQL_requires_(DISPATCH_LEVEL)
     VOID LockAtDpc() {
-        KeAcquireInStackQueuedSpinLockAtDpcLevel(&Spinlock, &LockHandle);
+        Acquire([this] { return KeTryToAcquireSpinLockAtDpcLevel(&Spinlock); }, [this] { KeAcquireSpinLockAtDpcLevel(&Spinlock); });
     }
 
     _IRQL_requires_(DISPATCH_LEVEL)
     VOID UnlockFromDpc() {
-        KeReleaseInStackQueuedSpinLockFromDpcLevel(&LockHandle);
+        Release();
+        KeReleaseSpinLockFromDpcLevel(&Spinlock);
     }
 };
 
 
-class EResource {
+// QueuedSpinLock is the in-stack queued spinlock: every acquirer spins
+// on its own KLOCK_QUEUE_HANDLE, so waiters don't share a cache line.
+// The handle is kept by the caller, Guard keeps it on its own stack frame:
+//   {
+//       QueuedSpinLock::Guard Guard(Lock);
+//       ...
+//   }
+class QueuedSpinLock final : private LockProbe {
+private:
+    ALIGNED KSPIN_LOCK Spinlock;
+public:
+    QueuedSpinLock(const QueuedSpinLock&) = delete;
+    QueuedSpinLock(QueuedSpinLock&&) = delete;
+    QueuedSpinLock& operator = (const QueuedSpinLock&) = delete;
+    QueuedSpinLock& operator = (QueuedSpinLock&&) = delete;
+
+    explicit QueuedSpinLock(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Spinlock(0) {
+        KeInitializeSpinLock(&Spinlock);
+    }
+
+    ~QueuedSpinLock() = default;
+
+    // 'LockHandle' must stay in place until Unlock():
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _IRQL_saves_global_(QueuedSpinLock,LockHandle)
+    _IRQL_raises_(DISPATCH_LEVEL)
+    VOID Lock(OUT PKLOCK_QUEUE_HANDLE LockHandle) {
+        AcquireTimed([&] { KeAcquireInStackQueuedSpinLock(&Spinlock, LockHandle); });
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _IRQL_restores_global_(QueuedSpinLock,LockHandle)
+    VOID Unlock(PKLOCK_QUEUE_HANDLE LockHandle) {
+        Release();
+        KeReleaseInStackQueuedSpinLock(LockHandle);
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID LockAtDpc(OUT PKLOCK_QUEUE_HANDLE LockHandle) {
+        AcquireTimed([&] { KeAcquireInStackQueuedSpinLockAtDpcLevel(&Spinlock, LockHandle); });
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID UnlockFromDpc(PKLOCK_QUEUE_HANDLE LockHandle) {
+        Release();
+        KeReleaseInStackQueuedSpinLockFromDpcLevel(LockHandle);
+    }
+
+    // Scoped acquisition, 'AtDpc' if the thread is already at DISPATCH_LEVEL:
+    class Guard final {
+    private:
+        QueuedSpinLock& Owner;
+        KLOCK_QUEUE_HANDLE LockHandle;
+        BOOLEAN AtDpc;
+    public:
+        Guard(const Guard&) = delete;
+        Guard(Guard&&) = delete;
+        Guard& operator = (const Guard&) = delete;
+        Guard& operator = (Guard&&) = delete;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        explicit Guard(QueuedSpinLock& Source, BOOLEAN IsAtDpc = FALSE) : Owner(Source), LockHandle({}), AtDpc(IsAtDpc) {
+            if (AtDpc)
+                Owner.LockAtDpc(&LockHandle);
+            else
+                Owner.Lock(&LockHandle);
+        }
+
+        _IRQL_requires_(DISPATCH_LEVEL)
+        ~Guard() {
+            if (AtDpc)
+                Owner.UnlockFromDpc(&LockHandle);
+            else
+                Owner.Unlock(&LockHandle);
+        }
+    };
+};
+
+
+// RwSpinLock raises IRQL to DISPATCH_LEVEL, readers count themselves on their CPU,
+// so they don't write shared cache lines, a pending writer stops new readers.
+// Readers get the previous IRQL from LockShared() and pass it to UnlockShared().
+// If thread is already at DISPATCH_LEVEL, you can use ***AtDpc()/***FromDpc():
+class RwSpinLock final : private LockProbe {
+private:
+    SharedSpinLockCore<> Lock;
+    KIRQL OldIrql; // Of the exclusive owner
+public:
+    RwSpinLock(const RwSpinLock&) = delete;
+    RwSpinLock(RwSpinLock&&) = delete;
+    RwSpinLock& operator = (const RwSpinLock&) = delete;
+    RwSpinLock& operator = (RwSpinLock&&) = delete;
+
+    explicit RwSpinLock(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Lock(), OldIrql(PASSIVE_LEVEL) {}
+    ~RwSpinLock() = default;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _IRQL_raises_(DISPATCH_LEVEL)
+    _IRQL_saves_
+    KIRQL LockShared() {
+        KIRQL Irql = KeRaiseIrqlToDpcLevel();
+        LockSharedAtDpc();
+        return Irql;
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID UnlockShared(_IRQL_restores_ KIRQL Irql) {
+        // The thread can't migrate at DISPATCH_LEVEL, so the slot is the same:
+        Lock.UnlockShared(KeGetCurrentProcessorNumberEx(NULL));
+        KeLowerIrql(Irql);
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID LockSharedAtDpc() {
+        ULONG Slot = KeGetCurrentProcessorNumberEx(NULL);
+        Acquire([&] { return Lock.TryLockShared(Slot); }, [&] { Lock.LockShared(Slot); }, FALSE);
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID UnlockSharedFromDpc() {
+        Lock.UnlockShared(KeGetCurrentProcessorNumberEx(NULL));
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _IRQL_raises_(DISPATCH_LEVEL)
+    _IRQL_saves_global_(OldIrql,OldIrql)
+    VOID LockExclusive() {
+        KIRQL Irql = KeRaiseIrqlToDpcLevel();
+        LockExclusiveAtDpc();
+        OldIrql = Irql;
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _IRQL_restores_global_(OldIrql,OldIrql)
+    VOID UnlockExclusive() {
+        KIRQL Irql = OldIrql;
+        UnlockExclusiveFromDpc();
+        KeLowerIrql(Irql);
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID LockExclusiveAtDpc() {
+        Acquire([this] { return Lock.TryLockExclusive(); }, [this] { Lock.LockExclusive(); });
+    }
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    VOID UnlockExclusiveFromDpc() {
+        Release();
+        Lock.UnlockExclusive();
+    }
+};
+
+// SeqLock keeps a small POD value (e.g. a cached configuration or a pair of counters),
+// readers copy it without writing shared memory and retry if a writer has changed it.
+// Writers raise IRQL to DISPATCH_LEVEL, so readers at IRQL <= DISPATCH_LEVEL
+// never spin on a preempted writer:
+template <typename T>
+class SeqLock final {
+private:
+    SequenceLockCore<T> Lock;
+public:
+    SeqLock(const SeqLock&) = delete;
+    SeqLock(SeqLock&&) = delete;
+    SeqLock& operator = (const SeqLock&) = delete;
+    SeqLock& operator = (SeqLock&&) = delete;
+
+    SeqLock() : Lock() {}
+    ~SeqLock() = default;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    VOID Read(OUT T* Value) const {
+        Lock.Read(Value);
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    T Get() const {
+        T Value;
+        Lock.Read(&Value);
+        return Value;
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    VOID Set(const T& Value) {
+        KIRQL Irql = KeRaiseIrqlToDpcLevel();
+        Lock.Write(Value);
+        KeLowerIrql(Irql);
+    }
+
+    // Count of completed writes, e.g. to check whether a cached copy is outdated:
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONG GetVersion() const {
+        return Lock.GetVersion();
+    }
+};
+
+class EResource : private LockProbe {
 private:
     ERESOURCE Resource;
 public:
@@ -162,7 +433,7 @@ public:
     EResource& operator = (EResource&&) = delete;
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    EResource() : Resource({}) {
+    explicit EResource(OPTIONAL const CHAR* Name = NULL) : LockProbe(Name), Resource({}) {
         ExInitializeResourceLite(&Resource);
     }
 
@@ -179,17 +450,29 @@ public:
     _IRQL_requires_max_(APC_LEVEL)
     BOOLEAN LockShared(BOOLEAN Wait = TRUE) {
         ENTER_CRITICAL_REGION();
-        return ExAcquireResourceSharedLite(&Resource, Wait);
+        if (!Wait) return TryAcquire([this] { return ExAcquireResourceSharedLite(&Resource, FALSE); }, FALSE);
+        Acquire(
+            [this] { return ExAcquireResourceSharedLite(&Resource, FALSE); },
+            [this] { ExAcquireResourceSharedLite(&Resource, TRUE); },
+            FALSE
+        );
+        return TRUE;
     }
 
     _IRQL_requires_max_(APC_LEVEL)
     BOOLEAN LockExclusive(BOOLEAN Wait = TRUE) {
         ENTER_CRITICAL_REGION();
-        return ExAcquireResourceExclusiveLite(&Resource, Wait);
+        if (!Wait) return TryAcquire([this] { return ExAcquireResourceExclusiveLite(&Resource, FALSE); });
+        Acquire(
+            [this] { return ExAcquireResourceExclusiveLite(&Resource, FALSE); },
+            [this] { ExAcquireResourceExclusiveLite(&Resource, TRUE); }
+        );
+        return TRUE;
     }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
     VOID Unlock() {
+        Release(); // Records the ownership of the exclusive owner only
         ExReleaseResourceLite(&Resource);
         LEAVE_CRITICAL_REGION();
     }
@@ -233,6 +516,7 @@ public:
     // ERESOURCE with exclusive access:
     _IRQL_requires_max_(APC_LEVEL)
     VOID ConvertExclusiveToShared() {
+        Release();
         ExConvertExclusiveToSharedLite(&Resource);
     }
 };
@@ -358,7 +642,7 @@ public:
     operator PVOID() { return Get(); }
 };
 
-// Pass FastMutex or GuardedMutex to this template:
+// Pass FastMutex or GuardedMutex to this template, the name is given to the mutex:
 template <class T>
 class CriticalSection final {
 private:
@@ -371,7 +655,7 @@ public:
     CriticalSection& operator = (const CriticalSection&) = delete;
     CriticalSection& operator = (CriticalSection&&) = delete;
 
-    CriticalSection() : Owner(NULL), LocksCount(0) {}
+    explicit CriticalSection(OPTIONAL const CHAR* Name = NULL) : Mutex(Name), Owner(NULL), LocksCount(0) {}
     ~CriticalSection() = default;
 
     _IRQL_raises_(APC_LEVEL)
@@ -416,12 +700,12 @@ public:
     SpinCriticalSection& operator = (const SpinCriticalSection&) = delete;
     SpinCriticalSection& operator = (SpinCriticalSection&&) = delete;
 
-    SpinCriticalSection() : Owner(NULL), LocksCount(0) {}
+    explicit SpinCriticalSection(OPTIONAL const CHAR* Name = NULL) : SpinMutex(Name), Owner(NULL), LocksCount(0) {}
     ~SpinCriticalSection() = default;
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
     _IRQL_raises_(DISPATCH_LEVEL)
-    _IRQL_saves_global_(QueuedSpinLock,SpinMutex)
+    _IRQL_saves_global_(OldIrql,SpinMutex)
     void Enter() {
         PETHREAD CurrentThread = PsGetCurrentThread();
         if (Owner == CurrentThread) {
@@ -434,7 +718,7 @@ public:
     }
 
     _IRQL_requires_(DISPATCH_LEVEL)
-    _IRQL_restores_global_(QueuedSpinLock,SpinMutex)
+    _IRQL_restores_global_(OldIrql,SpinMutex)
     void Leave() {
         LONG64 Locks = LocksCount;
         if (Locks == 0) return;
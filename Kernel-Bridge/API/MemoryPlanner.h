@@ -0,0 +1,171 @@
+#pragma once
+
+// Planning of MDL mappings for Processes::MemoryManagement::OperateProcessMemory.
+
+namespace MemoryPlanner {
+    using CHUNK = struct {
+        UINT64 PageBase;    // Page-aligned base of the mapping
+        SIZE_T PagesCount;  // Count of pages to map
+        UINT64 BaseAddress; // First byte of the request inside of the mapping
+        SIZE_T Size;        // Count of bytes of the request inside of the mapping
+        SIZE_T Offset;      // Offset of the BaseAddress from the beginning of the request
+    };
+    using PCHUNK = CHUNK*;
+
+    // Splits the request into page-aligned chunks of at most 'MaxChunkPages' pages.
+    // Boundaries of chunks are aligned to 'MaxChunkPages' pages in the address space
+    // (not to the beginning of the request), so adjacent and consecutive requests
+    // get the same chunks and can share their mappings:
+    class Planner final {
+    private:
+        UINT64 BaseAddress;
+        SIZE_T Size;
+        SIZE_T PageSize;
+        UINT64 ChunkSize;
+        SIZE_T Offset;
+    public:
+        Planner(const Planner&) = delete;
+        Planner(Planner&&) = delete;
+        Planner& operator = (const Planner&) = delete;
+        Planner& operator = (Planner&&) = delete;
+
+        // 'PageSize' must be a power of 2:
+        Planner(UINT64 RequestBase, SIZE_T RequestSize, SIZE_T PageBytes, SIZE_T MaxChunkPages)
+            : BaseAddress(RequestBase), Size(RequestSize), PageSize(PageBytes),
+              ChunkSize(static_cast<UINT64>(PageBytes) * (MaxChunkPages ? MaxChunkPages : 1)), Offset(0)
+        {
+            // Request that wraps around the address space can't be mapped:
+            if (!PageSize || (PageSize & (PageSize - 1)) || BaseAddress + Size < BaseAddress) Size = 0;
+        }
+
+        ~Planner() = default;
+
+        UINT64 AlignDown(UINT64 Address) const {
+            return Address & ~static_cast<UINT64>(PageSize - 1);
+        }
+
+        UINT64 AlignUp(UINT64 Address) const {
+            return AlignDown(Address + PageSize - 1);
+        }
+
+        // Returns FALSE when the whole request is planned:
+        BOOLEAN Next(OUT PCHUNK Chunk)
+        {
+            if (Offset >= Size) return FALSE;
+
+            UINT64 Begin = BaseAddress + Offset;
+            UINT64 CellBegin = Begin - (Begin % ChunkSize);
+            UINT64 RequestEnd = BaseAddress + Size;
+            UINT64 End = (CellBegin + ChunkSize > CellBegin && CellBegin + ChunkSize < RequestEnd)
+                ? CellBegin + ChunkSize
+                : RequestEnd;
+
+            Chunk->PageBase = AlignDown(Begin);
+            Chunk->PagesCount = static_cast<SIZE_T>((AlignUp(End) - Chunk->PageBase) / PageSize);
+            Chunk->BaseAddress = Begin;
+            Chunk->Size = static_cast<SIZE_T>(End - Begin);
+            Chunk->Offset = Offset;
+
+            Offset += Chunk->Size;
+            return TRUE;
+        }
+    };
+
+    // Bounded LRU cache of mappings, 'ValueType' is an opaque mapping of the caller.
+    // An entry satisfies the chunk when the pages of chunk lie inside of the entry pages:
+    template <typename ValueType, ULONG Capacity>
+    class MappingCache final {
+    private:
+        using ENTRY = struct {
+            PVOID Owner; // Process of the mapping
+            UINT64 PageBase;
+            SIZE_T PagesCount;
+            ULONG LastUse;
+            BOOLEAN Used;
+            ValueType Value;
+        };
+
+        ENTRY Entries[Capacity];
+        ULONG Clock;
+        SIZE_T PageSize;
+    public:
+        MappingCache(const MappingCache&) = delete;
+        MappingCache(MappingCache&&) = delete;
+        MappingCache& operator = (const MappingCache&) = delete;
+        MappingCache& operator = (MappingCache&&) = delete;
+
+        MappingCache(SIZE_T PageBytes) : Entries(), Clock(0), PageSize(PageBytes) {}
+        ~MappingCache() = default;
+
+        ULONG GetCapacity() const { return Capacity; }
+
+        // Returns the cached mapping that contains the chunk or NULL:
+        ValueType* Lookup(PVOID Owner, const CHUNK* Chunk)
+        {
+            UINT64 ChunkEnd = Chunk->PageBase + static_cast<UINT64>(Chunk->PagesCount) * PageSize;
+            for (ULONG i = 0; i < Capacity; i++) {
+                ENTRY* Entry = &Entries[i];
+                if (!Entry->Used || Entry->Owner != Owner) continue;
+                UINT64 EntryEnd = Entry->PageBase + static_cast<UINT64>(Entry->PagesCount) * PageSize;
+                if (Chunk->PageBase < Entry->PageBase || ChunkEnd > EntryEnd) continue;
+                Entry->LastUse = ++Clock;
+                return &Entry->Value;
+            }
+            return NULL;
+        }
+
+        // Returns the slot for the mapping of chunk. If there are no free slots,
+        // the least recently used entry is evicted and its value is copied to 'Evicted',
+        // the caller must release it:
+        ValueType* Insert(PVOID Owner, const CHUNK* Chunk, OUT ValueType* Evicted, OUT PBOOLEAN IsEvicted)
+        {
+            *IsEvicted = FALSE;
+
+            ENTRY* Victim = &Entries[0];
+            for (ULONG i = 0; i < Capacity; i++) {
+                ENTRY* Entry = &Entries[i];
+                if (!Entry->Used) {
+                    Victim = Entry;
+                    break;
+                }
+                // Unsigned difference handles wrapping of the clock:
+                if (Clock - Entry->LastUse > Clock - Victim->LastUse) Victim = Entry;
+            }
+
+            if (Victim->Used) {
+                *Evicted = Victim->Value;
+                *IsEvicted = TRUE;
+            }
+
+            Victim->Owner = Owner;
+            Victim->PageBase = Chunk->PageBase;
+            Victim->PagesCount = Chunk->PagesCount;
+            Victim->LastUse = ++Clock;
+            Victim->Used = TRUE;
+            Victim->Value = {};
+            return &Victim->Value;
+        }
+
+        // Removes the entry returned by Lookup or Insert without releasing of its value:
+        VOID Remove(ValueType* Value)
+        {
+            for (ULONG i = 0; i < Capacity; i++) {
+                if (&Entries[i].Value == Value) {
+                    Entries[i].Used = FALSE;
+                    return;
+                }
+            }
+        }
+
+        // Calls 'Release' for values of all entries and empties the cache:
+        template <typename ReleaseType>
+        VOID Flush(ReleaseType Release)
+        {
+            for (ULONG i = 0; i < Capacity; i++) {
+                if (!Entries[i].Used) continue;
+                Release(&Entries[i].Value);
+                Entries[i].Used = FALSE;
+            }
+        }
+    };
+}
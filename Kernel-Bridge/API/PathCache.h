@@ -0,0 +1,191 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Concurrent cache of file paths keyed by FILE_OBJECT (or any other pointer).
+// Buckets are singly-linked chains guarded by striped reader/writer locks,
+// lookups take the stripe shared and return a referenced entry, so the path
+// can be used without copying after the lock is released.
+//
+// Every entry also holds a 'Tag' (e.g. FsContext of the FILE_OBJECT) that must match on lookup,
+// so a reused FILE_OBJECT address never returns the path of the previous file.
+//
+// Invalidation bumps the generation: a path computed before the invalidation
+// (e.g. before the rename) is refused by Insert, so stale paths never get into the cache.
+// Renames are rare, so they drop the whole cache instead of tracking which keys are affected.
+//
+// 'LockType' must provide LockShared(), LockExclusive() and Unlock() (EResource in the driver).
+
+// 'BucketsCount' and 'StripesCount' must be powers of 2:
+template <typename LockType, ULONG BucketsCount = 4096, ULONG StripesCount = 64, ULONG MaxEntries = 16384>
+class PathCache final {
+public:
+    struct ENTRY {
+        ENTRY* Next;
+        PVOID Key;
+        PVOID Tag;
+        volatile LONG References;
+        ULONG Length; // In characters, not null-terminated
+        WCHAR Path[1];
+    };
+private:
+    static_assert(BucketsCount && (BucketsCount & (BucketsCount - 1)) == 0, "BucketsCount must be a power of 2");
+    static_assert(StripesCount && (StripesCount & (StripesCount - 1)) == 0, "StripesCount must be a power of 2");
+    static_assert(StripesCount <= BucketsCount, "Too many stripes");
+
+    ENTRY* Buckets[BucketsCount];
+    LockType Stripes[StripesCount];
+    volatile LONG Generation;
+    volatile LONG Count;
+
+    static ULONG GetBucket(PVOID Key) {
+        // Pool allocations are aligned, so low bits are dropped by the multiplicative hash:
+        UINT64 Hash = static_cast<UINT64>(reinterpret_cast<SIZE_T>(Key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<ULONG>(Hash >> 32) & (BucketsCount - 1);
+    }
+
+    LockType& GetStripe(ULONG Bucket) {
+        return Stripes[Bucket & (StripesCount - 1)];
+    }
+
+    static ENTRY* CreateEntry(PVOID Key, PVOID Tag, const WCHAR* Path, ULONG Length) {
+        SIZE_T Size = sizeof(ENTRY) + (Length ? Length - 1 : 0) * sizeof(WCHAR);
+        auto Entry = reinterpret_cast<ENTRY*>(new UCHAR[Size]);
+        if (!Entry) return NULL;
+        Entry->Next = NULL;
+        Entry->Key = Key;
+        Entry->Tag = Tag;
+        Entry->References = 1; // Reference of the cache
+        Entry->Length = Length;
+        for (ULONG i = 0; i < Length; i++) Entry->Path[i] = Path[i];
+        return Entry;
+    }
+
+    // Must be called under the exclusive lock of the stripe, returns the unlinked entry:
+    ENTRY* Unlink(ULONG Bucket, PVOID Key) {
+        for (ENTRY** Link = &Buckets[Bucket]; *Link; Link = &(*Link)->Next) {
+            if ((*Link)->Key != Key) continue;
+            ENTRY* Entry = *Link;
+            *Link = Entry->Next;
+            KB_ATOMIC_DECREMENT(Count);
+            return Entry;
+        }
+        return NULL;
+    }
+public:
+    PathCache(const PathCache&) = delete;
+    PathCache(PathCache&&) = delete;
+    PathCache& operator = (const PathCache&) = delete;
+    PathCache& operator = (PathCache&&) = delete;
+
+    PathCache() : Buckets(), Stripes(), Generation(0), Count(0) {}
+
+    ~PathCache() {
+        Clear();
+    }
+
+    ULONG GetCount() const {
+        return static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Count));
+    }
+
+    // Must be obtained before computing of the path that will be inserted:
+    LONG GetGeneration() const {
+        return KB_ATOMIC_LOAD_ACQUIRE(Generation);
+    }
+
+    // Returns the referenced entry or NULL, it must be released by Release:
+    const ENTRY* Acquire(PVOID Key, PVOID Tag) {
+        ULONG Bucket = GetBucket(Key);
+        LockType& Stripe = GetStripe(Bucket);
+        ENTRY* Found = NULL;
+        Stripe.LockShared();
+        for (ENTRY* Entry = Buckets[Bucket]; Entry; Entry = Entry->Next) {
+            if (Entry->Key != Key) continue;
+            if (Entry->Tag == Tag) {
+                KB_ATOMIC_INCREMENT(Entry->References);
+                Found = Entry;
+            }
+            break;
+        }
+        Stripe.Unlock();
+        return Found;
+    }
+
+    static VOID Release(OPTIONAL const ENTRY* Entry) {
+        if (!Entry) return;
+        auto Mutable = const_cast<ENTRY*>(Entry);
+        if (KB_ATOMIC_DECREMENT(Mutable->References) == 0) {
+            delete[] reinterpret_cast<UCHAR*>(Mutable);
+        }
+    }
+
+    // Replaces the previous path of the key, returns FALSE if the cache was invalidated
+    // since 'ObtainedGeneration', if the cache is full (MaxEntries is approximate) or if there is no memory:
+    BOOLEAN Insert(PVOID Key, PVOID Tag, const WCHAR* Path, ULONG Length, LONG ObtainedGeneration) {
+        if (!Path || !Length) return FALSE;
+        if (GetCount() >= MaxEntries || GetGeneration() != ObtainedGeneration) return FALSE;
+
+        ENTRY* Entry = CreateEntry(Key, Tag, Path, Length);
+        if (!Entry) return FALSE;
+
+        ULONG Bucket = GetBucket(Key);
+        LockType& Stripe = GetStripe(Bucket);
+        ENTRY* Previous = NULL;
+        BOOLEAN Inserted = FALSE;
+        Stripe.LockExclusive();
+        // Checked under the lock, so it is ordered with Invalidate:
+        if (GetGeneration() == ObtainedGeneration) {
+            Previous = Unlink(Bucket, Key);
+            Entry->Next = Buckets[Bucket];
+            Buckets[Bucket] = Entry;
+            KB_ATOMIC_INCREMENT(Count);
+            Inserted = TRUE;
+        }
+        Stripe.Unlock();
+
+        Release(Previous);
+        if (!Inserted) Release(Entry);
+        return Inserted;
+    }
+
+    // The key will never be used again (e.g. on IRP_MJ_CLOSE):
+    VOID Remove(PVOID Key) {
+        ULONG Bucket = GetBucket(Key);
+        LockType& Stripe = GetStripe(Bucket);
+        Stripe.LockExclusive();
+        ENTRY* Entry = Unlink(Bucket, Key);
+        Stripe.Unlock();
+        Release(Entry);
+    }
+
+    // Paths of any keys may have changed (e.g. on rename of a file or a directory):
+    VOID InvalidateAll() {
+        KB_ATOMIC_INCREMENT(Generation);
+        Clear();
+    }
+
+    VOID Clear() {
+        for (ULONG StripeIndex = 0; StripeIndex < StripesCount; StripeIndex++) {
+            // Chains of all buckets of the stripe are detached at once and freed without the lock:
+            ENTRY* Detached = NULL;
+            LockType& Stripe = Stripes[StripeIndex];
+            Stripe.LockExclusive();
+            for (ULONG Bucket = StripeIndex; Bucket < BucketsCount; Bucket += StripesCount) {
+                while (ENTRY* Entry = Buckets[Bucket]) {
+                    Buckets[Bucket] = Entry->Next;
+                    Entry->Next = Detached;
+                    Detached = Entry;
+                }
+            }
+            Stripe.Unlock();
+
+            while (Detached) {
+                ENTRY* Next = Detached->Next;
+                KB_ATOMIC_DECREMENT(Count);
+                Release(Detached);
+                Detached = Next;
+            }
+        }
+    }
+};
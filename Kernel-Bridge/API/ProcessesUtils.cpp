@@ -1,6 +1,7 @@
 #include <fltKernel.h>
 #include "Importer.h"
 #include "MemoryUtils.h"
+#include "MemoryPlanner.h"
 #include "ProcessesUtils.h"
 
 namespace Processes {
@@ -400,97 +401,161 @@ namespace Processes {
             MemWrite
         };
 
+        // Mappings of the target process are made by chunks of at most this count of pages:
+        constexpr SIZE_T MaxMappingPages = 256;
+
         _IRQL_requires_max_(APC_LEVEL)
-        NTSTATUS OperateProcessMemory(
+        VOID ProcessMappingCache::Release(PMAPPING Mapping) {
+            if (Mapping->Mapping.Mdl) Mdl::UnmapMemory(&Mapping->Mapping);
+            if (Mapping->hSecure) VirtualMemory::UnsecureProcessMemory(Mapping->Process, Mapping->hSecure);
+            *Mapping = {};
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        ProcessMappingCache::PMAPPING ProcessMappingCache::Lookup(
             PEPROCESS Process,
-            __in_data_source(USER_MODE) PVOID BaseAddress,
-            PVOID Buffer,
-            ULONG Size,
-            MEMORY_OPERATION_TYPE Operation
+            const MemoryPlanner::CHUNK* Chunk,
+            MEMORY_CACHING_TYPE CacheType
         ) {
-            if (!Process) return STATUS_INVALID_PARAMETER_1;
-            if (!BaseAddress || AddressRange::IsKernelAddress(BaseAddress)) return STATUS_INVALID_PARAMETER_2;
-            if (!Buffer) return STATUS_INVALID_PARAMETER_3;
-            if (!Size) return STATUS_INVALID_PARAMETER_4;
+            PMAPPING Mapping = Cache.Lookup(Process, Chunk);
+            if (Mapping && Mapping->CacheType != CacheType) {
+                // Pages can't be mapped with different caching types at the same time:
+                Remove(Mapping);
+                return NULL;
+            }
+            return Mapping;
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        ProcessMappingCache::PMAPPING ProcessMappingCache::Insert(
+            const MemoryPlanner::CHUNK* Chunk,
+            IN const MAPPING* Mapping
+        ) {
+            MAPPING Evicted = {};
+            BOOLEAN IsEvicted = FALSE;
+            PMAPPING Slot = Cache.Insert(Mapping->Process, Chunk, &Evicted, &IsEvicted);
+            if (IsEvicted) Release(&Evicted);
+            *Slot = *Mapping;
+            return Slot;
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID ProcessMappingCache::Remove(PMAPPING Mapping) {
+            Release(Mapping);
+            Cache.Remove(Mapping);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID ProcessMappingCache::Flush() {
+            Cache.Flush(Release);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS MapProcessChunk(
+            PEPROCESS Process,
+            const MemoryPlanner::CHUNK* Chunk,
+            MEMORY_CACHING_TYPE CacheType,
+            OUT ProcessMappingCache::PMAPPING Mapping
+        ) {
+            PVOID PageBase = reinterpret_cast<PVOID>(Chunk->PageBase);
+            SIZE_T Size = Chunk->PagesCount * PAGE_SIZE;
+
+            *Mapping = {};
+            Mapping->Process = Process;
+            Mapping->CacheType = CacheType;
 
             // Attempt to lock process memory from freeing:
-            HANDLE hProcessSecure = NULL;
-            if (!VirtualMemory::SecureProcessMemory(Process, BaseAddress, Size, PAGE_READONLY, &hProcessSecure))
+            if (!VirtualMemory::SecureProcessMemory(Process, PageBase, Size, PAGE_READONLY, &Mapping->hSecure))
                 return STATUS_NOT_LOCKED;
 
-            // Attempt to lock buffer memory if it is usermode memory:
-            HANDLE hBufferSecure = NULL;
-            BOOLEAN IsBufferUsermode = AddressRange::IsUserAddress(Buffer);
-            if (IsBufferUsermode) {
-                if (!VirtualMemory::SecureMemory(Buffer, Size, PAGE_READWRITE, &hBufferSecure)) {
-                    VirtualMemory::UnsecureProcessMemory(Process, hProcessSecure);
-                    return STATUS_NOT_LOCKED;
-                }
-            }
-
             // Attempt to map process memory:
-            Mdl::MAPPING_INFO ProcessMapping = {};
             NTSTATUS Status = Mdl::MapMemory(
-                &ProcessMapping,
+                &Mapping->Mapping,
                 Process,
                 NULL,
-                BaseAddress,
-                Size,
+                PageBase,
+                static_cast<ULONG>(Size),
                 KernelMode,
                 IoReadAccess,
-                MmNonCached,
+                CacheType,
                 NULL
             );
 
-            if (NT_SUCCESS(Status) && (Operation == MemWrite)) {
-                Status = MmProtectMdlSystemAddress(ProcessMapping.Mdl, PAGE_READWRITE);
-            }
-
-            if (!NT_SUCCESS(Status)) { 
-                VirtualMemory::UnsecureProcessMemory(Process, hProcessSecure);
-                if (IsBufferUsermode) VirtualMemory::UnsecureMemory(hBufferSecure);
+            if (!NT_SUCCESS(Status)) {
+                ProcessMappingCache::Release(Mapping);
                 return STATUS_NOT_MAPPED_VIEW;
             }
 
-            // Attempt to map buffer memory:
-            Mdl::MAPPING_INFO BufferMapping = {};
-            Status = Mdl::MapMemory(
-                &BufferMapping,
-                NULL,
-                NULL,
-                Buffer,
-                Size,
-                KernelMode,
-                Operation == MemRead ? IoModifyAccess : IoReadAccess,
-                MmNonCached,
-                NULL
-            );
+            return STATUS_SUCCESS;
+        }
 
-            if (!NT_SUCCESS(Status)) {
-                Mdl::UnmapMemory(&ProcessMapping);
-                VirtualMemory::UnsecureProcessMemory(Process, hProcessSecure);
-                if (IsBufferUsermode) VirtualMemory::UnsecureMemory(hBufferSecure);
-                return STATUS_NOT_MAPPED_VIEW;
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS OperateProcessMemory(
+            PEPROCESS Process,
+            __in_data_source(USER_MODE) PVOID BaseAddress,
+            PVOID Buffer,
+            ULONG Size,
+            MEMORY_OPERATION_TYPE Operation,
+            MEMORY_CACHING_TYPE CacheType,
+            OPTIONAL ProcessMappingCache* Cache
+        ) {
+            if (!Process) return STATUS_INVALID_PARAMETER_1;
+            if (!BaseAddress || AddressRange::IsKernelAddress(BaseAddress)) return STATUS_INVALID_PARAMETER_2;
+            if (!Buffer) return STATUS_INVALID_PARAMETER_3;
+            if (!Size) return STATUS_INVALID_PARAMETER_4;
+
+            // Attempt to lock buffer memory if it is usermode memory,
+            // it is accessed directly in context of the caller, so it isn't mapped:
+            HANDLE hBufferSecure = NULL;
+            BOOLEAN IsBufferUsermode = AddressRange::IsUserAddress(Buffer);
+            if (IsBufferUsermode) {
+                if (!VirtualMemory::SecureMemory(Buffer, Size, PAGE_READWRITE, &hBufferSecure))
+                    return STATUS_NOT_LOCKED;
             }
 
-            __try {
-                Status = STATUS_UNSUCCESSFUL;
-                switch (Operation) {
-                case MemRead:
-                    RtlCopyMemory(BufferMapping.BaseAddress, ProcessMapping.BaseAddress, Size);
-                    break;
-                case MemWrite:
-                    RtlCopyMemory(ProcessMapping.BaseAddress, BufferMapping.BaseAddress, Size);
-                    break;
+            NTSTATUS Status = STATUS_SUCCESS;
+            MemoryPlanner::Planner Plan(reinterpret_cast<UINT64>(BaseAddress), Size, PAGE_SIZE, MaxMappingPages);
+            MemoryPlanner::CHUNK Chunk = {};
+            while (NT_SUCCESS(Status) && Plan.Next(&Chunk)) {
+                ProcessMappingCache::MAPPING LocalMapping = {};
+                ProcessMappingCache::PMAPPING Mapping = Cache ? Cache->Lookup(Process, &Chunk, CacheType) : NULL;
+                if (!Mapping) {
+                    Status = MapProcessChunk(Process, &Chunk, CacheType, &LocalMapping);
+                    if (!NT_SUCCESS(Status)) break;
+                    Mapping = Cache ? Cache->Insert(&Chunk, &LocalMapping) : &LocalMapping;
+                }
+
+                if (Operation == MemWrite && !Mapping->Writeable) {
+                    Status = MmProtectMdlSystemAddress(Mapping->Mapping.Mdl, PAGE_READWRITE);
+                    if (NT_SUCCESS(Status)) Mapping->Writeable = TRUE;
+                    else Status = STATUS_NOT_MAPPED_VIEW;
+                }
+
+                if (NT_SUCCESS(Status)) {
+                    PUCHAR Mapped = static_cast<PUCHAR>(Mapping->Mapping.BaseAddress) + (Chunk.BaseAddress - Chunk.PageBase);
+                    PUCHAR Data = static_cast<PUCHAR>(Buffer) + Chunk.Offset;
+                    __try {
+                        switch (Operation) {
+                        case MemRead:
+                            RtlCopyMemory(Data, Mapped, Chunk.Size);
+                            break;
+                        case MemWrite:
+                            RtlCopyMemory(Mapped, Data, Chunk.Size);
+                            break;
+                        }
+                    } __except (EXCEPTION_EXECUTE_HANDLER) {
+                        Status = STATUS_ACCESS_VIOLATION;
+                    }
                 }
-                Status = STATUS_SUCCESS;
-            } __finally {
-                Mdl::UnmapMemory(&BufferMapping);
-                Mdl::UnmapMemory(&ProcessMapping);
-                VirtualMemory::UnsecureProcessMemory(Process, hProcessSecure);
-                if (IsBufferUsermode) VirtualMemory::UnsecureMemory(hBufferSecure);
+
+                if (!Cache)
+                    ProcessMappingCache::Release(Mapping);
+                else if (!NT_SUCCESS(Status))
+                    Cache->Remove(Mapping);
             }
 
+            if (IsBufferUsermode) VirtualMemory::UnsecureMemory(hBufferSecure);
+
             return Status;
         }
 
@@ -499,9 +564,11 @@ namespace Processes {
             PEPROCESS Process,
             __in_data_source(USER_MODE) IN PVOID BaseAddress,
             OUT PVOID Buffer,
-            ULONG Size
+            ULONG Size,
+            MEMORY_CACHING_TYPE CacheType,
+            OPTIONAL ProcessMappingCache* Cache
         ) {
-            return OperateProcessMemory(Process, BaseAddress, Buffer, Size, MemRead);
+            return OperateProcessMemory(Process, BaseAddress, Buffer, Size, MemRead, CacheType, Cache);
         }
 
         _IRQL_requires_max_(APC_LEVEL)
@@ -509,9 +576,77 @@ namespace Processes {
             PEPROCESS Process,
             __in_data_source(USER_MODE) OUT PVOID BaseAddress,
             IN PVOID Buffer,
-            ULONG Size
+            ULONG Size,
+            MEMORY_CACHING_TYPE CacheType,
+            OPTIONAL ProcessMappingCache* Cache
+        ) {
+            return OperateProcessMemory(Process, BaseAddress, Buffer, Size, MemWrite, CacheType, Cache);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS OperateProcessMemoryRanges(
+            PEPROCESS Process,
+            IN OUT PPROCESS_MEMORY_RANGE Ranges,
+            ULONG Count,
+            MEMORY_OPERATION_TYPE Operation
+        ) {
+            if (!Process) return STATUS_INVALID_PARAMETER_1;
+            if (!Ranges) return STATUS_INVALID_PARAMETER_2;
+            if (!Count) return STATUS_INVALID_PARAMETER_3;
+
+            KAPC_STATE ApcState;
+            KeStackAttachProcess(Process, &ApcState);
+            for (ULONG i = 0; i < Count; i++) {
+                PPROCESS_MEMORY_RANGE Range = &Ranges[i];
+                if (!NT_SUCCESS(Range->Status)) continue;
+
+                // Buffer must be accessible in context of the target process:
+                if (
+                    !Range->BaseAddress || AddressRange::IsKernelAddress(Range->BaseAddress) ||
+                    !Range->Buffer || AddressRange::IsUserAddress(Range->Buffer) ||
+                    !Range->Size
+                ) {
+                    Range->Status = STATUS_INVALID_PARAMETER;
+                    continue;
+                }
+
+                __try {
+                    switch (Operation) {
+                    case MemRead:
+                        ProbeForRead(Range->BaseAddress, Range->Size, 1);
+                        RtlCopyMemory(Range->Buffer, Range->BaseAddress, Range->Size);
+                        break;
+                    case MemWrite:
+                        ProbeForWrite(Range->BaseAddress, Range->Size, 1);
+                        RtlCopyMemory(Range->BaseAddress, Range->Buffer, Range->Size);
+                        break;
+                    }
+                    Range->Status = STATUS_SUCCESS;
+                } __except (EXCEPTION_EXECUTE_HANDLER) {
+                    Range->Status = GetExceptionCode();
+                }
+            }
+            KeUnstackDetachProcess(&ApcState);
+
+            return STATUS_SUCCESS;
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS ReadProcessMemoryRanges(
+            PEPROCESS Process,
+            IN OUT PPROCESS_MEMORY_RANGE Ranges,
+            ULONG Count
+        ) {
+            return OperateProcessMemoryRanges(Process, Ranges, Count, MemRead);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS WriteProcessMemoryRanges(
+            PEPROCESS Process,
+            IN OUT PPROCESS_MEMORY_RANGE Ranges,
+            ULONG Count
         ) {
-            return OperateProcessMemory(Process, BaseAddress, Buffer, Size, MemWrite);
+            return OperateProcessMemoryRanges(Process, Ranges, Count, MemWrite);
         }
     }
 
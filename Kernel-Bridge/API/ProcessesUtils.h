@@ -176,12 +176,60 @@ namespace Processes {
         _IRQL_requires_max_(PASSIVE_LEVEL)
         NTSTATUS FreeVirtualMemory(HANDLE hProcess, PVOID BaseAddress);
 
+        // Mappings of the target process reused between consecutive Read/WriteProcessMemory calls.
+        // Cached pages stay locked and secured, so the owner must flush the cache
+        // before returning to usermode (it is flushed on destruction):
+        class ProcessMappingCache final {
+        public:
+            using MAPPING = struct {
+                PEPROCESS Process;
+                Mdl::MAPPING_INFO Mapping; // Whole pages of the chunk
+                HANDLE hSecure;
+                MEMORY_CACHING_TYPE CacheType;
+                BOOLEAN Writeable;
+            };
+            using PMAPPING = MAPPING*;
+        private:
+            MemoryPlanner::MappingCache<MAPPING, 8> Cache;
+        public:
+            ProcessMappingCache(const ProcessMappingCache&) = delete;
+            ProcessMappingCache(ProcessMappingCache&&) = delete;
+            ProcessMappingCache& operator = (const ProcessMappingCache&) = delete;
+            ProcessMappingCache& operator = (ProcessMappingCache&&) = delete;
+
+            ProcessMappingCache() : Cache(PAGE_SIZE) {}
+            ~ProcessMappingCache() { Flush(); }
+
+            // Returns the mapping that contains pages of the chunk or NULL:
+            _IRQL_requires_max_(APC_LEVEL)
+            PMAPPING Lookup(PEPROCESS Process, const MemoryPlanner::CHUNK* Chunk, MEMORY_CACHING_TYPE CacheType);
+
+            // Takes ownership of the mapping, the least recently used one may be released:
+            _IRQL_requires_max_(APC_LEVEL)
+            PMAPPING Insert(const MemoryPlanner::CHUNK* Chunk, IN const MAPPING* Mapping);
+
+            // Releases the mapping returned by Lookup or Insert:
+            _IRQL_requires_max_(APC_LEVEL)
+            VOID Remove(PMAPPING Mapping);
+
+            _IRQL_requires_max_(APC_LEVEL)
+            VOID Flush();
+
+            _IRQL_requires_max_(APC_LEVEL)
+            static VOID Release(PMAPPING Mapping);
+        };
+
+        // Large requests are mapped by page-aligned chunks (MemoryPlanner.h).
+        // MmCached mapping is faster for regular memory, but the caller must be sure
+        // that the range isn't mapped as non-cached (e.g. device memory) in the target process:
         _IRQL_requires_max_(APC_LEVEL)
         NTSTATUS ReadProcessMemory(
             PEPROCESS Process,
             __in_data_source(USER_MODE) IN PVOID BaseAddress,
             OUT PVOID Buffer, // User or kernel address
-            ULONG Size
+            ULONG Size,
+            MEMORY_CACHING_TYPE CacheType = MmNonCached,
+            OPTIONAL ProcessMappingCache* Cache = NULL
         );
 
         _IRQL_requires_max_(APC_LEVEL)
@@ -189,7 +237,33 @@ namespace Processes {
             PEPROCESS Process,
             __in_data_source(USER_MODE) OUT PVOID BaseAddress,
             IN PVOID Buffer, // User or kernel address
-            ULONG Size
+            ULONG Size,
+            MEMORY_CACHING_TYPE CacheType = MmNonCached,
+            OPTIONAL ProcessMappingCache* Cache = NULL
+        );
+
+        using PROCESS_MEMORY_RANGE = struct {
+            PVOID BaseAddress; // Usermode address in the target process
+            PVOID Buffer;      // Kernel address
+            SIZE_T Size;
+            NTSTATUS Status;   // Ranges with failure status are skipped
+        };
+        using PPROCESS_MEMORY_RANGE = PROCESS_MEMORY_RANGE*;
+
+        // Copies all ranges within a single attach to the process,
+        // result of every copy is written to the Status of range:
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS ReadProcessMemoryRanges(
+            PEPROCESS Process,
+            IN OUT PPROCESS_MEMORY_RANGE Ranges,
+            ULONG Count
+        );
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS WriteProcessMemoryRanges(
+            PEPROCESS Process,
+            IN OUT PPROCESS_MEMORY_RANGE Ranges,
+            ULONG Count
         );
     }
 
@@ -0,0 +1,228 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Spinning primitives for very short read-mostly sections:
+//   - SharedSpinLockCore: writer-preferring reader/writer spin lock, readers count themselves
+//     in per-CPU slots on separate cache lines, so concurrent readers don't share written lines;
+//     a pending writer stops new readers and waits until the slots are drained.
+//   - SequenceLockCore<T>: sequence lock for small POD snapshots, readers never write
+//     and retry if a writer has changed the value during the copy.
+//   - McsLock: queued (MCS) spin lock, every acquirer spins on its own NODE
+//     and the owner hands the lock to the next one in order of arrival,
+//     so waiters don't bounce the cache line of the lock (user-mode counterpart
+//     of the in-stack queued spinlock).
+//
+// Locks.h wraps them with IRQL management (RwSpinLock and SeqLock).
+
+// 'SlotsCount' must be a power of 2, readers with the same slot share its cache line:
+template <ULONG SlotsCount = 64>
+class SharedSpinLockCore final {
+private:
+    static_assert(SlotsCount && (SlotsCount & (SlotsCount - 1)) == 0, "SlotsCount must be a power of 2");
+
+    static constexpr ULONG CacheLine = 64;
+
+    using SLOT = struct {
+        volatile LONG Readers;
+        UCHAR Reserved[CacheLine - sizeof(LONG)];
+    };
+
+    volatile LONG Writer; // Owned or pending
+    UCHAR Reserved0[CacheLine - sizeof(LONG)];
+    SLOT Slots[SlotsCount];
+
+    BOOLEAN IsReaderPresent() const {
+        for (ULONG i = 0; i < SlotsCount; i++) {
+            if (KB_ATOMIC_LOAD_ACQUIRE(Slots[i].Readers)) return TRUE;
+        }
+        return FALSE;
+    }
+public:
+    SharedSpinLockCore(const SharedSpinLockCore&) = delete;
+    SharedSpinLockCore(SharedSpinLockCore&&) = delete;
+    SharedSpinLockCore& operator = (const SharedSpinLockCore&) = delete;
+    SharedSpinLockCore& operator = (SharedSpinLockCore&&) = delete;
+
+    SharedSpinLockCore() : Writer(0), Reserved0(), Slots() {}
+    ~SharedSpinLockCore() = default;
+
+    // 'Slot' is the current CPU number, it must be passed to UnlockShared():
+    BOOLEAN TryLockShared(ULONG Slot) {
+        if (KB_ATOMIC_LOAD_ACQUIRE(Writer)) return FALSE;
+        volatile LONG* Readers = &Slots[Slot & (SlotsCount - 1)].Readers;
+        KB_ATOMIC_INCREMENT(*Readers);
+        // The writer sets its flag before checking slots, so one of us sees the other:
+        if (!KB_ATOMIC_LOAD_ACQUIRE(Writer)) return TRUE;
+        KB_ATOMIC_DECREMENT(*Readers);
+        return FALSE;
+    }
+
+    VOID LockShared(ULONG Slot) {
+        while (!TryLockShared(Slot)) {
+            while (KB_ATOMIC_LOAD_RELAXED(Writer)) KB_CPU_PAUSE();
+        }
+    }
+
+    VOID UnlockShared(ULONG Slot) {
+        KB_ATOMIC_DECREMENT(Slots[Slot & (SlotsCount - 1)].Readers);
+    }
+
+    BOOLEAN TryLockExclusive() {
+        if (KB_ATOMIC_COMPARE_EXCHANGE(Writer, TRUE, FALSE) != FALSE) return FALSE;
+        if (!IsReaderPresent()) return TRUE;
+        KB_ATOMIC_STORE_RELEASE(Writer, FALSE);
+        return FALSE;
+    }
+
+    // New readers wait from the moment the writer has claimed the lock:
+    VOID LockExclusive() {
+        while (KB_ATOMIC_COMPARE_EXCHANGE(Writer, TRUE, FALSE) != FALSE) {
+            while (KB_ATOMIC_LOAD_RELAXED(Writer)) KB_CPU_PAUSE();
+        }
+        while (IsReaderPresent()) KB_CPU_PAUSE();
+    }
+
+    VOID UnlockExclusive() {
+        KB_ATOMIC_STORE_RELEASE(Writer, FALSE);
+    }
+};
+
+// 'T' must be trivially copyable, it is copied by LONG words:
+template <typename T>
+class SequenceLockCore final {
+private:
+    static_assert(__is_trivially_copyable(T), "T must be trivially copyable");
+
+    static constexpr ULONG WordsCount = static_cast<ULONG>((sizeof(T) + sizeof(LONG) - 1) / sizeof(LONG));
+
+    volatile LONG Sequence; // Odd while the value is being written
+    volatile LONG Words[WordsCount];
+public:
+    SequenceLockCore(const SequenceLockCore&) = delete;
+    SequenceLockCore(SequenceLockCore&&) = delete;
+    SequenceLockCore& operator = (const SequenceLockCore&) = delete;
+    SequenceLockCore& operator = (SequenceLockCore&&) = delete;
+
+    SequenceLockCore() : Sequence(0), Words() {}
+    ~SequenceLockCore() = default;
+
+    // Returns FALSE if a writer is active or has changed the value during the copy:
+    BOOLEAN TryRead(OUT T* Value) const {
+        LONG Buffer[WordsCount];
+        LONG Before = KB_ATOMIC_LOAD_ACQUIRE(Sequence);
+        if (Before & 1) return FALSE;
+        for (ULONG i = 0; i < WordsCount; i++) Buffer[i] = KB_ATOMIC_LOAD_RELAXED(Words[i]);
+        // Pairs with the fence of the writer: if the copy has seen any store of a write,
+        // the second load sees the odd sequence of that write (or a newer one):
+        KB_ATOMIC_ACQUIRE_FENCE();
+        if (KB_ATOMIC_LOAD_RELAXED(Sequence) != Before) return FALSE;
+
+        auto Destination = reinterpret_cast<UCHAR*>(Value);
+        auto Source = reinterpret_cast<const UCHAR*>(Buffer);
+        for (SIZE_T i = 0; i < sizeof(T); i++) Destination[i] = Source[i];
+        return TRUE;
+    }
+
+    VOID Read(OUT T* Value) const {
+        while (!TryRead(Value)) KB_CPU_PAUSE();
+    }
+
+    // Writers are serialized by the sequence itself:
+    VOID Write(const T& Value) {
+        LONG Current = 0;
+        for (;;) {
+            Current = KB_ATOMIC_LOAD_RELAXED(Sequence);
+            if (!(Current & 1) && KB_ATOMIC_COMPARE_EXCHANGE(Sequence, static_cast<ULONG>(Current) + 1, Current) == Current) break;
+            KB_CPU_PAUSE();
+        }
+        // The odd sequence is visible before any word of the new value:
+        KB_ATOMIC_RELEASE_FENCE();
+
+        LONG Buffer[WordsCount] = {};
+        auto Destination = reinterpret_cast<UCHAR*>(Buffer);
+        auto Source = reinterpret_cast<const UCHAR*>(&Value);
+        for (SIZE_T i = 0; i < sizeof(T); i++) Destination[i] = Source[i];
+        for (ULONG i = 0; i < WordsCount; i++) KB_ATOMIC_STORE_RELAXED(Words[i], Buffer[i]);
+
+        // Words are visible before the even sequence:
+        KB_ATOMIC_STORE_RELEASE(Sequence, static_cast<ULONG>(Current) + 2);
+    }
+
+    // Count of completed writes:
+    ULONG GetVersion() const {
+        return static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Sequence)) >> 1;
+    }
+};
+
+class McsLock final {
+public:
+    // Queue entry of the acquirer, must stay in place until Unlock():
+    using NODE = struct _NODE {
+        _NODE* volatile Next;
+        volatile LONG Waiting;
+    };
+
+    // Scoped acquisition with the node on the stack of the acquirer:
+    class Guard final {
+    private:
+        McsLock& Owner;
+        NODE Node;
+    public:
+        Guard(const Guard&) = delete;
+        Guard(Guard&&) = delete;
+        Guard& operator = (const Guard&) = delete;
+        Guard& operator = (Guard&&) = delete;
+
+        explicit Guard(McsLock& Source) : Owner(Source), Node() {
+            Owner.Lock(&Node);
+        }
+
+        ~Guard() {
+            Owner.Unlock(&Node);
+        }
+    };
+
+private:
+    NODE* volatile Tail;
+public:
+    McsLock(const McsLock&) = delete;
+    McsLock(McsLock&&) = delete;
+    McsLock& operator = (const McsLock&) = delete;
+    McsLock& operator = (McsLock&&) = delete;
+
+    McsLock() : Tail(NULL) {}
+    ~McsLock() = default;
+
+    BOOLEAN TryLock(OUT NODE* Node) {
+        Node->Next = NULL;
+        Node->Waiting = FALSE;
+        return KB_ATOMIC_COMPARE_EXCHANGE_POINTER(Tail, Node, static_cast<NODE*>(NULL)) == NULL;
+    }
+
+    VOID Lock(OUT NODE* Node) {
+        Node->Next = NULL;
+        Node->Waiting = TRUE;
+        NODE* Previous = static_cast<NODE*>(KB_ATOMIC_EXCHANGE_POINTER(Tail, Node));
+        if (!Previous) return;
+
+        // Spinning on our own node until the previous owner hands the lock over:
+        KB_ATOMIC_STORE_POINTER_RELEASE(Previous->Next, Node);
+        while (KB_ATOMIC_LOAD_ACQUIRE(Node->Waiting)) KB_CPU_PAUSE();
+    }
+
+    VOID Unlock(NODE* Node) {
+        NODE* Next = static_cast<NODE*>(KB_ATOMIC_LOAD_POINTER_ACQUIRE(Node->Next));
+        if (!Next) {
+            if (KB_ATOMIC_COMPARE_EXCHANGE_POINTER(Tail, static_cast<NODE*>(NULL), Node) == Node) return;
+            // The next acquirer has taken the tail but hasn't linked itself yet:
+            while (!(Next = static_cast<NODE*>(KB_ATOMIC_LOAD_POINTER_ACQUIRE(Node->Next)))) KB_CPU_PAUSE();
+        }
+        KB_ATOMIC_STORE_RELEASE(Next->Waiting, FALSE);
+    }
+
+    BOOLEAN IsLocked() const {
+        return KB_ATOMIC_LOAD_POINTER_ACQUIRE(Tail) != NULL;
+    }
+};
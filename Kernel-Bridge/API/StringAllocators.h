@@ -0,0 +1,404 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Allocator policies of String<TChar, TAllocator>, every policy provides:
+//   PVOID Allocate(size_t Bytes);
+//   VOID Free(PVOID Memory, size_t Bytes); // 'Bytes' is the size that was allocated
+//   size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) const; // Growth strategy, >= RequiredBytes
+//   bool operator == (const Policy&) const; // Memory allocated by one may be freed by another
+// Policies live inside strings (empty policies take no space), stateful ones only hold a pointer
+// to the lookaside lists or to the arena, which must outlive strings that use them.
+// Default-constructed stateful policies fall back to the pool.
+
+#ifdef _NTDDK_
+#ifdef POOL_NX_OPTIN
+    #define KB_STRING_POOL_TYPE ExDefaultNonPagedPoolType
+#else
+    #define KB_STRING_POOL_TYPE NonPagedPool
+#endif
+#endif
+
+constexpr ULONG StringPoolTag = 'RTS_';
+
+// Rounds the buffer up to the next granule with at least one spare character,
+// it is the behaviour of String before policies:
+template <size_t Granularity = 64>
+struct StringGranularGrowth {
+    static size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) {
+        UNREFERENCED_PARAMETER(CurrentBytes);
+        return ((RequiredBytes / Granularity) + 1) * Granularity;
+    }
+};
+
+// Reallocations at least double the buffer, so appending in a loop is amortized O(1):
+template <size_t Granularity = 64>
+struct StringGeometricGrowth {
+    static size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) {
+        if (RequiredBytes > CurrentBytes && RequiredBytes < CurrentBytes * 2) RequiredBytes = CurrentBytes * 2;
+        return ((RequiredBytes + Granularity - 1) / Granularity) * Granularity;
+    }
+};
+
+// ExAllocatePoolWithTag in the kernel and new[] in usermode:
+template <typename TGrowth = StringGranularGrowth<>>
+class StringPoolAllocator {
+public:
+    static size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) {
+        return TGrowth::GetBufferSize(RequiredBytes, CurrentBytes);
+    }
+
+    static PVOID Allocate(size_t Bytes) {
+#ifdef _NTDDK_
+        return ExAllocatePoolWithTag(KB_STRING_POOL_TYPE, Bytes, StringPoolTag);
+#else
+        return new BYTE[Bytes];
+#endif
+    }
+
+    static VOID Free(PVOID Memory, size_t Bytes) {
+        UNREFERENCED_PARAMETER(Bytes);
+#ifdef _NTDDK_
+        ExFreePoolWithTag(Memory, StringPoolTag);
+#else
+        delete[] static_cast<BYTE*>(Memory);
+#endif
+    }
+
+    bool operator == (const StringPoolAllocator&) const { return true; }
+    bool operator != (const StringPoolAllocator&) const { return false; }
+};
+
+// Lookaside lists of buffers of 64, 128, 256 and 512 bytes (most of paths and names fit them),
+// larger buffers are allocated from the pool.
+// In the kernel every processor has its own lists (buffers may be freed on another processor),
+// usermode builds have one spinlocked free list per size.
+class StringLookaside final {
+public:
+    static constexpr ULONG ClassesCount = 4;
+    static constexpr size_t MinClassSize = 64; // Sizes are MinClassSize << Class
+    static constexpr size_t MaxClassSize = MinClassSize << (ClassesCount - 1);
+private:
+#ifdef _NTDDK_
+    using PROCESSOR_LISTS = struct {
+        LOOKASIDE_LIST_EX Lists[ClassesCount];
+    };
+
+    PROCESSOR_LISTS* Processors;
+    ULONG ProcessorsCount;
+
+    LOOKASIDE_LIST_EX* GetList(ULONG Class) {
+        ULONG Processor = KeGetCurrentProcessorNumberEx(NULL);
+        // Processors may be added after the initialization:
+        if (Processor >= ProcessorsCount) Processor %= ProcessorsCount;
+        return &Processors[Processor].Lists[Class];
+    }
+#else
+    static constexpr ULONG MaxDepth = 256;
+
+    using FREE_BUFFER = struct _FREE_BUFFER {
+        _FREE_BUFFER* Next;
+    };
+
+    using FREE_LIST = struct {
+        FREE_BUFFER* Head;
+        ULONG Depth;
+        volatile LONG Lock;
+    };
+
+    FREE_LIST FreeLists[ClassesCount];
+    bool Initialized;
+
+    static VOID Lock(FREE_LIST* List) {
+        while (KB_ATOMIC_EXCHANGE(List->Lock, 1)) {
+            while (KB_ATOMIC_LOAD_RELAXED(List->Lock)) KB_CPU_PAUSE();
+        }
+    }
+
+    static VOID Unlock(FREE_LIST* List) {
+        KB_ATOMIC_STORE_RELEASE(List->Lock, 0);
+    }
+#endif
+
+    static ULONG GetClass(size_t Bytes) {
+        ULONG Class = 0;
+        while (Class < ClassesCount && (MinClassSize << Class) < Bytes) ++Class;
+        return Class;
+    }
+public:
+    StringLookaside(const StringLookaside&) = delete;
+    StringLookaside(StringLookaside&&) = delete;
+    StringLookaside& operator = (const StringLookaside&) = delete;
+    StringLookaside& operator = (StringLookaside&&) = delete;
+
+#ifdef _NTDDK_
+    StringLookaside() : Processors(NULL), ProcessorsCount(0) {}
+#else
+    StringLookaside() : FreeLists(), Initialized(false) {}
+#endif
+
+    ~StringLookaside() {
+        Deinitialize();
+    }
+
+    bool Initialize() {
+#ifdef _NTDDK_
+        if (Processors) return true;
+        ULONG Count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        auto Lists = static_cast<PROCESSOR_LISTS*>(
+            ExAllocatePoolWithTag(KB_STRING_POOL_TYPE, Count * sizeof(PROCESSOR_LISTS), StringPoolTag)
+        );
+        if (!Lists) return false;
+        for (ULONG Processor = 0; Processor < Count; ++Processor) {
+            for (ULONG Class = 0; Class < ClassesCount; ++Class) {
+                NTSTATUS Status = ExInitializeLookasideListEx(
+                    &Lists[Processor].Lists[Class],
+                    NULL,
+                    NULL,
+                    KB_STRING_POOL_TYPE,
+                    0,
+                    MinClassSize << Class,
+                    StringPoolTag,
+                    0
+                );
+                if (!NT_SUCCESS(Status)) {
+                    // Lists are initialized in order, delete the initialized ones:
+                    for (ULONG Initialized = 0; Initialized < Processor * ClassesCount + Class; ++Initialized) {
+                        ExDeleteLookasideListEx(&Lists[Initialized / ClassesCount].Lists[Initialized % ClassesCount]);
+                    }
+                    ExFreePoolWithTag(Lists, StringPoolTag);
+                    return false;
+                }
+            }
+        }
+        ProcessorsCount = Count;
+        Processors = Lists;
+#else
+        Initialized = true;
+#endif
+        return true;
+    }
+
+    // All strings that use the lists must be freed before:
+    VOID Deinitialize() {
+#ifdef _NTDDK_
+        if (!Processors) return;
+        for (ULONG Processor = 0; Processor < ProcessorsCount; ++Processor) {
+            for (ULONG Class = 0; Class < ClassesCount; ++Class) {
+                ExDeleteLookasideListEx(&Processors[Processor].Lists[Class]);
+            }
+        }
+        ExFreePoolWithTag(Processors, StringPoolTag);
+        Processors = NULL;
+        ProcessorsCount = 0;
+#else
+        for (ULONG Class = 0; Class < ClassesCount; ++Class) {
+            FREE_BUFFER* Buffer = FreeLists[Class].Head;
+            while (Buffer) {
+                FREE_BUFFER* Next = Buffer->Next;
+                StringPoolAllocator<>::Free(Buffer, MinClassSize << Class);
+                Buffer = Next;
+            }
+            FreeLists[Class].Head = NULL;
+            FreeLists[Class].Depth = 0;
+        }
+        Initialized = false;
+#endif
+    }
+
+    // Sizes up to MaxClassSize are rounded up to the size of their list:
+    static size_t RoundUp(size_t Bytes) {
+        ULONG Class = GetClass(Bytes);
+        return Class < ClassesCount ? MinClassSize << Class : Bytes;
+    }
+
+    PVOID Allocate(size_t Bytes) {
+        ULONG Class = GetClass(Bytes);
+#ifdef _NTDDK_
+        if (Class == ClassesCount || !Processors) return StringPoolAllocator<>::Allocate(Bytes);
+        return ExAllocateFromLookasideListEx(GetList(Class));
+#else
+        if (Class == ClassesCount || !Initialized) return StringPoolAllocator<>::Allocate(Bytes);
+        FREE_LIST* List = &FreeLists[Class];
+        Lock(List);
+        FREE_BUFFER* Buffer = List->Head;
+        if (Buffer) {
+            List->Head = Buffer->Next;
+            --List->Depth;
+        }
+        Unlock(List);
+        return Buffer ? Buffer : StringPoolAllocator<>::Allocate(MinClassSize << Class);
+#endif
+    }
+
+    VOID Free(PVOID Memory, size_t Bytes) {
+        ULONG Class = GetClass(Bytes);
+#ifdef _NTDDK_
+        if (Class == ClassesCount || !Processors) {
+            StringPoolAllocator<>::Free(Memory, Bytes);
+            return;
+        }
+        ExFreeToLookasideListEx(GetList(Class), Memory);
+#else
+        if (Class == ClassesCount || !Initialized) {
+            StringPoolAllocator<>::Free(Memory, Bytes);
+            return;
+        }
+        FREE_LIST* List = &FreeLists[Class];
+        Lock(List);
+        if (List->Depth < MaxDepth) {
+            auto Buffer = static_cast<FREE_BUFFER*>(Memory);
+            Buffer->Next = List->Head;
+            List->Head = Buffer;
+            ++List->Depth;
+            Memory = NULL;
+        }
+        Unlock(List);
+        if (Memory) StringPoolAllocator<>::Free(Memory, Bytes);
+#endif
+    }
+};
+
+template <typename TGrowth = StringGranularGrowth<>>
+class StringLookasideAllocator {
+private:
+    StringLookaside* Lookaside;
+public:
+    StringLookasideAllocator() : Lookaside(NULL) {}
+    StringLookasideAllocator(StringLookaside* Lists) : Lookaside(Lists) {}
+
+    size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) const {
+        size_t Size = TGrowth::GetBufferSize(RequiredBytes, CurrentBytes);
+        return Lookaside ? StringLookaside::RoundUp(Size) : Size;
+    }
+
+    PVOID Allocate(size_t Bytes) {
+        return Lookaside ? Lookaside->Allocate(Bytes) : StringPoolAllocator<>::Allocate(Bytes);
+    }
+
+    VOID Free(PVOID Memory, size_t Bytes) {
+        if (Lookaside) Lookaside->Free(Memory, Bytes); else StringPoolAllocator<>::Free(Memory, Bytes);
+    }
+
+    bool operator == (const StringLookasideAllocator& Allocator) const { return Lookaside == Allocator.Lookaside; }
+    bool operator != (const StringLookasideAllocator& Allocator) const { return Lookaside != Allocator.Lookaside; }
+};
+
+// Bump allocator for strings of one request (e.g. of one filter callback):
+//   WCHAR Initial[256];
+//   StringArena Arena(Initial, sizeof(Initial));
+//   String<WCHAR, StringArenaAllocator<>> Path(GetView(), &Arena);
+// Free only rolls back the last allocation (e.g. of a temporary string destroyed right away),
+// everything else is released at once by Reset or the destructor. A growing string allocates
+// its new buffer before freeing the old one, so old buffers stay in the arena until Reset:
+// Reserve() the final length of such strings up front.
+// The arena isn't synchronized, it belongs to one thread.
+class StringArena final {
+private:
+    using CHUNK = struct _CHUNK {
+        _CHUNK* Next;
+        size_t Size; // With the header
+    };
+
+    static constexpr size_t Alignment = MEMORY_ALLOCATION_ALIGNMENT;
+    static constexpr size_t HeaderSize = (sizeof(CHUNK) + Alignment - 1) & ~(Alignment - 1);
+
+    UCHAR* InitialBuffer;
+    size_t InitialSize;
+    size_t ChunkSize;
+    CHUNK* Chunks;
+    UCHAR* Top;
+    UCHAR* End;
+    UCHAR* LastAllocation;
+
+    static size_t AlignUp(size_t Bytes) {
+        return (Bytes + Alignment - 1) & ~(Alignment - 1);
+    }
+
+    VOID SetupInitial() {
+        // The caller's buffer may be unaligned:
+        size_t Skip = AlignUp(reinterpret_cast<size_t>(InitialBuffer)) - reinterpret_cast<size_t>(InitialBuffer);
+        Top = InitialBuffer && InitialSize > Skip ? InitialBuffer + Skip : NULL;
+        End = Top ? InitialBuffer + InitialSize : NULL;
+        LastAllocation = NULL;
+    }
+public:
+    StringArena(const StringArena&) = delete;
+    StringArena(StringArena&&) = delete;
+    StringArena& operator = (const StringArena&) = delete;
+    StringArena& operator = (StringArena&&) = delete;
+
+    StringArena(size_t ChunkBytes = 4096)
+        : InitialBuffer(NULL), InitialSize(0), ChunkSize(ChunkBytes), Chunks(NULL), Top(NULL), End(NULL), LastAllocation(NULL) {}
+
+    StringArena(PVOID Buffer, size_t Size, size_t ChunkBytes = 4096)
+        : InitialBuffer(static_cast<UCHAR*>(Buffer)), InitialSize(Size), ChunkSize(ChunkBytes), Chunks(NULL)
+    {
+        SetupInitial();
+    }
+
+    ~StringArena() {
+        Reset();
+    }
+
+    PVOID Allocate(size_t Bytes) {
+        Bytes = AlignUp(Bytes);
+        if (!Top || static_cast<size_t>(End - Top) < Bytes) {
+            size_t Size = HeaderSize + Bytes;
+            if (Size < ChunkSize) Size = ChunkSize;
+            auto Chunk = static_cast<CHUNK*>(StringPoolAllocator<>::Allocate(Size));
+            if (!Chunk) return NULL;
+            Chunk->Next = Chunks;
+            Chunk->Size = Size;
+            Chunks = Chunk;
+            Top = reinterpret_cast<UCHAR*>(Chunk) + HeaderSize;
+            End = reinterpret_cast<UCHAR*>(Chunk) + Size;
+        }
+        LastAllocation = Top;
+        Top += Bytes;
+        return LastAllocation;
+    }
+
+    VOID Free(PVOID Memory, size_t Bytes) {
+        UNREFERENCED_PARAMETER(Bytes);
+        if (Memory && Memory == LastAllocation) {
+            Top = LastAllocation;
+            LastAllocation = NULL;
+        }
+    }
+
+    // All strings that use the arena must be freed before:
+    VOID Reset() {
+        while (Chunks) {
+            CHUNK* Next = Chunks->Next;
+            StringPoolAllocator<>::Free(Chunks, Chunks->Size);
+            Chunks = Next;
+        }
+        SetupInitial();
+    }
+};
+
+template <typename TGrowth = StringGranularGrowth<MEMORY_ALLOCATION_ALIGNMENT>>
+class StringArenaAllocator {
+private:
+    StringArena* Arena;
+public:
+    StringArenaAllocator() : Arena(NULL) {}
+    StringArenaAllocator(StringArena* RequestArena) : Arena(RequestArena) {}
+
+    static size_t GetBufferSize(size_t RequiredBytes, size_t CurrentBytes) {
+        return TGrowth::GetBufferSize(RequiredBytes, CurrentBytes);
+    }
+
+    PVOID Allocate(size_t Bytes) {
+        return Arena ? Arena->Allocate(Bytes) : StringPoolAllocator<>::Allocate(Bytes);
+    }
+
+    VOID Free(PVOID Memory, size_t Bytes) {
+        if (Arena) Arena->Free(Memory, Bytes); else StringPoolAllocator<>::Free(Memory, Bytes);
+    }
+
+    bool operator == (const StringArenaAllocator& Allocator) const { return Arena == Allocator.Arena; }
+    bool operator != (const StringArenaAllocator& Allocator) const { return Arena != Allocator.Arena; }
+};
@@ -5,9 +5,17 @@
      - wdm.h/fltKernel.h
      - ntstrsafe.h
      - stdarg.h
+     - intrin.h
+     - UnicodeCase.h
+     - StringAllocators.h
+     - UtfTypes.h
     [UM] Dependencies:
      - Windows.h
      - cstdarg
+     - intrin.h
+     - UnicodeCase.h
+     - StringAllocators.h
+     - UtfTypes.h
 */
 
 #ifndef _NTDDK_
@@ -22,74 +30,696 @@ extern "C" {
 extern "C" int __cdecl _vsnprintf_s(char* dest, size_t size, size_t max_count, const char* format, va_list args);
 extern "C" int __cdecl _vsnwprintf_s(wchar_t* dest, size_t size, size_t max_count, const wchar_t* format, va_list args);
 
-template<typename TChar> class String {
+// Search kernels use SSE2 on x64 only: it is always present there and XMM registers
+// may be used in the kernel without saving of the extended state (AVX can't).
+// Define KB_STRINGS_NO_SIMD to build the scalar versions:
+#if !defined(KB_STRINGS_NO_SIMD) && (defined(_M_AMD64) || defined(__x86_64__))
+    #define KB_STRINGS_SSE2
+#endif
+
+namespace StringSearch {
+    constexpr size_t NoIndex = ~static_cast<size_t>(0);
+
+    template <typename TChar>
+    inline bool IsEqual(const TChar* First, const TChar* Second, size_t Characters) {
+        return !Characters || RtlEqualMemory(First, Second, Characters * sizeof(TChar));
+    }
+
+#ifdef KB_STRINGS_SSE2
+    inline __m128i Load(const CHAR* Str) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(Str)); }
+    inline __m128i Load(const WCHAR* Str) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(Str)); }
+
+    inline __m128i Broadcast(CHAR Char) { return _mm_set1_epi8(Char); }
+    inline __m128i Broadcast(WCHAR Char) { return _mm_set1_epi16(static_cast<short>(Char)); }
+
+    // One bit per character (the lowest bit of its bytes in the movemask):
+    inline unsigned int CompareMask(__m128i Block, __m128i Pattern, CHAR) {
+        return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(Block, Pattern)));
+    }
+    inline unsigned int CompareMask(__m128i Block, __m128i Pattern, WCHAR) {
+        return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi16(Block, Pattern))) & 0x5555;
+    }
+
+    inline unsigned int LowestBit(unsigned int Mask) {
+#ifdef _MSC_VER
+        unsigned long Index = 0;
+        _BitScanForward(&Index, Mask);
+        return Index;
+#else
+        return static_cast<unsigned int>(__builtin_ctz(Mask));
+#endif
+    }
+#endif
+
+    // Index of the first 'Char' in Str[0..Length) or NoIndex:
+    template <typename TChar>
+    inline size_t FindChar(const TChar* Str, size_t Length, TChar Char) {
+        size_t Index = 0;
+#ifdef KB_STRINGS_SSE2
+        static_assert(sizeof(TChar) == 1 || sizeof(TChar) == 2, "Unsupported character type");
+        constexpr size_t Lanes = sizeof(__m128i) / sizeof(TChar);
+        const __m128i Pattern = Broadcast(Char);
+        for (; Index + Lanes <= Length; Index += Lanes) {
+            unsigned int Mask = CompareMask(Load(Str + Index), Pattern, TChar());
+            if (Mask) return Index + LowestBit(Mask) / sizeof(TChar);
+        }
+#endif
+        for (; Index < Length; ++Index) {
+            if (Str[Index] == Char) return Index;
+        }
+        return NoIndex;
+    }
+
+    // Maximal suffix of the needle by the ordering of characters (or by the reversed one)
+    // and the period of this suffix, Crochemore-Perrin:
+    template <typename TChar>
+    inline LONG_PTR MaximalSuffix(const TChar* Needle, LONG_PTR NeedleLength, bool Reversed, OUT LONG_PTR* Period) {
+        LONG_PTR Suffix = -1, j = 0, k = 1;
+        *Period = 1;
+        while (j + k < NeedleLength) {
+            TChar a = Needle[j + k];
+            TChar b = Needle[Suffix + k];
+            if (Reversed ? (a > b) : (a < b)) {
+                j += k;
+                k = 1;
+                *Period = j - Suffix;
+            } else if (a == b) {
+                if (k != *Period) {
+                    ++k;
+                } else {
+                    j += *Period;
+                    k = 1;
+                }
+            } else {
+                Suffix = j;
+                j = Suffix + 1;
+                k = *Period = 1;
+            }
+        }
+        return Suffix;
+    }
+
+    // Two-way search, linear time and constant space for any text and needle:
+    template <typename TChar>
+    inline size_t TwoWay(const TChar* Str, size_t Length, const TChar* Needle, size_t NeedleLength) {
+        if (NeedleLength > Length) return NoIndex;
+
+        auto n = static_cast<LONG_PTR>(Length);
+        auto m = static_cast<LONG_PTR>(NeedleLength);
+
+        LONG_PTR Period = 0, ReversedPeriod = 0;
+        LONG_PTR Suffix = MaximalSuffix(Needle, m, false, &Period);
+        LONG_PTR ReversedSuffix = MaximalSuffix(Needle, m, true, &ReversedPeriod);
+
+        // Critical factorization: Needle = Needle[0..Ell] + Needle[Ell + 1..m):
+        LONG_PTR Ell = Suffix > ReversedSuffix ? Suffix : ReversedSuffix;
+        if (ReversedSuffix >= Suffix) Period = ReversedPeriod;
+
+        if (IsEqual(Needle, Needle + Period, static_cast<size_t>(Ell + 1))) {
+            // Periodic needle, the matched prefix is remembered between shifts:
+            LONG_PTR Memory = -1;
+            for (LONG_PTR j = 0; j <= n - m;) {
+                LONG_PTR i = (Ell > Memory ? Ell : Memory) + 1;
+                while (i < m && Needle[i] == Str[i + j]) ++i;
+                if (i >= m) {
+                    i = Ell;
+                    while (i > Memory && Needle[i] == Str[i + j]) --i;
+                    if (i <= Memory) return static_cast<size_t>(j);
+                    j += Period;
+                    Memory = m - Period - 1;
+                } else {
+                    j += i - Ell;
+                    Memory = -1;
+                }
+            }
+        } else {
+            Period = (Ell + 1 > m - Ell - 1 ? Ell + 1 : m - Ell - 1) + 1;
+            for (LONG_PTR j = 0; j <= n - m;) {
+                LONG_PTR i = Ell + 1;
+                while (i < m && Needle[i] == Str[i + j]) ++i;
+                if (i >= m) {
+                    i = Ell;
+                    while (i >= 0 && Needle[i] == Str[i + j]) --i;
+                    if (i < 0) return static_cast<size_t>(j);
+                    j += Period;
+                } else {
+                    j += i - Ell;
+                }
+            }
+        }
+        return NoIndex;
+    }
+
+    // Index of the first Needle[0..NeedleLength) in Str[0..Length) or NoIndex.
+    // Only positions where two characters of the needle match are verified (SSE2 version checks
+    // 16 bytes of positions at once), if candidates are mostly false (periodic texts), it continues by TwoWay.
+    // The second character is the last one that differs from the first: in paths needles often start
+    // and end with '\\', so checking both of them would produce a candidate on every separator:
+    template <typename TChar>
+    inline size_t FindSubstring(const TChar* Str, size_t Length, const TChar* Needle, size_t NeedleLength) {
+        if (!NeedleLength) return 0;
+        if (NeedleLength > Length) return NoIndex;
+        if (NeedleLength == 1) return FindChar(Str, Length, Needle[0]);
+
+        size_t Probe = NeedleLength - 1;
+        while (Probe > 1 && Needle[Probe] == Needle[0]) --Probe;
+        if (Needle[Probe] == Needle[0]) Probe = NeedleLength - 1;
+
+        size_t Index = 0;
+        size_t LastPosition = Length - NeedleLength;
+        size_t FalseCandidates = 0;
+#ifdef KB_STRINGS_SSE2
+        constexpr size_t Lanes = sizeof(__m128i) / sizeof(TChar);
+        const __m128i First = Broadcast(Needle[0]);
+        const __m128i Second = Broadcast(Needle[Probe]);
+        while (LastPosition + 1 >= Lanes && Index <= LastPosition) {
+            // The last block overlaps the previous one, already checked positions are masked out:
+            unsigned int Checked = 0;
+            if (Index + Lanes - 1 > LastPosition) {
+                Checked = static_cast<unsigned int>(Index - (LastPosition + 1 - Lanes));
+                Index = LastPosition + 1 - Lanes;
+            }
+
+            unsigned int Mask = CompareMask(Load(Str + Index), First, TChar())
+                              & CompareMask(Load(Str + Index + Probe), Second, TChar());
+            Mask &= ~0u << (Checked * sizeof(TChar));
+            while (Mask) {
+                size_t Candidate = Index + LowestBit(Mask) / sizeof(TChar);
+                if (IsEqual(Str + Candidate + 1, Needle + 1, NeedleLength - 1)) return Candidate;
+                Mask &= Mask - 1;
+                ++FalseCandidates;
+            }
+
+            Index += Lanes;
+            if (FalseCandidates > 64 + Index / 4) {
+                size_t Found = TwoWay(Str + Index, Length - Index, Needle, NeedleLength);
+                return Found == NoIndex ? NoIndex : Index + Found;
+            }
+        }
+#endif
+        // Scalar version and texts shorter than one block for SSE2:
+        for (; Index <= LastPosition; ++Index) {
+            if (Str[Index] != Needle[0] || Str[Index + Probe] != Needle[Probe]) continue;
+            if (IsEqual(Str + Index + 1, Needle + 1, NeedleLength - 1)) return Index;
+
+            if (++FalseCandidates > 64 + Index / 4) {
+                size_t Next = Index + 1;
+                size_t Found = TwoWay(Str + Next, Length - Next, Needle, NeedleLength);
+                return Found == NoIndex ? NoIndex : Next + Found;
+            }
+        }
+        return NoIndex;
+    }
+}
+
+// Case-insensitive comparison and hashing without allocations (characters are folded to upper case
+// by UnicodeCase as RtlCompareUnicodeString does). Strings are processed by 8 bytes: equal words
+// are skipped without folding and words of ASCII characters are folded all at once:
+namespace StringCase {
+    template <typename TChar>
+    struct Lanes;
+
+    template <>
+    struct Lanes<CHAR> {
+        static constexpr UINT64 Ones = 0x0101010101010101ULL;
+        static constexpr UINT64 NonAscii = 0x8080808080808080ULL;
+        using Unsigned = UCHAR;
+    };
+
+    template <>
+    struct Lanes<WCHAR> {
+        static_assert(sizeof(WCHAR) == 2, "WCHAR must be 16-bit (use -fshort-wchar)");
+        static constexpr UINT64 Ones = 0x0001000100010001ULL;
+        static constexpr UINT64 NonAscii = 0xFF80FF80FF80FF80ULL;
+        using Unsigned = WCHAR;
+    };
+
+    template <typename TChar>
+    inline UINT64 LoadWord(const TChar* Str) {
+        UINT64 Word;
+        RtlCopyMemory(&Word, Str, sizeof(Word));
+        return Word;
+    }
+
+    template <typename TChar>
+    inline UINT64 UpcaseWord(UINT64 Word) {
+        constexpr size_t Characters = sizeof(UINT64) / sizeof(TChar);
+        if (!(Word & Lanes<TChar>::NonAscii)) {
+            // Every lane is below 0x80, so additions never carry into the next lane:
+            UINT64 Above = Word + Lanes<TChar>::Ones * (0x80 - 'a'); // Bit 7 is set for lanes >= 'a'
+            UINT64 Beyond = Word + Lanes<TChar>::Ones * (0x80 - 'z' - 1); // Bit 7 is set for lanes > 'z'
+            UINT64 Lower = Above & ~Beyond & (Lanes<TChar>::Ones * 0x80);
+            return Word - (Lower >> 2);
+        }
+
+        TChar Chars[Characters];
+        RtlCopyMemory(Chars, &Word, sizeof(Word));
+        for (size_t i = 0; i < Characters; ++i) Chars[i] = UnicodeCase::Upcase(Chars[i]);
+        RtlCopyMemory(&Word, Chars, sizeof(Word));
+        return Word;
+    }
+
+    // Compares folded characters, returns the difference of the first different ones (0 if equal):
+    template <typename TChar>
+    inline int Compare(const TChar* First, const TChar* Second, size_t Characters) {
+        constexpr size_t Step = sizeof(UINT64) / sizeof(TChar);
+        size_t Index = 0;
+        for (; Index + Step <= Characters; Index += Step) {
+            UINT64 FirstWord = LoadWord(First + Index);
+            UINT64 SecondWord = LoadWord(Second + Index);
+            if (FirstWord == SecondWord) continue;
+            if (UpcaseWord<TChar>(FirstWord) != UpcaseWord<TChar>(SecondWord)) break; // The tail loop finds the difference
+        }
+
+        for (; Index < Characters; ++Index) {
+            if (First[Index] == Second[Index]) continue;
+            auto FirstChar = static_cast<int>(static_cast<typename Lanes<TChar>::Unsigned>(UnicodeCase::Upcase(First[Index])));
+            auto SecondChar = static_cast<int>(static_cast<typename Lanes<TChar>::Unsigned>(UnicodeCase::Upcase(Second[Index])));
+            if (FirstChar != SecondChar) return FirstChar - SecondChar;
+        }
+        return 0;
+    }
+
+    inline UINT64 Mix(UINT64 Hash) {
+        Hash ^= Hash >> 33;
+        Hash *= 0xFF51AFD7ED558CCDULL;
+        Hash ^= Hash >> 33;
+        Hash *= 0xC4CEB9FE1A85EC53ULL;
+        Hash ^= Hash >> 33;
+        return Hash;
+    }
+
+    // Stable 64-bit hash of the characters (the same in every build and on every run),
+    // strings that are equal by Compare have equal case-insensitive hashes:
+    template <typename TChar>
+    inline UINT64 Hash(const TChar* Str, size_t Characters, bool CaseInsensitive) {
+        constexpr size_t Step = sizeof(UINT64) / sizeof(TChar);
+        UINT64 Hash = 0x9E3779B97F4A7C15ULL ^ (static_cast<UINT64>(Characters) * sizeof(TChar));
+        size_t Index = 0;
+        for (; Index + Step <= Characters; Index += Step) {
+            UINT64 Word = LoadWord(Str + Index);
+            if (CaseInsensitive) Word = UpcaseWord<TChar>(Word);
+            Hash = (Hash ^ Word) * 0xBF58476D1CE4E5B9ULL;
+            Hash ^= Hash >> 31;
+        }
+
+        if (Index < Characters) {
+            // The tail is padded by zeroes:
+            UINT64 Word = 0;
+            RtlCopyMemory(&Word, Str + Index, (Characters - Index) * sizeof(TChar));
+            if (CaseInsensitive) Word = UpcaseWord<TChar>(Word);
+            Hash = (Hash ^ Word) * 0xBF58476D1CE4E5B9ULL;
+        }
+
+        return Mix(Hash);
+    }
+}
+
+// Counted strings of the system that StringView can be built from:
+template <typename TChar>
+struct CountedString;
+
+template <>
+struct CountedString<CHAR> {
+    using Type = ANSI_STRING;
+};
+
+template <>
+struct CountedString<WCHAR> {
+    using Type = UNICODE_STRING;
+};
+
+// The character type that strings are converted to or from:
+template <typename TChar>
+struct OtherChar;
+
+template <>
+struct OtherChar<CHAR> {
+    using Type = WCHAR;
+};
+
+template <>
+struct OtherChar<WCHAR> {
+    using Type = CHAR;
+};
+
+// Non-owning view of characters (not necessarily null-terminated), it is as cheap to copy as a pointer
+// and must not outlive the viewed buffer. String converts to it implicitly, so String methods that only
+// read their arguments accept String, null-terminated strings, views and counted strings:
+//   StringView<WCHAR> Path(&FileObject->FileName);
+//   StringView<WCHAR> Component;
+//   for (size_t Position = 0; Path.NextToken(L'\\', &Position, &Component);) { ... }
+template <typename TChar>
+class StringView {
 private:
-    static const TChar NullChar = 0;
+    const TChar* Buffer;
+    size_t Characters;
+
+    static size_t Length(const TChar* Str) {
+        if (!Str) return 0;
+        size_t StrLength = 0;
+        while (Str[StrLength]) ++StrLength;
+        return StrLength;
+    }
+
+    static bool IsSpace(TChar Char) {
+        return Char == static_cast<TChar>(' ') || Char == static_cast<TChar>('\t');
+    }
+public:
+    static constexpr size_t NoPos = StringSearch::NoIndex;
 
-    // Small string optimization (using stack memory for small strings):
-    static constexpr unsigned char SSO_SIZE = 32;
-    __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) TChar SsoBuffer[SSO_SIZE];
+    StringView() : Buffer(NULL), Characters(0) {}
+    StringView(const TChar* Str) : Buffer(Str), Characters(Length(Str)) {}
+    StringView(const TChar* Str, size_t StrLength) : Buffer(Str), Characters(Str ? StrLength : 0) {}
+    StringView(const typename CountedString<TChar>::Type* Str)
+        : Buffer(Str ? Str->Buffer : NULL), Characters(Str && Str->Buffer ? Str->Length / sizeof(TChar) : 0) {}
 
-    static constexpr unsigned short AllocationGranularity = 64;
+    inline const TChar* GetData() const { return Buffer; }
+    inline size_t GetLength() const { return Characters; }
+    inline bool IsEmpty() const { return !Characters; }
 
+    inline TChar operator [] (size_t Index) const {
+        return Buffer[Index];
+    }
+
+    // Length is limited by MAXUSHORT bytes, the buffer isn't null-terminated:
+    typename CountedString<TChar>::Type GetCountedString() const {
+        typename CountedString<TChar>::Type Str = {};
+        size_t Size = Characters * sizeof(TChar);
+        if (Size > MAXUSHORT - (MAXUSHORT % sizeof(TChar))) Size = MAXUSHORT - (MAXUSHORT % sizeof(TChar));
+        Str.Buffer = const_cast<TChar*>(Buffer);
+        Str.Length = static_cast<USHORT>(Size);
+        Str.MaximumLength = static_cast<USHORT>(Size);
+        return Str;
+    }
+
+    StringView Substr(size_t Position, size_t Count = NoPos) const {
+        if (Position > Characters) return StringView();
+        if (Count > Characters - Position) Count = Characters - Position;
+        return StringView(Buffer + Position, Count);
+    }
+
+    StringView TrimLeft() const {
+        size_t Symbol = 0;
+        while (Symbol < Characters && IsSpace(Buffer[Symbol])) ++Symbol;
+        return StringView(Buffer + Symbol, Characters - Symbol);
+    }
+
+    StringView TrimRight() const {
+        size_t Count = Characters;
+        while (Count && IsSpace(Buffer[Count - 1])) --Count;
+        return StringView(Buffer, Count);
+    }
+
+    StringView Trim() const {
+        return TrimLeft().TrimRight();
+    }
+
+    size_t Pos(StringView Substring, size_t Offset = 0) const {
+        if (Offset > Characters) return NoPos;
+        size_t Index = StringSearch::FindSubstring(Buffer + Offset, Characters - Offset, Substring.Buffer, Substring.Characters);
+        return Index == StringSearch::NoIndex ? NoPos : Offset + Index;
+    }
+
+    size_t Pos(TChar Char, size_t Offset = 0) const {
+        if (Offset > Characters) return NoPos;
+        size_t Index = StringSearch::FindChar(Buffer + Offset, Characters - Offset, Char);
+        return Index == StringSearch::NoIndex ? NoPos : Offset + Index;
+    }
+
+    size_t LastPos(TChar Char) const {
+        for (size_t Index = Characters; Index; --Index) {
+            if (Buffer[Index - 1] == Char) return Index - 1;
+        }
+        return NoPos;
+    }
+
+    inline bool Contains(StringView Substring, size_t Offset = 0) const {
+        return Pos(Substring, Offset) != NoPos;
+    }
+
+    // Splits by the first delimiter, returns false (and the whole view as 'Head') if there is no one:
+    bool Split(TChar Delimiter, OUT StringView* Head, OUT StringView* Tail) const {
+        size_t Index = Pos(Delimiter);
+        if (Index == NoPos) {
+            *Head = *this;
+            *Tail = StringView();
+            return false;
+        }
+        *Head = StringView(Buffer, Index);
+        *Tail = StringView(Buffer + Index + 1, Characters - Index - 1);
+        return true;
+    }
+
+    // Returns the next token between delimiters starting from '*Position' (0 for the first call),
+    // empty tokens are skipped, returns false when there are no more tokens:
+    bool NextToken(TChar Delimiter, IN OUT size_t* Position, OUT StringView* Token) const {
+        size_t Begin = *Position;
+        while (Begin < Characters && Buffer[Begin] == Delimiter) ++Begin;
+        if (Begin >= Characters) {
+            *Position = Characters;
+            return false;
+        }
+        size_t End = Pos(Delimiter, Begin);
+        if (End == NoPos) End = Characters;
+        *Token = StringView(Buffer + Begin, End - Begin);
+        *Position = End;
+        return true;
+    }
+
+    // Returns < 0, 0 or > 0 comparing characters as unsigned values:
+    int Compare(StringView Str) const {
+        size_t Count = Characters < Str.Characters ? Characters : Str.Characters;
+        for (size_t Index = 0; Index < Count; ++Index) {
+            if (Buffer[Index] == Str.Buffer[Index]) continue;
+            using Unsigned = typename StringCase::Lanes<TChar>::Unsigned;
+            return static_cast<Unsigned>(Buffer[Index]) < static_cast<Unsigned>(Str.Buffer[Index]) ? -1 : 1;
+        }
+        return Characters == Str.Characters ? 0 : (Characters < Str.Characters ? -1 : 1);
+    }
+
+    int CompareInsensitive(StringView Str) const {
+        size_t Count = Characters < Str.Characters ? Characters : Str.Characters;
+        int Result = StringCase::Compare(Buffer, Str.Buffer, Count);
+        if (Result) return Result;
+        return Characters == Str.Characters ? 0 : (Characters < Str.Characters ? -1 : 1);
+    }
+
+    bool IsEqual(StringView Str, bool CaseInsensitive = false) const {
+        if (Characters != Str.Characters) return false;
+        return CaseInsensitive
+            ? !StringCase::Compare(Buffer, Str.Buffer, Characters)
+            : StringSearch::IsEqual(Buffer, Str.Buffer, Characters);
+    }
+
+    bool StartsWith(StringView Prefix, bool CaseInsensitive = false) const {
+        return Prefix.Characters <= Characters && Substr(0, Prefix.Characters).IsEqual(Prefix, CaseInsensitive);
+    }
+
+    bool EndsWith(StringView Suffix, bool CaseInsensitive = false) const {
+        return Suffix.Characters <= Characters && Substr(Characters - Suffix.Characters).IsEqual(Suffix, CaseInsensitive);
+    }
+
+    UINT64 GetHash(bool CaseInsensitive = false) const {
+        return StringCase::Hash(Buffer, Characters, CaseInsensitive);
+    }
+
+    bool operator == (StringView Str) const {
+        return IsEqual(Str);
+    }
+
+    bool operator != (StringView Str) const {
+        return !IsEqual(Str);
+    }
+};
+
+// Memory of strings is provided by the allocator policy (see StringAllocators.h),
+// the default one is the pool with 64-byte granularity.
+// Strings shorter than 'SsoSize' characters are kept inside of the object, the default is the size
+// of the heap descriptor (3 pointers: 23 CHARs or 11 WCHARs on x64), larger values make the object larger:
+template<typename TChar, typename TAllocator = StringPoolAllocator<>, size_t SsoSize = 3 * sizeof(PVOID) / sizeof(TChar)> class String;
+
+// Routines that depend on the character type, String dispatches to them by overloading:
+namespace StringConversion {
+    inline size_t Length(const CHAR* Str) {
+        if (!Str) return 0;
+        return strlen(Str);
+    }
+
+    inline size_t Length(const WCHAR* Str) {
+        if (!Str) return 0;
+#ifdef _MSC_VER
+        return wcslen(Str);
+#else
+        // wcslen of other compilers works with 4-byte wchar_t:
+        size_t StrLength = 0;
+        while (Str[StrLength]) ++StrLength;
+        return StrLength;
+#endif
+    }
+
+    inline VOID ToLowerCase(IN OUT CHAR* Buffer) {
+        UNICODE_STRING UnicodeString;
+        ANSI_STRING AnsiString;
+        RtlInitAnsiString(&AnsiString, Buffer);
+        RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
+        RtlDowncaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
+        RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, FALSE);
+        RtlFreeUnicodeString(&UnicodeString);
+    }
+
+    inline VOID ToUpperCase(IN OUT CHAR* Buffer) {
+        UNICODE_STRING UnicodeString;
+        ANSI_STRING AnsiString;
+        RtlInitAnsiString(&AnsiString, Buffer);
+        RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
+        RtlUpcaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
+        RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, FALSE);
+        RtlFreeUnicodeString(&UnicodeString);
+    }
+
+    inline VOID ToLowerCase(IN OUT WCHAR* Buffer) {
+        UNICODE_STRING UnicodeString;
+        RtlInitUnicodeString(&UnicodeString, Buffer);
+        RtlDowncaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
+    }
+
+    inline VOID ToUpperCase(IN OUT WCHAR* Buffer) {
+        UNICODE_STRING UnicodeString;
+        RtlInitUnicodeString(&UnicodeString, Buffer);
+        RtlUpcaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
+    }
+
+    inline String<CHAR> ToAnsi(StringView<CHAR> Str);
+    inline String<CHAR> ToAnsi(StringView<WCHAR> Str);
+    inline String<WCHAR> ToWide(StringView<CHAR> Str);
+    inline String<WCHAR> ToWide(StringView<WCHAR> Str);
+}
+
+template<typename TChar, typename TAllocator, size_t SsoSize> class String : private TAllocator {
+private:
+    static constexpr TChar NullChar = 0;
+
+    // Descriptor of a heap buffer:
     using STRING_INFO = struct {
         TChar* Buffer;
         size_t Length; // Symbols count without null-terminator
         size_t BufferSize; // Buffer size in bytes
-        BOOLEAN SsoUsing;
     };
 
-    STRING_INFO Data;
+    // Small string optimization (small strings are kept inside of the object):
+    // the inline buffer overlaps the heap descriptor and takes at least as much space as it does.
+    // In the inline mode the last character keeps the unused capacity, so it is 0 (the null-terminator)
+    // when the buffer is full. In the heap mode the high bit of the last byte is set,
+    // it is the high bit of BufferSize if the buffer isn't larger than the descriptor:
+    static constexpr size_t SSO_BYTES = SsoSize * sizeof(TChar) > sizeof(STRING_INFO) ? SsoSize * sizeof(TChar) : sizeof(STRING_INFO);
+    static constexpr size_t SSO_CHARS = (SSO_BYTES + alignof(STRING_INFO) - 1) / alignof(STRING_INFO) * alignof(STRING_INFO) / sizeof(TChar);
+    static_assert(SSO_CHARS <= 128, "The unused capacity must fit into 7 bits");
+    static constexpr UCHAR HeapFlag = 0x80;
+    static constexpr size_t BufferSizeMask = static_cast<size_t>(~static_cast<size_t>(0)) >> 1;
+
+    union {
+        STRING_INFO Heap;
+        TChar Sso[SSO_CHARS];
+    } Data;
+    static_assert(sizeof(Data) == SSO_CHARS * sizeof(TChar), "The last character must be the last byte of the storage");
+
+    inline UCHAR GetTag() const {
+        return reinterpret_cast<const UCHAR*>(&Data)[sizeof(Data) - 1];
+    }
 
-    static inline VOID SetupSso(OUT STRING_INFO* StringInfo, const TChar* SsoBuffer) {
-        StringInfo->Buffer = const_cast<TChar*>(SsoBuffer);
-        StringInfo->Length = 0;
-        StringInfo->BufferSize = SSO_SIZE * sizeof(TChar);
-        StringInfo->SsoUsing = TRUE;
-        StringInfo->Buffer[0] = NullChar;
-        StringInfo->Buffer[SSO_SIZE - 1] = NullChar;
+    inline bool IsSso() const {
+        return !(GetTag() & HeapFlag);
     }
 
-    static inline TChar* StrAllocMem(size_t Bytes) {
-#ifdef _NTDDK_
-#ifdef POOL_NX_OPTIN
-        return static_cast<TChar*>(ExAllocatePoolWithTag(ExDefaultNonPagedPoolType, Bytes, StrPoolTag));
-#else
-        return static_cast<TChar*>(ExAllocatePoolWithTag(NonPagedPool, Bytes, StrPoolTag));
-#endif
-#else
-        return reinterpret_cast<TChar*>(new BYTE[Bytes]);
-#endif
+    inline VOID SetupSso() {
+        Data.Sso[0] = NullChar;
+        Data.Sso[SSO_CHARS - 1] = static_cast<TChar>(SSO_CHARS - 1);
     }
 
-    static inline VOID StrFreeMem(TChar* Memory) {
-#ifdef _NTDDK_
-        ExFreePoolWithTag(Memory, StrPoolTag);
-#else
-        delete[] Memory;
-#endif
+    // Takes the buffer, the previous one must be already freed:
+    inline VOID SetupHeap(const IN STRING_INFO* StringInfo) {
+        Data.Heap = *StringInfo;
+        reinterpret_cast<UCHAR*>(&Data)[sizeof(Data) - 1] |= HeapFlag;
+    }
+
+    inline STRING_INFO GetHeap() const {
+        STRING_INFO StringInfo = Data.Heap;
+        StringInfo.BufferSize &= BufferSizeMask;
+        return StringInfo;
+    }
+
+    inline TChar* GetBuffer() {
+        return IsSso() ? Data.Sso : Data.Heap.Buffer;
+    }
+
+    inline const TChar* GetBuffer() const {
+        return IsSso() ? Data.Sso : Data.Heap.Buffer;
+    }
+
+    inline size_t GetBufferSize() const {
+        return IsSso() ? sizeof(Data.Sso) : (Data.Heap.BufferSize & BufferSizeMask);
+    }
+
+    // Doesn't write the null-terminator:
+    inline VOID SetLength(size_t Characters) {
+        if (IsSso()) Data.Sso[SSO_CHARS - 1] = static_cast<TChar>(SSO_CHARS - 1 - Characters);
+        else Data.Heap.Length = Characters;
+    }
+
+    inline TAllocator& Allocator() {
+        return *this;
     }
 
-    static bool Alloc(OUT STRING_INFO* StringInfo, size_t Characters) {
+    // 'CurrentSize' is the size of the buffer that is growing (0 for new buffers):
+    static bool Alloc(TAllocator& Owner, OUT STRING_INFO* StringInfo, size_t Characters, size_t CurrentSize = 0) {
         if (!StringInfo || !Characters) return false;
         *StringInfo = {};
         size_t Size = (Characters + 1) * sizeof(TChar); // Null-terminated buffer
-        Size = ((Size / AllocationGranularity) + 1) * AllocationGranularity;
-        TChar* Buffer = StrAllocMem(Size);
+        Size = Owner.GetBufferSize(Size, CurrentSize);
+        TChar* Buffer = static_cast<TChar*>(Owner.Allocate(Size));
         if (!Buffer) return false;
         Buffer[0] = NullChar;
         Buffer[Characters] = NullChar;
         StringInfo->Buffer = Buffer;
         StringInfo->Length = Characters;
         StringInfo->BufferSize = Size;
-        StringInfo->SsoUsing = FALSE;
         return true;
     }
 
-    static VOID Free(IN OUT STRING_INFO* StringInfo) {
-        if (StringInfo && StringInfo->Buffer && !StringInfo->SsoUsing) {
-            StrFreeMem(StringInfo->Buffer);
+    bool Alloc(OUT STRING_INFO* StringInfo, size_t Characters, size_t CurrentSize = 0) {
+        return Alloc(Allocator(), StringInfo, Characters, CurrentSize);
+    }
+
+    VOID Free(IN OUT STRING_INFO* StringInfo) {
+        if (StringInfo && StringInfo->Buffer) {
+            Allocator().Free(StringInfo->Buffer, StringInfo->BufferSize);
+        }
+    }
+
+    // Frees the heap buffer and switches to the empty inline one:
+    VOID Free() {
+        if (!IsSso()) {
+            STRING_INFO Heap = GetHeap();
+            Free(&Heap);
         }
+        SetupSso();
+    }
+
+    // Replaces the current buffer by the allocated one:
+    VOID Assign(const IN STRING_INFO* StringInfo) {
+        Free();
+        SetupHeap(StringInfo);
+    }
+
+    // Moves the heap string of less than SSO_CHARS characters into the inline buffer:
+    VOID MoveToSso() {
+        STRING_INFO Heap = GetHeap();
+        // Overwrites the descriptor, the last character (and the flag) is written explicitly:
+        RtlCopyMemory(Data.Sso, Heap.Buffer, Heap.Length * sizeof(TChar));
+        Data.Sso[Heap.Length] = NullChar;
+        Data.Sso[SSO_CHARS - 1] = static_cast<TChar>(SSO_CHARS - 1 - Heap.Length);
+        Free(&Heap);
     }
 
     static VOID Copy(OUT TChar* Dest, const IN TChar* Src, size_t Characters, bool Terminate = true) {
@@ -117,66 +747,73 @@ private:
 
     bool Concat(const IN TChar* Str, size_t StrLength) {
         if (!StrLength) return true;
-        Resize(Data.Length + StrLength);
-        Copy(&Data.Buffer[Data.Length - StrLength], Str, StrLength);
+        size_t OldLength = GetLength();
+        Resize(OldLength + StrLength);
+        if (GetLength() != OldLength + StrLength) return false;
+        Copy(&GetBuffer()[OldLength], Str, StrLength);
         return true;
     }
 
-    bool Concat(const IN STRING_INFO* StringInfo) {
-        return Concat(StringInfo->Buffer, StringInfo->Length);
+    bool IsInside(StringView<TChar> View) const {
+        return View.GetLength() && View.GetData() >= GetBuffer() && View.GetData() < GetBuffer() + GetLength();
     }
 
-    String(const IN STRING_INFO* StringInfo) : String() {
-        if (StringInfo->SsoUsing) {
-            Copy(SsoBuffer, StringInfo->Buffer, StringInfo->Length);
-            SetupSso(&Data, SsoBuffer);
-            Data.Length = StringInfo->Length;
-        } else {
-            Data = *StringInfo;
-            // Check whether we can use SSO:
-            if (Data.Length < SSO_SIZE) {
-                SetupSso(&Data, SsoBuffer);
-                Data.Length = StringInfo->Length;
-                Copy(SsoBuffer, StringInfo->Buffer, Data.Length);
-            }
+    // Nothing points into the object, so the buffer is taken by copying of the storage,
+    // the current buffer must be already freed and the allocators must be equal:
+    VOID Take(IN OUT String& Str) {
+        Data = Str.Data;
+        Str.SetupSso();
+    }
+
+    // Takes the buffer that was allocated by 'Owner':
+    String(const IN STRING_INFO* StringInfo, const TAllocator& Owner) : String(Owner) {
+        SetupHeap(StringInfo);
+        // Check whether we can use SSO:
+        if (StringInfo->Length < SSO_CHARS) MoveToSso();
+    }
+
+    // Prepares the buffer of the empty string, returns NULL if there is no memory:
+    TChar* Initialize(size_t Characters) {
+        if (Characters >= SSO_CHARS) {
+            STRING_INFO StringInfo = {};
+            if (!Alloc(&StringInfo, Characters)) return NULL;
+            SetupHeap(&StringInfo);
+            return StringInfo.Buffer;
         }
-        
+        SetLength(Characters);
+        return Data.Sso;
     }
 
 public:
 
 #ifdef _NTDDK_
-    static constexpr ULONG StrPoolTag = 'RTS_';
+    static constexpr ULONG StrPoolTag = StringPoolTag;
 #endif
 
     String() {
-        SetupSso(&Data, SsoBuffer);
+        SetupSso();
     };
+    explicit String(const TAllocator& Allocator) : TAllocator(Allocator) {
+        SetupSso();
+    }
     ~String() {
-        Free(&Data);
+        Free();
     }
     String(const TChar* Str) : String(Str, Length(Str)) {
     }
     String(const TChar* Str, size_t StrLength) : String() {
-        if (StrLength < SSO_SIZE || Alloc(&Data, StrLength))
-            Copy(Data.Buffer, Str, StrLength);
-
-        Data.Length = StrLength;
+        Copy(Initialize(StrLength), Str, StrLength);
     }
-    String(const String& Str) : String() {
-        if (Str.Data.Length < SSO_SIZE || Alloc(&Data, Str.Data.Length))
-            Copy(Data.Buffer, Str.Data.Buffer, Str.Data.Length);
-
-        Data.Length = Str.Data.Length;
+    String(StringView<TChar> View) : String(View.GetData(), View.GetLength()) {
     }
-    String(String&& Str) : String() {
-        if (Str.Data.SsoUsing || Str.Data.Length < SSO_SIZE) {
-            Copy(Data.Buffer, Str.Data.Buffer, Str.Data.Length);
-        } else {
-            Data = Str.Data;    
-        }
-        Data.Length = Str.Data.Length;
-        Str.Data = {};
+    String(StringView<TChar> View, const TAllocator& Allocator) : String(Allocator) {
+        Copy(Initialize(View.GetLength()), View.GetData(), View.GetLength());
+    }
+    String(const String& Str) : String(Str.GetAllocator()) {
+        Copy(Initialize(Str.GetLength()), Str.GetBuffer(), Str.GetLength());
+    }
+    String(String&& Str) : String(Str.GetAllocator()) {
+        Take(Str);
     }
 
     String operator + (const TChar* Str) {
@@ -185,45 +822,45 @@ public:
         size_t StrLength = Length(Str);
         if (!StrLength) return *this;
 
-        size_t SummaryLength = Data.Length + StrLength;
+        size_t SummaryLength = GetLength() + StrLength;
 
         STRING_INFO StringInfo = {};
         if (!Alloc(&StringInfo, SummaryLength)) 
             return *this;
 
-        CopyCat(StringInfo.Buffer, Data.Buffer, Data.Length, Str, StrLength);
+        CopyCat(StringInfo.Buffer, GetBuffer(), GetLength(), Str, StrLength);
         StringInfo.Length = SummaryLength;
 
-        return String(&StringInfo);
+        return String(&StringInfo, Allocator());
     }
     String operator + (String&& Str) {
         size_t StrLength = Str.GetLength();
         if (!StrLength) return *this;
 
-        size_t SummaryLength = Data.Length + Str.Data.Length;
+        size_t SummaryLength = GetLength() + Str.GetLength();
 
         STRING_INFO StringInfo = {};
         if (!Alloc(&StringInfo, SummaryLength)) 
             return *this;
 
-        CopyCat(StringInfo.Buffer, Data.Buffer, Data.Length, Str.GetConstData(), StrLength);
+        CopyCat(StringInfo.Buffer, GetBuffer(), GetLength(), Str.GetConstData(), StrLength);
         StringInfo.Length = SummaryLength;
 
-        return String(&StringInfo);         
+        return String(&StringInfo, Allocator());         
     }
     String operator + (const String& Str) {
-        if (!Str.Data.Length) return *this;
+        if (!Str.GetLength()) return *this;
 
-        size_t SummaryLength = Data.Length + Str.Data.Length;
+        size_t SummaryLength = GetLength() + Str.GetLength();
 
         STRING_INFO StringInfo = {};
         if (!Alloc(&StringInfo, SummaryLength)) 
             return *this;
 
-        CopyCat(StringInfo.Buffer, Data.Buffer, Data.Length, Str.Data.Buffer, Str.Data.Length);
+        CopyCat(StringInfo.Buffer, GetBuffer(), GetLength(), Str.GetBuffer(), Str.GetLength());
         StringInfo.Length = SummaryLength;
 
-        return String(&StringInfo);        
+        return String(&StringInfo, Allocator());        
     }
     friend String operator + (const TChar* Left, const String& Right) {
         if (!Left) return Right;
@@ -233,14 +870,15 @@ public:
 
         size_t SummaryLength = Right.GetLength() + LeftLength;
 
+        TAllocator Owner(Right.GetAllocator());
         STRING_INFO StringInfo = {};
-        if (!Alloc(&StringInfo, SummaryLength)) 
-            return String(Left);
+        if (!Alloc(Owner, &StringInfo, SummaryLength)) 
+            return String(StringView<TChar>(Left, LeftLength), Owner);
 
         CopyCat(StringInfo.Buffer, Left, LeftLength, Right.GetConstData(), Right.GetLength());
         StringInfo.Length = SummaryLength;
 
-        return String(&StringInfo);  
+        return String(&StringInfo, Owner);
     }
 
     String& operator += (const TChar* Str) {
@@ -249,96 +887,131 @@ public:
     }
 
     String& operator += (String&& Str) {
-        Concat(&Str.Data);
-        return *this;
+        return *this += Str.GetView();
     }
 
     String& operator += (const String& Str) {
-        Concat(&Str.Data);
+        return *this += Str.GetView();
+    }
+
+    String& operator += (StringView<TChar> View) {
+        if (IsInside(View)) {
+            String Copied(View); // Concat may reallocate the viewed buffer
+            Concat(Copied.GetBuffer(), Copied.GetLength());
+        } else {
+            Concat(View.GetData(), View.GetLength());
+        }
         return *this;
     }
 
     String& operator = (const TChar* Str) {
         size_t StrLength = Length(Str);
         Resize(StrLength);
-        Copy(Data.Buffer, Str, StrLength);
+        Copy(GetBuffer(), Str, StrLength);
         return *this;
     }
     String& operator = (const String& Str) {
-        Resize(Str.Data.Length);
-        Copy(Data.Buffer, Str.Data.Buffer, Str.Data.Length);
+        if (&Str == this) return *this;
+        Resize(Str.GetLength());
+        Copy(GetBuffer(), Str.GetBuffer(), Str.GetLength());
         return *this;
     }
-    String& operator = (String&& Str) {
-        Free(&Data);
-        SetupSso(&Data, SsoBuffer);
-        if (Str.Data.SsoUsing || Str.Data.Length < SSO_SIZE) {
-            Copy(Data.Buffer, Str.Data.Buffer, Str.Data.Length);
-        } else {
-            Data = Str.Data;
+    String& operator = (StringView<TChar> View) {
+        if (IsInside(View)) {
+            // The view of a part of this string, it can only shrink:
+            RtlMoveMemory(GetBuffer(), View.GetData(), View.GetLength() * sizeof(TChar));
+            Resize(View.GetLength());
+            return *this;
         }
-        Data.Length = Str.Data.Length;
-        Str.Data = {};
+        Resize(View.GetLength());
+        Copy(GetBuffer(), View.GetData(), View.GetLength());
+        return *this;
+    }
+    String& operator = (String&& Str) {
+        // The buffer can't be taken if it is owned by another arena or lookaside:
+        if (Allocator() != Str.Allocator()) return *this = static_cast<const String&>(Str);
+        if (&Str == this) return *this;
+        Free();
+        Take(Str);
         return *this;
     }
 
     bool operator == (const TChar* Str) {
-        if (Data.Buffer == Str) return true;
+        if (GetBuffer() == Str) return true;
         size_t StrLength = Length(Str);
-        if (Data.Length != StrLength) return false;
-        return RtlCompareMemory(Data.Buffer, Str, StrLength) == StrLength;
+        if (GetLength() != StrLength) return false;
+        return RtlCompareMemory(GetBuffer(), Str, StrLength) == StrLength;
     }
     bool operator == (const String& String) {
-        if (Data.Buffer == String.Data.Buffer) return true;
-        if (Data.Length != String.Data.Length) return false;
-        return RtlCompareMemory(Data.Buffer, String.Data.Buffer, Data.Length) == Data.Length;
+        if (GetBuffer() == String.GetBuffer()) return true;
+        if (GetLength() != String.GetLength()) return false;
+        return RtlCompareMemory(GetBuffer(), String.GetBuffer(), GetLength()) == GetLength();
     }
 
     bool operator != (const TChar* Str) {
-        if (Data.Buffer == Str) return false;
+        if (GetBuffer() == Str) return false;
         size_t StrLength = Length(Str);
-        if (Data.Length != StrLength) return true;
-        return RtlCompareMemory(Data.Buffer, Str, StrLength) != StrLength;
+        if (GetLength() != StrLength) return true;
+        return RtlCompareMemory(GetBuffer(), Str, StrLength) != StrLength;
     }
     bool operator != (const String& String) {
-        if (Data.Buffer == String.Data.Buffer) return false;
-        if (Data.Length != String.Data.Length) return true;
-        return RtlCompareMemory(Data.Buffer, String.Data.Buffer, Data.Length) != Data.Length;
+        if (GetBuffer() == String.GetBuffer()) return false;
+        if (GetLength() != String.GetLength()) return true;
+        return RtlCompareMemory(GetBuffer(), String.GetBuffer(), GetLength()) != GetLength();
     }
 
     inline operator const TChar* () const {
-        return Data.Buffer;
+        return GetBuffer();
     }
 
     inline operator TChar* () {
-        return Data.Buffer;
+        return GetBuffer();
+    }
+
+    inline operator StringView<TChar> () const {
+        return StringView<TChar>(GetBuffer(), GetLength());
+    }
+
+    inline StringView<TChar> GetView() const {
+        return StringView<TChar>(GetBuffer(), GetLength());
     }
 
     inline TChar& operator [] (int Index) {
-        return Data.Buffer[Index];
+        return GetBuffer()[Index];
     }
 
     inline TChar operator [] (int Index) const {
-        return Data.Buffer[Index];
+        return GetBuffer()[Index];
     }
 
-    static inline size_t Length(const TChar* String);
+    static inline size_t Length(const TChar* Str) {
+        return StringConversion::Length(Str);
+    }
 
-    inline size_t GetLength() const { return Data.Length; };
-    inline size_t GetSize() const { return Data.BufferSize; }
-    inline const TChar* GetConstData() const { return Data.Buffer ? Data.Buffer : &NullChar; }
-    inline TChar* GetData() { return Data.Buffer ? Data.Buffer : NULL; };
+    inline size_t GetLength() const {
+        return IsSso() ? SSO_CHARS - 1 - static_cast<size_t>(Data.Sso[SSO_CHARS - 1]) : Data.Heap.Length;
+    };
+    inline const TAllocator& GetAllocator() const { return *this; }
+    inline size_t GetSize() const { return GetBufferSize(); }
+    inline const TChar* GetConstData() const { return GetBuffer(); }
+    inline TChar* GetData() { return GetBuffer(); };
 
     VOID Clear() {
-        Free(&Data);
-        SetupSso(&Data, SsoBuffer);
+        Free();
     }
 
     String<CHAR> GetAnsi() const;
     String<WCHAR> GetWide() const;
 
-    String& ToLowerCase();
-    String& ToUpperCase();
+    String& ToLowerCase() {
+        StringConversion::ToLowerCase(GetBuffer());
+        return *this;
+    }
+
+    String& ToUpperCase() {
+        StringConversion::ToUpperCase(GetBuffer());
+        return *this;
+    }
 
     String GetLowerCase() const {
         String Str(*this);
@@ -351,6 +1024,37 @@ public:
         return Str;
     }
 
+    // Case-insensitive comparison without copies (unlike GetLowerCase() == ...),
+    // returns < 0, 0 or > 0 as RtlCompareUnicodeString:
+    static int CompareInsensitive(const TChar* First, size_t FirstLength, const TChar* Second, size_t SecondLength) {
+        int Result = StringCase::Compare(First, Second, FirstLength < SecondLength ? FirstLength : SecondLength);
+        if (Result) return Result;
+        return FirstLength == SecondLength ? 0 : (FirstLength < SecondLength ? -1 : 1);
+    }
+    int CompareInsensitive(StringView<TChar> Str) const {
+        return GetView().CompareInsensitive(Str);
+    }
+
+    bool IsEqualInsensitive(StringView<TChar> Str) const {
+        return GetView().IsEqual(Str, true);
+    }
+
+    bool StartsWith(StringView<TChar> Prefix, bool CaseInsensitive = false) const {
+        return GetView().StartsWith(Prefix, CaseInsensitive);
+    }
+
+    bool EndsWith(StringView<TChar> Suffix, bool CaseInsensitive = false) const {
+        return GetView().EndsWith(Suffix, CaseInsensitive);
+    }
+
+    // Stable 64-bit hash, case-insensitive hashes are equal for strings that are IsEqualInsensitive:
+    static UINT64 GetHash(const TChar* Str, size_t StrLength, bool CaseInsensitive = false) {
+        return StringCase::Hash(Str, StrLength, CaseInsensitive);
+    }
+    UINT64 GetHash(bool CaseInsensitive = false) const {
+        return StringCase::Hash(GetBuffer(), GetLength(), CaseInsensitive);
+    }
+
     static bool Matches(const TChar* Str, const TChar* Mask) {
         /* 
             Dr.Dobb's Algorithm:
@@ -413,15 +1117,22 @@ public:
     }
 
     bool Matches(const TChar* Mask) {
-        return Matches(Data.Buffer, Mask);
+        return Matches(GetBuffer(), Mask);
     }
 
-    static inline const TChar* Find(const TChar* Str, const TChar* Substr, size_t Offset = 0);
-    inline const TChar* Find(const TChar* Substring, size_t Offset = 0) const {
-        if (Offset > Data.Length) return nullptr;
-        return Find(Data.Buffer, Substring, Offset);
+    static inline const TChar* Find(const TChar* Str, StringView<TChar> Substr, size_t Offset = 0) {
+        if (!Str || !Substr.GetData()) return nullptr;
+        size_t StrLength = Length(Str);
+        if (Offset > StrLength) return nullptr;
+        size_t Index = StringSearch::FindSubstring(Str + Offset, StrLength - Offset, Substr.GetData(), Substr.GetLength());
+        return Index != StringSearch::NoIndex ? Str + Offset + Index : nullptr;
+    }
+    inline const TChar* Find(StringView<TChar> Substring, size_t Offset = 0) const {
+        if (Offset > GetLength() || !Substring.GetData()) return nullptr;
+        size_t Index = StringSearch::FindSubstring(GetBuffer() + Offset, GetLength() - Offset, Substring.GetData(), Substring.GetLength());
+        return Index != StringSearch::NoIndex ? GetBuffer() + Offset + Index : nullptr;
     }
-    inline bool Contains(const TChar* Substring, size_t Offset = 0) const {
+    inline bool Contains(StringView<TChar> Substring, size_t Offset = 0) const {
         return Find(Substring, Offset) != nullptr;
     }
 
@@ -431,22 +1142,24 @@ public:
     static constexpr size_t NoPos = ~0UL;
 #endif
 
-    inline size_t Pos(const TChar* Substring, size_t Offset = 0, bool GetRelativePos = false) const {
+    inline size_t Pos(StringView<TChar> Substring, size_t Offset = 0, bool GetRelativePos = false) const {
         const TChar* SubstrAddr = Find(Substring, Offset);
         if (!SubstrAddr) return NoPos;
-        size_t AbsPos = (reinterpret_cast<size_t>(SubstrAddr) - reinterpret_cast<size_t>(Data.Buffer)) / sizeof(TChar);
+        size_t AbsPos = (reinterpret_cast<size_t>(SubstrAddr) - reinterpret_cast<size_t>(GetBuffer())) / sizeof(TChar);
         return GetRelativePos ? AbsPos - Offset : AbsPos;
     }
 
     String& Delete(size_t Position, size_t Count, bool AutoShrink = false) {
-        if (Position >= Data.Length) return *this;
-        if (Position + Count >= Data.Length) {
-            Data.Buffer[Position] = NullChar;
-            Data.Length = Position;
+        size_t StrLength = GetLength();
+        if (Position >= StrLength) return *this;
+        TChar* Buffer = GetBuffer();
+        if (Position + Count >= StrLength) {
+            Buffer[Position] = NullChar;
+            SetLength(Position);
         } else {
-            Copy(&Data.Buffer[Position], &Data.Buffer[Position + Count], Data.Length - (Position + Count));
-            Data.Length -= Count;
-            Data.Buffer[Data.Length] = NullChar;
+            RtlMoveMemory(&Buffer[Position], &Buffer[Position + Count], (StrLength - (Position + Count)) * sizeof(TChar));
+            Buffer[StrLength - Count] = NullChar;
+            SetLength(StrLength - Count);
         }
 
         if (AutoShrink) Shrink();
@@ -458,97 +1171,95 @@ public:
         return Insert(Position, Insertion, Length(Insertion));
     }
 
+    String& Insert(size_t Position, StringView<TChar> Insertion) {
+        if (IsInside(Insertion)) return Insert(Position, String(Insertion));
+        return Insert(Position, Insertion.GetData(), Insertion.GetLength());
+    }
+
     String& Insert(size_t Position, const String& Insertion) {
-        return Insert(Position, Insertion.Data.Buffer, Insertion.Data.Length);
+        return Insert(Position, Insertion.GetView());
     }
 
     String& Insert(size_t Position, const String&& Insertion) {
-        return Insert(Position, Insertion.Data.Buffer, Insertion.Data.Length);
+        return Insert(Position, Insertion.GetView());
     }
 
     String& Insert(size_t Position, const TChar* Insertion, size_t CharactersCount) {
         if (!CharactersCount) return *this;
-        size_t SummaryLength = Data.Length + CharactersCount;
+        size_t StrLength = GetLength();
+        TChar* Buffer = GetBuffer();
+        size_t SummaryLength = StrLength + CharactersCount;
         size_t RequiredSize = (SummaryLength + 1) * sizeof(TChar);
-        if (RequiredSize > Data.BufferSize) {
+        if (RequiredSize > GetBufferSize()) {
             STRING_INFO StringInfo = {};
-            if (Alloc(&StringInfo, SummaryLength)) {
-                Copy(StringInfo.Buffer, Data.Buffer, Position);
-                Copy(&StringInfo.Buffer[Position], Insertion, CharactersCount);
-                Copy(&StringInfo.Buffer[Position + CharactersCount], &Data.Buffer[Position], Data.Length - Position);
-                Free(&Data);
-                Data = StringInfo;
-            }
-        } else {
-            Copy(&Data.Buffer[Position + CharactersCount], &Data.Buffer[Position], Data.Length - Position);
-            Copy(&Data.Buffer[Position], Insertion, CharactersCount, false);
+            if (!Alloc(&StringInfo, SummaryLength, GetBufferSize())) return *this;
+            Copy(StringInfo.Buffer, Buffer, Position);
+            Copy(&StringInfo.Buffer[Position], Insertion, CharactersCount);
+            Copy(&StringInfo.Buffer[Position + CharactersCount], &Buffer[Position], StrLength - Position);
+            Assign(&StringInfo);
+            return *this;
         }
-        Data.Length += CharactersCount;
+        // Ranges are overlapped:
+        RtlMoveMemory(&Buffer[Position + CharactersCount], &Buffer[Position], (StrLength - Position) * sizeof(TChar));
+        Copy(&Buffer[Position], Insertion, CharactersCount, false);
+        Buffer[SummaryLength] = NullChar;
+        SetLength(SummaryLength);
         return *this;
     } 
 
     String Substr(size_t Position, size_t CharactersCount = 0) const {
-        if (!Data.Length || Position > Data.Length) return String();
+        if (!GetLength() || Position > GetLength()) return String();
         if (CharactersCount) {
-            if (Position + CharactersCount > Data.Length) CharactersCount = Data.Length - Position;
-            return String(&Data.Buffer[Position], CharactersCount);
+            if (Position + CharactersCount > GetLength()) CharactersCount = GetLength() - Position;
+            return String(&GetBuffer()[Position], CharactersCount);
         } else {
-            return String(&Data.Buffer[Position]);
+            return String(&GetBuffer()[Position]);
         }
     }
 
     String& TrimLeft(bool AutoShrink = false) {
-        if (!Data.Length) return *this;
+        size_t StrLength = GetLength();
+        if (!StrLength) return *this;
+        TChar* Buffer = GetBuffer();
         size_t Symbol;
-        for (Symbol = 0; Symbol < Data.Length; ++Symbol) {
+        for (Symbol = 0; Symbol < StrLength; ++Symbol) {
             if (
-                Data.Buffer[Symbol] != static_cast<TChar>(' ') &&
-                Data.Buffer[Symbol] != static_cast<TChar>('\t')
+                Buffer[Symbol] != static_cast<TChar>(' ') &&
+                Buffer[Symbol] != static_cast<TChar>('\t')
             ) break;
         }
 
         if (Symbol == 0) return *this;
         
-        size_t TrimmedLength = Data.Length - Symbol;
+        size_t TrimmedLength = StrLength - Symbol;
+        RtlMoveMemory(Buffer, &Buffer[Symbol], TrimmedLength * sizeof(TChar));
+        Buffer[TrimmedLength] = NullChar;
+        SetLength(TrimmedLength);
 
-        if (!Data.SsoUsing && TrimmedLength < SSO_SIZE) {
-            STRING_INFO StringInfo = {};
-            SetupSso(&StringInfo, SsoBuffer);
-            Copy(StringInfo.Buffer, &Data.Buffer[Symbol], TrimmedLength);
-            StringInfo.Length = TrimmedLength;
-            Free(&Data);
-            Data = StringInfo;
+        if (!IsSso() && TrimmedLength < SSO_CHARS) {
+            MoveToSso();
             return *this;
         }
 
-        Copy(Data.Buffer, &Data.Buffer[Symbol], TrimmedLength);
-        Data.Length = TrimmedLength;
-
         if (AutoShrink) Shrink();
         return *this;
     }
 
     String& TrimRight(bool AutoShrink = false) {
-        if (!Data.Length) return *this;
-        size_t Symbol;
-        for (Symbol = Data.Length - 1; Symbol >= 0; --Symbol) {
-            if (
-                Data.Buffer[Symbol] != static_cast<TChar>(' ') &&
-                Data.Buffer[Symbol] != static_cast<TChar>('\t')
-            ) break;
+        size_t StrLength = GetLength();
+        if (!StrLength) return *this;
+        TChar* Buffer = GetBuffer();
+        size_t Symbol = StrLength;
+        while (Symbol && (Buffer[Symbol - 1] == static_cast<TChar>(' ') || Buffer[Symbol - 1] == static_cast<TChar>('\t'))) {
+            --Symbol;
         }
 
-        ++Symbol; // Set it to points to null-terminator
-        Data.Buffer[Symbol] = NullChar;
-        Data.Length = Symbol;
+        // Symbol points to the null-terminator now:
+        Buffer[Symbol] = NullChar;
+        SetLength(Symbol);
 
-        if (!Data.SsoUsing && Data.Length < SSO_SIZE) {
-            STRING_INFO StringInfo = {};
-            SetupSso(&StringInfo, SsoBuffer);
-            Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-            StringInfo.Length = Data.Length;
-            Free(&Data);
-            Data = StringInfo;
+        if (!IsSso() && Symbol < SSO_CHARS) {
+            MoveToSso();
             return *this;
         }
 
@@ -564,28 +1275,25 @@ public:
     }
 
     void Shrink() {
-        if (Data.SsoUsing) return;
-        size_t RequiredSize = ((((Data.Length + 1) * sizeof(TChar)) / AllocationGranularity) + 1) * AllocationGranularity;
-        if (RequiredSize < Data.BufferSize) {
-            STRING_INFO StringInfo = {};
-            if (Data.Length < SSO_SIZE) {
-                SetupSso(&StringInfo, SsoBuffer);
-                Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-                StringInfo.Length = Data.Length;
-                Free(&Data);
-                Data = StringInfo;
+        if (IsSso()) return;
+        size_t StrLength = GetLength();
+        size_t RequiredSize = Allocator().GetBufferSize((StrLength + 1) * sizeof(TChar), 0);
+        if (RequiredSize < GetBufferSize()) {
+            if (StrLength < SSO_CHARS) {
+                MoveToSso();
             } else {
-                if (Alloc(&StringInfo, Data.Length)) {
-                    Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-                    Free(&Data);
-                    Data = StringInfo;
+                STRING_INFO StringInfo = {};
+                if (Alloc(&StringInfo, StrLength)) {
+                    Copy(StringInfo.Buffer, GetBuffer(), StrLength);
+                    Assign(&StringInfo);
                 }
             }
         }
     }
 
     void Resize(size_t Characters, TChar Filler = 0, bool AutoShrink = false) {
-        if (Characters == Data.Length) {
+        size_t StrLength = GetLength();
+        if (Characters == StrLength) {
             if (AutoShrink) Shrink();
             return;
         }
@@ -594,97 +1302,168 @@ public:
             if (AutoShrink) {
                 Clear();
             } else {
-                Data.Buffer[0] = NullChar;
-                Data.Length = 0;
+                GetBuffer()[0] = NullChar;
+                SetLength(0);
             }
             return;
         }
 
-        if (Characters > Data.Length) {
+        if (Characters > StrLength) {
+            TChar* Buffer = GetBuffer();
             size_t RequiredSize = (Characters + 1) * sizeof(TChar);
-            if (RequiredSize <= Data.BufferSize) {
-                if (Filler == 0)
-                    RtlZeroMemory(&Data.Buffer[Data.Length], (Characters - Data.Length) * sizeof(TChar));
-                else {
-                    for (size_t Index = Data.Length; Index < Characters; ++Index)
-                        Data.Buffer[Index] = Filler;
-                }
-                Data.Buffer[Characters] = NullChar;
-                Data.Length = Characters;
-                return;
-            } 
-
-            STRING_INFO StringInfo = {};            
-            if (Alloc(&StringInfo, Characters)) {
-                Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-                if (Filler == 0)
-                    RtlZeroMemory(&StringInfo.Buffer[Data.Length], (Characters - Data.Length) * sizeof(TChar));
-                else {
-                    for (size_t Index = Data.Length; Index < Characters; ++Index)
-                        StringInfo.Buffer[Index] = Filler;
-                }
-                StringInfo.Buffer[Characters] = NullChar;
-                StringInfo.Length = Characters;
-                Free(&Data);
-                Data = StringInfo;
+            if (RequiredSize > GetBufferSize()) {
+                STRING_INFO StringInfo = {};
+                if (!Alloc(&StringInfo, Characters, GetBufferSize())) return;
+                Copy(StringInfo.Buffer, Buffer, StrLength, false);
+                Assign(&StringInfo);
+                Buffer = StringInfo.Buffer;
             }
-        } else {
-            Data.Buffer[Characters] = NullChar;
-            Data.Length = Characters;
+            if (Filler == 0)
+                RtlZeroMemory(&Buffer[StrLength], (Characters - StrLength) * sizeof(TChar));
+            else {
+                for (size_t Index = StrLength; Index < Characters; ++Index)
+                    Buffer[Index] = Filler;
+            }
+            Buffer[Characters] = NullChar;
+            SetLength(Characters);
+            return;
         }
+
+        GetBuffer()[Characters] = NullChar;
+        SetLength(Characters);
         if (AutoShrink) Shrink();
     }
 
     void Reserve(size_t Characters) {
-        if (Characters == Data.Length) return;
-        if (Characters < Data.Length) {
+        size_t StrLength = GetLength();
+        if (Characters == StrLength) return;
+        if (Characters < StrLength) {
             Resize(Characters);
             return;
         }
+        if ((Characters + 1) * sizeof(TChar) <= GetBufferSize()) return;
         STRING_INFO StringInfo = {};
-        if (Characters < SSO_SIZE) {
-            if (Data.SsoUsing) return;
-            SetupSso(&StringInfo, SsoBuffer);
-            Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-            Free(&Data);
-            Data = StringInfo;
-        } else {
-            if (Alloc(&StringInfo, Characters)) {
-                Copy(StringInfo.Buffer, Data.Buffer, Data.Length);
-                Free(&Data);
-                Data = StringInfo;
-            }
+        if (Alloc(&StringInfo, Characters)) {
+            Copy(StringInfo.Buffer, GetBuffer(), StrLength);
+            StringInfo.Length = StrLength;
+            Assign(&StringInfo);
         }
     }
 
-    String& Replace(
+    // Calls 'Callback(Position)' for every occurrence in Str that Replace replaces:
+    template <typename ReplacementCallback>
+    static unsigned int ScanReplacements(
+        const TChar* Str,
+        size_t StrLength,
         const TChar* Substr,
+        size_t SubstrLength,
         const TChar* Replacer,
-        bool SelectiveReplacement = false, // aXXabXXabc.Replace("a", "abc", true) == abcXXabcbXXabc
-        unsigned int* ReplacementsCount = nullptr
+        size_t ReplacerLength,
+        bool SelectiveReplacement,
+        ReplacementCallback Callback
     ) {
         unsigned int Replaced = 0;
-        size_t SubstrLength = Length(Substr);
-        size_t ReplacerLength = Length(Replacer);
-        
-        size_t Position = Pos(Substr);
-        if (Position == NoPos) return *this;
-        do {
-            if (SelectiveReplacement)
-                if (Pos(Replacer, Position) == Position) continue;
-            Delete(Position, SubstrLength);
-            Insert(Position, Replacer);
+        size_t Position = 0;
+        while (Position <= StrLength) {
+            size_t Index = StringSearch::FindSubstring(Str + Position, StrLength - Position, Substr, SubstrLength);
+            if (Index == StringSearch::NoIndex) break;
+            Position += Index;
+
+            // The replacer is already here, it is skipped as a whole:
+            if (SelectiveReplacement && StrLength - Position >= ReplacerLength && StringSearch::IsEqual(&Str[Position], Replacer, ReplacerLength)) {
+                Position += ReplacerLength ? ReplacerLength : 1;
+                continue;
+            }
+
+            Callback(Position);
             Replaced++;
-        } while ((Position = Pos(Substr, Position + ReplacerLength)) != NoPos);
-    
+            Position += SubstrLength;
+        }
+        return Replaced;
+    }
+
+    String& Replace(
+        StringView<TChar> Substring,
+        StringView<TChar> Replacement,
+        bool SelectiveReplacement = false, // aXXabXXabc.Replace("a", "abc", true) == abcXXabcbXXabc
+        unsigned int* ReplacementsCount = nullptr
+    ) {
+        if (ReplacementsCount) *ReplacementsCount = 0;
+
+        // The string is rewritten in place (and scanned again after more than MaxRemembered
+        // replacements), so views of its own parts are copied first:
+        if (IsInside(Substring)) {
+            String Copied(Substring);
+            return Replace(Copied.GetView(), Replacement, SelectiveReplacement, ReplacementsCount);
+        }
+        if (IsInside(Replacement)) {
+            String Copied(Replacement);
+            return Replace(Substring, Copied.GetView(), SelectiveReplacement, ReplacementsCount);
+        }
+
+        const TChar* Substr = Substring.GetData();
+        size_t SubstrLength = Substring.GetLength();
+        const TChar* Replacer = Replacement.GetData();
+        size_t ReplacerLength = Replacement.GetLength();
+        if (!SubstrLength || !GetLength()) return *this;
+
+        // The first pass counts replacements (and remembers the first of them),
+        // so the result is built without reallocations:
+        constexpr unsigned int MaxRemembered = 16;
+        size_t Positions[MaxRemembered];
+        unsigned int Remembered = 0;
+        unsigned int Replaced = ScanReplacements(GetBuffer(), GetLength(), Substr, SubstrLength, Replacer, ReplacerLength, SelectiveReplacement, [&](size_t Position) {
+            if (Remembered < MaxRemembered) Positions[Remembered++] = Position;
+        });
+        if (!Replaced) return *this;
+
+        size_t ResultLength = GetLength() - Replaced * SubstrLength + Replaced * ReplacerLength;
+
+        // If the result fits into the buffer, the source is moved to its end and the result is built
+        // from the beginning: the written part never overtakes the part that is not scanned yet:
+        size_t StrLength = GetLength();
+        TChar* Buffer = GetBuffer();
+        TChar* Dest = Buffer;
+        const TChar* Source = Buffer;
+        STRING_INFO Result = {};
+        if ((ResultLength + 1) * sizeof(TChar) <= GetBufferSize()) {
+            if (ResultLength > StrLength) {
+                Source = &Buffer[ResultLength - StrLength];
+                RtlMoveMemory(const_cast<TChar*>(Source), Buffer, StrLength * sizeof(TChar));
+            }
+        } else if (Alloc(&Result, ResultLength, GetBufferSize())) {
+            Dest = Result.Buffer;
+        } else {
+            return *this;
+        }
+
+        size_t Scanned = 0;
+        auto Emit = [&](size_t Position) {
+            if (Position != Scanned) RtlMoveMemory(Dest, &Source[Scanned], (Position - Scanned) * sizeof(TChar));
+            Dest += Position - Scanned;
+            Copy(Dest, Replacer, ReplacerLength, false);
+            Dest += ReplacerLength;
+            Scanned = Position + SubstrLength;
+        };
+        if (Replaced == Remembered) {
+            for (unsigned int i = 0; i < Remembered; ++i) Emit(Positions[i]);
+        } else {
+            ScanReplacements(Source, StrLength, Substr, SubstrLength, Replacer, ReplacerLength, SelectiveReplacement, Emit);
+        }
+        if (Scanned != StrLength) RtlMoveMemory(Dest, &Source[Scanned], (StrLength - Scanned) * sizeof(TChar));
+
+        if (Result.Buffer) Assign(&Result);
+        GetBuffer()[ResultLength] = NullChar;
+        SetLength(ResultLength);
+
         if (ReplacementsCount) *ReplacementsCount = Replaced;
         return *this;
     }
 
     VOID CopyTo(TChar* Buffer, size_t Characters) {
-        if (Data.Length < Characters)
-            Characters = Data.Length;
-        RtlCopyMemory(Buffer, Data.Buffer, Characters * sizeof(TChar));
+        if (GetLength() < Characters)
+            Characters = GetLength();
+        RtlCopyMemory(Buffer, GetBuffer(), Characters * sizeof(TChar));
         Buffer[Characters] = 0x0000;
     }
 };
@@ -694,7 +1473,7 @@ public:
     using String::String;
     AnsiString(PCANSI_STRING Ansi) : String(Ansi->Buffer, Ansi->Length / sizeof(CHAR)) {}
     AnsiString(const String& Str) : String(Str) {}
-    AnsiString(String&& Str) : String(Str) {}
+    AnsiString(String&& Str) : String(static_cast<String&&>(Str)) {}
     AnsiString() : String() {}
 };
 
@@ -703,106 +1482,727 @@ public:
     using String::String;
     WideString(PCUNICODE_STRING Wide) : String(Wide->Buffer, Wide->Length / sizeof(WCHAR)) {}
     WideString(const String& Str) : String(Str) {}
-    WideString(String&& Str) : String(Str) {}
+    WideString(String&& Str) : String(static_cast<String&&>(Str)) {}
     WideString() : String() {}
 };
 
-template<>
-static inline size_t String<CHAR>::Length(const CHAR* String) {
-    if (!String) return 0;
-    return strlen(String);
-}
+// The default strings are as large as their heap descriptor (the allocator policy is empty):
+static_assert(sizeof(String<CHAR>) == 3 * sizeof(PVOID), "Unexpected size of String<CHAR>");
+static_assert(sizeof(String<WCHAR>) == 3 * sizeof(PVOID), "Unexpected size of String<WCHAR>");
+static_assert(sizeof(AnsiString) == sizeof(String<CHAR>), "Unexpected size of AnsiString");
+static_assert(sizeof(WideString) == sizeof(String<WCHAR>), "Unexpected size of WideString");
+
+// Gathers pieces and builds the string at once: the length is summed up while appending,
+// so Build makes one allocation (none if the result fits SSO) and BuildTo makes none at all.
+// Pieces aren't copied, so appended strings must live until the build:
+//   StringBuilder<WCHAR> Builder;
+//   Builder.Append(&VolumeName).Append(&FileObject->FileName).Append(L':').AppendHex(Offset, 8);
+//   WideString Path = Builder.Build();
+// Appending of more than 'MaxPieces' pieces fails the builder, Build returns an empty string then.
+// Strings of the other character type are converted while writing as Latin-1 (like the "C" locale of CRT):
+// ASCII is exact, wide characters above 0xFF become '?'.
+template <typename TChar, size_t MaxPieces = 8>
+class StringBuilder final {
+private:
+    using TOther = typename OtherChar<TChar>::Type;
+
+    using PIECE = struct {
+        union {
+            const TChar* Str;
+            const TOther* Converted;
+            TChar Char;
+            UINT64 Number;
+        };
+        ULONG Length; // In characters
+        UCHAR Radix; // 0 for strings, 1 for characters, 2 for strings of the other type
+        bool Negative;
+        bool Lowercase;
+    };
 
-template<>
-static inline size_t String<WCHAR>::Length(const WCHAR* String) {
-    if (!String) return 0;
-    return wcslen(String);
-}
+    PIECE Pieces[MaxPieces];
+    size_t PiecesCount;
+    size_t Characters;
+    bool Failed;
 
-template<>
-String<CHAR> String<CHAR>::GetAnsi() const {
-    return *this;
-}
+    PIECE* AddPiece(size_t Length) {
+        if (Failed || PiecesCount == MaxPieces || Length > MAXULONG) {
+            Failed = true;
+            return NULL;
+        }
+        PIECE* Piece = &Pieces[PiecesCount++];
+        Piece->Length = static_cast<ULONG>(Length);
+        Piece->Radix = 0;
+        Piece->Negative = false;
+        Piece->Lowercase = false;
+        Characters += Length;
+        return Piece;
+    }
 
-template<>
-String<WCHAR> String<CHAR>::GetWide() const {
-    ANSI_STRING AnsiString = {};
-    RtlInitAnsiString(&AnsiString, Data.Buffer);
-    UNICODE_STRING UnicodeString = {};
-    RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
-    String<WCHAR> Wide(UnicodeString.Buffer, UnicodeString.Length / sizeof(WCHAR));
-    RtlFreeUnicodeString(&UnicodeString);
-    return Wide;
-}
+    StringBuilder& AppendNumber(UINT64 Value, UCHAR Radix, bool Negative, ULONG MinDigits, bool Lowercase = false) {
+        // Radixes are constant in the loops, so divisions become shifts and multiplications:
+        ULONG Digits = 1;
+        if (Radix == 16) {
+            for (UINT64 Rest = Value >> 4; Rest; Rest >>= 4) ++Digits;
+        } else {
+            for (UINT64 Rest = Value; Rest >= 10; Rest /= 10) ++Digits;
+        }
+        if (Digits < MinDigits) Digits = MinDigits;
+        PIECE* Piece = AddPiece(Digits + (Negative ? 1 : 0));
+        if (!Piece) return *this;
+        Piece->Number = Value;
+        Piece->Radix = Radix;
+        Piece->Negative = Negative;
+        Piece->Lowercase = Lowercase;
+        return *this;
+    }
 
-template<>
-String<CHAR> String<WCHAR>::GetAnsi() const {
-    UNICODE_STRING UnicodeString = {};
-    RtlInitUnicodeString(&UnicodeString, Data.Buffer);
-    ANSI_STRING AnsiString = {};
-    RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, TRUE);
-    String<CHAR> Ansi(AnsiString.Buffer, AnsiString.Length / sizeof(CHAR));
-    RtlFreeAnsiString(&AnsiString);
-    return Ansi;
-}
+    // Digits are written from the end, so the number is padded by zeroes up to the length of the piece:
+    static VOID WriteNumber(OUT TChar* Dest, const PIECE* Piece) {
+        const char* Alphabet = Piece->Lowercase ? "0123456789abcdef" : "0123456789ABCDEF";
+        TChar* Begin = Dest + (Piece->Negative ? 1 : 0);
+        TChar* Position = Dest + Piece->Length;
+        UINT64 Value = Piece->Number;
+        if (Piece->Radix == 16) {
+            while (Position > Begin) {
+                *--Position = static_cast<TChar>(Alphabet[Value & 0xF]);
+                Value >>= 4;
+            }
+        } else {
+            while (Position > Begin) {
+                *--Position = static_cast<TChar>('0' + Value % 10);
+                Value /= 10;
+            }
+        }
+        if (Piece->Negative) *Dest = static_cast<TChar>('-');
+    }
 
-template<>
-String<WCHAR> String<WCHAR>::GetWide() const {
-    return *this;
-}
+    static VOID WriteConverted(OUT WCHAR* Dest, const CHAR* Src, size_t Length) {
+        for (size_t Index = Utf::WidenAscii(Src, Length, Dest); Index < Length; ++Index) {
+            Dest[Index] = static_cast<WCHAR>(static_cast<UCHAR>(Src[Index]));
+        }
+    }
 
-template<>
-String<CHAR>& String<CHAR>::ToLowerCase() {
-    UNICODE_STRING UnicodeString;
-    ANSI_STRING AnsiString;
-    RtlInitAnsiString(&AnsiString, Data.Buffer);
-    RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
-    RtlDowncaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
-    RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, FALSE);
-    RtlFreeUnicodeString(&UnicodeString);
-    return *this;
-}
+    static VOID WriteConverted(OUT CHAR* Dest, const WCHAR* Src, size_t Length) {
+        for (size_t Index = Utf::NarrowAscii(Src, Length, Dest); Index < Length; ++Index) {
+            Dest[Index] = Src[Index] <= 0xFF ? static_cast<CHAR>(Src[Index]) : '?';
+        }
+    }
 
-template<>
-String<CHAR>& String<CHAR>::ToUpperCase() {
-    UNICODE_STRING UnicodeString;
-    ANSI_STRING AnsiString;
-    RtlInitAnsiString(&AnsiString, Data.Buffer);
-    RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
-    RtlUpcaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
-    RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, FALSE);
-    RtlFreeUnicodeString(&UnicodeString);
-    return *this;
-}
+    VOID Write(OUT TChar* Dest) const {
+        for (size_t Index = 0; Index < PiecesCount; ++Index) {
+            const PIECE* Piece = &Pieces[Index];
+            if (Piece->Radix == 1) {
+                *Dest = Piece->Char;
+            } else if (Piece->Radix == 2) {
+                WriteConverted(Dest, Piece->Converted, Piece->Length);
+            } else if (Piece->Radix) {
+                WriteNumber(Dest, Piece);
+            } else if (Piece->Length) {
+                RtlCopyMemory(Dest, Piece->Str, Piece->Length * sizeof(TChar));
+            }
+            Dest += Piece->Length;
+        }
+        *Dest = static_cast<TChar>(0);
+    }
+public:
+    StringBuilder(const StringBuilder&) = delete;
+    StringBuilder(StringBuilder&&) = delete;
+    StringBuilder& operator = (const StringBuilder&) = delete;
+    StringBuilder& operator = (StringBuilder&&) = delete;
 
-template<>
-String<WCHAR>& String<WCHAR>::ToLowerCase() {
-    UNICODE_STRING UnicodeString;
-    RtlInitUnicodeString(&UnicodeString, Data.Buffer);
-    RtlDowncaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
-    return *this;
-}
+    StringBuilder() : PiecesCount(0), Characters(0), Failed(false) {}
+    ~StringBuilder() = default;
+
+    StringBuilder& Append(StringView<TChar> Str) {
+        PIECE* Piece = AddPiece(Str.GetLength());
+        if (Piece) Piece->Str = Str.GetData();
+        return *this;
+    }
+
+    StringBuilder& Append(const TChar* Str) {
+        return Append(StringView<TChar>(Str));
+    }
+
+    StringBuilder& Append(StringView<TOther> Str) {
+        PIECE* Piece = AddPiece(Str.GetLength());
+        if (!Piece) return *this;
+        Piece->Converted = Str.GetData();
+        Piece->Radix = 2;
+        return *this;
+    }
+
+    StringBuilder& Append(const TOther* Str) {
+        return Append(StringView<TOther>(Str));
+    }
+
+    template <typename TAllocator, size_t SsoSize>
+    StringBuilder& Append(const String<TChar, TAllocator, SsoSize>& Str) {
+        return Append(Str.GetView());
+    }
+
+    StringBuilder& Append(TChar Char) {
+        PIECE* Piece = AddPiece(1);
+        if (!Piece) return *this;
+        Piece->Char = Char;
+        Piece->Radix = 1;
+        return *this;
+    }
+
+    // Numbers are padded by zeroes up to 'MinDigits' (the sign isn't counted):
+    StringBuilder& AppendDec(UINT64 Value, ULONG MinDigits = 0) {
+        return AppendNumber(Value, 10, false, MinDigits > 20 ? 20 : MinDigits);
+    }
+
+    StringBuilder& AppendSigned(INT64 Value, ULONG MinDigits = 0) {
+        if (MinDigits > 20) MinDigits = 20;
+        return Value < 0
+            ? AppendNumber(0 - static_cast<UINT64>(Value), 10, true, MinDigits)
+            : AppendNumber(static_cast<UINT64>(Value), 10, false, MinDigits);
+    }
+
+    // Uppercase (or lowercase) digits without prefix:
+    StringBuilder& AppendHex(UINT64 Value, ULONG MinDigits = 0, bool Lowercase = false) {
+        return AppendNumber(Value, 16, false, MinDigits > 16 ? 16 : MinDigits, Lowercase);
+    }
+
+    VOID Reset() {
+        PiecesCount = 0;
+        Characters = 0;
+        Failed = false;
+    }
+
+    inline bool IsFailed() const { return Failed; }
+    inline size_t GetLength() const { return Characters; }
+
+    // Returns an empty string if the builder is failed or there is no memory:
+    template <typename TAllocator = StringPoolAllocator<>>
+    String<TChar, TAllocator> Build(const TAllocator& Allocator = TAllocator()) const {
+        String<TChar, TAllocator> Result(Allocator);
+        if (Failed || !Characters) return Result;
+        Result.Resize(Characters);
+        if (Result.GetLength() != Characters) {
+            Result.Clear();
+            return Result;
+        }
+        Write(Result.GetData());
+        return Result;
+    }
+
+    // Builds the null-terminated string into the caller's buffer (e.g. on the stack),
+    // fails if it is less than GetLength() + 1 characters:
+    bool BuildTo(OUT TChar* Buffer, size_t BufferCharacters, OUT OPTIONAL StringView<TChar>* Result = NULL) const {
+        if (Failed || !Buffer || Characters >= BufferCharacters) return false;
+        Write(Buffer);
+        if (Result) *Result = StringView<TChar>(Buffer, Characters);
+        return true;
+    }
+};
+
+// Precompiled mask for String::Matches ('*' and '?', case-sensitive),
+// the mask is parsed once and reused for many strings:
+//   StringMask<WCHAR> Mask;
+//   if (Mask.Compile(L"*\\System32\\*.dll")) Mask.IsMatches(Path);
+// It splits the mask by '*' into segments: the first one is anchored at the beginning,
+// the last one is anchored at the end and the middle ones are searched in order by StringSearch.
+template <typename TChar>
+class StringMask final {
+private:
+    using SEGMENT = struct {
+        size_t Offset; // In Chars
+        size_t Length;
+        size_t Anchor; // Index of the first character that isn't '?', Length if there is no one
+        bool HasJokers; // Contains '?'
+    };
+
+    TChar* Chars;
+    SEGMENT* Segments;
+    size_t SegmentsCount;
+    size_t MinLength; // Sum of lengths of segments
+    bool AnchoredBegin; // Mask doesn't start with '*'
+    bool AnchoredEnd; // Mask doesn't end with '*'
+
+    static constexpr TChar Star = static_cast<TChar>('*');
+    static constexpr TChar Joker = static_cast<TChar>('?');
+
+    bool IsSegmentAt(const SEGMENT& Segment, const TChar* Str) const {
+        const TChar* Pattern = &Chars[Segment.Offset];
+        if (!Segment.HasJokers) return StringSearch::IsEqual(Str, Pattern, Segment.Length);
+        for (size_t i = 0; i < Segment.Length; ++i) {
+            if (Pattern[i] != Joker && Pattern[i] != Str[i]) return false;
+        }
+        return true;
+    }
+
+    // Index of the first occurrence of the segment in Str[0..Length) or NoIndex:
+    size_t FindSegment(const SEGMENT& Segment, const TChar* Str, size_t Length) const {
+        if (Segment.Length > Length) return StringSearch::NoIndex;
+        if (!Segment.HasJokers) return StringSearch::FindSubstring(Str, Length, &Chars[Segment.Offset], Segment.Length);
+        if (Segment.Anchor == Segment.Length) return 0; // Only '?'
+
+        // Candidates are positions of the first character that isn't '?':
+        TChar AnchorChar = Chars[Segment.Offset + Segment.Anchor];
+        size_t LastPosition = Length - Segment.Length;
+        size_t Position = 0;
+        while (Position <= LastPosition) {
+            size_t Index = StringSearch::FindChar(Str + Position + Segment.Anchor, LastPosition - Position + 1, AnchorChar);
+            if (Index == StringSearch::NoIndex) break;
+            Position += Index;
+            if (IsSegmentAt(Segment, Str + Position)) return Position;
+            ++Position;
+        }
+        return StringSearch::NoIndex;
+    }
+
+    VOID Free() {
+        delete[] Chars;
+        delete[] Segments;
+        Chars = NULL;
+        Segments = NULL;
+        SegmentsCount = 0;
+        MinLength = 0;
+    }
+public:
+    StringMask(const StringMask&) = delete;
+    StringMask(StringMask&&) = delete;
+    StringMask& operator = (const StringMask&) = delete;
+    StringMask& operator = (StringMask&&) = delete;
+
+    StringMask() : Chars(NULL), Segments(NULL), SegmentsCount(0), MinLength(0), AnchoredBegin(true), AnchoredEnd(true) {}
+
+    ~StringMask() {
+        Free();
+    }
+
+    bool Compile(const TChar* Mask) {
+        return Compile(Mask, String<TChar>::Length(Mask));
+    }
+
+    bool Compile(const TChar* Mask, size_t MaskLength) {
+        Free();
+        if (!Mask && MaskLength) return false;
+
+        AnchoredBegin = !MaskLength || Mask[0] != Star;
+        AnchoredEnd = !MaskLength || Mask[MaskLength - 1] != Star;
+
+        size_t MaxSegments = 1;
+        for (size_t i = 0; i < MaskLength; ++i) {
+            if (Mask[i] == Star) ++MaxSegments;
+        }
+
+        Chars = new TChar[MaskLength ? MaskLength : 1];
+        Segments = new SEGMENT[MaxSegments];
+        if (!Chars || !Segments) {
+            Free();
+            return false;
+        }
+
+        size_t CharsCount = 0;
+        for (size_t i = 0; i < MaskLength;) {
+            if (Mask[i] == Star) {
+                ++i;
+                continue;
+            }
+
+            SEGMENT& Segment = Segments[SegmentsCount++];
+            Segment.Offset = CharsCount;
+            Segment.HasJokers = false;
+            for (; i < MaskLength && Mask[i] != Star; ++i) {
+                if (Mask[i] == Joker) Segment.HasJokers = true;
+                Chars[CharsCount++] = Mask[i];
+            }
+            Segment.Length = CharsCount - Segment.Offset;
+
+            Segment.Anchor = 0;
+            while (Segment.Anchor < Segment.Length && Chars[Segment.Offset + Segment.Anchor] == Joker) ++Segment.Anchor;
+            MinLength += Segment.Length;
+        }
+
+        return true;
+    }
+
+    bool IsMatches(const TChar* Str, size_t Length) const {
+        if (!Segments) return false;
+        if (Length < MinLength) return false;
+
+        // No stars at all, the whole string must be the only segment:
+        if (AnchoredBegin && AnchoredEnd && SegmentsCount <= 1) {
+            if (!SegmentsCount) return !Length;
+            return Length == Segments[0].Length && IsSegmentAt(Segments[0], Str);
+        }
+
+        size_t First = 0, Last = SegmentsCount;
+        size_t Begin = 0, End = Length;
+
+        if (AnchoredBegin && SegmentsCount) {
+            if (!IsSegmentAt(Segments[0], Str)) return false;
+            Begin = Segments[0].Length;
+            ++First;
+        }
+
+        if (AnchoredEnd && Last > First) {
+            const SEGMENT& Segment = Segments[Last - 1];
+            if (End - Begin < Segment.Length || !IsSegmentAt(Segment, Str + End - Segment.Length)) return false;
+            End -= Segment.Length;
+            --Last;
+        }
+
+        // Leftmost occurrences of the middle segments in order:
+        for (size_t i = First; i < Last; ++i) {
+            size_t Index = FindSegment(Segments[i], Str + Begin, End - Begin);
+            if (Index == StringSearch::NoIndex) return false;
+            Begin += Index + Segments[i].Length;
+        }
+
+        return true;
+    }
+
+    bool IsMatches(const TChar* Str) const {
+        return IsMatches(Str, String<TChar>::Length(Str));
+    }
+
+    bool IsMatches(const String<TChar>& Str) const {
+        return IsMatches(Str.GetConstData(), Str.GetLength());
+    }
+};
+
+namespace StringConversion {
+    inline String<CHAR> ToAnsi(StringView<CHAR> Str) {
+        return String<CHAR>(Str);
+    }
+
+    inline String<CHAR> ToAnsi(StringView<WCHAR> Str) {
+        // ASCII is the same in all code pages, so it is converted without Rtl and temporary buffers:
+        String<CHAR> Narrowed;
+        Narrowed.Resize(Str.GetLength());
+        if (Narrowed.GetLength() == Str.GetLength() &&
+            Utf::NarrowAscii(Str.GetData(), Str.GetLength(), Narrowed.GetData()) == Str.GetLength()
+        ) return Narrowed;
+
+        UNICODE_STRING UnicodeString = Str.GetCountedString();
+        ANSI_STRING AnsiString = {};
+        RtlUnicodeStringToAnsiString(&AnsiString, &UnicodeString, TRUE);
+        String<CHAR> Ansi(AnsiString.Buffer, AnsiString.Length / sizeof(CHAR));
+        RtlFreeAnsiString(&AnsiString);
+        return Ansi;
+    }
+
+    inline String<WCHAR> ToWide(StringView<CHAR> Str) {
+        // ASCII is the same in all code pages, so it is converted without Rtl and temporary buffers:
+        String<WCHAR> Widened;
+        Widened.Resize(Str.GetLength());
+        if (Widened.GetLength() == Str.GetLength() &&
+            Utf::WidenAscii(Str.GetData(), Str.GetLength(), Widened.GetData()) == Str.GetLength()
+        ) return Widened;
+
+        ANSI_STRING AnsiString = Str.GetCountedString();
+        UNICODE_STRING UnicodeString = {};
+        RtlAnsiStringToUnicodeString(&UnicodeString, &AnsiString, TRUE);
+        String<WCHAR> Wide(UnicodeString.Buffer, UnicodeString.Length / sizeof(WCHAR));
+        RtlFreeUnicodeString(&UnicodeString);
+        return Wide;
+    }
+
+    inline String<WCHAR> ToWide(StringView<WCHAR> Str) {
+        return String<WCHAR>(Str);
+    }
 
-template<>
-String<WCHAR>& String<WCHAR>::ToUpperCase() {
-    UNICODE_STRING UnicodeString;
-    RtlInitUnicodeString(&UnicodeString, Data.Buffer);
-    RtlUpcaseUnicodeString(&UnicodeString, &UnicodeString, FALSE);
-    return *this;
+    // Returns an empty string if the source isn't valid UTF-8 or there is no memory:
+    inline String<WCHAR> FromUtf8(StringView<CHAR> Str) {
+        // UTF-16 never needs more units than UTF-8 bytes, so it is converted in one pass
+        // and the unused tail is cut off:
+        String<WCHAR> Wide;
+        if (!Str.GetLength()) return Wide;
+        Wide.Resize(Str.GetLength());
+        size_t Written = 0;
+        if (Wide.GetLength() != Str.GetLength() ||
+            Utf::Utf8ToUtf16(Str.GetData(), Str.GetLength(), Wide.GetData(), Wide.GetLength(), &Written) != UtfSuccess
+        ) return String<WCHAR>();
+        Wide.Resize(Written);
+        return Wide;
+    }
+
+    // Returns an empty string if the source has unpaired surrogates or there is no memory:
+    inline String<CHAR> ToUtf8(StringView<WCHAR> Str) {
+        String<CHAR> Utf8;
+        size_t Length = Utf::GetUtf8Length(Str.GetData(), Str.GetLength());
+        if (Length == Utf::InvalidLength || !Length) return Utf8;
+        Utf8.Resize(Length);
+        if (Utf8.GetLength() != Length) return String<CHAR>();
+        Utf::Utf16ToUtf8(Str.GetData(), Str.GetLength(), Utf8.GetData(), Length);
+        return Utf8;
+    }
 }
 
-template<>
-inline const CHAR* String<CHAR>::Find(const CHAR* Str, const CHAR* Substr, size_t Offset) {
-    return strstr(Str + Offset, Substr);
+template<typename TChar, typename TAllocator, size_t SsoSize>
+inline String<CHAR> String<TChar, TAllocator, SsoSize>::GetAnsi() const {
+    return StringConversion::ToAnsi(GetView());
 }
 
-template<>
-inline const WCHAR* String<WCHAR>::Find(const WCHAR* Str, const WCHAR* Substr, size_t Offset) {
-    return wcsstr(Str + Offset, Substr);
+template<typename TChar, typename TAllocator, size_t SsoSize>
+inline String<WCHAR> String<TChar, TAllocator, SsoSize>::GetWide() const {
+    return StringConversion::ToWide(GetView());
 }
 
+// Type-safe formatting without vararg routines: the format is checked and measured at compile time
+// by KB_FORMAT, arguments are appended to StringBuilder as pieces and the string is written at once:
+//   WideString Text = KB_FORMAT(L"{} opened {} ({}, access {:08X})", ProcessId, &FileObject->FileName, StringFormat::Status(Status), Access);
+// Placeholders:
+//   {}              - by the type of the argument
+//   {:x}, {:X}      - hex (lowercase or uppercase) without prefix
+//   {:N}, {:Nx} ... - zero-padded to N digits ({:08X} is the same as {:8X})
+//   {{, }}          - braces
+// Arguments:
+//   integers (CHAR and WCHAR are characters), pointers (hex of the pointer width as %p),
+//   strings of both character types (null-terminated, String, StringView, ANSI_STRING* and UNICODE_STRING*),
+//   StringFormat::Status(Status) as 0xC0000022.
+// Specifiers are allowed for integers only. Strings and the format literal aren't copied,
+// so KB_FORMAT_APPEND requires them to live until the builder is built.
+namespace StringFormat {
+    constexpr size_t InvalidFormat = ~static_cast<size_t>(0);
+    constexpr size_t MaxPlaceholders = 64;
+
+    struct FORMAT_INFO {
+        size_t Placeholders; // InvalidFormat if the format is malformed
+        size_t Pieces; // Maximal count of StringBuilder pieces
+        UINT64 SpecifiedMask; // Placeholders with specifiers
+    };
+
+    // Evaluated by KB_FORMAT at compile time, AppendLiteral splits the format at runtime the same way:
+    template <typename TChar>
+    constexpr FORMAT_INFO Parse(const TChar* Format) {
+        FORMAT_INFO Info = { 0, 0, 0 };
+        const FORMAT_INFO Invalid = { InvalidFormat, 0, 0 };
+        bool InLiteral = false;
+        size_t Index = 0;
+        while (Format[Index]) {
+            TChar Char = Format[Index];
+            if ((Char == '{' || Char == '}') && Format[Index + 1] == Char) {
+                // The brace ends the literal piece, the second one is skipped:
+                if (!InLiteral) ++Info.Pieces;
+                InLiteral = false;
+                Index += 2;
+                continue;
+            }
+            if (Char == '}') return Invalid;
+            if (Char != '{') {
+                if (!InLiteral) ++Info.Pieces;
+                InLiteral = true;
+                ++Index;
+                continue;
+            }
+            InLiteral = false;
+            ++Index;
+            bool Specified = Format[Index] == ':';
+            if (Specified) {
+                ++Index;
+                size_t Digits = 0, Width = 0;
+                while (Format[Index] >= '0' && Format[Index] <= '9') {
+                    Width = Width * 10 + (Format[Index++] - '0');
+                    if (++Digits > 2 || Width > 20) return Invalid;
+                }
+                if (Format[Index] == 'x' || Format[Index] == 'X' || Format[Index] == 'd') {
+                    ++Index;
+                } else if (!Digits) {
+                    return Invalid;
+                }
+            }
+            if (Format[Index] != '}' || Info.Placeholders == MaxPlaceholders) return Invalid;
+            ++Index;
+            if (Specified) Info.SpecifiedMask |= 1ULL << Info.Placeholders;
+            ++Info.Placeholders;
+            Info.Pieces += 2; // Status takes two pieces
+        }
+        return Info;
+    }
+
+    template <typename TValue> struct IsInteger { static constexpr bool Value = false; };
+    template <> struct IsInteger<signed char> { static constexpr bool Value = true; };
+    template <> struct IsInteger<unsigned char> { static constexpr bool Value = true; };
+    template <> struct IsInteger<short> { static constexpr bool Value = true; };
+    template <> struct IsInteger<unsigned short> { static constexpr bool Value = true; };
+    template <> struct IsInteger<int> { static constexpr bool Value = true; };
+    template <> struct IsInteger<unsigned int> { static constexpr bool Value = true; };
+    template <> struct IsInteger<long> { static constexpr bool Value = true; };
+    template <> struct IsInteger<unsigned long> { static constexpr bool Value = true; };
+    template <> struct IsInteger<long long> { static constexpr bool Value = true; };
+    template <> struct IsInteger<unsigned long long> { static constexpr bool Value = true; };
+
+    template <typename... TArgs>
+    constexpr bool IsSpecifiedIntegers(UINT64 SpecifiedMask) {
+        const bool Integers[] = { true, IsInteger<TArgs>::Value... }; // The first one allows empty packs
+        for (size_t Index = 0; Index < sizeof...(TArgs); ++Index) {
+            if (((SpecifiedMask >> Index) & 1) && !Integers[Index + 1]) return false;
+        }
+        return true;
+    }
+
+    struct Status {
+        NTSTATUS Value;
+        explicit Status(NTSTATUS Status) : Value(Status) {}
+    };
+
+    struct SPEC {
+        ULONG MinDigits;
+        UCHAR Radix; // 0 if it isn't specified
+        bool Lowercase;
+    };
+
+    // Appends the literal up to the next placeholder, returns the position after it (or the end):
+    template <typename TChar, size_t MaxPieces>
+    inline const TChar* AppendLiteral(StringBuilder<TChar, MaxPieces>& Builder, const TChar* Format, OUT SPEC* Spec) {
+        const TChar* Begin = Format;
+        for (; *Format; ++Format) {
+            if ((*Format == '{' || *Format == '}') && Format[1] == *Format) {
+                Builder.Append(StringView<TChar>(Begin, Format - Begin + 1));
+                Begin = ++Format + 1;
+                continue;
+            }
+            if (*Format != '{') continue;
+            if (Format != Begin) Builder.Append(StringView<TChar>(Begin, Format - Begin));
+            *Spec = {};
+            if (*++Format == ':') {
+                while (*++Format >= '0' && *Format <= '9') Spec->MinDigits = Spec->MinDigits * 10 + (*Format - '0');
+                if (*Format == 'x' || *Format == 'X') {
+                    Spec->Radix = 16;
+                    Spec->Lowercase = *Format++ == 'x';
+                } else {
+                    Spec->Radix = 10;
+                    if (*Format == 'd') ++Format;
+                }
+            }
+            return Format + 1; // Skips '}'
+        }
+        if (Format != Begin) Builder.Append(StringView<TChar>(Begin, Format - Begin));
+        return Format;
+    }
+
+    template <typename TChar, size_t MaxPieces, typename TValue>
+    inline VOID AppendInteger(StringBuilder<TChar, MaxPieces>& Builder, TValue Value, const SPEC& Spec) {
+        bool Signed = static_cast<TValue>(-1) < static_cast<TValue>(0);
+        if (Spec.Radix == 16) {
+            // Negative values are printed in the width of their type as %X does:
+            UINT64 Mask = sizeof(TValue) < sizeof(UINT64) ? (1ULL << (sizeof(TValue) * 8)) - 1 : ~0ULL;
+            Builder.AppendHex(static_cast<UINT64>(Value) & Mask, Spec.MinDigits, Spec.Lowercase);
+        } else if (Signed) {
+            Builder.AppendSigned(static_cast<INT64>(Value), Spec.MinDigits);
+        } else {
+            Builder.AppendDec(static_cast<UINT64>(Value), Spec.MinDigits);
+        }
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, signed char Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, unsigned char Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, short Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, unsigned short Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, int Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, unsigned int Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, long Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, unsigned long Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, long long Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, unsigned long long Value, const SPEC& Spec) { AppendInteger(Builder, Value, Spec); }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, CHAR Char, const SPEC&) {
+        Builder.Append(static_cast<TChar>(static_cast<UCHAR>(Char)));
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, WCHAR Char, const SPEC&) {
+        Builder.Append(sizeof(TChar) >= sizeof(WCHAR) || Char <= 0xFF ? static_cast<TChar>(Char) : static_cast<TChar>('?'));
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, StringView<CHAR> Str, const SPEC&) {
+        Builder.Append(Str);
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, StringView<WCHAR> Str, const SPEC&) {
+        Builder.Append(Str);
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const CHAR* Str, const SPEC&) {
+        Builder.Append(StringView<CHAR>(Str));
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const WCHAR* Str, const SPEC&) {
+        Builder.Append(StringView<WCHAR>(Str));
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const ANSI_STRING* Str, const SPEC&) {
+        Builder.Append(StringView<CHAR>(Str));
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const UNICODE_STRING* Str, const SPEC&) {
+        Builder.Append(StringView<WCHAR>(Str));
+    }
+
+    template <typename TChar, size_t MaxPieces, typename TSource, typename TAllocator, size_t SsoSize>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const String<TSource, TAllocator, SsoSize>& Str, const SPEC&) {
+        Builder.Append(Str.GetView());
+    }
+
+    template <typename TChar, size_t MaxPieces, typename TPointee>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, const TPointee* Pointer, const SPEC&) {
+        Builder.AppendHex(static_cast<UINT64>(reinterpret_cast<SIZE_T>(Pointer)), sizeof(PVOID) * 2);
+    }
+
+    template <typename TChar, size_t MaxPieces>
+    inline VOID AppendArgument(StringBuilder<TChar, MaxPieces>& Builder, Status Value, const SPEC&) {
+        static const TChar Prefix[] = { '0', 'x' };
+        Builder.Append(StringView<TChar>(Prefix, 2)).AppendHex(static_cast<ULONG>(Value.Value), 8);
+    }
+
+    template <size_t Placeholders, UINT64 SpecifiedMask, typename TChar, size_t MaxPieces, typename... TArgs>
+    inline StringBuilder<TChar, MaxPieces>& AppendTo(StringBuilder<TChar, MaxPieces>& Builder, const TChar* Format, const TArgs&... Args) {
+        static_assert(Placeholders != InvalidFormat, "Invalid format string");
+        static_assert(Placeholders == sizeof...(TArgs), "Count of arguments doesn't match the format string");
+        static_assert(IsSpecifiedIntegers<TArgs...>(SpecifiedMask), "Specifiers are allowed for integers only");
+        SPEC Spec = {};
+        // Braced initializers are evaluated in order:
+        int Expansion[] = { 0, (Format = AppendLiteral(Builder, Format, &Spec), AppendArgument(Builder, Args, Spec), 0)... };
+        UNREFERENCED_PARAMETER(Expansion);
+        AppendLiteral(Builder, Format, &Spec);
+        return Builder;
+    }
+
+    template <size_t Placeholders, size_t Pieces, UINT64 SpecifiedMask, typename TChar, typename... TArgs>
+    inline String<TChar> ToString(const TChar* Format, const TArgs&... Args) {
+        StringBuilder<TChar, Pieces ? Pieces : 1> Builder;
+        return AppendTo<Placeholders, SpecifiedMask>(Builder, Format, Args...).Build();
+    }
+}
 
-String<CHAR> FormatAnsi(LPCSTR Format, ...) {
+#define KB_FORMAT(Fmt, ...) \
+    StringFormat::ToString< \
+        StringFormat::Parse(Fmt).Placeholders, \
+        StringFormat::Parse(Fmt).Pieces, \
+        StringFormat::Parse(Fmt).SpecifiedMask \
+    >(Fmt, ##__VA_ARGS__)
+
+// Appends to the existing builder, it must have enough free pieces (2 per placeholder and 1 per literal part):
+#define KB_FORMAT_APPEND(Builder, Fmt, ...) \
+    StringFormat::AppendTo< \
+        StringFormat::Parse(Fmt).Placeholders, \
+        StringFormat::Parse(Fmt).SpecifiedMask \
+    >(Builder, Fmt, ##__VA_ARGS__)
+
+// printf-like formatting for formats known at runtime only, KB_FORMAT is faster and checked:
+inline String<CHAR> FormatAnsi(LPCSTR Format, ...) {
     va_list args;
     va_start(args, Format);
     constexpr int BufferSize = 64;
@@ -824,7 +2224,7 @@ String<CHAR> FormatAnsi(LPCSTR Format, ...) {
     return Result;
 }
 
-String<WCHAR> FormatWide(LPCWSTR Format, ...) {
+inline String<WCHAR> FormatWide(LPCWSTR Format, ...) {
     va_list args;
     va_start(args, Format);
     constexpr int BufferSize = 64;
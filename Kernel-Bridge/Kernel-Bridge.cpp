@@ -94,6 +94,18 @@ static CONST FLT_OPERATION_REGISTRATION Callbacks[] =
         reinterpret_cast<PFLT_PRE_OPERATION_CALLBACK>(FilterPreOperation),
         reinterpret_cast<PFLT_POST_OPERATION_CALLBACK>(FilterPostOperation)
     },
+    {
+        IRP_MJ_CLOSE, // Drops the cached path of the file
+        0,
+        reinterpret_cast<PFLT_PRE_OPERATION_CALLBACK>(FilterPreOperation),
+        NULL
+    },
+    {
+        IRP_MJ_SET_INFORMATION, // Drops cached paths on rename
+        0,
+        reinterpret_cast<PFLT_PRE_OPERATION_CALLBACK>(FilterPreOperation),
+        reinterpret_cast<PFLT_POST_OPERATION_CALLBACK>(FilterPostOperation)
+    },
     {
         IRP_MJ_OPERATION_END
     }
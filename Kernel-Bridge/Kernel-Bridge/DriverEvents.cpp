@@ -1,6 +1,7 @@
 #include <fltKernel.h>
 
 #include "FilterCallbacks.h"
+#include "SubmissionRings.h"
 
 VOID OnDriverLoad(
     PDRIVER_OBJECT DriverObject, 
@@ -27,6 +28,8 @@ VOID OnDriverUnload(
 ) {
     UNREFERENCED_PARAMETER(DriverObject);
     UNREFERENCED_PARAMETER(DeviceObject);
+
+    SubmissionRings::Destroy(TRUE);
 }
 
 VOID OnFilterUnload(
@@ -44,6 +47,8 @@ VOID OnFilterUnload(
     KbCallbacks::StopPsImageFilter();
 
     Communication::StopServer();
+
+    SubmissionRings::Destroy(TRUE);
 }
 
 VOID OnDriverCreate(
@@ -68,6 +73,9 @@ VOID OnDriverCleanup(
     UNREFERENCED_PARAMETER(FilterHandle);
     UNREFERENCED_PARAMETER(Irp);
     UNREFERENCED_PARAMETER(IrpStack);
+
+    // Owner of submission rings closes the device:
+    SubmissionRings::Destroy();
 }
 
 VOID OnDriverClose(
@@ -1,19 +1,35 @@
 #include <fltKernel.h>
 #include <stdarg.h>
+#include <intrin.h>
 
 #include "../API/MemoryUtils.h"
+#include "../API/MemoryPlanner.h"
 #include "../API/ProcessesUtils.h"
+#include "Atomics.h"
+#include "../API/SpinLocks.h"
+#include "WdkTypes.h"
+#include "LockStatsTypes.h"
+#include "../API/LockStats.h"
 #include "../API/Locks.h"
 #include "../API/LinkedList.h"
+#include "../API/Epoch.h"
+#include "../API/ClientsIndex.h"
 #include "../API/CommPort.h"
+#include "../API/EventQueue.h"
+#include "../API/PathCache.h"
 #include "../API/ObCallbacks.h"
 #include "../API/PsCallbacks.h"
+#include "../API/UnicodeCase.h"
+#include "../API/StringAllocators.h"
+#include "UtfTypes.h"
 #include "../API/StringsAPI.h"
 
 #include "FilterCallbacks.h"
 
-#include "WdkTypes.h"
 #include "FltTypes.h"
+#include "FltFilterTypes.h"
+#include "FltFrameTypes.h"
+#include "FltRecordTypes.h"
 
 #include "IOCTLs.h"
 
@@ -22,8 +38,269 @@ namespace Communication {
 
     LPCWSTR PortName = L"\\Kernel-Bridge"; 
 
+    // Ps* events are queued per client and sent by the worker thread,
+    // so process, thread and image callbacks never wait for listeners:
+    namespace Notifications {
+        constexpr ULONG QueueCapacity = 256;
+        constexpr ULONG SendTimeout = 100; // Msec, the worker skips the listener until the next round
+        constexpr ULONG MaxSubscribers = CommPort::MaxClients; // MaxConnections of the server
+
+        template <typename InfoType>
+        using PsQueue = EventQueue<InfoType, QueueCapacity>;
+
+        using SUBSCRIBER = struct {
+            KbFltTypes Type;
+            PFLT_PORT Port;
+            EX_RUNDOWN_REF Rundown; // Held by the worker while it sends events of this subscriber
+            PVOID Queue; // PsQueue<KB_FLT_PS_***_INFO> according to the Type
+            ULONG Lost;  // Events that weren't received by the listener, accessed by the worker only
+            BOOLEAN Batched; // Events are sent in KB_FLT_FRAME
+        };
+
+        static KEVENT Pending;
+        static PKB_FLT_FRAME Frame = NULL; // Used by the worker only
+        static PKTHREAD Worker = NULL;
+        static volatile LONG StopRequested = FALSE;
+
+        template <typename InfoType>
+        VOID Enqueue(const CommPort::CLIENT_INFO& Client, const InfoType& Info) {
+            auto Subscriber = static_cast<SUBSCRIBER*>(Client.ServerContext);
+            if (!Subscriber) return;
+            if (static_cast<PsQueue<InfoType>*>(Subscriber->Queue)->Push(Info))
+                KeSetEvent(&Pending, IO_NO_INCREMENT, FALSE);
+        }
+
+        // Packs all pending events into frames, one message per frame:
+        template <typename InfoType>
+        BOOLEAN DrainBatched(SUBSCRIBER* Subscriber) {
+            auto Queue = static_cast<PsQueue<InfoType>*>(Subscriber->Queue);
+            InfoType Info;
+            while (!InterlockedCompareExchange(&StopRequested, 0, 0)) {
+                FltFrame::Initialize(Frame, sizeof(InfoType));
+                while (!FltFrame::IsFull(Frame) && Queue->Pop(&Info)) {
+                    Info.Dropped = Queue->TakeDropped() + Subscriber->Lost;
+                    Subscriber->Lost = 0;
+                    FltFrame::Append(Frame, &Info);
+                }
+                if (!Frame->Header.Count) break;
+
+                NTSTATUS Status = Server.Send(Subscriber->Port, Frame, FltFrame::GetFrameSize(Frame), NULL, 0, SendTimeout);
+                if (Status != STATUS_SUCCESS) {
+                    Subscriber->Lost += Frame->Header.Count;
+                    return FALSE;
+                }
+            }
+            return TRUE;
+        }
+
+        // Returns FALSE if some events are left in the queue:
+        template <typename InfoType>
+        BOOLEAN Drain(SUBSCRIBER* Subscriber) {
+            if (Subscriber->Batched) return DrainBatched<InfoType>(Subscriber);
+
+            auto Queue = static_cast<PsQueue<InfoType>*>(Subscriber->Queue);
+            InfoType Info;
+            while (!InterlockedCompareExchange(&StopRequested, 0, 0) && Queue->Pop(&Info)) {
+                Info.Dropped = Queue->TakeDropped() + Subscriber->Lost;
+                Subscriber->Lost = 0;
+
+                // We're not waiting for response:
+                NTSTATUS Status = Server.Send(Subscriber->Port, &Info, sizeof(Info), NULL, 0, SendTimeout);
+                if (Status != STATUS_SUCCESS) {
+                    // Listener isn't receiving, the rest of events waits for the next round:
+                    Subscriber->Lost++;
+                    return FALSE;
+                }
+            }
+            return TRUE;
+        }
+
+        template <typename InfoType>
+        NTSTATUS CreateQueue(SUBSCRIBER* Subscriber) {
+            Subscriber->Queue = new PsQueue<InfoType>();
+            return Subscriber->Queue ? STATUS_SUCCESS : STATUS_MEMORY_NOT_ALLOCATED;
+        }
+
+        template <typename InfoType>
+        VOID DeleteQueue(SUBSCRIBER* Subscriber) {
+            delete static_cast<PsQueue<InfoType>*>(Subscriber->Queue);
+            Subscriber->Queue = NULL;
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        NTSTATUS Attach(IN OUT CommPort::CLIENT_INFO& Client) {
+            if (!Client.ConnectionContext || Client.SizeOfContext < sizeof(KB_FLT_CONTEXT)) return STATUS_SUCCESS;
+
+            auto Context = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
+            KbFltTypes Type = Context->Type;
+            if (Type != KbPsProcess && Type != KbPsThread && Type != KbPsImage) {
+                // Only Ps* events are queued and can be batched:
+                return (Context->Flags & KbFltBatched) ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
+            }
+
+            auto Subscriber = new SUBSCRIBER;
+            if (!Subscriber) return STATUS_MEMORY_NOT_ALLOCATED;
+            Subscriber->Type = Type;
+            Subscriber->Port = Client.ClientPort;
+            Subscriber->Batched = (Context->Flags & KbFltBatched) != 0;
+            ExInitializeRundownProtection(&Subscriber->Rundown);
+
+            NTSTATUS Status = STATUS_SUCCESS;
+            switch (Type) {
+            case KbPsProcess:
+                Status = CreateQueue<KB_FLT_PS_PROCESS_INFO>(Subscriber);
+                break;
+            case KbPsThread:
+                Status = CreateQueue<KB_FLT_PS_THREAD_INFO>(Subscriber);
+                break;
+            case KbPsImage:
+                Status = CreateQueue<KB_FLT_PS_IMAGE_INFO>(Subscriber);
+                break;
+            }
+
+            if (!NT_SUCCESS(Status)) {
+                delete Subscriber;
+                return Status;
+            }
+
+            Client.ServerContext = Subscriber;
+            return STATUS_SUCCESS;
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        VOID Detach(CommPort::CLIENT_INFO& Client) {
+            auto Subscriber = static_cast<SUBSCRIBER*>(Client.ServerContext);
+            if (!Subscriber) return;
+            Client.ServerContext = NULL;
+
+            // Client is already unlinked, so only the worker can still use it:
+            ExWaitForRundownProtectionRelease(&Subscriber->Rundown);
+
+            switch (Subscriber->Type) {
+            case KbPsProcess:
+                DeleteQueue<KB_FLT_PS_PROCESS_INFO>(Subscriber);
+                break;
+            case KbPsThread:
+                DeleteQueue<KB_FLT_PS_THREAD_INFO>(Subscriber);
+                break;
+            case KbPsImage:
+                DeleteQueue<KB_FLT_PS_IMAGE_INFO>(Subscriber);
+                break;
+            }
+            delete Subscriber;
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        VOID NotificationsWorker(PVOID Argument) {
+            UNREFERENCED_PARAMETER(Argument);
+
+            SUBSCRIBER* Subscribers[MaxSubscribers];
+            BOOLEAN HasBacklog = FALSE;
+            while (!InterlockedCompareExchange(&StopRequested, 0, 0)) {
+                // Events left after failed sends are retried without new events:
+                LARGE_INTEGER Timeout;
+                Timeout.QuadPart = -static_cast<LONGLONG>(SendTimeout) * 10 * 1000;
+                KeWaitForSingleObject(&Pending, Executive, KernelMode, FALSE, HasBacklog ? &Timeout : NULL);
+                HasBacklog = FALSE;
+
+                // Sending without the lock, so connecting and disconnecting clients don't wait for listeners:
+                ULONG Count = 0;
+                CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+                for (auto& Client : Clients) {
+                    auto Subscriber = static_cast<SUBSCRIBER*>(Client.ServerContext);
+                    if (!Subscriber || Count >= MaxSubscribers) continue;
+                    if (ExAcquireRundownProtection(&Subscriber->Rundown)) Subscribers[Count++] = Subscriber;
+                }
+                Clients.Unlock();
+
+                for (ULONG i = 0; i < Count; i++) {
+                    BOOLEAN IsDrained = TRUE;
+                    switch (Subscribers[i]->Type) {
+                    case KbPsProcess:
+                        IsDrained = Drain<KB_FLT_PS_PROCESS_INFO>(Subscribers[i]);
+                        break;
+                    case KbPsThread:
+                        IsDrained = Drain<KB_FLT_PS_THREAD_INFO>(Subscribers[i]);
+                        break;
+                    case KbPsImage:
+                        IsDrained = Drain<KB_FLT_PS_IMAGE_INFO>(Subscribers[i]);
+                        break;
+                    }
+                    if (!IsDrained) HasBacklog = TRUE;
+                    ExReleaseRundownProtection(&Subscribers[i]->Rundown);
+                }
+            }
+
+            PsTerminateSystemThread(STATUS_SUCCESS);
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        NTSTATUS StartWorker() {
+            KeInitializeEvent(&Pending, SynchronizationEvent, FALSE);
+            InterlockedExchange(&StopRequested, FALSE);
+
+            Frame = static_cast<PKB_FLT_FRAME>(VirtualMemory::AllocFromPool(sizeof(KB_FLT_FRAME)));
+            if (!Frame) return STATUS_MEMORY_NOT_ALLOCATED;
+
+            HANDLE hThread = NULL;
+            NTSTATUS Status = Processes::Threads::CreateSystemThread(NotificationsWorker, NULL, &hThread);
+            if (!NT_SUCCESS(Status)) {
+                VirtualMemory::FreePoolMemory(Frame);
+                Frame = NULL;
+                return Status;
+            }
+
+            Status = ObReferenceObjectByHandle(
+                hThread,
+                SYNCHRONIZE,
+                *PsThreadType,
+                KernelMode,
+                reinterpret_cast<PVOID*>(&Worker),
+                NULL
+            );
+            if (!NT_SUCCESS(Status)) {
+                // We can't wait for the worker, so just ask it to exit (its frame is leaked):
+                InterlockedExchange(&StopRequested, TRUE);
+                KeSetEvent(&Pending, IO_NO_INCREMENT, FALSE);
+                Worker = NULL;
+            }
+            ZwClose(hThread);
+            return Status;
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        VOID StopWorker() {
+            if (!Worker) return;
+            InterlockedExchange(&StopRequested, TRUE);
+            KeSetEvent(&Pending, IO_NO_INCREMENT, FALSE);
+            KeWaitForSingleObject(Worker, Executive, KernelMode, FALSE, NULL);
+            ObDereferenceObject(Worker);
+            Worker = NULL;
+
+            VirtualMemory::FreePoolMemory(Frame);
+            Frame = NULL;
+        }
+    }
+
+    // Connected clients of every type, file handlers skip all work
+    // (locking of buffers, obtaining of paths) for types without clients:
+    static volatile LONG SubscribersCount[KbFltNone] = {};
+
+    static VOID CountSubscriber(const CommPort::CLIENT_INFO& Client, LONG Delta) {
+        if (!Client.ConnectionContext || Client.SizeOfContext < sizeof(KB_FLT_CONTEXT)) return;
+        auto Type = static_cast<ULONG>(static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext)->Type);
+        if (Type < KbFltNone) InterlockedAdd(&SubscribersCount[Type], Delta);
+    }
+
+    bool HasSubscribers(KbFltTypes Type) {
+        return static_cast<ULONG>(Type) < KbFltNone && SubscribersCount[Type] > 0;
+    }
+
     NTSTATUS StartServer(PFLT_FILTER FilterHandle) {
-        return Server.StartServer(
+        NTSTATUS Status = Notifications::StartWorker();
+        if (!NT_SUCCESS(Status)) return Status;
+
+        Status = Server.StartServer(
             FilterHandle, 
             PortName,
             []( // OnMessage received:
@@ -36,28 +313,70 @@ namespace Communication {
                 UNREFERENCED_PARAMETER(ReturnLength);
                 KdPrint(("[Kernel-Bridge]: Message received!\r\n"));
                 return STATUS_SUCCESS;
+            },
+            CommPort::MaxClients,
+            NULL,
+            []( // OnConnect, context is KB_FLT_CONTEXT optionally followed by the filter program:
+                IN OUT CommPort::CLIENT_INFO& Client
+            ) -> NTSTATUS {
+                if (Client.ConnectionContext && Client.SizeOfContext > sizeof(KB_FLT_CONTEXT)) {
+                    BOOLEAN IsValid = FltFilter::IsProgramValid(
+                        static_cast<PUCHAR>(Client.ConnectionContext) + sizeof(KB_FLT_CONTEXT),
+                        Client.SizeOfContext - sizeof(KB_FLT_CONTEXT)
+                    );
+                    if (!IsValid) return STATUS_INVALID_PARAMETER;
+                }
+                if (Client.ConnectionContext && Client.SizeOfContext >= sizeof(KB_FLT_CONTEXT)) {
+                    // Handlers dispatch events to clients of the event type only:
+                    auto ClientContext = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
+                    auto Type = static_cast<ULONG>(ClientContext->Type);
+                    if (Type < KbFltNone) Client.Type = Type;
+                    Client.ProcessId = ClientContext->Client.ProcessId;
+                }
+                NTSTATUS Status = Notifications::Attach(Client);
+                if (NT_SUCCESS(Status)) CountSubscriber(Client, 1);
+                return Status;
+            },
+            []( // OnDisconnect:
+                CommPort::CLIENT_INFO& Client
+            ) -> VOID {
+                CountSubscriber(Client, -1);
+                Notifications::Detach(Client);
             }
         );
+
+        if (!NT_SUCCESS(Status)) Notifications::StopWorker();
+        return Status;
     }
 
     VOID StopServer() {
         Server.StopServer();
+        Notifications::StopWorker();
     }
 
-    bool IsProcessSubscribed(CommPort::ClientsList& Clients, HANDLE ProcessId) {
-        for (const auto& Client : Clients) {
-            if (Client.SizeOfContext != sizeof(KB_FLT_CONTEXT)) continue;
-            auto ClientContext = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
-            if (ClientContext->Client.ProcessId == reinterpret_cast<UINT64>(ProcessId)) return true;
-        }
-        return false;
+    static_assert(KbFltNone <= CommPort::MaxClientTypes, "Clients of every KbFltTypes must be indexed");
+
+    bool IsProcessSubscribed(const CommPort::ClientsList::Snapshot& Clients, HANDLE ProcessId) {
+        return Clients.IsProcessPresent(reinterpret_cast<UINT64>(ProcessId)) == TRUE;
     }
 
-    bool IsClientAppropriate(const CommPort::CLIENT_INFO& Client, KbFltTypes Type, OPTIONAL HANDLE IgnoredThreadId = NULL) {
-        if (Client.SizeOfContext != sizeof(KB_FLT_CONTEXT)) return false;
+    // Clients from Clients.OfType(...) have the valid context, events of their own threads are skipped,
+    // 'ThreadId' is the current thread, so with KbFltSkipOwnProcess its process is compared:
+    bool IsClientThread(const CommPort::CLIENT_INFO& Client, HANDLE ThreadId) {
         auto ClientContext = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
-        if (ClientContext->Type != Type) return false;
-        return !IgnoredThreadId || reinterpret_cast<HANDLE>(ClientContext->Client.ThreadId) != IgnoredThreadId;    
+        if (ClientContext->Flags & KbFltSkipOwnProcess) {
+            return Client.ProcessId == reinterpret_cast<UINT64>(PsGetCurrentProcessId());
+        }
+        return reinterpret_cast<HANDLE>(ClientContext->Client.ThreadId) == ThreadId;
+    }
+
+    // Client must be appropriate, the program was validated on connection:
+    bool IsEventAccepted(const CommPort::CLIENT_INFO& Client, IN OUT FltFilter::PEVENT Event) {
+        return FltFilter::Evaluate(
+            static_cast<PUCHAR>(Client.ConnectionContext) + sizeof(KB_FLT_CONTEXT),
+            Client.SizeOfContext - sizeof(KB_FLT_CONTEXT),
+            Event
+        ) == TRUE;
     }
 }
 
@@ -94,25 +413,16 @@ namespace KbCallbacks {
                 FltInfo.DuplicateResultAccess  = Info->Parameters->DuplicateHandleInformation.DesiredAccess;
 
                 using namespace Communication;
-                auto& Clients = Server.GetClients();
-                
-                Clients.LockShared();
+                CommPort::ClientsList::Snapshot Clients(Server.GetClients());
 
                 // Check whether we are in context of one of filtering threads:
-                for (auto& Client : Clients) {
-                    if (Client.SizeOfContext != sizeof(KB_FLT_CONTEXT)) continue;
-                    auto ClientContext = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
-                    if (FltInfo.Client.ProcessId == ClientContext->Client.ProcessId) {
-                        Clients.Unlock();
-                        return OB_PREOP_SUCCESS;
-                    }
+                if (Clients.IsProcessPresent(FltInfo.Client.ProcessId)) {
+                    Clients.Unlock();
+                    return OB_PREOP_SUCCESS;
                 }
                 
-                // Broadcasting:
-                for (auto& Client : Clients) {
-                    // Check whether the filter type is ObCallbacks:
-                    if (!IsClientAppropriate(Client, KbObCallbacks)) continue;
-                    
+                // Broadcasting to clients of ObCallbacks:
+                for (auto& Client : Clients.OfType(KbObCallbacks)) {
                     KB_FLT_OB_CALLBACK_INFO Request = FltInfo;
                     Server.Send(Client.ClientPort, &Request, sizeof(Request), &Request, sizeof(Request), 350);
                     FltInfo.CreateResultAccess = Request.CreateResultAccess;
@@ -141,17 +451,19 @@ namespace KbCallbacks {
                 Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
                 Info.Created = Created;
 
-                using namespace Communication;
-                auto& Clients = Server.GetClients();
+                FltFilter::EVENT Event = {};
+                Event.ProcessId = Info.ProcessId;
 
+                using namespace Communication;
                 HANDLE CurrentThreadId = PsGetCurrentThreadId();
 
-                Clients.LockShared();
-                for (auto& Client : Clients) {
-                    if (!IsClientAppropriate(Client, KbPsProcess, CurrentThreadId)) continue;
+                CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+                for (auto& Client : Clients.OfType(KbPsProcess)) {
+                    if (IsClientThread(Client, CurrentThreadId)) continue;
+                    if (!IsEventAccepted(Client, &Event)) continue;
 
-                    // We're not waiting for response:
-                    Server.Send(Client.ClientPort, &Info, sizeof(Info));
+                    // Delivered by the notifications worker:
+                    Notifications::Enqueue(Client, Info);
                 }
                 Clients.Unlock();
             }
@@ -170,17 +482,19 @@ namespace KbCallbacks {
                 Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
                 Info.Created = Created;
 
-                using namespace Communication;
-                auto& Clients = Server.GetClients();
+                FltFilter::EVENT Event = {};
+                Event.ProcessId = Info.ProcessId;
 
+                using namespace Communication;
                 HANDLE CurrentThreadId = PsGetCurrentThreadId();
 
-                Clients.LockShared();
-                for (auto& Client : Clients) {
-                    if (!IsClientAppropriate(Client, KbPsThread, CurrentThreadId)) continue;
+                CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+                for (auto& Client : Clients.OfType(KbPsThread)) {
+                    if (IsClientThread(Client, CurrentThreadId)) continue;
+                    if (!IsEventAccepted(Client, &Event)) continue;
 
-                    // We're not waiting for response:
-                    Server.Send(Client.ClientPort, &Info, sizeof(Info));
+                    // Delivered by the notifications worker:
+                    Notifications::Enqueue(Client, Info);
                 }
                 Clients.Unlock();
             }
@@ -208,17 +522,20 @@ namespace KbCallbacks {
                     );
                 }
 
-                using namespace Communication;
-                auto& Clients = Server.GetClients();
+                FltFilter::EVENT Event = {};
+                Event.ProcessId = Info.ProcessId;
+                Event.Size = static_cast<ULONG>(Info.ImageSize);
+                Event.Path = Info.FullImageName;
+                Event.PathLength = static_cast<ULONG>(wcslen(Info.FullImageName));
+                Event.PathQueried = TRUE;
 
-                Clients.LockShared();
-                for (auto& Client : Clients) {
-                    if (Client.SizeOfContext != sizeof(KB_FLT_CONTEXT)) continue;
-                    auto ClientContext = static_cast<PKB_FLT_CONTEXT>(Client.ConnectionContext);
-                    if (ClientContext->Type != KbPsImage) continue;
+                using namespace Communication;
+                CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+                for (auto& Client : Clients.OfType(KbPsImage)) {
+                    if (!IsEventAccepted(Client, &Event)) continue;
 
-                    // We're not waiting for response:
-                    Server.Send(Client.ClientPort, &Info, sizeof(Info));
+                    // Delivered by the notifications worker:
+                    Notifications::Enqueue(Client, Info);
                 }
                 Clients.Unlock();
             }
@@ -240,9 +557,11 @@ static WideString GetWin32Path(const PFLT_CALLBACK_DATA Data) {
     
     UNICODE_STRING VolumeName;
     if (NT_SUCCESS(IoVolumeDeviceToDosName(FileObject->DeviceObject, &VolumeName))) {
-        WideString Volume(&VolumeName);
+        StringBuilder<WCHAR, 2> Builder;
+        Builder.Append(&VolumeName).Append(&FileObject->FileName);
+        WideString Path = Builder.Build();
         ExFreePool(VolumeName.Buffer);
-        return Volume + WideString(&FileObject->FileName);
+        return Path;
     } else {
         return WideString(&FileObject->FileName);
     }
@@ -280,6 +599,174 @@ namespace FltHandlers {
         FltPostOp
     };
 
+    // Paths of opened files, an entry lives until IRP_MJ_CLOSE of its FILE_OBJECT
+    // and all entries are dropped on any successful rename:
+    using FilePathsCache = PathCache<EResource>;
+    static FilePathsCache FilePaths;
+
+    // The path is obtained only when a filter or an accepted client needs it:
+    using PATH_QUERY = struct {
+        PFLT_CALLBACK_DATA Data;
+        WideString* Path;
+        const FilePathsCache::ENTRY* Cached; // Released by ReleasePath
+        BOOLEAN UseCache; // FALSE until the file is opened (e.g. in pre-create)
+    };
+
+    static BOOLEAN QueryFilePath(PVOID Context, OUT const WCHAR** Path, OUT PULONG Length) {
+        auto Query = static_cast<PATH_QUERY*>(Context);
+        PFILE_OBJECT FileObject = Query->Data->Iopb->TargetFileObject;
+        BOOLEAN UseCache = Query->UseCache && FileObject->FsContext;
+
+        if (UseCache) {
+            Query->Cached = FilePaths.Acquire(FileObject, FileObject->FsContext);
+            if (Query->Cached) {
+                *Path = Query->Cached->Path;
+                *Length = Query->Cached->Length;
+                return TRUE;
+            }
+        }
+
+        // Only full paths are cached, GetWin32Path can't obtain them at APC_LEVEL:
+        BOOLEAN IsFullPath = KeGetCurrentIrql() == PASSIVE_LEVEL && !KeAreAllApcsDisabled();
+        LONG Generation = FilePaths.GetGeneration();
+
+        *Query->Path = GetFilePath(Query->Data);
+        if (!Query->Path->GetLength()) return FALSE;
+        *Path = Query->Path->GetConstData();
+        *Length = static_cast<ULONG>(Query->Path->GetLength());
+
+        if (UseCache && IsFullPath) {
+            FilePaths.Insert(FileObject, FileObject->FsContext, *Path, *Length, Generation);
+        }
+        return TRUE;
+    }
+
+    static VOID ReleasePath(IN PATH_QUERY* Query) {
+        FilePathsCache::Release(Query->Cached);
+        Query->Cached = NULL;
+    }
+
+    // Read, write and device control events need paths of files opened before:
+    static bool IsPathCacheNeeded() {
+        for (ULONG Type = KbFltPreRead; Type <= KbFltPostInternalDeviceControl; Type++) {
+            if (Communication::HasSubscribers(static_cast<KbFltTypes>(Type))) return true;
+        }
+        return false;
+    }
+
+    static bool IsPostOperationNeeded(UCHAR MajorFunction) {
+        using Communication::HasSubscribers;
+        switch (MajorFunction) {
+        case IRP_MJ_CREATE:
+            return HasSubscribers(KbFltPostCreate) || IsPathCacheNeeded();
+        case IRP_MJ_READ:
+            return HasSubscribers(KbFltPostRead);
+        case IRP_MJ_WRITE:
+            return HasSubscribers(KbFltPostWrite);
+        case IRP_MJ_DEVICE_CONTROL:
+            return HasSubscribers(KbFltPostDeviceControl);
+        case IRP_MJ_INTERNAL_DEVICE_CONTROL:
+            return HasSubscribers(KbFltPostInternalDeviceControl);
+        }
+        return false;
+    }
+
+    static bool IsRename(const PFLT_CALLBACK_DATA Data) {
+        switch (Data->Iopb->Parameters.SetFileInformation.FileInformationClass) {
+        case FileRenameInformation:
+        case FileRenameInformationEx:
+            return true;
+        }
+        return false;
+    }
+
+    VOID OnFileClose(const PFLT_CALLBACK_DATA Data) {
+        FilePaths.Remove(Data->Iopb->TargetFileObject);
+    }
+
+    VOID OnFileRenamed() {
+        FilePaths.InvalidateAll();
+    }
+
+    static VOID InitializeEvent(OUT FltFilter::PEVENT Event, IN PATH_QUERY* PathQuery, HANDLE ProcessId) {
+        *Event = {};
+        Event->ProcessId = reinterpret_cast<UINT64>(ProcessId);
+        Event->QueryPath = QueryFilePath;
+        Event->QueryContext = PathQuery;
+    }
+
+    static BOOLEAN DeferPath(PVOID Context, OUT const WCHAR** Path, OUT PULONG Length) {
+        UNREFERENCED_PARAMETER(Path);
+        UNREFERENCED_PARAMETER(Length);
+        *static_cast<PBOOLEAN>(Context) = TRUE; // The filter depends on the path
+        return FALSE;
+    }
+
+    // Obtaining of the path may wait for filesystem locks, so it must not be done under the clients
+    // snapshot (connecting and disconnecting clients wait for it). Filters are probed with the path
+    // deferred, and the event is wanted if any client accepts it or its filter depends on the path,
+    // then the caller obtains the path without the snapshot and evaluates filters again.
+    // Clients connected between the probe and the delivery may miss the event:
+    static bool IsEventWanted(
+        KbFltTypes Type,
+        HANDLE ThreadId,
+        const FltFilter::EVENT* Event,
+        bool SkipSubscribedProcesses
+    ) {
+        using namespace Communication;
+        BOOLEAN IsPathNeeded = FALSE;
+        bool IsWanted = false;
+        CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+        HANDLE ProcessId = reinterpret_cast<HANDLE>(Event->ProcessId);
+        if (!SkipSubscribedProcesses || !IsProcessSubscribed(Clients, ProcessId)) for (auto& Client : Clients.OfType(Type)) {
+            if (IsClientThread(Client, ThreadId)) continue;
+
+            FltFilter::EVENT Probe = *Event;
+            Probe.QueryPath = DeferPath;
+            Probe.QueryContext = &IsPathNeeded;
+            if (IsEventAccepted(Client, &Probe) || IsPathNeeded) {
+                IsWanted = true;
+                break;
+            }
+        }
+        Clients.Unlock();
+        return IsWanted;
+    }
+
+    // Record is built once per event and sent to all accepted clients, it must be freed by FreeRecord:
+    template <typename FixedType>
+    static PKB_FLT_RECORD_HEADER BuildRecord(
+        KbFltTypes Type,
+        const FixedType& Fixed,
+        IN FltFilter::PEVENT Event,
+        OPTIONAL const KB_FLT_EXT_CREATE_PARAMETERS* CreateParameters = NULL
+    ) {
+        static_assert(sizeof(FixedType) % 8 == 0 && sizeof(FixedType) <= KB_FLT_RECORD_MAX_FIXED_SIZE, "Invalid fixed part");
+
+        FltFilter::QueryEventPath(Event);
+        ULONG Size = FltRecord::GetRecordSize(sizeof(Fixed), Event->PathLength);
+        if (CreateParameters) Size += FltRecord::GetExtensionSize(sizeof(*CreateParameters));
+
+        auto Record = static_cast<PKB_FLT_RECORD_HEADER>(VirtualMemory::AllocFromPool(Size, FALSE));
+        if (!Record) return NULL;
+
+        FltRecord::Writer Writer(Record, Size);
+        BOOLEAN Built = Writer.Begin(static_cast<USHORT>(Type), &Fixed, sizeof(Fixed), Event->Path, Event->PathLength);
+        if (Built && CreateParameters) {
+            Built = Writer.AddExtension(KbFltExtCreateParameters, CreateParameters, sizeof(*CreateParameters));
+        }
+
+        if (!Built) {
+            VirtualMemory::FreePoolMemory(Record);
+            return NULL;
+        }
+        return Record;
+    }
+
+    static VOID FreeRecord(OPTIONAL PKB_FLT_RECORD_HEADER Record) {
+        if (Record) VirtualMemory::FreePoolMemory(Record);
+    }
+
     NTSTATUS FltCreateHandler(
         FltDirection Direction,
         _Inout_ PFLT_CALLBACK_DATA Data,
@@ -305,7 +792,10 @@ namespace FltHandlers {
             return STATUS_SUCCESS; // Unknown direction
         }
 
-        WideString Path = GetFilePath(Data);
+        // Paths of opened files are cached here, so read and write handlers don't obtain them:
+        BOOLEAN IsOpened = Direction == FltPostOp && NT_SUCCESS(Data->IoStatus.Status);
+        bool FillCache = IsOpened && IsPathCacheNeeded();
+        if (!Communication::HasSubscribers(HandlerType) && !FillCache) return STATUS_SUCCESS;
 
         KB_FLT_CREATE_INFO Info = {};
         HANDLE ProcessId = PsGetCurrentProcessId();
@@ -313,25 +803,40 @@ namespace FltHandlers {
         Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
         Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
         Info.AccessMask = Data->Iopb->Parameters.Create.SecurityContext->DesiredAccess;
-        Path.CopyTo(Info.Path, (sizeof(Info.Path) / sizeof(Info.Path[0])) - 1);
+
+        KB_FLT_EXT_CREATE_PARAMETERS CreateParameters = {};
+        CreateParameters.CreateOptions = Data->Iopb->Parameters.Create.Options;
+        CreateParameters.FileAttributes = Data->Iopb->Parameters.Create.FileAttributes;
+        CreateParameters.ShareAccess = Data->Iopb->Parameters.Create.ShareAccess;
+
+        WideString Path;
+        PATH_QUERY PathQuery = { Data, &Path, NULL, IsOpened };
+        FltFilter::EVENT Event;
+        InitializeEvent(&Event, &PathQuery, ProcessId);
+        PKB_FLT_RECORD_HEADER Record = NULL;
+        KB_FLT_CREATE_INFO Reply = {};
 
         using namespace Communication;
-        auto& Clients = Server.GetClients();
+        bool IsWanted = HasSubscribers(HandlerType) && IsEventWanted(HandlerType, ThreadId, &Event, false);
+        if (IsWanted || FillCache) FltFilter::QueryEventPath(&Event);
 
-        Clients.LockShared();
-        for (auto& Client : Clients) {
-            if (!IsClientAppropriate(Client, HandlerType, ThreadId)) continue;
+        if (IsWanted) {
+            CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+            for (auto& Client : Clients.OfType(HandlerType)) {
+                if (IsClientThread(Client, ThreadId)) continue;
+                if (!IsEventAccepted(Client, &Event)) continue;
 
-            Server.Send(Client.ClientPort, &Info, sizeof(Info), &Info, sizeof(Info), 350);
+                if (!Record) Record = BuildRecord(HandlerType, Info, &Event, &CreateParameters);
+                if (!Record) break;
 
-            // Restoring constant fields:
-            Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
-            Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
-            Info.AccessMask = Data->Iopb->Parameters.Create.SecurityContext->DesiredAccess;
+                Server.Send(Client.ClientPort, Record, Record->Size, &Reply, sizeof(Reply), 350);
+            }
+            Clients.Unlock();
         }
-        Clients.Unlock();
 
-        return Info.Status;
+        FreeRecord(Record);
+        ReleasePath(&PathQuery);
+        return Reply.Status;
     }
 
     NTSTATUS FltReadWriteHandler(
@@ -374,12 +879,12 @@ namespace FltHandlers {
             return STATUS_SUCCESS; // Unknown direction
         }
 
+        if (!Communication::HasSubscribers(HandlerType))
+            return STATUS_SUCCESS;
+
         if (!NT_SUCCESS(FltLockUserBuffer(Data)))
             return STATUS_SUCCESS; // Well, we aren't filtering due to locking failure
 
-        WideString Path = GetFilePath(Data);
-        
-        KB_FLT_READ_WRITE_INFO Info = {};
         HANDLE ProcessId = PsGetCurrentProcessId();
         HANDLE ThreadId = PsGetCurrentThreadId();
         PMDL Mdl = NULL;
@@ -400,25 +905,41 @@ namespace FltHandlers {
             return STATUS_SUCCESS; // Invalid HandlerType fot this request
         }
 
+        WideString Path;
+        PATH_QUERY PathQuery = { Data, &Path, NULL, TRUE };
+        FltFilter::EVENT Event;
+        InitializeEvent(&Event, &PathQuery, ProcessId);
+        Event.Size = Size;
+
+        KB_FLT_READ_WRITE_INFO Info = {};
+        Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
+        Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
+        Info.LockedMdl = reinterpret_cast<WdkTypes::PMDL>(Mdl);
+        Info.Size = Size;
+
+        PKB_FLT_RECORD_HEADER Record = NULL;
+        KB_FLT_READ_WRITE_INFO Reply = {};
+
         using namespace Communication;
-        auto& Clients = Server.GetClients();
+        if (IsEventWanted(HandlerType, ThreadId, &Event, true)) {
+            FltFilter::QueryEventPath(&Event);
 
-        Clients.LockShared();
-        if (!IsProcessSubscribed(Clients, ProcessId)) for (auto& Client : Clients) {
-            if (!IsClientAppropriate(Client, HandlerType, ThreadId)) continue;
+            CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+            if (!IsProcessSubscribed(Clients, ProcessId)) for (auto& Client : Clients.OfType(HandlerType)) {
+                if (IsClientThread(Client, ThreadId)) continue;
+                if (!IsEventAccepted(Client, &Event)) continue;
 
-            // Every iteration restoring constant fields:
-            Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
-            Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
-            Info.LockedMdl = reinterpret_cast<WdkTypes::PMDL>(Mdl);
-            Info.Size = Size;
-            Path.CopyTo(Info.Path, (sizeof(Info.Path) / sizeof(Info.Path[0])) - 1);
+                if (!Record) Record = BuildRecord(HandlerType, Info, &Event);
+                if (!Record) break;
 
-            Server.Send(Client.ClientPort, &Info, sizeof(Info), &Info, sizeof(Info), 5000);
+                Server.Send(Client.ClientPort, Record, Record->Size, &Reply, sizeof(Reply), 5000);
+            }
+            Clients.Unlock();
         }
-        Clients.Unlock();
 
-        return Info.Status;    
+        FreeRecord(Record);
+        ReleasePath(&PathQuery);
+        return Reply.Status;    
     }
 
     NTSTATUS FltDeviceControlHandler(
@@ -461,9 +982,9 @@ namespace FltHandlers {
             return STATUS_SUCCESS; // Unknown direction
         }
 
-        WideString Path = GetFilePath(Data);
+        if (!Communication::HasSubscribers(HandlerType))
+            return STATUS_SUCCESS;
 
-        KB_FLT_DEVICE_CONTROL_INFO Info = {};
         HANDLE ProcessId = PsGetCurrentProcessId();
         HANDLE ThreadId = PsGetCurrentThreadId();
         ULONG Ioctl = Data->Iopb->Parameters.DeviceIoControl.Common.IoControlCode;
@@ -499,26 +1020,44 @@ namespace FltHandlers {
             break;
         }
 
+        WideString Path;
+        PATH_QUERY PathQuery = { Data, &Path, NULL, TRUE };
+        FltFilter::EVENT Event;
+        InitializeEvent(&Event, &PathQuery, ProcessId);
+        Event.Ioctl = Ioctl;
+        Event.Size = InputSize;
+
+        KB_FLT_DEVICE_CONTROL_INFO Info = {};
+        Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
+        Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
+        Info.InputLockedMdl = reinterpret_cast<WdkTypes::PMDL>(InputMdl);
+        Info.OutputLockedMdl = reinterpret_cast<WdkTypes::PMDL>(OutputMdl);
+        Info.InputSize = InputSize;
+        Info.OutputSize = OutputSize;
+        Info.Ioctl = Ioctl;
+
+        PKB_FLT_RECORD_HEADER Record = NULL;
+        KB_FLT_DEVICE_CONTROL_INFO Reply = {};
+
         using namespace Communication;
-        auto& Clients = Server.GetClients();
-
-        Clients.LockShared();
-        if (!IsProcessSubscribed(Clients, ProcessId)) for (auto& Client : Clients) {
-            if (!IsClientAppropriate(Client, HandlerType, ThreadId)) continue;
-
-            // Every iteration restoring constant fields:
-            Info.ProcessId = reinterpret_cast<UINT64>(ProcessId);
-            Info.ThreadId = reinterpret_cast<UINT64>(ThreadId);
-            Info.InputLockedMdl = reinterpret_cast<WdkTypes::PMDL>(InputMdl);
-            Info.OutputLockedMdl = reinterpret_cast<WdkTypes::PMDL>(OutputMdl);
-            Info.InputSize = InputSize;
-            Info.OutputSize = OutputSize;
-            Info.Ioctl = Ioctl;
-            Path.CopyTo(Info.Path, (sizeof(Info.Path) / sizeof(Info.Path[0])) - 1);
-
-            Server.Send(Client.ClientPort, &Info, sizeof(Info), &Info, sizeof(Info), 5000);
+        if (IsEventWanted(HandlerType, ThreadId, &Event, true)) {
+            FltFilter::QueryEventPath(&Event);
+
+            CommPort::ClientsList::Snapshot Clients(Server.GetClients());
+            if (!IsProcessSubscribed(Clients, ProcessId)) for (auto& Client : Clients.OfType(HandlerType)) {
+                if (IsClientThread(Client, ThreadId)) continue;
+                if (!IsEventAccepted(Client, &Event)) continue;
+
+                if (!Record) Record = BuildRecord(HandlerType, Info, &Event);
+                if (!Record) break;
+
+                Server.Send(Client.ClientPort, Record, Record->Size, &Reply, sizeof(Reply), 5000);
+            }
+            Clients.Unlock();
         }
-        Clients.Unlock();
+
+        FreeRecord(Record);
+        ReleasePath(&PathQuery);
 
         switch (EXTRACT_CTL_METHOD(Ioctl)) {
         case METHOD_BUFFERED:
@@ -533,7 +1072,7 @@ namespace FltHandlers {
             break;
         }
 
-        return Info.Status;    
+        return Reply.Status;    
     }
 }
 
@@ -553,6 +1092,14 @@ FilterPreOperation(
 
     NTSTATUS Status = STATUS_SUCCESS;
     switch (Data->Iopb->MajorFunction) {
+    case IRP_MJ_CLOSE:
+        FltHandlers::OnFileClose(Data);
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    case IRP_MJ_SET_INFORMATION:
+        // Post-operation of synchronized requests is called at IRQL <= APC_LEVEL:
+        return FltHandlers::IsRename(Data)
+            ? FLT_PREOP_SYNCHRONIZE
+            : FLT_PREOP_SUCCESS_NO_CALLBACK;
     case IRP_MJ_CREATE:
         Status = FltHandlers::FltCreateHandler(FltHandlers::FltPreOp, Data, FltObjects, CompletionContext);
         break;
@@ -571,7 +1118,9 @@ FilterPreOperation(
         return FLT_PREOP_COMPLETE;
     }
 
-    return FLT_PREOP_SUCCESS_WITH_CALLBACK;
+    return FltHandlers::IsPostOperationNeeded(Data->Iopb->MajorFunction)
+        ? FLT_PREOP_SUCCESS_WITH_CALLBACK
+        : FLT_PREOP_SUCCESS_NO_CALLBACK;
 }
 
 FLT_POSTOP_CALLBACK_STATUS
@@ -591,6 +1140,9 @@ FilterPostOperation(
 
     NTSTATUS Status = STATUS_SUCCESS;
     switch (Data->Iopb->MajorFunction) {
+    case IRP_MJ_SET_INFORMATION:
+        if (NT_SUCCESS(Data->IoStatus.Status)) FltHandlers::OnFileRenamed();
+        return FLT_POSTOP_FINISHED_PROCESSING;
     case IRP_MJ_CREATE:
         Status = FltHandlers::FltCreateHandler(FltHandlers::FltPostOp, Data, FltObjects, &CompletionContext);
         break;
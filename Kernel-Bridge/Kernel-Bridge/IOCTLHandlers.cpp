@@ -1,17 +1,26 @@
 #include <fltKernel.h>
 
 #include "WdkTypes.h"
+#include "Atomics.h"
 #include "CtlTypes.h"
+#include "BatchTypes.h"
+#include "ScatterTypes.h"
+#include "LockStatsTypes.h"
 #include "IOCTLHandlers.h"
 
 #include "../API/MemoryUtils.h"
+#include "../API/MemoryPlanner.h"
 #include "../API/ProcessesUtils.h"
 #include "../API/IO.h"
 #include "../API/CPU.h"
 #include "../API/Importer.h"
 #include "../API/KernelShells.h"
+#include "../API/SpinLocks.h"
+#include "../API/LockStats.h"
+#include "../API/Locks.h"
 
 #include "IOCTLs.h"
+#include "SubmissionRings.h"
 
 namespace
 {
@@ -1116,6 +1125,251 @@ namespace
         return Status; 
     }
 
+    // Descriptors up to this size are copied through the bounce buffer within a single attach,
+    // larger ones are copied directly through MDLs by Read/WriteProcessMemory
+    // (mappings are shared between descriptors of the request by MappingCache):
+    constexpr ULONG VectoredBounceSize = 256 * 1024;
+
+    // Data of the descriptor inside of the bounce buffer of its segment:
+    PUCHAR GetBounceData(
+        const Processes::MemoryManagement::PROCESS_MEMORY_RANGE* Range,
+        const KB_MEMORY_SEGMENT* Segment,
+        const KB_MEMORY_DESCRIPTOR* Descriptor
+    ) {
+        return static_cast<PUCHAR>(Range->Buffer) + (Descriptor->BaseAddress - Segment->BaseAddress);
+    }
+
+    NTSTATUS OperateProcessMemoryVectored(
+        IN PIOCTL_INFO RequestInfo,
+        BOOLEAN IsWrite,
+        Processes::MemoryManagement::ProcessMappingCache* MappingCache
+    ) {
+        using namespace Processes::MemoryManagement;
+
+        if (RequestInfo->InputBufferSize != sizeof(KB_READ_WRITE_PROCESS_MEMORY_VECTORED_IN))
+            return STATUS_INFO_LENGTH_MISMATCH;
+
+        auto Input = static_cast<PKB_READ_WRITE_PROCESS_MEMORY_VECTORED_IN>(RequestInfo->InputBuffer);
+        if (!Input || !Input->Descriptors || !Input->Count) return STATUS_INVALID_PARAMETER;
+        if (Input->Count > ScatterGather::MaxDescriptorsCount) return STATUS_INVALID_PARAMETER;
+
+        ULONG Count = Input->Count;
+        auto UserDescriptors = reinterpret_cast<PKB_MEMORY_DESCRIPTOR>(Input->Descriptors);
+
+        // Capture descriptors to not depend on changes of usermode memory:
+        auto Descriptors = static_cast<PKB_MEMORY_DESCRIPTOR>(
+            VirtualMemory::AllocArray(sizeof(KB_MEMORY_DESCRIPTOR), Count)
+        );
+        if (!Descriptors) return STATUS_MEMORY_NOT_ALLOCATED;
+
+        __try {
+            RtlCopyMemory(Descriptors, UserDescriptors, Count * sizeof(KB_MEMORY_DESCRIPTOR));
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+            VirtualMemory::FreePoolMemory(Descriptors);
+            return STATUS_ACCESS_VIOLATION;
+        }
+
+        // Until the end of processing STATUS_SUCCESS means 'not failed yet':
+        for (ULONG i = 0; i < Count; i++) {
+            Descriptors[i].Status = ScatterGather::IsDescriptorValid(&Descriptors[i])
+                ? STATUS_SUCCESS
+                : STATUS_INVALID_PARAMETER;
+        }
+
+        HANDLE ProcessId = Input->ProcessId ? reinterpret_cast<HANDLE>(Input->ProcessId) : PsGetCurrentProcessId();
+        PEPROCESS Process = Processes::Descriptors::GetEPROCESS(ProcessId);
+        if (!Process) {
+            VirtualMemory::FreePoolMemory(Descriptors);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        // Ranges[i] describes Segments[i] in the bounce buffer,
+        // Retries[i] describes Descriptors[RetryOwners[i]] of a failed segment:
+        auto Segments = static_cast<PKB_MEMORY_SEGMENT>(VirtualMemory::AllocArray(sizeof(KB_MEMORY_SEGMENT), Count));
+        auto Ranges = static_cast<PPROCESS_MEMORY_RANGE>(VirtualMemory::AllocArray(sizeof(PROCESS_MEMORY_RANGE), Count));
+        auto Retries = static_cast<PPROCESS_MEMORY_RANGE>(VirtualMemory::AllocArray(sizeof(PROCESS_MEMORY_RANGE), Count));
+        auto RetryOwners = static_cast<PULONG>(VirtualMemory::AllocArray(sizeof(ULONG), Count));
+        auto Bounce = static_cast<PUCHAR>(VirtualMemory::AllocFromPool(VectoredBounceSize, FALSE));
+
+        NTSTATUS Status = Segments && Ranges && Retries && RetryOwners && Bounce
+            ? STATUS_SUCCESS
+            : STATUS_MEMORY_NOT_ALLOCATED;
+
+        ULONG Index = 0;
+        KB_MEMORY_SEGMENT Segment = {};
+        BOOLEAN HasSegment = NT_SUCCESS(Status)
+            && ScatterGather::GetNextSegment(Descriptors, Count, &Index, VectoredBounceSize, &Segment);
+
+        while (HasSegment) {
+            if (Segment.Size > VectoredBounceSize) {
+                PKB_MEMORY_DESCRIPTOR Descriptor = &Descriptors[Segment.FirstDescriptor];
+                Descriptor->Status = IsWrite
+                    ? WriteProcessMemory(
+                        Process,
+                        reinterpret_cast<PVOID>(Descriptor->BaseAddress),
+                        reinterpret_cast<PVOID>(Descriptor->Buffer),
+                        Descriptor->Size,
+                        MmCached,
+                        MappingCache
+                    )
+                    : ReadProcessMemory(
+                        Process,
+                        reinterpret_cast<PVOID>(Descriptor->BaseAddress),
+                        reinterpret_cast<PVOID>(Descriptor->Buffer),
+                        Descriptor->Size,
+                        MmCached,
+                        MappingCache
+                    );
+                HasSegment = ScatterGather::GetNextSegment(Descriptors, Count, &Index, VectoredBounceSize, &Segment);
+                continue;
+            }
+
+            // Pack as much segments as possible into the bounce buffer:
+            ULONG RangesCount = 0;
+            ULONG Used = 0;
+            while (HasSegment && Segment.Size <= VectoredBounceSize - Used) {
+                Segments[RangesCount] = Segment;
+                Ranges[RangesCount].BaseAddress = reinterpret_cast<PVOID>(Segment.BaseAddress);
+                Ranges[RangesCount].Buffer = Bounce + Used;
+                Ranges[RangesCount].Size = Segment.Size;
+                Ranges[RangesCount].Status = STATUS_SUCCESS;
+                RangesCount++;
+                Used += Segment.Size;
+                HasSegment = ScatterGather::GetNextSegment(Descriptors, Count, &Index, VectoredBounceSize, &Segment);
+            }
+
+            if (IsWrite) {
+                // Gather buffers of the caller, the segment is split if any of them is invalid:
+                for (ULONG i = 0; i < RangesCount; i++) {
+                    for (ULONG j = 0; j < Segments[i].DescriptorsCount; j++) {
+                        PKB_MEMORY_DESCRIPTOR Descriptor = &Descriptors[Segments[i].FirstDescriptor + j];
+                        __try {
+                            RtlCopyMemory(
+                                GetBounceData(&Ranges[i], &Segments[i], Descriptor),
+                                reinterpret_cast<PVOID>(Descriptor->Buffer),
+                                Descriptor->Size
+                            );
+                        } __except (EXCEPTION_EXECUTE_HANDLER) {
+                            Descriptor->Status = STATUS_INVALID_USER_BUFFER;
+                            Ranges[i].Status = STATUS_INVALID_USER_BUFFER;
+                        }
+                    }
+                }
+                WriteProcessMemoryRanges(Process, Ranges, RangesCount);
+            } else {
+                ReadProcessMemoryRanges(Process, Ranges, RangesCount);
+            }
+
+            // Failed segments of a few descriptors are copied again per descriptor
+            // to get the status of each one:
+            ULONG RetriesCount = 0;
+            for (ULONG i = 0; i < RangesCount; i++) {
+                if (NT_SUCCESS(Ranges[i].Status)) continue;
+                for (ULONG j = 0; j < Segments[i].DescriptorsCount; j++) {
+                    ULONG DescriptorIndex = Segments[i].FirstDescriptor + j;
+                    PKB_MEMORY_DESCRIPTOR Descriptor = &Descriptors[DescriptorIndex];
+                    if (!NT_SUCCESS(Descriptor->Status)) continue;
+                    if (Segments[i].DescriptorsCount == 1) {
+                        Descriptor->Status = Ranges[i].Status;
+                        continue;
+                    }
+                    RetryOwners[RetriesCount] = DescriptorIndex;
+                    Retries[RetriesCount].BaseAddress = reinterpret_cast<PVOID>(Descriptor->BaseAddress);
+                    Retries[RetriesCount].Buffer = GetBounceData(&Ranges[i], &Segments[i], Descriptor);
+                    Retries[RetriesCount].Size = Descriptor->Size;
+                    Retries[RetriesCount].Status = STATUS_SUCCESS;
+                    RetriesCount++;
+                }
+            }
+
+            if (RetriesCount) {
+                if (IsWrite)
+                    WriteProcessMemoryRanges(Process, Retries, RetriesCount);
+                else
+                    ReadProcessMemoryRanges(Process, Retries, RetriesCount);
+
+                for (ULONG i = 0; i < RetriesCount; i++) {
+                    Descriptors[RetryOwners[i]].Status = Retries[i].Status;
+                }
+            }
+
+            for (ULONG i = 0; i < RangesCount; i++) {
+                for (ULONG j = 0; j < Segments[i].DescriptorsCount; j++) {
+                    PKB_MEMORY_DESCRIPTOR Descriptor = &Descriptors[Segments[i].FirstDescriptor + j];
+                    if (Descriptor->Status == STATUS_INVALID_USER_BUFFER) continue;
+                    if (IsWrite) {
+                        // Read-only pages of the target process can be written through MDL only:
+                        if (!NT_SUCCESS(Descriptor->Status)) {
+                            Descriptor->Status = WriteProcessMemory(
+                                Process,
+                                reinterpret_cast<PVOID>(Descriptor->BaseAddress),
+                                GetBounceData(&Ranges[i], &Segments[i], Descriptor),
+                                Descriptor->Size,
+                                MmCached,
+                                MappingCache
+                            );
+                        }
+                    } else if (NT_SUCCESS(Descriptor->Status)) {
+                        // Scatter the data to buffers of the caller:
+                        __try {
+                            RtlCopyMemory(
+                                reinterpret_cast<PVOID>(Descriptor->Buffer),
+                                GetBounceData(&Ranges[i], &Segments[i], Descriptor),
+                                Descriptor->Size
+                            );
+                        } __except (EXCEPTION_EXECUTE_HANDLER) {
+                            Descriptor->Status = STATUS_INVALID_USER_BUFFER;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Cached mappings lock pages of the process, they must not outlive the request:
+        MappingCache->Flush();
+        ObDereferenceObject(Process);
+
+        if (NT_SUCCESS(Status)) {
+            for (ULONG i = 0; i < Count; i++) {
+                if (!NT_SUCCESS(Descriptors[i].Status)) {
+                    Status = STATUS_PARTIAL_COPY;
+                    break;
+                }
+            }
+
+            __try {
+                for (ULONG i = 0; i < Count; i++) {
+                    UserDescriptors[i].Status = Descriptors[i].Status;
+                }
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+                Status = STATUS_ACCESS_VIOLATION;
+            }
+        }
+
+        if (Bounce) VirtualMemory::FreePoolMemory(Bounce);
+        if (RetryOwners) VirtualMemory::FreePoolMemory(RetryOwners);
+        if (Retries) VirtualMemory::FreePoolMemory(Retries);
+        if (Ranges) VirtualMemory::FreePoolMemory(Ranges);
+        if (Segments) VirtualMemory::FreePoolMemory(Segments);
+        VirtualMemory::FreePoolMemory(Descriptors);
+
+        return Status;
+    }
+
+    NTSTATUS FASTCALL KbReadProcessMemoryVectored(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        UNREFERENCED_PARAMETER(ResponseLength);
+        Processes::MemoryManagement::ProcessMappingCache MappingCache;
+        return OperateProcessMemoryVectored(RequestInfo, FALSE, &MappingCache);
+    }
+
+    NTSTATUS FASTCALL KbWriteProcessMemoryVectored(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        UNREFERENCED_PARAMETER(ResponseLength);
+        Processes::MemoryManagement::ProcessMappingCache MappingCache;
+        return OperateProcessMemoryVectored(RequestInfo, TRUE, &MappingCache);
+    }
+
     NTSTATUS FASTCALL KbSuspendProcess(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
     {    
         UNREFERENCED_PARAMETER(ResponseLength);
@@ -1610,6 +1864,130 @@ namespace
 
         return Status;
     }
+
+    NTSTATUS FASTCALL KbExecuteBatch(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        // Batch is processed in-place, so input and output must be the same buffer:
+        if (!RequestInfo->InputBuffer || RequestInfo->InputBuffer != RequestInfo->OutputBuffer)
+            return STATUS_INVALID_PARAMETER;
+        if (
+            RequestInfo->InputBufferSize < sizeof(KB_BATCH_HEADER) || 
+            RequestInfo->InputBufferSize != RequestInfo->OutputBufferSize
+        ) return STATUS_INFO_LENGTH_MISMATCH;
+
+        Batch::Decoder Decoder(RequestInfo->InputBuffer, RequestInfo->InputBufferSize);
+        if (!Decoder.IsValid()) return STATUS_INVALID_PARAMETER;
+
+        BOOLEAN StopOnError = (Decoder.GetFlags() & KbBatchStopOnError) == KbBatchStopOnError;
+
+        // Function code of IOCTL has 12 bits:
+        constexpr ULONG MaxCtlIndex = 0xFFF - CTL_BASE;
+
+        ULONG ExecutedCount = 0;
+        KB_BATCH_ENTRY Entry = {};
+        while (PKB_BATCH_ENTRY Record = Decoder.Next(&Entry)) {
+            NTSTATUS Status = STATUS_NOT_IMPLEMENTED;
+            SIZE_T EntryResponseLength = 0;
+            
+            // Nested batches are not allowed:
+            if (Entry.CtlIndex != Ctls::KbExecuteBatch && Entry.CtlIndex <= MaxCtlIndex) {
+                IOCTL_INFO EntryInfo = {};
+                EntryInfo.InputBuffer = Entry.InputSize ? Batch::GetEntryInput(Record) : NULL;
+                EntryInfo.OutputBuffer = Entry.OutputSize ? Batch::GetEntryOutput(Record, Entry.InputSize) : NULL;
+                EntryInfo.InputBufferSize = Entry.InputSize;
+                EntryInfo.OutputBufferSize = Entry.OutputSize;
+                EntryInfo.ControlCode = IOCTL(CTL_BASE + Entry.CtlIndex, METHOD_NEITHER);
+                __try {
+                    Status = DispatchIOCTL(&EntryInfo, &EntryResponseLength);
+                } __except (EXCEPTION_EXECUTE_HANDLER) {
+                    Status = STATUS_UNSUCCESSFUL;
+                    EntryResponseLength = 0;
+                }
+            }
+
+            Record->Status = Status;
+            Record->ResponseLength = static_cast<ULONG>(EntryResponseLength);
+            ExecutedCount++;
+
+            if (StopOnError && !NT_SUCCESS(Status)) break;
+        }
+
+        Decoder.GetHeader()->ExecutedCount = ExecutedCount;
+        *ResponseLength = Decoder.GetTotalSize();
+        return Decoder.IsMalformed() ? STATUS_INVALID_PARAMETER : STATUS_SUCCESS;
+    }
+
+    NTSTATUS FASTCALL KbCreateRings(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        if (
+            RequestInfo->InputBufferSize != sizeof(KB_CREATE_RINGS_IN) || 
+            RequestInfo->OutputBufferSize != sizeof(KB_CREATE_RINGS_OUT)
+        ) return STATUS_INFO_LENGTH_MISMATCH;
+
+        auto Input = static_cast<PKB_CREATE_RINGS_IN>(RequestInfo->InputBuffer);
+        auto Output = static_cast<PKB_CREATE_RINGS_OUT>(RequestInfo->OutputBuffer);
+
+        if (!Input || !Output) return STATUS_INVALID_PARAMETER;
+
+        PVOID SubmissionRing = NULL, CompletionRing = NULL;
+        NTSTATUS Status = SubmissionRings::Create(
+            Input->SubmissionEntries,
+            Input->CompletionEntries,
+            &SubmissionRing,
+            &CompletionRing
+        );
+
+        if (!NT_SUCCESS(Status)) return Status;
+
+        Output->SubmissionRing = reinterpret_cast<WdkTypes::PVOID>(SubmissionRing);
+        Output->CompletionRing = reinterpret_cast<WdkTypes::PVOID>(CompletionRing);
+
+        *ResponseLength = RequestInfo->OutputBufferSize;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS FASTCALL KbDestroyRings(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        UNREFERENCED_PARAMETER(RequestInfo);
+        UNREFERENCED_PARAMETER(ResponseLength);
+        return SubmissionRings::Destroy();
+    }
+
+    NTSTATUS FASTCALL KbRingDoorbell(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+        UNREFERENCED_PARAMETER(RequestInfo);
+        UNREFERENCED_PARAMETER(ResponseLength);
+        return SubmissionRings::Doorbell();
+    }
+
+    NTSTATUS FASTCALL KbGetLockStats(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
+    {
+#ifdef KB_LOCKS_INSTRUMENTED
+        if (
+            RequestInfo->InputBufferSize != sizeof(KB_GET_LOCK_STATS_IN) || 
+            RequestInfo->OutputBufferSize < sizeof(KB_GET_LOCK_STATS_OUT)
+        ) return STATUS_INFO_LENGTH_MISMATCH;
+
+        auto Input = static_cast<PKB_GET_LOCK_STATS_IN>(RequestInfo->InputBuffer);
+        auto Output = static_cast<PKB_GET_LOCK_STATS_OUT>(RequestInfo->OutputBuffer);
+
+        if (!Input || !Output) return STATUS_INVALID_PARAMETER;
+
+        ULONG Capacity = static_cast<ULONG>((RequestInfo->OutputBufferSize - sizeof(KB_GET_LOCK_STATS_OUT)) / sizeof(KB_LOCK_STATS));
+        auto Locks = reinterpret_cast<PKB_LOCK_STATS>(Output + 1);
+
+        Output->TotalCount = KbLockStats.GetCount();
+        Output->Count = KbLockStats.Read(Locks, Capacity, Input->Reset);
+
+        *ResponseLength = sizeof(KB_GET_LOCK_STATS_OUT) + Output->Count * sizeof(KB_LOCK_STATS);
+        return STATUS_SUCCESS;
+#else
+        // Locks are instrumented only in builds with KB_LOCKS_INSTRUMENTED:
+        UNREFERENCED_PARAMETER(RequestInfo);
+        UNREFERENCED_PARAMETER(ResponseLength);
+        return STATUS_NOT_SUPPORTED;
+#endif
+    }
 }
 
 NTSTATUS FASTCALL DispatchIOCTL(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T ResponseLength)
@@ -1701,7 +2079,22 @@ NTSTATUS FASTCALL DispatchIOCTL(IN PIOCTL_INFO RequestInfo, OUT PSIZE_T Response
         /* 61 */ KbGetKernelProcAddress,
         /* 62 */ KbStallExecutionProcessor,
         /* 63 */ KbBugCheck,
-        /* 64 */ KbCreateDriver
+        /* 64 */ KbCreateDriver,
+
+        // Batching:
+        /* 65 */ KbExecuteBatch,
+
+        // Submission rings:
+        /* 66 */ KbCreateRings,
+        /* 67 */ KbDestroyRings,
+        /* 68 */ KbRingDoorbell,
+
+        // Vectored memory operations:
+        /* 69 */ KbReadProcessMemoryVectored,
+        /* 70 */ KbWriteProcessMemoryVectored,
+
+        // Diagnostics:
+        /* 71 */ KbGetLockStats
     };
 
     USHORT Index = EXTRACT_CTL_CODE(RequestInfo->ControlCode) - CTL_BASE;
@@ -0,0 +1,322 @@
+#include <fltKernel.h>
+
+#include "WdkTypes.h"
+#include "Atomics.h"
+#include "CtlTypes.h"
+#include "RingTypes.h"
+#include "LockStatsTypes.h"
+
+#include "../API/MemoryUtils.h"
+#include "../API/MemoryPlanner.h"
+#include "../API/ProcessesUtils.h"
+#include "../API/SpinLocks.h"
+#include "../API/LockStats.h"
+#include "../API/Locks.h"
+
+#include "IOCTLHandlers.h"
+#include "IOCTLs.h"
+#include "SubmissionRings.h"
+
+namespace SubmissionRings
+{
+    namespace
+    {
+        // Count of empty polls before the worker goes to sleep:
+        constexpr ULONG SpinsBeforeSleep = 1024;
+
+        // Sleeping worker re-checks the rings periodically even without doorbells:
+        constexpr LONGLONG IdleTimeout = -100LL * 10000LL; // 100 ms in 100-ns units
+
+        // Function code of IOCTL has 12 bits:
+        constexpr ULONG MaxCtlIndex = 0xFFF - CTL_BASE;
+
+        using RING = struct {
+            PKB_RING_HEADER Ring; // Kernel address
+            ULONG EntriesCount;
+            Mdl::MAPPING_INFO UserMapping;
+        };
+        using PRING = RING*;
+
+        using SESSION = struct {
+            RING Submission;
+            RING Completion;
+            PEPROCESS Owner;
+            PKTHREAD Worker;
+            KEVENT Doorbell;
+            volatile LONG StopRequested;
+        };
+        using PSESSION = SESSION*;
+
+        EResource SessionLock("SubmissionRings.Session");
+        PSESSION Session = NULL;
+
+        _IRQL_requires_max_(APC_LEVEL)
+        NTSTATUS AllocRing(OUT PRING Ring, ULONG EntrySize, ULONG EntriesCount)
+        {
+            // Whole pages to not expose neighbouring pool allocations to usermode:
+            SIZE_T Size = ROUND_TO_PAGES(Rings::GetRingSize(EntrySize, EntriesCount));
+            Ring->Ring = static_cast<PKB_RING_HEADER>(VirtualMemory::AllocFromPool(Size));
+            if (!Ring->Ring) return STATUS_MEMORY_NOT_ALLOCATED;
+
+            Rings::InitializeRing(Ring->Ring, Size, EntrySize, EntriesCount);
+            Ring->EntriesCount = EntriesCount;
+
+            return Mdl::MapMemory(
+                &Ring->UserMapping,
+                NULL,
+                NULL,
+                Ring->Ring,
+                static_cast<ULONG>(Size),
+                UserMode,
+                PAGE_READWRITE,
+                MmCached
+            );
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID FreeRing(PRING Ring)
+        {
+            if (Ring->UserMapping.BaseAddress) Mdl::UnmapMemory(&Ring->UserMapping);
+            if (Ring->Ring) VirtualMemory::FreePoolMemory(Ring->Ring);
+            *Ring = {};
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        VOID FreeSession(PSESSION Instance)
+        {
+            // Usermode mappings must be unmapped in context of the owner:
+            KAPC_STATE ApcState;
+            BOOLEAN NeedAttach = Instance->Owner && Instance->Owner != PsGetCurrentProcess();
+            if (NeedAttach) KeStackAttachProcess(Instance->Owner, &ApcState);
+            FreeRing(&Instance->Submission);
+            FreeRing(&Instance->Completion);
+            if (NeedAttach) KeUnstackDetachProcess(&ApcState);
+
+            if (Instance->Owner) ObDereferenceObject(Instance->Owner);
+            VirtualMemory::FreePoolMemory(Instance);
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        VOID ExecuteSubmission(IN PKB_RING_SUBMISSION Submission, OUT PKB_RING_COMPLETION Completion)
+        {
+            Completion->UserData = Submission->UserData;
+            Completion->ResponseLength = 0;
+
+            // Rings management isn't allowed from the rings, batches are rejected too,
+            // as a batch with KbDestroyRings would make the worker wait for itself:
+            if (
+                Submission->CtlIndex > MaxCtlIndex ||
+                Submission->CtlIndex == Ctls::KbExecuteBatch ||
+                Submission->CtlIndex == Ctls::KbCreateRings ||
+                Submission->CtlIndex == Ctls::KbDestroyRings ||
+                Submission->CtlIndex == Ctls::KbRingDoorbell
+            ) {
+                Completion->Status = STATUS_NOT_SUPPORTED;
+                return;
+            }
+
+            if (Submission->InputSize > KB_RING_INLINE_INPUT_SIZE) {
+                Completion->Status = STATUS_INFO_LENGTH_MISMATCH;
+                return;
+            }
+
+            PVOID Output = reinterpret_cast<PVOID>(Submission->Output);
+            if (Output && !AddressRange::IsUserAddress(Output)) {
+                Completion->Status = STATUS_ACCESS_VIOLATION;
+                return;
+            }
+
+            IOCTL_INFO RequestInfo = {};
+            RequestInfo.InputBuffer = Submission->InputSize ? Submission->Input : NULL;
+            RequestInfo.OutputBuffer = Output;
+            RequestInfo.InputBufferSize = Submission->InputSize;
+            RequestInfo.OutputBufferSize = Output ? Submission->OutputSize : 0;
+            RequestInfo.ControlCode = IOCTL(CTL_BASE + Submission->CtlIndex, METHOD_NEITHER);
+
+            NTSTATUS Status = STATUS_SUCCESS;
+            SIZE_T ResponseLength = 0;
+            __try {
+                Status = DispatchIOCTL(&RequestInfo, &ResponseLength);
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+                Status = STATUS_UNSUCCESSFUL;
+                ResponseLength = 0;
+            }
+
+            Completion->Status = Status;
+            Completion->ResponseLength = static_cast<ULONG>(ResponseLength);
+        }
+
+        _IRQL_requires_max_(PASSIVE_LEVEL)
+        VOID RingsWorker(PVOID Argument)
+        {
+            auto Instance = static_cast<PSESSION>(Argument);
+
+            Rings::Consumer<KB_RING_SUBMISSION> Submissions(
+                Instance->Submission.Ring,
+                Instance->Submission.EntriesCount
+            );
+
+            Rings::Producer<KB_RING_COMPLETION> Completions(
+                Instance->Completion.Ring,
+                Instance->Completion.EntriesCount
+            );
+
+            // Usermode pointers in submissions are valid only in context of the owner:
+            KAPC_STATE ApcState;
+            KeStackAttachProcess(Instance->Owner, &ApcState);
+
+            ULONG IdleSpins = 0;
+            while (!InterlockedCompareExchange(&Instance->StopRequested, 0, 0)) {
+                PKB_RING_COMPLETION Completion = Completions.Reserve();
+                KB_RING_SUBMISSION Submission;
+                if (Completion && Submissions.Pop(&Submission)) {
+                    ExecuteSubmission(&Submission, Completion);
+                    Completions.Commit();
+                    IdleSpins = 0;
+                    continue;
+                }
+
+                if (++IdleSpins < SpinsBeforeSleep) {
+                    YieldProcessor();
+                    continue;
+                }
+
+                IdleSpins = 0;
+
+                // Submission ring is empty or completion ring is full,
+                // request a doorbell and re-check the rings to not miss it:
+                Submissions.RequestWakeup(Completion ? KbRingNeedWakeup : KbRingCompletionsFull);
+                BOOLEAN NeedSleep = Completion
+                    ? Submissions.Peek() == NULL
+                    : Completions.Reserve() == NULL;
+
+                if (NeedSleep) {
+                    KeUnstackDetachProcess(&ApcState);
+                    LARGE_INTEGER Timeout;
+                    Timeout.QuadPart = IdleTimeout;
+                    KeWaitForSingleObject(&Instance->Doorbell, Executive, KernelMode, FALSE, &Timeout);
+                    KeStackAttachProcess(Instance->Owner, &ApcState);
+                }
+
+                Submissions.ClearWakeup();
+            }
+
+            KeUnstackDetachProcess(&ApcState);
+            PsTerminateSystemThread(STATUS_SUCCESS);
+        }
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS Create(
+        ULONG SubmissionEntries,
+        ULONG CompletionEntries,
+        OUT PVOID* SubmissionRing,
+        OUT PVOID* CompletionRing
+    ) {
+        if (!SubmissionRing || !CompletionRing) return STATUS_INVALID_PARAMETER;
+        if (
+            !Rings::IsPowerOfTwo(SubmissionEntries) || SubmissionEntries > Rings::MaxEntriesCount ||
+            !Rings::IsPowerOfTwo(CompletionEntries) || CompletionEntries > Rings::MaxEntriesCount
+        ) return STATUS_INVALID_PARAMETER;
+
+        SessionLock.LockExclusive();
+
+        if (Session) {
+            SessionLock.Unlock();
+            return STATUS_DEVICE_BUSY;
+        }
+
+        auto Instance = static_cast<PSESSION>(VirtualMemory::AllocFromPool(sizeof(SESSION)));
+        if (!Instance) {
+            SessionLock.Unlock();
+            return STATUS_MEMORY_NOT_ALLOCATED;
+        }
+
+        Instance->Owner = PsGetCurrentProcess();
+        ObReferenceObject(Instance->Owner);
+
+        KeInitializeEvent(&Instance->Doorbell, SynchronizationEvent, FALSE);
+
+        NTSTATUS Status = AllocRing(&Instance->Submission, sizeof(KB_RING_SUBMISSION), SubmissionEntries);
+        if (NT_SUCCESS(Status))
+            Status = AllocRing(&Instance->Completion, sizeof(KB_RING_COMPLETION), CompletionEntries);
+
+        HANDLE hThread = NULL;
+        if (NT_SUCCESS(Status))
+            Status = Processes::Threads::CreateSystemThread(RingsWorker, Instance, &hThread);
+
+        if (NT_SUCCESS(Status)) {
+            Status = ObReferenceObjectByHandle(
+                hThread,
+                SYNCHRONIZE,
+                *PsThreadType,
+                KernelMode,
+                reinterpret_cast<PVOID*>(&Instance->Worker),
+                NULL
+            );
+            if (!NT_SUCCESS(Status)) {
+                // We can't wait for the worker, so it will be leaked:
+                InterlockedExchange(&Instance->StopRequested, TRUE);
+                KeSetEvent(&Instance->Doorbell, IO_NO_INCREMENT, FALSE);
+                ZwClose(hThread);
+                SessionLock.Unlock();
+                return Status;
+            }
+            ZwClose(hThread);
+        }
+
+        if (!NT_SUCCESS(Status)) {
+            FreeSession(Instance);
+            SessionLock.Unlock();
+            return Status;
+        }
+
+        *SubmissionRing = Instance->Submission.UserMapping.BaseAddress;
+        *CompletionRing = Instance->Completion.UserMapping.BaseAddress;
+        Session = Instance;
+
+        SessionLock.Unlock();
+        return STATUS_SUCCESS;
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS Destroy(BOOLEAN Force)
+    {
+        SessionLock.LockExclusive();
+
+        PSESSION Instance = Session;
+        if (!Instance) {
+            SessionLock.Unlock();
+            return STATUS_NOT_FOUND;
+        }
+
+        if (!Force && Instance->Owner != PsGetCurrentProcess()) {
+            SessionLock.Unlock();
+            return STATUS_ACCESS_DENIED;
+        }
+
+        Session = NULL;
+        SessionLock.Unlock();
+
+        InterlockedExchange(&Instance->StopRequested, TRUE);
+        KeSetEvent(&Instance->Doorbell, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(Instance->Worker, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(Instance->Worker);
+
+        FreeSession(Instance);
+        return STATUS_SUCCESS;
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    NTSTATUS Doorbell()
+    {
+        NTSTATUS Status = STATUS_NOT_FOUND;
+        SessionLock.LockShared();
+        if (Session) {
+            KeSetEvent(&Session->Doorbell, IO_NO_INCREMENT, FALSE);
+            Status = STATUS_SUCCESS;
+        }
+        SessionLock.Unlock();
+        return Status;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+// Submission/completion rings mapped into the client process.
+// The worker thread drains the submission ring through DispatchIOCTL
+// in context of the owner process and posts results to the completion ring:
+namespace SubmissionRings {
+    // Allocates the rings, maps them into the current process and starts the worker,
+    // only one pair of rings can exist at a time:
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS Create(
+        ULONG SubmissionEntries, // Power of 2
+        ULONG CompletionEntries, // Power of 2
+        OUT PVOID* SubmissionRing, // Usermode address
+        OUT PVOID* CompletionRing  // Usermode address
+    );
+
+    // Stops the worker and unmaps the rings.
+    // If 'Force' is FALSE, only the owner process can destroy the rings:
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS Destroy(BOOLEAN Force = FALSE);
+
+    // Wakes the sleeping worker up:
+    _IRQL_requires_max_(APC_LEVEL)
+    NTSTATUS Doorbell();
+}
\ No newline at end of file
@@ -2,8 +2,13 @@
 
 #include "WdkTypes.h"
 #include "CtlTypes.h"
+#include "BatchTypes.h"
+#include "LockStatsTypes.h"
 #include "User-Bridge.h"
 
+#include <vector>
+#include "Batch-Bridge.h"
+
 #include "Kernel-Tests.h"
 
 #include <intrin.h>
@@ -218,6 +223,26 @@ bool ProcessesTest::RunTest() {
         if (!Status) Log(L"KbReadProcessMemory == FALSE");
         if (Data != 0x1122334455667788) Log(L"Data != 0x1122334455667788");
 
+        // Adjacent descriptors are coalesced, the last one is invalid:
+        UINT64 Parts[3] = {};
+        KB_MEMORY_DESCRIPTOR Descriptors[4] = {};
+        for (int i = 0; i < 3; i++) {
+            Descriptors[i].BaseAddress = Buffer + i * sizeof(UINT64);
+            Descriptors[i].Buffer = reinterpret_cast<WdkTypes::PVOID>(&Parts[i]);
+            Descriptors[i].Size = sizeof(UINT64);
+        }
+        Status = KbReadProcessMemoryVectored(ProcessId, Descriptors, 4);
+        if (Status) Log(L"KbReadProcessMemoryVectored with invalid descriptor == TRUE");
+        TestStatus &= Status = Descriptors[0].Status == 0 && Descriptors[1].Status == 0 && Descriptors[2].Status == 0;
+        if (!Status) Log(L"KbReadProcessMemoryVectored: Status of valid descriptor != STATUS_SUCCESS");
+        if (Descriptors[3].Status == 0) Log(L"KbReadProcessMemoryVectored: Status of invalid descriptor == STATUS_SUCCESS");
+        if (Parts[0] != 0x1122334455667788 || Parts[1] != 0x9090909090909090) Log(L"Vectored data mismatch");
+
+        Parts[1] = 0xAABBCCDDEEFF0011;
+        TestStatus &= Status = KbWriteProcessMemoryVectored(ProcessId, &Descriptors[1], 1);
+        if (!Status) Log(L"KbWriteProcessMemoryVectored == FALSE");
+        if (static_cast<PUINT64>(uBuffer)[1] != 0xAABBCCDDEEFF0011) Log(L"Vectored write mismatch");
+
         TestStatus &= Status = KbFreeUserMemory(ProcessId, Buffer);
         if (!Status) Log(L"KbFreeUserMemory == FALSE");
     }
@@ -263,4 +288,43 @@ bool StuffTest::RunTest() {
     if (!KernelAddress) Log(L"KernelAddress == NULL");
 
     return static_cast<bool>(Status);
+}
+
+bool BatchTest::RunTest() {
+    KbBatch Batch;
+
+    ULONG FirstTsc = Batch.Add(Ctls::KbReadTsc, NULL, 0, sizeof(KB_READ_TSC_OUT));
+    ULONG Nested = Batch.Add(Ctls::KbExecuteBatch);
+    ULONG SecondTsc = Batch.Add(Ctls::KbReadTsc, NULL, 0, sizeof(KB_READ_TSC_OUT));
+
+    if (!Batch.Execute()) {
+        Log(L"KbExecuteBatch == FALSE");
+        return false;
+    }
+
+    bool TestStatus = true;
+
+    if (Batch.GetExecutedCount() != Batch.GetCount()) {
+        Log(L"ExecutedCount != Count");
+        TestStatus = false;
+    }
+
+    if (Batch.IsSucceeded(Nested)) {
+        Log(L"Nested batch was executed");
+        TestStatus = false;
+    }
+
+    if (!Batch.IsSucceeded(FirstTsc) || !Batch.IsSucceeded(SecondTsc)) {
+        Log(L"KbReadTsc in batch failed");
+        return false;
+    }
+
+    auto First = Batch.GetOutput<KB_READ_TSC_OUT>(FirstTsc);
+    auto Second = Batch.GetOutput<KB_READ_TSC_OUT>(SecondTsc);
+    if (!First || !Second || Second->Value < First->Value) {
+        Log(L"Invalid TSC values");
+        TestStatus = false;
+    }
+
+    return TestStatus;
 }
\ No newline at end of file
@@ -72,4 +72,10 @@ class StuffTest : KernelTests {
 public:
     StuffTest(LPCWSTR Name) : KernelTests(Name) { Passed = RunTest(); PrintStatus(); }
     bool RunTest() override;
+};
+
+class BatchTest : KernelTests {
+public:
+    BatchTest(LPCWSTR Name) : KernelTests(Name) { Passed = RunTest(); PrintStatus(); }
+    bool RunTest() override;
 };
\ No newline at end of file
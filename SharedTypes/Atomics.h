@@ -0,0 +1,81 @@
+#pragma once
+
+// Interlocked operations of portable headers (rings, queues, spinning primitives, statistics),
+// so they can be built by MSVC (wdm.h or Windows.h) and by GCC/Clang outside of the driver.
+//
+// Operands are 'volatile LONG' (or LONG64 for *64 and pointers for *_POINTER) lvalues,
+// plain names are sequentially consistent, others have the ordering in their names.
+// The ordering is a minimum: Interlocked* routines of MSVC are full barriers.
+//
+// Dependencies:
+// - winnt.h or wdm.h with MSVC
+
+#if defined(_MSC_VER)
+    #define KB_ATOMIC_LOAD(Value) ReadAcquire(const_cast<volatile LONG*>(&(Value)))
+    #define KB_ATOMIC_LOAD_ACQUIRE(Value) ReadAcquire(const_cast<volatile LONG*>(&(Value)))
+    #define KB_ATOMIC_LOAD_RELAXED(Value) ReadNoFence(const_cast<volatile LONG*>(&(Value)))
+    #define KB_ATOMIC_STORE_RELAXED(Value, NewValue) WriteNoFence(&(Value), static_cast<LONG>(NewValue))
+    #define KB_ATOMIC_STORE_RELEASE(Value, NewValue) WriteRelease(&(Value), static_cast<LONG>(NewValue))
+    #define KB_ATOMIC_EXCHANGE(Value, NewValue) InterlockedExchange(&(Value), static_cast<LONG>(NewValue))
+    #define KB_ATOMIC_COMPARE_EXCHANGE(Value, NewValue, Comparand) InterlockedCompareExchange(&(Value), static_cast<LONG>(NewValue), static_cast<LONG>(Comparand))
+    #define KB_ATOMIC_INCREMENT(Value) InterlockedIncrement(&(Value))
+    #define KB_ATOMIC_DECREMENT(Value) InterlockedDecrement(&(Value))
+
+    #define KB_ATOMIC_LOAD64_RELAXED(Value) ReadNoFence64(&(Value))
+    #define KB_ATOMIC_ADD64_RELAXED(Value, Addend) InterlockedExchangeAdd64(&(Value), static_cast<LONG64>(Addend))
+    #define KB_ATOMIC_EXCHANGE64_RELAXED(Value, NewValue) InterlockedExchange64(&(Value), static_cast<LONG64>(NewValue))
+    #define KB_ATOMIC_COMPARE_EXCHANGE64(Value, NewValue, Comparand) InterlockedCompareExchange64(&(Value), static_cast<LONG64>(NewValue), static_cast<LONG64>(Comparand))
+
+    #define KB_ATOMIC_LOAD_POINTER(Pointer) ReadPointerAcquire(reinterpret_cast<PVOID volatile*>(const_cast<decltype(Pointer)*>(&(Pointer))))
+    #define KB_ATOMIC_LOAD_POINTER_ACQUIRE(Pointer) ReadPointerAcquire(reinterpret_cast<PVOID volatile*>(const_cast<decltype(Pointer)*>(&(Pointer))))
+    #define KB_ATOMIC_STORE_POINTER(Pointer, NewPointer) InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&(Pointer)), (NewPointer))
+    #define KB_ATOMIC_STORE_POINTER_RELEASE(Pointer, NewPointer) WritePointerRelease(reinterpret_cast<PVOID volatile*>(&(Pointer)), (NewPointer))
+    #define KB_ATOMIC_EXCHANGE_POINTER(Pointer, NewPointer) InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&(Pointer)), (NewPointer))
+    #define KB_ATOMIC_COMPARE_EXCHANGE_POINTER(Pointer, NewPointer, Comparand) InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&(Pointer)), (NewPointer), (Comparand))
+
+    #define KB_ATOMIC_FULL_BARRIER() MemoryBarrier()
+    #if defined(_M_IX86) || defined(_M_X64)
+        // Loads aren't reordered with older loads and stores aren't reordered with older accesses:
+        #define KB_ATOMIC_ACQUIRE_FENCE() _ReadWriteBarrier()
+        #define KB_ATOMIC_RELEASE_FENCE() _ReadWriteBarrier()
+    #else
+        #define KB_ATOMIC_ACQUIRE_FENCE() MemoryBarrier()
+        #define KB_ATOMIC_RELEASE_FENCE() MemoryBarrier()
+    #endif
+
+    #define KB_CPU_PAUSE() YieldProcessor()
+    #define KB_CPU_TIMESTAMP() static_cast<UINT64>(ReadTimeStampCounter())
+#else
+    #define KB_ATOMIC_LOAD(Value) __atomic_load_n(&(Value), __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_LOAD_ACQUIRE(Value) __atomic_load_n(&(Value), __ATOMIC_ACQUIRE)
+    #define KB_ATOMIC_LOAD_RELAXED(Value) __atomic_load_n(&(Value), __ATOMIC_RELAXED)
+    #define KB_ATOMIC_STORE_RELAXED(Value, NewValue) __atomic_store_n(&(Value), static_cast<LONG>(NewValue), __ATOMIC_RELAXED)
+    #define KB_ATOMIC_STORE_RELEASE(Value, NewValue) __atomic_store_n(&(Value), static_cast<LONG>(NewValue), __ATOMIC_RELEASE)
+    #define KB_ATOMIC_EXCHANGE(Value, NewValue) __atomic_exchange_n(&(Value), static_cast<LONG>(NewValue), __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_COMPARE_EXCHANGE(Value, NewValue, Comparand) __sync_val_compare_and_swap(&(Value), static_cast<LONG>(Comparand), static_cast<LONG>(NewValue))
+    #define KB_ATOMIC_INCREMENT(Value) __atomic_add_fetch(&(Value), 1, __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_DECREMENT(Value) __atomic_sub_fetch(&(Value), 1, __ATOMIC_SEQ_CST)
+
+    #define KB_ATOMIC_LOAD64_RELAXED(Value) __atomic_load_n(&(Value), __ATOMIC_RELAXED)
+    #define KB_ATOMIC_ADD64_RELAXED(Value, Addend) __atomic_fetch_add(&(Value), static_cast<LONG64>(Addend), __ATOMIC_RELAXED)
+    #define KB_ATOMIC_EXCHANGE64_RELAXED(Value, NewValue) __atomic_exchange_n(&(Value), static_cast<LONG64>(NewValue), __ATOMIC_RELAXED)
+    #define KB_ATOMIC_COMPARE_EXCHANGE64(Value, NewValue, Comparand) __sync_val_compare_and_swap(&(Value), static_cast<LONG64>(Comparand), static_cast<LONG64>(NewValue))
+
+    #define KB_ATOMIC_LOAD_POINTER(Pointer) __atomic_load_n(&(Pointer), __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_LOAD_POINTER_ACQUIRE(Pointer) __atomic_load_n(&(Pointer), __ATOMIC_ACQUIRE)
+    #define KB_ATOMIC_STORE_POINTER(Pointer, NewPointer) __atomic_store_n(&(Pointer), (NewPointer), __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_STORE_POINTER_RELEASE(Pointer, NewPointer) __atomic_store_n(&(Pointer), (NewPointer), __ATOMIC_RELEASE)
+    #define KB_ATOMIC_EXCHANGE_POINTER(Pointer, NewPointer) __atomic_exchange_n(&(Pointer), (NewPointer), __ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_COMPARE_EXCHANGE_POINTER(Pointer, NewPointer, Comparand) __sync_val_compare_and_swap(&(Pointer), (Comparand), (NewPointer))
+
+    #define KB_ATOMIC_FULL_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define KB_ATOMIC_ACQUIRE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+    #define KB_ATOMIC_RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+    #if defined(__i386__) || defined(__x86_64__)
+        #define KB_CPU_PAUSE() __builtin_ia32_pause()
+    #else
+        #define KB_CPU_PAUSE() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+    #endif
+    #define KB_CPU_TIMESTAMP() static_cast<UINT64>(__builtin_ia32_rdtsc())
+#endif
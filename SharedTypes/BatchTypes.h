@@ -0,0 +1,181 @@
+#pragma once
+
+// Batch of IOCTL requests executed by a single KbExecuteBatch call.
+// Layout of the batch buffer (every record is aligned to 8 bytes):
+//   KB_BATCH_HEADER
+//   KB_BATCH_ENTRY, Input[InputSize], Output[OutputSize]
+//   KB_BATCH_ENTRY, Input[InputSize], Output[OutputSize]
+//   ...
+// The batch is processed in-place: driver writes Status, ResponseLength
+// and output data of each entry back into the same buffer.
+
+constexpr unsigned int KB_BATCH_SIGNATURE = 0x4843544B; // 'KTCH'
+constexpr unsigned short KB_BATCH_VERSION = 1;
+
+enum KB_BATCH_FLAGS {
+    KbBatchNoFlags     = 0,
+    KbBatchStopOnError = 1, // Don't execute remaining entries after the first failed one
+};
+
+DECLARE_STRUCT(KB_BATCH_HEADER, {
+    ULONG Signature;     // KB_BATCH_SIGNATURE
+    USHORT Version;      // KB_BATCH_VERSION
+    USHORT HeaderSize;   // sizeof(KB_BATCH_HEADER)
+    ULONG Flags;         // KB_BATCH_FLAGS
+    ULONG EntriesCount;
+    ULONG TotalSize;     // Size of header and all entries
+    ULONG ExecutedCount; // Filled by driver
+});
+
+DECLARE_STRUCT(KB_BATCH_ENTRY, {
+    ULONG EntrySize;           // Size of entry header with aligned input and output
+    ULONG CtlIndex;            // Ctls::KbCtlIndices
+    ULONG InputSize;
+    ULONG OutputSize;
+    WdkTypes::NTSTATUS Status; // Filled by driver
+    ULONG ResponseLength;      // Filled by driver
+});
+
+namespace Batch {
+    constexpr ULONG Alignment = 8;
+
+    constexpr ULONG AlignSize(ULONG Size) {
+        return (Size + (Alignment - 1)) & ~(Alignment - 1);
+    }
+
+    // Maximum size of input or output of a single entry:
+    constexpr ULONG MaxDataSize = 0x10000000;
+
+    constexpr ULONG GetEntrySize(ULONG InputSize, ULONG OutputSize) {
+        return sizeof(KB_BATCH_ENTRY) + AlignSize(InputSize) + AlignSize(OutputSize);
+    }
+
+    inline PVOID GetEntryInput(PKB_BATCH_ENTRY Entry) {
+        return reinterpret_cast<PUCHAR>(Entry) + sizeof(KB_BATCH_ENTRY);
+    }
+
+    inline PVOID GetEntryOutput(PKB_BATCH_ENTRY Entry, ULONG InputSize) {
+        return reinterpret_cast<PUCHAR>(Entry) + sizeof(KB_BATCH_ENTRY) + AlignSize(InputSize);
+    }
+
+    // Initializes an empty batch, 'Buffer' must be at least sizeof(KB_BATCH_HEADER) bytes:
+    inline PKB_BATCH_HEADER InitializeBatch(PVOID Buffer, ULONG BufferSize, ULONG Flags = KbBatchNoFlags)
+    {
+        if (!Buffer || BufferSize < sizeof(KB_BATCH_HEADER)) return NULL;
+        auto Header = static_cast<PKB_BATCH_HEADER>(Buffer);
+        Header->Signature = KB_BATCH_SIGNATURE;
+        Header->Version = KB_BATCH_VERSION;
+        Header->HeaderSize = sizeof(KB_BATCH_HEADER);
+        Header->Flags = Flags;
+        Header->EntriesCount = 0;
+        Header->TotalSize = sizeof(KB_BATCH_HEADER);
+        Header->ExecutedCount = 0;
+        return Header;
+    }
+
+    // Appends an entry to the end of initialized batch,
+    // returns NULL if there is not enough space in the 'Buffer':
+    inline PKB_BATCH_ENTRY AppendEntry(
+        PVOID Buffer,
+        ULONG BufferSize,
+        ULONG CtlIndex,
+        OPTIONAL const VOID* Input,
+        ULONG InputSize,
+        ULONG OutputSize
+    ) {
+        if (!Buffer || InputSize > MaxDataSize || OutputSize > MaxDataSize) return NULL;
+        if (InputSize && !Input) return NULL;
+
+        auto Header = static_cast<PKB_BATCH_HEADER>(Buffer);
+        ULONG EntrySize = GetEntrySize(InputSize, OutputSize);
+        if (Header->TotalSize > BufferSize || BufferSize - Header->TotalSize < EntrySize) return NULL;
+
+        auto Entry = reinterpret_cast<PKB_BATCH_ENTRY>(static_cast<PUCHAR>(Buffer) + Header->TotalSize);
+        Entry->EntrySize = EntrySize;
+        Entry->CtlIndex = CtlIndex;
+        Entry->InputSize = InputSize;
+        Entry->OutputSize = OutputSize;
+        Entry->Status = 0;
+        Entry->ResponseLength = 0;
+
+        auto Data = static_cast<PUCHAR>(GetEntryInput(Entry));
+        for (ULONG i = 0; i < EntrySize - sizeof(KB_BATCH_ENTRY); i++) {
+            Data[i] = i < InputSize ? static_cast<const UCHAR*>(Input)[i] : 0;
+        }
+
+        Header->EntriesCount++;
+        Header->TotalSize += EntrySize;
+        return Entry;
+    }
+
+    // Sequential reader of batch entries.
+    // Header and entries fields are captured into a local copies before validation,
+    // so the buffer may be safely changed by another thread while decoding:
+    class Decoder {
+    private:
+        PUCHAR Buffer;
+        ULONG BufferSize;
+        KB_BATCH_HEADER Header;
+        ULONG Offset;
+        ULONG Decoded;
+        BOOLEAN Valid;
+        BOOLEAN Malformed;
+    public:
+        Decoder(const Decoder&) = delete;
+        Decoder(Decoder&&) = delete;
+        Decoder& operator = (const Decoder&) = delete;
+        Decoder& operator = (Decoder&&) = delete;
+
+        Decoder(PVOID Batch, ULONG Size)
+            : Buffer(static_cast<PUCHAR>(Batch)), BufferSize(Size), Header({}),
+              Offset(0), Decoded(0), Valid(FALSE), Malformed(FALSE)
+        {
+            if (!Buffer || BufferSize < sizeof(KB_BATCH_HEADER)) return;
+            Header = *reinterpret_cast<PKB_BATCH_HEADER>(Buffer);
+            Valid = Header.Signature == KB_BATCH_SIGNATURE
+                && Header.Version == KB_BATCH_VERSION
+                && Header.HeaderSize == sizeof(KB_BATCH_HEADER)
+                && Header.TotalSize >= sizeof(KB_BATCH_HEADER)
+                && Header.TotalSize <= BufferSize;
+            Offset = sizeof(KB_BATCH_HEADER);
+        }
+
+        ~Decoder() = default;
+
+        BOOLEAN IsValid() const { return Valid; }
+        BOOLEAN IsMalformed() const { return Malformed; }
+        ULONG GetFlags() const { return Header.Flags; }
+        ULONG GetEntriesCount() const { return Header.EntriesCount; }
+        ULONG GetTotalSize() const { return Header.TotalSize; }
+        PKB_BATCH_HEADER GetHeader() const { return reinterpret_cast<PKB_BATCH_HEADER>(Buffer); }
+
+        // Returns pointer to the next entry in the buffer and its validated copy in 'Entry',
+        // returns NULL when all entries are decoded or the batch is malformed:
+        PKB_BATCH_ENTRY Next(OUT PKB_BATCH_ENTRY Entry)
+        {
+            if (!Valid || Malformed || Decoded >= Header.EntriesCount) return NULL;
+
+            if (Header.TotalSize - Offset < sizeof(KB_BATCH_ENTRY)) {
+                Malformed = TRUE;
+                return NULL;
+            }
+
+            auto Record = reinterpret_cast<PKB_BATCH_ENTRY>(Buffer + Offset);
+            *Entry = *Record;
+
+            if (
+                Entry->InputSize > MaxDataSize ||
+                Entry->OutputSize > MaxDataSize ||
+                Entry->EntrySize != GetEntrySize(Entry->InputSize, Entry->OutputSize) ||
+                Entry->EntrySize > Header.TotalSize - Offset
+            ) {
+                Malformed = TRUE;
+                return NULL;
+            }
+
+            Offset += Entry->EntrySize;
+            Decoded++;
+            return Record;
+        }
+    };
+}
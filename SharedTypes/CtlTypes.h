@@ -87,7 +87,22 @@ namespace Ctls {
         /* 61 */ KbGetKernelProcAddress,
         /* 62 */ KbStallExecutionProcessor,
         /* 63 */ KbBugCheck,
-        /* 64 */ KbCreateDriver
+        /* 64 */ KbCreateDriver,
+
+        // Batching:
+        /* 65 */ KbExecuteBatch,
+
+        // Submission rings:
+        /* 66 */ KbCreateRings,
+        /* 67 */ KbDestroyRings,
+        /* 68 */ KbRingDoorbell,
+
+        // Vectored memory operations:
+        /* 69 */ KbReadProcessMemoryVectored,
+        /* 70 */ KbWriteProcessMemoryVectored,
+
+        // Diagnostics:
+        /* 71 */ KbGetLockStats
     };
 }
 
@@ -416,6 +431,19 @@ DECLARE_STRUCT(KB_READ_WRITE_PROCESS_MEMORY_IN, {
     ULONG Size;
 });
 
+DECLARE_STRUCT(KB_MEMORY_DESCRIPTOR, {
+    WdkTypes::PVOID BaseAddress; // Address in the target process
+    WdkTypes::PVOID Buffer;      // Buffer in the caller process
+    ULONG Size;
+    WdkTypes::NTSTATUS Status;   // Filled by driver
+});
+
+DECLARE_STRUCT(KB_READ_WRITE_PROCESS_MEMORY_VECTORED_IN, {
+    UINT64 ProcessId;
+    WdkTypes::PVOID Descriptors; // PKB_MEMORY_DESCRIPTOR
+    ULONG Count;
+});
+
 DECLARE_STRUCT(KB_SUSPEND_RESUME_PROCESS_IN, {
     UINT64 ProcessId;
 });
@@ -481,4 +509,24 @@ DECLARE_STRUCT(KB_CREATE_DRIVER_IN, {
     WdkTypes::PVOID DriverEntry;
     WdkTypes::LPCWSTR DriverName;
     ULONG DriverNameSizeInBytes;
+});
+
+DECLARE_STRUCT(KB_CREATE_RINGS_IN, {
+    ULONG SubmissionEntries; // Power of 2
+    ULONG CompletionEntries; // Power of 2
+});
+
+DECLARE_STRUCT(KB_CREATE_RINGS_OUT, {
+    WdkTypes::PVOID SubmissionRing; // PKB_RING_HEADER
+    WdkTypes::PVOID CompletionRing; // PKB_RING_HEADER
+});
+
+DECLARE_STRUCT(KB_GET_LOCK_STATS_IN, {
+    BOOLEAN Reset; // Zero counters after the read
+});
+
+// Followed by 'Count' of KB_LOCK_STATS (LockStatsTypes.h), as many as fit into the output buffer:
+DECLARE_STRUCT(KB_GET_LOCK_STATS_OUT, {
+    ULONG TotalCount; // Count of lock names in the driver
+    ULONG Count;      // Count of entries written after the header
 });
\ No newline at end of file
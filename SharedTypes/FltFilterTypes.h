@@ -0,0 +1,500 @@
+#pragma once
+
+// Per-client event filters, the driver evaluates them before the path
+// of a file is obtained and before the event is sent to the client.
+// Compiled filter is appended to KB_FLT_CONTEXT in the connection context:
+//   KB_FLT_CONTEXT
+//   KB_FLT_PROGRAM_HEADER
+//   KB_FLT_INSTRUCTION Instructions[InstructionsCount]
+//   Data[DataSize] (process IDs and path patterns referenced by instructions)
+//
+// Every instruction tests a single field of the event and continues at 'OnTrue' or 'OnFalse':
+// index of the next instruction (it must be greater than the current one, so every
+// program terminates after at most InstructionsCount steps) or KbFltAccept/KbFltReject.
+// Driver checks the program by IsProgramValid once on connection and refuses malformed ones.
+
+constexpr unsigned int KB_FLT_PROGRAM_SIGNATURE = 0x50544C46; // 'FLTP'
+constexpr unsigned short KB_FLT_PROGRAM_VERSION = 1;
+
+enum KB_FLT_OPCODE {
+    KbFltOpAlways,     // Always true
+    KbFltOpProcessIn,  // ProcessId is in the sorted UINT64[Count] at Data + Offset
+    KbFltOpPathPrefix, // Path starts with WCHAR[Count] at Data + Offset
+    KbFltOpPathGlob,   // Path matches WCHAR[Count] at Data + Offset ('*' and '?')
+    KbFltOpIoctlRange, // Low <= Ioctl <= High
+    KbFltOpSizeRange,  // Low <= Size <= High
+    KbFltOpPathRules,  // Path matches any rule of KB_FLT_RULES_HEADER at Data + Offset, Count is its size in bytes
+    KbFltOpMaximum
+};
+
+constexpr unsigned short KbFltAccept = 0xFFFF;
+constexpr unsigned short KbFltReject = 0xFFFE;
+
+// Max count of instructions, any index below is a valid jump target:
+constexpr unsigned short KbFltMaxInstructions = 0xFF00;
+
+DECLARE_STRUCT(KB_FLT_PROGRAM_HEADER, {
+    ULONG Signature;          // KB_FLT_PROGRAM_SIGNATURE
+    USHORT Version;           // KB_FLT_PROGRAM_VERSION
+    USHORT InstructionsCount;
+    ULONG DataSize;
+    ULONG Reserved;
+});
+
+DECLARE_STRUCT(KB_FLT_INSTRUCTION, {
+    USHORT Opcode;  // KB_FLT_OPCODE
+    USHORT OnTrue;  // Index of instruction, KbFltAccept or KbFltReject
+    USHORT OnFalse; // Index of instruction, KbFltAccept or KbFltReject
+    USHORT Reserved;
+    ULONG Offset;   // Offset of operand in the Data
+    ULONG Count;    // Count of elements of operand
+    UINT64 Low;
+    UINT64 High;
+});
+
+// Compiled set of path prefixes and masks, evaluated at once instead of one instruction per rule:
+//   KB_FLT_RULES_HEADER
+//   KB_FLT_RULE_NODE Nodes[NodesCount]
+//   KB_FLT_RULE_ENTRY Entries[EntriesCount]
+//   WCHAR Chars[CharsCount] (labels of nodes and unmatched parts of masks)
+//
+// Nodes form three radix tries of folded characters: prefixes from node 0, reversed suffixes
+// from ReverseRoot and infixes from InfixRoot. Rules are attached to nodes as entries:
+//   - prefix is attached to the end of its path in the trie of prefixes;
+//   - mask is attached by its literal head (before the first wildcard) to the trie of prefixes,
+//     otherwise by its literal tail (after the last wildcard) to the trie of suffixes,
+//     and its rest is matched by IsPathMatches only if the trie reaches its node;
+//   - masks with wildcards at both ends (e.g. '*\Temp\*') are attached by their longest
+//     literal part to the trie of infixes and matched as a whole only if the path contains it;
+//   - masks without literal parts (e.g. '*') are matched for every path.
+// So the cost of an event depends on the length of its path, not on the count of rules.
+constexpr unsigned int KbFltRuleNoMask = 0xFFFFFFFF;
+
+// Distinct infixes found in one path before matching falls back to all masks of infixes:
+constexpr unsigned int KbFltMaxSeenInfixes = 64;
+
+DECLARE_STRUCT(KB_FLT_RULES_HEADER, {
+    ULONG RulesCount;      // IDs of rules are below it
+    ULONG NodesCount;
+    ULONG EntriesCount;
+    ULONG CharsCount;
+    ULONG ReverseRoot;     // Root of the trie of suffixes, the trie of prefixes starts at 0
+    ULONG InfixRoot;       // Root of the trie of infixes, it spans up to the last node
+    ULONG UnanchoredEntry; // Entries from it to the end are matched for every path
+});
+
+DECLARE_STRUCT(KB_FLT_RULE_NODE, {
+    ULONG LabelOffset;    // Folded WCHAR[LabelLength] in Chars, reversed in the trie of suffixes
+    USHORT LabelLength;
+    USHORT ChildrenCount; // Children are consecutive and sorted by the first character of their labels
+    ULONG FirstChild;     // Greater than the index of the node
+    ULONG FirstEntry;     // Entries of the node end at FirstEntry of the next node (or at UnanchoredEntry)
+});
+
+DECLARE_STRUCT(KB_FLT_RULE_ENTRY, {
+    ULONG Id;
+    ULONG MaskOffset; // The part of the mask that isn't matched by the trie
+    ULONG MaskLength; // KbFltRuleNoMask for prefixes
+});
+
+namespace FltFilter {
+    // Returns the path of the event, it is called at most once per event:
+    using _QueryPath = BOOLEAN(*)(PVOID Context, OUT const WCHAR** Path, OUT PULONG Length);
+
+    using EVENT = struct {
+        UINT64 ProcessId;
+        ULONG Ioctl;
+        ULONG Size;
+        const WCHAR* Path; // Not null-terminated, may be NULL until QueryPath is called
+        ULONG PathLength;  // In characters
+        _QueryPath QueryPath;
+        PVOID QueryContext;
+        BOOLEAN PathQueried;
+    };
+    using PEVENT = EVENT*;
+
+    inline ULONG GetProgramSize(const KB_FLT_PROGRAM_HEADER* Header) {
+        return sizeof(KB_FLT_PROGRAM_HEADER) + Header->InstructionsCount * sizeof(KB_FLT_INSTRUCTION) + Header->DataSize;
+    }
+
+    inline const KB_FLT_INSTRUCTION* GetInstructions(const KB_FLT_PROGRAM_HEADER* Header) {
+        return reinterpret_cast<const KB_FLT_INSTRUCTION*>(Header + 1);
+    }
+
+    inline const UCHAR* GetData(const KB_FLT_PROGRAM_HEADER* Header) {
+        return reinterpret_cast<const UCHAR*>(GetInstructions(Header) + Header->InstructionsCount);
+    }
+
+    inline const KB_FLT_RULE_NODE* GetRuleNodes(const KB_FLT_RULES_HEADER* Rules) {
+        return reinterpret_cast<const KB_FLT_RULE_NODE*>(Rules + 1);
+    }
+
+    inline const KB_FLT_RULE_ENTRY* GetRuleEntries(const KB_FLT_RULES_HEADER* Rules) {
+        return reinterpret_cast<const KB_FLT_RULE_ENTRY*>(GetRuleNodes(Rules) + Rules->NodesCount);
+    }
+
+    inline const WCHAR* GetRuleChars(const KB_FLT_RULES_HEADER* Rules) {
+        return reinterpret_cast<const WCHAR*>(GetRuleEntries(Rules) + Rules->EntriesCount);
+    }
+
+    // Checks all references of nodes and entries, so matching may skip bounds checks
+    // and always terminates (children are after their parents):
+    inline BOOLEAN IsRuleSetValid(const VOID* RuleSet, ULONG Size)
+    {
+        if (!RuleSet || Size < sizeof(KB_FLT_RULES_HEADER)) return FALSE;
+
+        auto Rules = static_cast<const KB_FLT_RULES_HEADER*>(RuleSet);
+        ULONG Available = Size - sizeof(KB_FLT_RULES_HEADER);
+        if (Rules->NodesCount > Available / sizeof(KB_FLT_RULE_NODE)) return FALSE;
+        Available -= Rules->NodesCount * sizeof(KB_FLT_RULE_NODE);
+        if (Rules->EntriesCount > Available / sizeof(KB_FLT_RULE_ENTRY)) return FALSE;
+        Available -= Rules->EntriesCount * sizeof(KB_FLT_RULE_ENTRY);
+        if (Rules->CharsCount != Available / sizeof(WCHAR) || Available % sizeof(WCHAR)) return FALSE;
+
+        if (Rules->ReverseRoot >= Rules->NodesCount || Rules->InfixRoot >= Rules->NodesCount) return FALSE;
+        if (Rules->UnanchoredEntry > Rules->EntriesCount) return FALSE;
+
+        const KB_FLT_RULE_NODE* Nodes = GetRuleNodes(Rules);
+        ULONG PreviousEntry = 0;
+        for (ULONG i = 0; i < Rules->NodesCount; i++) {
+            const KB_FLT_RULE_NODE* Node = &Nodes[i];
+            if (Node->LabelOffset > Rules->CharsCount || Node->LabelLength > Rules->CharsCount - Node->LabelOffset) return FALSE;
+            if (Node->ChildrenCount) {
+                if (Node->FirstChild <= i || Node->FirstChild > Rules->NodesCount) return FALSE;
+                if (Node->ChildrenCount > Rules->NodesCount - Node->FirstChild) return FALSE;
+            }
+            if (Node->FirstEntry < PreviousEntry || Node->FirstEntry > Rules->UnanchoredEntry) return FALSE;
+            PreviousEntry = Node->FirstEntry;
+        }
+
+        const KB_FLT_RULE_ENTRY* Entries = GetRuleEntries(Rules);
+        for (ULONG i = 0; i < Rules->EntriesCount; i++) {
+            const KB_FLT_RULE_ENTRY* Entry = &Entries[i];
+            if (Entry->Id >= Rules->RulesCount) return FALSE;
+            if (Entry->MaskLength == KbFltRuleNoMask) continue;
+            if (Entry->MaskOffset > Rules->CharsCount || Entry->MaskLength > Rules->CharsCount - Entry->MaskOffset) return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    // Checks the header and all instructions, so Evaluate may skip bounds checks of operands:
+    inline BOOLEAN IsProgramValid(const VOID* Program, ULONG ProgramSize)
+    {
+        if (!Program || ProgramSize < sizeof(KB_FLT_PROGRAM_HEADER)) return FALSE;
+
+        auto Header = static_cast<const KB_FLT_PROGRAM_HEADER*>(Program);
+        if (Header->Signature != KB_FLT_PROGRAM_SIGNATURE || Header->Version != KB_FLT_PROGRAM_VERSION) return FALSE;
+        if (Header->InstructionsCount > KbFltMaxInstructions) return FALSE;
+        if (Header->DataSize > ProgramSize || GetProgramSize(Header) != ProgramSize) return FALSE;
+
+        const KB_FLT_INSTRUCTION* Instructions = GetInstructions(Header);
+        for (ULONG i = 0; i < Header->InstructionsCount; i++) {
+            const KB_FLT_INSTRUCTION* Instruction = &Instructions[i];
+            if (Instruction->Opcode >= KbFltOpMaximum) return FALSE;
+
+            // Only forward jumps are allowed:
+            if (Instruction->OnTrue <= i || (Instruction->OnTrue < KbFltReject && Instruction->OnTrue > Header->InstructionsCount)) return FALSE;
+            if (Instruction->OnFalse <= i || (Instruction->OnFalse < KbFltReject && Instruction->OnFalse > Header->InstructionsCount)) return FALSE;
+
+            ULONG ElementSize = 0;
+            switch (Instruction->Opcode) {
+            case KbFltOpProcessIn:
+                ElementSize = sizeof(UINT64);
+                if (Instruction->Offset % sizeof(UINT64)) return FALSE;
+                break;
+            case KbFltOpPathPrefix:
+            case KbFltOpPathGlob:
+                ElementSize = sizeof(WCHAR);
+                if (Instruction->Offset % sizeof(WCHAR)) return FALSE;
+                break;
+            case KbFltOpPathRules:
+                ElementSize = sizeof(UCHAR);
+                if (Instruction->Offset % sizeof(ULONG)) return FALSE;
+                break;
+            }
+
+            if (ElementSize) {
+                if (Instruction->Offset > Header->DataSize) return FALSE;
+                if (Instruction->Count > (Header->DataSize - Instruction->Offset) / ElementSize) return FALSE;
+            }
+
+            if (Instruction->Opcode == KbFltOpPathRules) {
+                if (!IsRuleSetValid(GetData(Header) + Instruction->Offset, Instruction->Count)) return FALSE;
+            }
+        }
+
+        return TRUE;
+    }
+
+    // Case-insensitive for ASCII letters only:
+    inline WCHAR FoldChar(WCHAR Char) {
+        return (Char >= L'a' && Char <= L'z') ? static_cast<WCHAR>(Char - (L'a' - L'A')) : Char;
+    }
+
+    inline BOOLEAN IsPathStartsWith(const WCHAR* Path, ULONG PathLength, const WCHAR* Prefix, ULONG PrefixLength)
+    {
+        if (PrefixLength > PathLength) return FALSE;
+        for (ULONG i = 0; i < PrefixLength; i++) {
+            if (FoldChar(Path[i]) != FoldChar(Prefix[i])) return FALSE;
+        }
+        return TRUE;
+    }
+
+    // '*' matches any sequence (including path separators), '?' matches any single character:
+    inline BOOLEAN IsPathMatches(const WCHAR* Path, ULONG PathLength, const WCHAR* Mask, ULONG MaskLength)
+    {
+        ULONG p = 0, m = 0;
+        BOOLEAN HasStar = FALSE;
+        ULONG StarMask = 0, StarPath = 0; // Positions to retry from after the last '*'
+        while (p < PathLength) {
+            if (m < MaskLength && Mask[m] == L'*') {
+                HasStar = TRUE;
+                StarMask = ++m;
+                StarPath = p;
+            } else if (m < MaskLength && (Mask[m] == L'?' || FoldChar(Mask[m]) == FoldChar(Path[p]))) {
+                m++;
+                p++;
+            } else if (HasStar) {
+                m = StarMask;
+                p = ++StarPath;
+            } else {
+                return FALSE;
+            }
+        }
+        while (m < MaskLength && Mask[m] == L'*') m++;
+        return m == MaskLength;
+    }
+
+    // Children are sorted, so long lists are searched by bisection:
+    inline const KB_FLT_RULE_NODE* FindRuleChild(const KB_FLT_RULE_NODE* Nodes, const WCHAR* Chars, const KB_FLT_RULE_NODE* Node, WCHAR Folded)
+    {
+        const KB_FLT_RULE_NODE* Children = &Nodes[Node->FirstChild];
+        ULONG Left = 0, Right = Node->ChildrenCount;
+        while (Right - Left > 8) {
+            ULONG Middle = Left + (Right - Left) / 2;
+            WCHAR First = Children[Middle].LabelLength ? Chars[Children[Middle].LabelOffset] : 0;
+            if (First == Folded) return &Children[Middle];
+            if (First < Folded) Left = Middle + 1;
+            else Right = Middle;
+        }
+        for (; Left < Right; Left++) {
+            if (Children[Left].LabelLength && Chars[Children[Left].LabelOffset] == Folded) return &Children[Left];
+        }
+        return NULL;
+    }
+
+    inline ULONG GetRuleEntriesEnd(const KB_FLT_RULES_HEADER* Rules, ULONG Node) {
+        return Node + 1 < Rules->NodesCount ? GetRuleNodes(Rules)[Node + 1].FirstEntry : Rules->UnanchoredEntry;
+    }
+
+    // Walks the trie along the path (from its end if 'Reverse') and calls 'OnNode(Node, Depth)'
+    // for every reached node, stops and returns FALSE if 'OnNode' returns FALSE:
+    template <typename TOnNode>
+    inline BOOLEAN WalkRuleTrie(const KB_FLT_RULES_HEADER* Rules, ULONG Root, bool Reverse, const WCHAR* Path, ULONG PathLength, TOnNode& OnNode)
+    {
+        const KB_FLT_RULE_NODE* Nodes = GetRuleNodes(Rules);
+        const WCHAR* Chars = GetRuleChars(Rules);
+
+        const KB_FLT_RULE_NODE* Node = &Nodes[Root];
+        ULONG Depth = 0;
+        for (;;) {
+            if (!OnNode(static_cast<ULONG>(Node - Nodes), Depth)) return FALSE;
+
+            if (Depth == PathLength || !Node->ChildrenCount) break;
+            const WCHAR* Next = Reverse ? &Path[PathLength - Depth - 1] : &Path[Depth];
+            const KB_FLT_RULE_NODE* Child = FindRuleChild(Nodes, Chars, Node, FoldChar(*Next));
+            if (!Child || Child->LabelLength > PathLength - Depth) break;
+
+            const WCHAR* Label = &Chars[Child->LabelOffset];
+            ULONG Matched = 1;
+            if (Reverse) {
+                while (Matched < Child->LabelLength && FoldChar(*(Next - Matched)) == Label[Matched]) Matched++;
+            } else {
+                while (Matched < Child->LabelLength && FoldChar(Next[Matched]) == Label[Matched]) Matched++;
+            }
+            if (Matched != Child->LabelLength) break;
+
+            Depth += Matched;
+            Node = Child;
+        }
+        return TRUE;
+    }
+
+    // Calls 'OnMatch(Id)' for every matched rule (in no particular order), stops and returns FALSE
+    // if 'OnMatch' returns FALSE. Rule set must be checked by IsRuleSetValid before:
+    template <typename TOnMatch>
+    inline BOOLEAN ForEachMatchedRule(const VOID* RuleSet, const WCHAR* Path, ULONG PathLength, TOnMatch OnMatch)
+    {
+        auto Rules = static_cast<const KB_FLT_RULES_HEADER*>(RuleSet);
+        const KB_FLT_RULE_NODE* Nodes = GetRuleNodes(Rules);
+        const KB_FLT_RULE_ENTRY* Entries = GetRuleEntries(Rules);
+        const WCHAR* Chars = GetRuleChars(Rules);
+
+        // Matches the unmatched parts of masks of the node against the rest of the path:
+        auto MatchEntries = [&](ULONG Node, const WCHAR* Rest, ULONG RestLength) -> bool {
+            for (ULONG i = Nodes[Node].FirstEntry; i < GetRuleEntriesEnd(Rules, Node); i++) {
+                const KB_FLT_RULE_ENTRY* Entry = &Entries[i];
+                BOOLEAN Matches = Entry->MaskLength == KbFltRuleNoMask
+                    || IsPathMatches(Rest, RestLength, &Chars[Entry->MaskOffset], Entry->MaskLength);
+                if (Matches && !OnMatch(Entry->Id)) return false;
+            }
+            return true;
+        };
+
+        auto OnPrefix = [&](ULONG Node, ULONG Depth) -> bool {
+            return MatchEntries(Node, Path + Depth, PathLength - Depth);
+        };
+        if (!WalkRuleTrie(Rules, 0, false, Path, PathLength, OnPrefix)) return FALSE;
+
+        auto OnSuffix = [&](ULONG Node, ULONG Depth) -> bool {
+            return MatchEntries(Node, Path, PathLength - Depth);
+        };
+        if (!WalkRuleTrie(Rules, Rules->ReverseRoot, true, Path, PathLength, OnSuffix)) return FALSE;
+
+        // Infixes are searched from every position of the path and whole masks are matched
+        // at the first occurrence of their infix only, so every rule is reported once.
+        // Too many distinct infixes in one path fall back to matching of all remaining masks:
+        ULONG Seen[KbFltMaxSeenInfixes];
+        ULONG SeenCount = 0;
+        bool Overflow = false;
+        auto IsSeen = [&](ULONG Node) -> bool {
+            for (ULONG i = 0; i < SeenCount; i++) {
+                if (Seen[i] == Node) return true;
+            }
+            return false;
+        };
+        auto OnInfix = [&](ULONG Node, ULONG Depth) -> bool {
+            UNREFERENCED_PARAMETER(Depth);
+            if (Nodes[Node].FirstEntry == GetRuleEntriesEnd(Rules, Node) || IsSeen(Node)) return true;
+            if (SeenCount == KbFltMaxSeenInfixes) {
+                Overflow = true;
+                return false;
+            }
+            Seen[SeenCount++] = Node;
+            return MatchEntries(Node, Path, PathLength);
+        };
+        for (ULONG Start = 0; Start < PathLength; Start++) {
+            if (!WalkRuleTrie(Rules, Rules->InfixRoot, false, Path + Start, PathLength - Start, OnInfix)) {
+                if (!Overflow) return FALSE;
+                break;
+            }
+        }
+        if (Overflow) {
+            for (ULONG Node = Rules->InfixRoot; Node < Rules->NodesCount; Node++) {
+                if (!IsSeen(Node) && !MatchEntries(Node, Path, PathLength)) return FALSE;
+            }
+        }
+
+        for (ULONG i = Rules->UnanchoredEntry; i < Rules->EntriesCount; i++) {
+            const KB_FLT_RULE_ENTRY* Entry = &Entries[i];
+            BOOLEAN Matches = Entry->MaskLength == KbFltRuleNoMask
+                || IsPathMatches(Path, PathLength, &Chars[Entry->MaskOffset], Entry->MaskLength);
+            if (Matches && !OnMatch(Entry->Id)) return FALSE;
+        }
+        return TRUE;
+    }
+
+    // Returns the count of matched rules, IDs of the first 'MaxIds' of them are written to 'Ids':
+    inline ULONG MatchRules(const VOID* RuleSet, const WCHAR* Path, ULONG PathLength, OUT OPTIONAL PULONG Ids, ULONG MaxIds)
+    {
+        ULONG Count = 0;
+        ForEachMatchedRule(RuleSet, Path, PathLength, [&](ULONG Id) -> bool {
+            if (Ids && Count < MaxIds) Ids[Count] = Id;
+            Count++;
+            return true;
+        });
+        return Count;
+    }
+
+    inline BOOLEAN IsAnyRuleMatches(const VOID* RuleSet, const WCHAR* Path, ULONG PathLength)
+    {
+        return !ForEachMatchedRule(RuleSet, Path, PathLength, [](ULONG) -> bool { return false; });
+    }
+
+    inline BOOLEAN IsInSortedSet(const UCHAR* Data, ULONG Offset, ULONG Count, UINT64 Value)
+    {
+        auto Set = reinterpret_cast<const UINT64*>(Data + Offset);
+        ULONG Left = 0, Right = Count;
+        while (Left < Right) {
+            ULONG Middle = Left + (Right - Left) / 2;
+            if (Set[Middle] == Value) return TRUE;
+            if (Set[Middle] < Value) Left = Middle + 1;
+            else Right = Middle;
+        }
+        return FALSE;
+    }
+
+    inline BOOLEAN QueryEventPath(IN OUT PEVENT Event)
+    {
+        if (!Event->PathQueried) {
+            Event->PathQueried = TRUE;
+            if (!Event->Path && Event->QueryPath) {
+                if (!Event->QueryPath(Event->QueryContext, &Event->Path, &Event->PathLength)) {
+                    Event->Path = NULL;
+                    Event->PathLength = 0;
+                }
+            }
+        }
+        return Event->Path != NULL;
+    }
+
+    // Returns TRUE if the event should be sent to the client, empty program accepts all events.
+    // Program must be checked by IsProgramValid before:
+    inline BOOLEAN Evaluate(const VOID* Program, ULONG ProgramSize, IN OUT PEVENT Event)
+    {
+        if (!Program || !ProgramSize) return TRUE;
+
+        auto Header = static_cast<const KB_FLT_PROGRAM_HEADER*>(Program);
+        const KB_FLT_INSTRUCTION* Instructions = GetInstructions(Header);
+        const UCHAR* Data = GetData(Header);
+
+        ULONG Index = 0;
+        while (Index < Header->InstructionsCount) {
+            const KB_FLT_INSTRUCTION* Instruction = &Instructions[Index];
+
+            BOOLEAN Result = FALSE;
+            switch (Instruction->Opcode) {
+            case KbFltOpAlways:
+                Result = TRUE;
+                break;
+            case KbFltOpProcessIn:
+                Result = IsInSortedSet(Data, Instruction->Offset, Instruction->Count, Event->ProcessId);
+                break;
+            case KbFltOpPathPrefix:
+                Result = QueryEventPath(Event) && IsPathStartsWith(
+                    Event->Path,
+                    Event->PathLength,
+                    reinterpret_cast<const WCHAR*>(Data + Instruction->Offset),
+                    Instruction->Count
+                );
+                break;
+            case KbFltOpPathGlob:
+                Result = QueryEventPath(Event) && IsPathMatches(
+                    Event->Path,
+                    Event->PathLength,
+                    reinterpret_cast<const WCHAR*>(Data + Instruction->Offset),
+                    Instruction->Count
+                );
+                break;
+            case KbFltOpPathRules:
+                Result = QueryEventPath(Event) && IsAnyRuleMatches(Data + Instruction->Offset, Event->Path, Event->PathLength);
+                break;
+            case KbFltOpIoctlRange:
+                Result = Event->Ioctl >= Instruction->Low && Event->Ioctl <= Instruction->High;
+                break;
+            case KbFltOpSizeRange:
+                Result = Event->Size >= Instruction->Low && Event->Size <= Instruction->High;
+                break;
+            }
+
+            USHORT Next = Result ? Instruction->OnTrue : Instruction->OnFalse;
+            if (Next == KbFltAccept) return TRUE;
+            if (Next == KbFltReject) return FALSE;
+            Index = Next;
+        }
+
+        // Falling off the end of program:
+        return FALSE;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// Frames of events for batched subscriptions (KbFltBatched in KB_FLT_CONTEXT::Flags).
+// The driver packs all pending events of a client into one message:
+//   KB_FLT_FRAME_HEADER
+//   Records[Count], every record is KB_FLT_***_INFO of the subscription type
+// Message size is sizeof(KB_FLT_FRAME_HEADER) + Count * RecordSize and never exceeds KB_FLT_FRAME_SIZE,
+// so the client receives frames into KB_FLT_FRAME.
+//
+// Records follow the 16-byte header without gaps and sizes of KB_FLT_***_INFO
+// are multiples of 8, so every record is naturally aligned.
+
+constexpr unsigned int KB_FLT_FRAME_SIGNATURE = 0x4D524646; // 'FFRM'
+constexpr unsigned int KB_FLT_FRAME_SIZE = 16384;
+
+DECLARE_STRUCT(KB_FLT_FRAME_HEADER, {
+    ULONG Signature;  // KB_FLT_FRAME_SIGNATURE
+    ULONG RecordSize; // sizeof(KB_FLT_***_INFO)
+    ULONG Count;
+    ULONG Reserved;
+});
+
+DECLARE_STRUCT(KB_FLT_FRAME, {
+    KB_FLT_FRAME_HEADER Header;
+    UCHAR Records[KB_FLT_FRAME_SIZE - sizeof(KB_FLT_FRAME_HEADER)];
+});
+
+namespace FltFrame {
+    constexpr ULONG MaxRecordsSize = KB_FLT_FRAME_SIZE - sizeof(KB_FLT_FRAME_HEADER);
+
+    inline ULONG GetCapacity(ULONG RecordSize) {
+        return RecordSize ? MaxRecordsSize / RecordSize : 0;
+    }
+
+    // Size of the used part of the frame:
+    inline ULONG GetFrameSize(const KB_FLT_FRAME* Frame) {
+        return sizeof(KB_FLT_FRAME_HEADER) + Frame->Header.Count * Frame->Header.RecordSize;
+    }
+
+    inline VOID Initialize(OUT PKB_FLT_FRAME Frame, ULONG RecordSize) {
+        Frame->Header.Signature = KB_FLT_FRAME_SIGNATURE;
+        Frame->Header.RecordSize = RecordSize;
+        Frame->Header.Count = 0;
+        Frame->Header.Reserved = 0;
+    }
+
+    inline BOOLEAN IsFull(const KB_FLT_FRAME* Frame) {
+        return Frame->Header.Count >= GetCapacity(Frame->Header.RecordSize);
+    }
+
+    // Returns FALSE if there is no space for the record:
+    inline BOOLEAN Append(IN OUT PKB_FLT_FRAME Frame, const VOID* Record) {
+        if (IsFull(Frame)) return FALSE;
+        UCHAR* Destination = &Frame->Records[Frame->Header.Count * Frame->Header.RecordSize];
+        const UCHAR* Source = static_cast<const UCHAR*>(Record);
+        for (ULONG i = 0; i < Frame->Header.RecordSize; i++) {
+            Destination[i] = Source[i];
+        }
+        Frame->Header.Count++;
+        return TRUE;
+    }
+
+    // Checks the received frame of 'Size' bytes, so its records can be accessed by GetRecord:
+    inline BOOLEAN IsFrameValid(const VOID* Frame, ULONG Size, ULONG ExpectedRecordSize) {
+        if (!Frame || Size < sizeof(KB_FLT_FRAME_HEADER) || Size > KB_FLT_FRAME_SIZE) return FALSE;
+        auto Header = static_cast<const KB_FLT_FRAME_HEADER*>(Frame);
+        if (Header->Signature != KB_FLT_FRAME_SIGNATURE) return FALSE;
+        if (!ExpectedRecordSize || Header->RecordSize != ExpectedRecordSize) return FALSE;
+        if (Header->Count > GetCapacity(Header->RecordSize)) return FALSE;
+        return Header->Count * Header->RecordSize <= Size - sizeof(KB_FLT_FRAME_HEADER);
+    }
+
+    template <typename RecordType>
+    inline const RecordType* GetRecords(const KB_FLT_FRAME* Frame) {
+        return reinterpret_cast<const RecordType*>(Frame->Records);
+    }
+}
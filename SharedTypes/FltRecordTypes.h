@@ -0,0 +1,246 @@
+#pragma once
+
+// Variable-length records of file events (KbFltPre/Post Create, Read, Write and DeviceControl):
+//   KB_FLT_RECORD_HEADER
+//   Fixed part: KB_FLT_CREATE_INFO, KB_FLT_READ_WRITE_INFO or KB_FLT_DEVICE_CONTROL_INFO
+//   WCHAR Path[PathLength] (not null-terminated)
+//   Extensions up to the end of record, every extension starts at 8-byte boundary:
+//     KB_FLT_RECORD_EXTENSION
+//     UCHAR Data[Length]
+//
+// Header and fixed parts are multiples of 8 bytes, so fixed part is naturally aligned.
+// Records are never larger than KB_FLT_RECORD_MAX_SIZE, clients receive them into KB_FLT_RECORD_BUFFER
+// and must parse them by FltRecord::Parse before any access.
+
+constexpr unsigned int KB_FLT_RECORD_MAX_PATH = 4096; // In characters, longer paths are truncated
+constexpr unsigned int KB_FLT_RECORD_MAX_FIXED_SIZE = 64;
+constexpr unsigned int KB_FLT_RECORD_MAX_EXTENSIONS_SIZE = 256;
+
+enum KB_FLT_RECORD_EXTENSION_TYPE {
+    KbFltExtCreateParameters = 1, // KB_FLT_EXT_CREATE_PARAMETERS
+};
+
+DECLARE_STRUCT(KB_FLT_RECORD_HEADER, {
+    ULONG Size;        // Total size of the record, multiple of 8
+    USHORT Type;       // KbFltTypes
+    USHORT FixedSize;  // Size of the fixed part
+    USHORT PathLength; // In characters
+    USHORT Reserved0;
+    ULONG Reserved1;
+});
+
+DECLARE_STRUCT(KB_FLT_RECORD_EXTENSION, {
+    USHORT Type; // KB_FLT_RECORD_EXTENSION_TYPE
+    USHORT Reserved;
+    ULONG Length; // Size of data after this header
+});
+
+DECLARE_STRUCT(KB_FLT_EXT_CREATE_PARAMETERS, {
+    ULONG CreateOptions;
+    ULONG FileAttributes;
+    ULONG ShareAccess;
+    ULONG Reserved;
+});
+
+constexpr unsigned int KB_FLT_RECORD_MAX_SIZE =
+    sizeof(KB_FLT_RECORD_HEADER) +
+    KB_FLT_RECORD_MAX_FIXED_SIZE +
+    KB_FLT_RECORD_MAX_PATH * sizeof(WCHAR) +
+    KB_FLT_RECORD_MAX_EXTENSIONS_SIZE;
+
+// UINT64 granularity keeps the received record aligned:
+DECLARE_STRUCT(KB_FLT_RECORD_BUFFER, {
+    UINT64 Data[(KB_FLT_RECORD_MAX_SIZE + sizeof(UINT64) - 1) / sizeof(UINT64)];
+});
+
+namespace FltRecord {
+    using RECORD = struct {
+        const KB_FLT_RECORD_HEADER* Header;
+        const VOID* Fixed;
+        const WCHAR* Path;
+        ULONG PathLength;
+        const UCHAR* Extensions;
+        ULONG ExtensionsSize;
+    };
+    using PRECORD = RECORD*;
+
+    using EXTENSION = struct {
+        USHORT Type;
+        ULONG Length;
+        const VOID* Data;
+    };
+    using PEXTENSION = EXTENSION*;
+
+    inline ULONG AlignUp(ULONG Value) {
+        return (Value + 7) & ~static_cast<ULONG>(7);
+    }
+
+    inline ULONG GetPathOffset(ULONG FixedSize) {
+        return sizeof(KB_FLT_RECORD_HEADER) + FixedSize;
+    }
+
+    inline ULONG GetExtensionsOffset(ULONG FixedSize, ULONG PathLength) {
+        return AlignUp(GetPathOffset(FixedSize) + PathLength * static_cast<ULONG>(sizeof(WCHAR)));
+    }
+
+    // Size of record without extensions, path is truncated to KB_FLT_RECORD_MAX_PATH:
+    inline ULONG GetRecordSize(ULONG FixedSize, ULONG PathLength) {
+        if (PathLength > KB_FLT_RECORD_MAX_PATH) PathLength = KB_FLT_RECORD_MAX_PATH;
+        return GetExtensionsOffset(FixedSize, PathLength);
+    }
+
+    inline ULONG GetExtensionSize(ULONG Length) {
+        return AlignUp(sizeof(KB_FLT_RECORD_EXTENSION) + Length);
+    }
+
+    inline VOID CopyBytes(OUT VOID* Destination, const VOID* Source, ULONG Size) {
+        auto To = static_cast<UCHAR*>(Destination);
+        auto From = static_cast<const UCHAR*>(Source);
+        for (ULONG i = 0; i < Size; i++) To[i] = From[i];
+    }
+
+    // Builds a record in the caller's buffer, all methods fail without writing beyond 'Capacity':
+    class Writer final {
+    private:
+        UCHAR* Buffer;
+        ULONG Capacity;
+        ULONG Size;
+        ULONG ExtensionsSize;
+        BOOLEAN Failed;
+
+        PKB_FLT_RECORD_HEADER GetHeader() const {
+            return reinterpret_cast<PKB_FLT_RECORD_HEADER>(Buffer);
+        }
+    public:
+        Writer(const Writer&) = delete;
+        Writer(Writer&&) = delete;
+        Writer& operator = (const Writer&) = delete;
+        Writer& operator = (Writer&&) = delete;
+
+        // Buffer must be 8-bytes aligned:
+        Writer(OUT VOID* RecordBuffer, ULONG BufferSize)
+            : Buffer(static_cast<UCHAR*>(RecordBuffer)), Capacity(BufferSize), Size(0), ExtensionsSize(0), Failed(FALSE) {}
+
+        ~Writer() = default;
+
+        // Writes the header, fixed part and path (truncated to KB_FLT_RECORD_MAX_PATH):
+        BOOLEAN Begin(USHORT Type, const VOID* Fixed, ULONG FixedSize, OPTIONAL const WCHAR* Path, ULONG PathLength)
+        {
+            Size = 0;
+            ExtensionsSize = 0;
+            Failed = TRUE;
+
+            if (!Buffer || (FixedSize % 8) || FixedSize > KB_FLT_RECORD_MAX_FIXED_SIZE) return FALSE;
+            if (!Path) PathLength = 0;
+            if (PathLength > KB_FLT_RECORD_MAX_PATH) PathLength = KB_FLT_RECORD_MAX_PATH;
+
+            ULONG RecordSize = GetRecordSize(FixedSize, PathLength);
+            if (RecordSize > Capacity) return FALSE;
+
+            PKB_FLT_RECORD_HEADER Header = GetHeader();
+            Header->Size = RecordSize;
+            Header->Type = Type;
+            Header->FixedSize = static_cast<USHORT>(FixedSize);
+            Header->PathLength = static_cast<USHORT>(PathLength);
+            Header->Reserved0 = 0;
+            Header->Reserved1 = 0;
+
+            CopyBytes(Buffer + sizeof(KB_FLT_RECORD_HEADER), Fixed, FixedSize);
+            if (PathLength) CopyBytes(Buffer + GetPathOffset(FixedSize), Path, PathLength * static_cast<ULONG>(sizeof(WCHAR)));
+
+            // Padding after the path:
+            for (ULONG i = GetPathOffset(FixedSize) + PathLength * static_cast<ULONG>(sizeof(WCHAR)); i < RecordSize; i++) {
+                Buffer[i] = 0;
+            }
+
+            Size = RecordSize;
+            Failed = FALSE;
+            return TRUE;
+        }
+
+        BOOLEAN AddExtension(USHORT Type, const VOID* Data, ULONG Length)
+        {
+            if (Failed) return FALSE;
+            ULONG ExtensionSize = GetExtensionSize(Length);
+            if (Length > KB_FLT_RECORD_MAX_EXTENSIONS_SIZE || ExtensionsSize + ExtensionSize > KB_FLT_RECORD_MAX_EXTENSIONS_SIZE) return FALSE;
+            if (ExtensionSize > Capacity - Size) return FALSE;
+
+            auto Extension = reinterpret_cast<PKB_FLT_RECORD_EXTENSION>(Buffer + Size);
+            Extension->Type = Type;
+            Extension->Reserved = 0;
+            Extension->Length = Length;
+            CopyBytes(Extension + 1, Data, Length);
+            for (ULONG i = sizeof(KB_FLT_RECORD_EXTENSION) + Length; i < ExtensionSize; i++) {
+                reinterpret_cast<UCHAR*>(Extension)[i] = 0;
+            }
+
+            Size += ExtensionSize;
+            ExtensionsSize += ExtensionSize;
+            GetHeader()->Size = Size;
+            return TRUE;
+        }
+
+        // Returns 0 if the record wasn't built:
+        ULONG GetSize() const {
+            return Failed ? 0 : Size;
+        }
+    };
+
+    // Validates the received record of at most 'BufferSize' bytes:
+    inline BOOLEAN Parse(const VOID* Buffer, ULONG BufferSize, OUT PRECORD Record)
+    {
+        if (!Buffer || !Record || BufferSize < sizeof(KB_FLT_RECORD_HEADER)) return FALSE;
+
+        auto Header = static_cast<const KB_FLT_RECORD_HEADER*>(Buffer);
+        if (Header->Size > BufferSize || Header->Size > KB_FLT_RECORD_MAX_SIZE || (Header->Size % 8)) return FALSE;
+        if ((Header->FixedSize % 8) || Header->FixedSize > KB_FLT_RECORD_MAX_FIXED_SIZE) return FALSE;
+        if (Header->PathLength > KB_FLT_RECORD_MAX_PATH) return FALSE;
+
+        ULONG ExtensionsOffset = GetExtensionsOffset(Header->FixedSize, Header->PathLength);
+        if (ExtensionsOffset > Header->Size) return FALSE;
+
+        auto Bytes = static_cast<const UCHAR*>(Buffer);
+        Record->Header = Header;
+        Record->Fixed = Bytes + sizeof(KB_FLT_RECORD_HEADER);
+        Record->Path = reinterpret_cast<const WCHAR*>(Bytes + GetPathOffset(Header->FixedSize));
+        Record->PathLength = Header->PathLength;
+        Record->Extensions = Bytes + ExtensionsOffset;
+        Record->ExtensionsSize = Header->Size - ExtensionsOffset;
+        return TRUE;
+    }
+
+    // Returns the fixed part if it is at least of sizeof(FixedType):
+    template <typename FixedType>
+    inline const FixedType* GetFixed(const RECORD* Record) {
+        return Record->Header->FixedSize >= sizeof(FixedType) ? static_cast<const FixedType*>(Record->Fixed) : NULL;
+    }
+
+    // Iterates extensions of the parsed record, '*Offset' must be 0 for the first call:
+    inline BOOLEAN GetNextExtension(const RECORD* Record, IN OUT PULONG Offset, OUT PEXTENSION Extension)
+    {
+        if (*Offset >= Record->ExtensionsSize || Record->ExtensionsSize - *Offset < sizeof(KB_FLT_RECORD_EXTENSION)) return FALSE;
+
+        auto Header = reinterpret_cast<const KB_FLT_RECORD_EXTENSION*>(Record->Extensions + *Offset);
+        ULONG Available = Record->ExtensionsSize - *Offset - static_cast<ULONG>(sizeof(KB_FLT_RECORD_EXTENSION));
+        if (Header->Length > Available) return FALSE;
+
+        Extension->Type = Header->Type;
+        Extension->Length = Header->Length;
+        Extension->Data = Header + 1;
+
+        ULONG Next = GetExtensionSize(Header->Length);
+        *Offset = Next > Record->ExtensionsSize - *Offset ? Record->ExtensionsSize : *Offset + Next;
+        return TRUE;
+    }
+
+    // Returns data of the first extension of this type if it is at least of 'MinLength' bytes:
+    inline const VOID* FindExtension(const RECORD* Record, USHORT Type, ULONG MinLength)
+    {
+        ULONG Offset = 0;
+        EXTENSION Extension = {};
+        while (GetNextExtension(Record, &Offset, &Extension)) {
+            if (Extension.Type == Type && Extension.Length >= MinLength) return Extension.Data;
+        }
+        return NULL;
+    }
+}
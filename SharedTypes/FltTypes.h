@@ -18,8 +18,15 @@ enum KbFltTypes {
     KbFltNone
 };
 
+enum KbFltContextFlags {
+    KbFltNoFlags = 0,
+    KbFltBatched = 1, // Ps* events are delivered in frames of FltFrameTypes.h
+    KbFltSkipOwnProcess = 2, // Events of all threads of the client process aren't sent, not only of Client.ThreadId
+};
+
 DECLARE_STRUCT(KB_FLT_CONTEXT, {
     KbFltTypes Type;
+    ULONG Flags; // KbFltContextFlags
     WdkTypes::CLIENT_ID Client;    
 });
 
@@ -32,16 +39,21 @@ DECLARE_STRUCT(KB_FLT_OB_CALLBACK_INFO, {
     ACCESS_MASK DuplicateResultAccess;
 });
 
+// Ps* events are queued per client and delivered asynchronously,
+// 'Dropped' is the count of events lost before this one due to overflow of the queue:
+
 DECLARE_STRUCT(KB_FLT_PS_PROCESS_INFO, {
     UINT64 ParentId;
     UINT64 ProcessId;
     BOOLEAN Created;
+    ULONG Dropped;
 });
 
 DECLARE_STRUCT(KB_FLT_PS_THREAD_INFO, {
     UINT64 ProcessId;
     UINT64 ThreadId;
     BOOLEAN Created;
+    ULONG Dropped;
 });
 
 DECLARE_STRUCT(KB_FLT_PS_IMAGE_INFO, {
@@ -49,14 +61,18 @@ DECLARE_STRUCT(KB_FLT_PS_IMAGE_INFO, {
     WdkTypes::PVOID BaseAddress;
     UINT64 ImageSize;
     WCHAR FullImageName[384]; // Fixed size! Enough for paths.
+    ULONG Dropped;
 });
 
+// File events are sent as variable-length records of FltRecordTypes.h,
+// structs below are their fixed parts and the replies of clients
+// (driver takes only 'Status' from the reply):
+
 DECLARE_STRUCT(KB_FLT_CREATE_INFO, {
     UINT64 ProcessId;
     UINT64 ThreadId;
     ACCESS_MASK AccessMask;
     WdkTypes::NTSTATUS Status;
-    WCHAR Path[384]; // Fixed size! Enough for paths.
 });
 
 DECLARE_STRUCT(KB_FLT_READ_WRITE_INFO, {
@@ -65,7 +81,6 @@ DECLARE_STRUCT(KB_FLT_READ_WRITE_INFO, {
     WdkTypes::PMDL LockedMdl;
     ULONG Size;
     WdkTypes::NTSTATUS Status;
-    WCHAR Path[384];
 });
 
 DECLARE_STRUCT(KB_FLT_DEVICE_CONTROL_INFO, {
@@ -77,5 +92,4 @@ DECLARE_STRUCT(KB_FLT_DEVICE_CONTROL_INFO, {
     ULONG OutputSize;
     ULONG Ioctl;
     WdkTypes::NTSTATUS Status;
-    WCHAR Path[384];
 });
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+// Contention statistics of named locks of the driver (KbGetLockStats).
+// Locks are recorded only if the driver is built with KB_LOCKS_INSTRUMENTED,
+// all locks with the same name (e.g. a lock of every client) are aggregated in one entry.
+//
+// Times are in TSC cycles, the wait histogram has log2 buckets:
+// bucket 0 is [0, 2) cycles, bucket N is [2^N, 2^(N + 1)), the last one is unbounded.
+// Shared between User-Bridge and the driver, so snapshots can be aggregated in usermode.
+
+namespace LockStats {
+    constexpr ULONG BucketsCount = 32;
+    constexpr ULONG MaxNameLength = 32; // Including the null-terminator
+}
+
+DECLARE_STRUCT(KB_LOCK_STATS, {
+    CHAR Name[LockStats::MaxNameLength];
+    UINT64 Acquires;  // Successful acquisitions, exclusive and shared
+    UINT64 Contended; // Acquisitions that had to wait
+    UINT64 TotalWait; // Cycles waited by contended acquisitions
+    UINT64 MaxHold;   // The longest exclusive ownership in cycles
+    UINT64 WaitHistogram[LockStats::BucketsCount]; // Contended acquisitions by the wait
+});
+
+namespace LockStats {
+    inline ULONG GetBucket(UINT64 Cycles) {
+        ULONG Bucket = 0;
+        while (Cycles > 1 && Bucket < BucketsCount - 1) {
+            Cycles >>= 1;
+            Bucket++;
+        }
+        return Bucket;
+    }
+
+    // Upper bound of the bucket (exclusive), the last bucket is unbounded:
+    inline UINT64 GetBucketLimit(ULONG Bucket) {
+        return Bucket < BucketsCount - 1 ? static_cast<UINT64>(2) << Bucket : ~0ULL;
+    }
+
+    // Upper bound of the wait of 'Percent' percents of contended acquisitions,
+    // it is accurate to the bucket (to 2x), zero if there were no contended acquisitions:
+    inline UINT64 GetWaitPercentile(const KB_LOCK_STATS* Stats, ULONG Percent) {
+        UINT64 Total = 0;
+        for (ULONG i = 0; i < BucketsCount; i++) Total += Stats->WaitHistogram[i];
+        if (!Total) return 0;
+
+        if (Percent > 100) Percent = 100;
+        UINT64 Rank = (Total * Percent + 99) / 100; // Count of acquisitions to cover
+        if (!Rank) Rank = 1;
+
+        UINT64 Covered = 0;
+        for (ULONG i = 0; i < BucketsCount; i++) {
+            Covered += Stats->WaitHistogram[i];
+            if (Covered >= Rank) return GetBucketLimit(i);
+        }
+        return GetBucketLimit(BucketsCount - 1);
+    }
+
+    // Adds counters of 'Source' to 'Dest', e.g. entries of the same name from several drivers:
+    inline VOID Accumulate(IN OUT PKB_LOCK_STATS Dest, const KB_LOCK_STATS* Source) {
+        Dest->Acquires += Source->Acquires;
+        Dest->Contended += Source->Contended;
+        Dest->TotalWait += Source->TotalWait;
+        if (Source->MaxHold > Dest->MaxHold) Dest->MaxHold = Source->MaxHold;
+        for (ULONG i = 0; i < BucketsCount; i++) Dest->WaitHistogram[i] += Source->WaitHistogram[i];
+    }
+
+    // Counters accumulated between two snapshots of the same lock, counters are monotonic
+    // unless the driver was asked to reset them, MaxHold is taken from 'Current':
+    inline VOID GetDelta(OUT PKB_LOCK_STATS Delta, const KB_LOCK_STATS* Current, const KB_LOCK_STATS* Previous) {
+        auto Subtract = [](UINT64 Now, UINT64 Before) -> UINT64 {
+            return Now >= Before ? Now - Before : Now; // Reset in between
+        };
+        for (ULONG i = 0; i < MaxNameLength; i++) Delta->Name[i] = Current->Name[i];
+        Delta->Acquires = Subtract(Current->Acquires, Previous->Acquires);
+        Delta->Contended = Subtract(Current->Contended, Previous->Contended);
+        Delta->TotalWait = Subtract(Current->TotalWait, Previous->TotalWait);
+        Delta->MaxHold = Current->MaxHold;
+        for (ULONG i = 0; i < BucketsCount; i++) {
+            Delta->WaitHistogram[i] = Subtract(Current->WaitHistogram[i], Previous->WaitHistogram[i]);
+        }
+    }
+}
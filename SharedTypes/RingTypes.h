@@ -0,0 +1,271 @@
+#pragma once
+
+// Dependencies:
+// - Atomics.h
+
+// Lock-free single-producer/single-consumer rings shared between
+// User-Bridge and the driver (submission and completion queues).
+//
+// Layout of the ring memory:
+//   KB_RING_HEADER (3 cache lines: constants, consumer-owned and producer-owned fields)
+//   Entries[EntriesCount], EntriesCount is a power of 2
+//
+// Head and Tail are free-running 32-bit counters, slot of the counter is (Counter & Mask):
+//   - Producer owns Tail: it fills the slot at Tail and then publishes Tail + 1 with release semantics.
+//   - Consumer owns Head: it reads Tail with acquire semantics, copies out the slot at Head
+//     and then publishes Head + 1 with release semantics, so producer may reuse the slot.
+//   - Ring is empty when Head == Tail and full when Tail - Head == EntriesCount.
+//
+// Sleeping consumer protocol (to avoid lost wakeups both sides use a full barrier):
+//   - Consumer sets KbRingNeedWakeup in ConsumerFlags, re-checks the ring and goes
+//     to sleep only if it is still empty.
+//   - Producer publishes Tail and then checks KbRingNeedWakeup, if it is set,
+//     producer should wake the consumer up (KbRingDoorbell for the driver worker).
+//   - Driver worker also sleeps when the completion ring is full, then it sets
+//     KbRingNeedWakeup | KbRingCompletionsFull, so client rings the doorbell after reaping
+//     of completions only in this case and after submissions only when the worker waits for them.
+//
+// Both sides must use their own trusted copy of EntriesCount and never trust
+// counters from the shared memory: all slots are indexed by masked values.
+
+constexpr unsigned int KB_RING_SIGNATURE = 0x474E524B; // 'KRNG'
+constexpr unsigned short KB_RING_VERSION = 1;
+constexpr unsigned int KB_RING_CACHE_LINE = 64;
+
+// Max size of KB_***_IN struct that can be submitted through the ring:
+constexpr unsigned int KB_RING_INLINE_INPUT_SIZE = 64;
+
+enum KB_RING_FLAGS {
+    KbRingNoFlags    = 0,
+    KbRingNeedWakeup = 1, // Consumer is sleeping and waits for a doorbell
+    KbRingCompletionsFull = 2, // With KbRingNeedWakeup: driver worker waits for space in the completion ring
+};
+
+DECLARE_STRUCT(KB_RING_HEADER, {
+    // Constant after initialization:
+    ULONG Signature;    // KB_RING_SIGNATURE
+    USHORT Version;     // KB_RING_VERSION
+    USHORT HeaderSize;  // sizeof(KB_RING_HEADER)
+    ULONG EntrySize;
+    ULONG EntriesCount; // Power of 2
+    UCHAR Reserved0[KB_RING_CACHE_LINE - 4 * sizeof(ULONG)];
+
+    // Written by consumer only:
+    volatile LONG Head;
+    volatile LONG ConsumerFlags; // KB_RING_FLAGS
+    UCHAR Reserved1[KB_RING_CACHE_LINE - 2 * sizeof(LONG)];
+
+    // Written by producer only:
+    volatile LONG Tail;
+    UCHAR Reserved2[KB_RING_CACHE_LINE - sizeof(LONG)];
+});
+
+// Submission queue entry (User-Bridge -> driver):
+DECLARE_STRUCT(KB_RING_SUBMISSION, {
+    UINT64 UserData;        // Returned as is in the completion
+    ULONG CtlIndex;         // Ctls::KbCtlIndices
+    ULONG InputSize;        // <= KB_RING_INLINE_INPUT_SIZE
+    WdkTypes::PVOID Output; // Usermode buffer that receives output of request
+    ULONG OutputSize;
+    ULONG Reserved;
+    UCHAR Input[KB_RING_INLINE_INPUT_SIZE];
+});
+
+// Completion queue entry (driver -> User-Bridge):
+DECLARE_STRUCT(KB_RING_COMPLETION, {
+    UINT64 UserData;
+    WdkTypes::NTSTATUS Status;
+    ULONG ResponseLength;
+});
+
+namespace Rings {
+    constexpr ULONG MaxEntriesCount = 65536;
+
+    constexpr BOOLEAN IsPowerOfTwo(ULONG Value) {
+        return Value && !(Value & (Value - 1));
+    }
+
+    constexpr SIZE_T GetRingSize(ULONG EntrySize, ULONG EntriesCount) {
+        return sizeof(KB_RING_HEADER) + static_cast<SIZE_T>(EntrySize) * EntriesCount;
+    }
+
+    inline PKB_RING_HEADER InitializeRing(PVOID Buffer, SIZE_T BufferSize, ULONG EntrySize, ULONG EntriesCount)
+    {
+        if (!Buffer || !EntrySize || !IsPowerOfTwo(EntriesCount) || EntriesCount > MaxEntriesCount) return NULL;
+        if (BufferSize < GetRingSize(EntrySize, EntriesCount)) return NULL;
+
+        auto Header = static_cast<PKB_RING_HEADER>(Buffer);
+        *Header = {};
+        Header->Signature = KB_RING_SIGNATURE;
+        Header->Version = KB_RING_VERSION;
+        Header->HeaderSize = sizeof(KB_RING_HEADER);
+        Header->EntrySize = EntrySize;
+        Header->EntriesCount = EntriesCount;
+        return Header;
+    }
+
+    // Checks the header of ring received from another side:
+    inline BOOLEAN IsRingValid(const KB_RING_HEADER* Header, ULONG EntrySize, ULONG EntriesCount)
+    {
+        return Header
+            && Header->Signature == KB_RING_SIGNATURE
+            && Header->Version == KB_RING_VERSION
+            && Header->HeaderSize == sizeof(KB_RING_HEADER)
+            && Header->EntrySize == EntrySize
+            && Header->EntriesCount == EntriesCount;
+    }
+
+    template <typename EntryType>
+    inline EntryType* GetRingEntries(PKB_RING_HEADER Header) {
+        return reinterpret_cast<EntryType*>(reinterpret_cast<PUCHAR>(Header) + sizeof(KB_RING_HEADER));
+    }
+
+    // Must be used from a single thread at a time:
+    template <typename EntryType>
+    class Producer final {
+    private:
+        PKB_RING_HEADER Header;
+        EntryType* Entries;
+        ULONG EntriesCount;
+        ULONG Tail;
+        ULONG CachedHead;
+    public:
+        Producer(const Producer&) = delete;
+        Producer(Producer&&) = delete;
+        Producer& operator = (const Producer&) = delete;
+        Producer& operator = (Producer&&) = delete;
+
+        Producer() : Header(NULL), Entries(NULL), EntriesCount(0), Tail(0), CachedHead(0) {}
+        Producer(PKB_RING_HEADER Ring, ULONG Count) : Producer() { Attach(Ring, Count); }
+        ~Producer() = default;
+
+        VOID Attach(PKB_RING_HEADER Ring, ULONG Count) {
+            Header = Ring;
+            Entries = GetRingEntries<EntryType>(Ring);
+            EntriesCount = Count;
+            Tail = static_cast<ULONG>(Ring->Tail);
+            CachedHead = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Ring->Head));
+        }
+
+        VOID Detach() {
+            Header = NULL;
+            Entries = NULL;
+            EntriesCount = 0;
+        }
+
+        BOOLEAN IsAttached() const { return Header != NULL; }
+
+        ULONG GetFreeCount() {
+            CachedHead = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Header->Head));
+            ULONG Used = Tail - CachedHead;
+            return Used < EntriesCount ? EntriesCount - Used : 0;
+        }
+
+        // Returns the free slot or NULL if the ring is full,
+        // the slot becomes visible to consumer after Commit():
+        EntryType* Reserve() {
+            if (Tail - CachedHead >= EntriesCount) {
+                CachedHead = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Header->Head));
+                if (Tail - CachedHead >= EntriesCount) return NULL;
+            }
+            return &Entries[Tail & (EntriesCount - 1)];
+        }
+
+        VOID Commit() {
+            Tail++;
+            KB_ATOMIC_STORE_RELEASE(Header->Tail, Tail);
+        }
+
+        BOOLEAN Push(const EntryType& Entry) {
+            EntryType* Slot = Reserve();
+            if (!Slot) return FALSE;
+            *Slot = Entry;
+            Commit();
+            return TRUE;
+        }
+
+        // Call it after Commit() to know whether consumer sleeps for this 'Reason' (KB_RING_FLAGS)
+        // and should be waked up, consumer sets all its flags at once, so they are matched exactly:
+        BOOLEAN IsWakeupNeeded(ULONG Reason = KbRingNeedWakeup) const {
+            KB_ATOMIC_FULL_BARRIER();
+            return static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Header->ConsumerFlags)) == Reason;
+        }
+    };
+
+    // Must be used from a single thread at a time:
+    template <typename EntryType>
+    class Consumer final {
+    private:
+        PKB_RING_HEADER Header;
+        EntryType* Entries;
+        ULONG EntriesCount;
+        ULONG Head;
+        ULONG CachedTail;
+    public:
+        Consumer(const Consumer&) = delete;
+        Consumer(Consumer&&) = delete;
+        Consumer& operator = (const Consumer&) = delete;
+        Consumer& operator = (Consumer&&) = delete;
+
+        Consumer() : Header(NULL), Entries(NULL), EntriesCount(0), Head(0), CachedTail(0) {}
+        Consumer(PKB_RING_HEADER Ring, ULONG Count) : Consumer() { Attach(Ring, Count); }
+        ~Consumer() = default;
+
+        VOID Attach(PKB_RING_HEADER Ring, ULONG Count) {
+            Header = Ring;
+            Entries = GetRingEntries<EntryType>(Ring);
+            EntriesCount = Count;
+            Head = static_cast<ULONG>(Ring->Head);
+            CachedTail = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Ring->Tail));
+        }
+
+        VOID Detach() {
+            Header = NULL;
+            Entries = NULL;
+            EntriesCount = 0;
+        }
+
+        BOOLEAN IsAttached() const { return Header != NULL; }
+
+        ULONG GetPendingCount() {
+            CachedTail = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Header->Tail));
+            ULONG Pending = CachedTail - Head;
+            return Pending < EntriesCount ? Pending : EntriesCount;
+        }
+
+        // Returns the oldest published slot or NULL if the ring is empty,
+        // the slot is returned to producer after Release():
+        EntryType* Peek() {
+            if (Head == CachedTail) {
+                CachedTail = static_cast<ULONG>(KB_ATOMIC_LOAD_ACQUIRE(Header->Tail));
+                if (Head == CachedTail) return NULL;
+            }
+            return &Entries[Head & (EntriesCount - 1)];
+        }
+
+        VOID Release() {
+            Head++;
+            KB_ATOMIC_STORE_RELEASE(Header->Head, Head);
+        }
+
+        // Copies the entry out of the shared memory, so it can't be changed
+        // by producer after validation:
+        BOOLEAN Pop(OUT EntryType* Entry) {
+            EntryType* Slot = Peek();
+            if (!Slot) return FALSE;
+            *Entry = *Slot;
+            Release();
+            return TRUE;
+        }
+
+        // Sets KbRingNeedWakeup (with the reason flags) with a full barrier, after it consumer must
+        // re-check the rings and go to sleep only if there is still nothing to do:
+        VOID RequestWakeup(ULONG Flags = KbRingNeedWakeup) {
+            KB_ATOMIC_EXCHANGE(Header->ConsumerFlags, Flags | KbRingNeedWakeup);
+        }
+
+        VOID ClearWakeup() {
+            KB_ATOMIC_STORE_RELEASE(Header->ConsumerFlags, KbRingNoFlags);
+        }
+    };
+}
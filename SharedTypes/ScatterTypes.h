@@ -0,0 +1,80 @@
+#pragma once
+
+// Validation and coalescing of KB_MEMORY_DESCRIPTOR arrays for
+// KbReadProcessMemoryVectored/KbWriteProcessMemoryVectored.
+// Shared between User-Bridge and the driver, so the same rules
+// can be checked in usermode before sending the request.
+//
+// Descriptors are never reordered: a segment is a run of consecutive valid
+// descriptors whose target ranges follow each other without gaps, so
+// the whole run can be copied from the target process at once.
+
+// Run of adjacent descriptors:
+DECLARE_STRUCT(KB_MEMORY_SEGMENT, {
+    WdkTypes::PVOID BaseAddress; // BaseAddress of the first descriptor
+    ULONG Size;                  // Sum of sizes of all descriptors in the run
+    ULONG FirstDescriptor;
+    ULONG DescriptorsCount;
+});
+
+namespace ScatterGather {
+    constexpr ULONG MaxDescriptorsCount = 65536;
+
+    // Lower half of the address space as in AddressRange::IsUserAddress:
+    constexpr UINT64 GetUserSpaceLimit() {
+        return static_cast<UINT64>(1) << (8 * sizeof(SIZE_T) - 1);
+    }
+
+    inline BOOLEAN IsUserRange(UINT64 Address, ULONG Size, UINT64 UserSpaceLimit) {
+        return Address && Address < UserSpaceLimit && Size <= UserSpaceLimit - Address;
+    }
+
+    // Both ranges of descriptor must be non-empty and lie in the usermode space:
+    inline BOOLEAN IsDescriptorValid(const KB_MEMORY_DESCRIPTOR* Descriptor, UINT64 UserSpaceLimit = GetUserSpaceLimit())
+    {
+        return Descriptor
+            && Descriptor->Size
+            && IsUserRange(Descriptor->BaseAddress, Descriptor->Size, UserSpaceLimit)
+            && IsUserRange(Descriptor->Buffer, Descriptor->Size, UserSpaceLimit);
+    }
+
+    // Finds the next segment starting from '*Index' and moves '*Index' past it,
+    // invalid descriptors are skipped and break the segment.
+    // Descriptors are merged while the size of segment doesn't exceed 'MaxSegmentSize',
+    // but a single descriptor larger than 'MaxSegmentSize' forms its own segment.
+    // Returns FALSE when there are no valid descriptors left:
+    inline BOOLEAN GetNextSegment(
+        const KB_MEMORY_DESCRIPTOR* Descriptors,
+        ULONG Count,
+        IN OUT PULONG Index,
+        ULONG MaxSegmentSize,
+        OUT PKB_MEMORY_SEGMENT Segment,
+        UINT64 UserSpaceLimit = GetUserSpaceLimit()
+    ) {
+        if (!Descriptors || !Index || !Segment) return FALSE;
+
+        ULONG i = *Index;
+        while (i < Count && !IsDescriptorValid(&Descriptors[i], UserSpaceLimit)) i++;
+        if (i >= Count) {
+            *Index = Count;
+            return FALSE;
+        }
+
+        Segment->BaseAddress = Descriptors[i].BaseAddress;
+        Segment->Size = Descriptors[i].Size;
+        Segment->FirstDescriptor = i;
+        Segment->DescriptorsCount = 1;
+
+        for (i++; i < Count; i++) {
+            const KB_MEMORY_DESCRIPTOR* Next = &Descriptors[i];
+            if (!IsDescriptorValid(Next, UserSpaceLimit)) break;
+            if (Next->BaseAddress != Segment->BaseAddress + Segment->Size) break;
+            if (Segment->Size > MaxSegmentSize || Next->Size > MaxSegmentSize - Segment->Size) break;
+            Segment->Size += Next->Size;
+            Segment->DescriptorsCount++;
+        }
+
+        *Index = i;
+        return TRUE;
+    }
+}
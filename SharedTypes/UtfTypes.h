@@ -0,0 +1,324 @@
+#pragma once
+
+/*
+    Depends on:
+    - WCHAR and size_t (wdm.h, Windows.h or any other definitions)
+    - intrin.h (or emmintrin.h) on x64
+*/
+
+// Validating UTF-8 <-> UTF-16 transcoder for the driver and User-Bridge, it writes into the caller's buffer
+// and never allocates. Runs of ASCII are converted by 16 characters with SSE2 on x64,
+// other characters are decoded by the scalar loop.
+// Invalid sequences (overlong forms, encoded surrogates, code points above U+10FFFF, truncated sequences
+// and unpaired surrogates in UTF-16) are never transcoded, conversion stops and fails on them.
+// Define KB_UTF_NO_SIMD to build the scalar versions only.
+
+#if !defined(KB_UTF_NO_SIMD) && (defined(_M_AMD64) || defined(__x86_64__))
+    #define KB_UTF_SSE2
+#endif
+
+enum UTF_STATUS {
+    UtfSuccess,
+    UtfInvalidSequence,
+    UtfBufferTooSmall
+};
+
+namespace Utf {
+    static_assert(sizeof(WCHAR) == 2, "UTF-16 requires 2-byte WCHAR");
+
+    constexpr size_t InvalidLength = ~static_cast<size_t>(0);
+
+#ifdef KB_UTF_SSE2
+    inline unsigned int FirstBit(unsigned int Mask) {
+    #ifdef _MSC_VER
+        unsigned long Bit = 0;
+        _BitScanForward(&Bit, Mask);
+        return static_cast<unsigned int>(Bit);
+    #else
+        return static_cast<unsigned int>(__builtin_ctz(Mask));
+    #endif
+    }
+#endif
+
+    // Converts the ASCII prefix (at most 'Length' characters), returns its length.
+    // A block containing the end of the prefix is stored entirely, so up to 15 units
+    // after the prefix may be overwritten (never beyond 'Length'):
+    inline size_t WidenAscii(const char* Src, size_t Length, OUT WCHAR* Dest) {
+        auto Bytes = reinterpret_cast<const unsigned char*>(Src);
+        size_t Index = 0;
+#ifdef KB_UTF_SSE2
+        const __m128i Zero = _mm_setzero_si128();
+        for (; Length - Index >= 16; Index += 16) {
+            __m128i Block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Bytes[Index]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&Dest[Index]), _mm_unpacklo_epi8(Block, Zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&Dest[Index + 8]), _mm_unpackhi_epi8(Block, Zero));
+            unsigned int NonAscii = static_cast<unsigned int>(_mm_movemask_epi8(Block));
+            if (NonAscii) return Index + FirstBit(NonAscii);
+        }
+#endif
+        for (; Index < Length && Bytes[Index] < 0x80; ++Index) Dest[Index] = static_cast<WCHAR>(Bytes[Index]);
+        return Index;
+    }
+
+    // Converts the ASCII prefix (at most 'Length' characters), returns its length.
+    // A block containing the end of the prefix is stored entirely, so up to 15 bytes
+    // after the prefix may be overwritten (never beyond 'Length'):
+    inline size_t NarrowAscii(const WCHAR* Src, size_t Length, OUT char* Dest) {
+        size_t Index = 0;
+#ifdef KB_UTF_SSE2
+        const __m128i HighBits = _mm_set1_epi16(static_cast<short>(0xFF80));
+        const __m128i Zero = _mm_setzero_si128();
+        for (; Length - Index >= 16; Index += 16) {
+            __m128i Low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[Index]));
+            __m128i High = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[Index + 8]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&Dest[Index]), _mm_packus_epi16(Low, High));
+            // Packing is signed, so ASCII lanes are found by comparison (0xFFFF -> 0xFF, 0 -> 0):
+            __m128i Ascii = _mm_packs_epi16(
+                _mm_cmpeq_epi16(_mm_and_si128(Low, HighBits), Zero),
+                _mm_cmpeq_epi16(_mm_and_si128(High, HighBits), Zero)
+            );
+            unsigned int NonAscii = ~static_cast<unsigned int>(_mm_movemask_epi8(Ascii)) & 0xFFFF;
+            if (NonAscii) return Index + FirstBit(NonAscii);
+        }
+#endif
+        for (; Index < Length && Src[Index] < 0x80; ++Index) Dest[Index] = static_cast<char>(Src[Index]);
+        return Index;
+    }
+
+    // Returns the length of the ASCII prefix:
+    inline size_t GetAsciiLength(const unsigned char* Src, size_t Length) {
+        size_t Index = 0;
+#ifdef KB_UTF_SSE2
+        for (; Length - Index >= 16; Index += 16) {
+            unsigned int NonAscii = static_cast<unsigned int>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[Index]))));
+            if (NonAscii) return Index + FirstBit(NonAscii);
+        }
+#endif
+        while (Index < Length && Src[Index] < 0x80) ++Index;
+        return Index;
+    }
+
+    inline size_t GetAsciiLength(const WCHAR* Src, size_t Length) {
+        size_t Index = 0;
+#ifdef KB_UTF_SSE2
+        const __m128i HighBits = _mm_set1_epi16(static_cast<short>(0xFF80));
+        const __m128i Zero = _mm_setzero_si128();
+        for (; Length - Index >= 8; Index += 8) {
+            __m128i Block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[Index]));
+            unsigned int NonAscii = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(Block, HighBits), Zero))) & 0xFFFF;
+            if (NonAscii) return Index + FirstBit(NonAscii) / 2;
+        }
+#endif
+        while (Index < Length && Src[Index] < 0x80) ++Index;
+        return Index;
+    }
+
+    // Decodes the non-ASCII sequence at 'Src[*Index]' (RFC 3629), returns false if it is invalid or truncated:
+    inline bool DecodeUtf8(const unsigned char* Src, size_t Length, IN OUT size_t* Index, OUT unsigned int* CodePoint) {
+        size_t Position = *Index;
+        unsigned int Lead = Src[Position];
+        unsigned int Count = 0;
+        unsigned char Min = 0x80, Max = 0xBF; // Bounds of the second byte
+        if (Lead >= 0xC2 && Lead <= 0xDF) {
+            Count = 1;
+            Lead &= 0x1F;
+        } else if (Lead >= 0xE0 && Lead <= 0xEF) {
+            Count = 2;
+            if (Lead == 0xE0) Min = 0xA0; // Overlong
+            else if (Lead == 0xED) Max = 0x9F; // Surrogates
+            Lead &= 0x0F;
+        } else if (Lead >= 0xF0 && Lead <= 0xF4) {
+            Count = 3;
+            if (Lead == 0xF0) Min = 0x90; // Overlong
+            else if (Lead == 0xF4) Max = 0x8F; // Above U+10FFFF
+            Lead &= 0x07;
+        } else {
+            return false;
+        }
+
+        if (Length - Position <= Count) return false;
+        if (Src[Position + 1] < Min || Src[Position + 1] > Max) return false;
+        unsigned int Value = Lead;
+        for (unsigned int i = 1; i <= Count; ++i) {
+            unsigned char Continuation = Src[Position + i];
+            if ((Continuation & 0xC0) != 0x80) return false;
+            Value = (Value << 6) | (Continuation & 0x3F);
+        }
+        *CodePoint = Value;
+        *Index = Position + Count + 1;
+        return true;
+    }
+
+    // Decodes the non-ASCII character or surrogate pair at 'Src[*Index]', returns false if a surrogate is unpaired:
+    inline bool DecodeUtf16(const WCHAR* Src, size_t Length, IN OUT size_t* Index, OUT unsigned int* CodePoint) {
+        size_t Position = *Index;
+        unsigned int Unit = Src[Position];
+        if (Unit < 0xD800 || Unit > 0xDFFF) {
+            *CodePoint = Unit;
+            *Index = Position + 1;
+            return true;
+        }
+        if (Unit > 0xDBFF || Length - Position < 2) return false;
+        unsigned int Low = Src[Position + 1];
+        if (Low < 0xDC00 || Low > 0xDFFF) return false;
+        *CodePoint = 0x10000 + ((Unit - 0xD800) << 10) + (Low - 0xDC00);
+        *Index = Position + 2;
+        return true;
+    }
+
+    // Returns the number of UTF-16 units of the UTF-8 string or InvalidLength:
+    inline size_t GetUtf16Length(const char* Src, size_t Length) {
+        auto Bytes = reinterpret_cast<const unsigned char*>(Src);
+        size_t Index = 0, Units = 0;
+        while (Index < Length) {
+            if (Bytes[Index] < 0x80) {
+                size_t Ascii = GetAsciiLength(&Bytes[Index], Length - Index);
+                Units += Ascii;
+                Index += Ascii;
+                continue;
+            }
+            // Two-byte sequences are the most frequent in non-ASCII text:
+            if (Bytes[Index] >= 0xC2 && Bytes[Index] <= 0xDF && Length - Index >= 2 && (Bytes[Index + 1] & 0xC0) == 0x80) {
+                ++Units;
+                Index += 2;
+                continue;
+            }
+            unsigned int CodePoint = 0;
+            if (!DecodeUtf8(Bytes, Length, &Index, &CodePoint)) return InvalidLength;
+            Units += CodePoint >= 0x10000 ? 2 : 1;
+        }
+        return Units;
+    }
+
+    // Returns the number of UTF-8 bytes of the UTF-16 string or InvalidLength:
+    inline size_t GetUtf8Length(const WCHAR* Src, size_t Length) {
+        size_t Index = 0, Bytes = 0;
+        while (Index < Length) {
+            if (Src[Index] < 0x80) {
+                size_t Ascii = GetAsciiLength(&Src[Index], Length - Index);
+                Bytes += Ascii;
+                Index += Ascii;
+                continue;
+            }
+            if (Src[Index] < 0x800) {
+                Bytes += 2;
+                ++Index;
+                continue;
+            }
+            unsigned int CodePoint = 0;
+            if (!DecodeUtf16(Src, Length, &Index, &CodePoint)) return InvalidLength;
+            Bytes += CodePoint < 0x800 ? 2 : (CodePoint < 0x10000 ? 3 : 4);
+        }
+        return Bytes;
+    }
+
+    // Transcodes into 'Dest' of 'Capacity' units (not null-terminated), '*Written' receives units
+    // written before the end or the failure. Never needs more units than 'Length':
+    inline UTF_STATUS Utf8ToUtf16(const char* Src, size_t Length, OUT WCHAR* Dest, size_t Capacity, OUT OPTIONAL size_t* Written = NULL) {
+        auto Bytes = reinterpret_cast<const unsigned char*>(Src);
+        size_t Index = 0, Units = 0;
+        UTF_STATUS Status = UtfSuccess;
+        while (Index < Length) {
+            if (Bytes[Index] < 0x80) {
+                size_t Available = Capacity - Units;
+                if (!Available) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                size_t Count = WidenAscii(&Src[Index], Length - Index < Available ? Length - Index : Available, &Dest[Units]);
+                Index += Count;
+                Units += Count;
+                continue;
+            }
+            if (Bytes[Index] >= 0xC2 && Bytes[Index] <= 0xDF && Length - Index >= 2 && (Bytes[Index + 1] & 0xC0) == 0x80) {
+                if (Units == Capacity) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                Dest[Units++] = static_cast<WCHAR>(((Bytes[Index] & 0x1F) << 6) | (Bytes[Index + 1] & 0x3F));
+                Index += 2;
+                continue;
+            }
+            unsigned int CodePoint = 0;
+            size_t Next = Index;
+            if (!DecodeUtf8(Bytes, Length, &Next, &CodePoint)) {
+                Status = UtfInvalidSequence;
+                break;
+            }
+            if (CodePoint < 0x10000) {
+                if (Capacity - Units < 1) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                Dest[Units++] = static_cast<WCHAR>(CodePoint);
+            } else {
+                if (Capacity - Units < 2) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                CodePoint -= 0x10000;
+                Dest[Units++] = static_cast<WCHAR>(0xD800 + (CodePoint >> 10));
+                Dest[Units++] = static_cast<WCHAR>(0xDC00 + (CodePoint & 0x3FF));
+            }
+            Index = Next;
+        }
+        if (Written) *Written = Units;
+        return Status;
+    }
+
+    // Transcodes into 'Dest' of 'Capacity' bytes (not null-terminated), '*Written' receives bytes
+    // written before the end or the failure:
+    inline UTF_STATUS Utf16ToUtf8(const WCHAR* Src, size_t Length, OUT char* Dest, size_t Capacity, OUT OPTIONAL size_t* Written = NULL) {
+        auto Bytes = reinterpret_cast<unsigned char*>(Dest);
+        size_t Index = 0, Count = 0;
+        UTF_STATUS Status = UtfSuccess;
+        while (Index < Length) {
+            if (Src[Index] < 0x80) {
+                size_t Available = Capacity - Count;
+                if (!Available) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                size_t Ascii = NarrowAscii(&Src[Index], Length - Index < Available ? Length - Index : Available, &Dest[Count]);
+                Index += Ascii;
+                Count += Ascii;
+                continue;
+            }
+            if (Src[Index] < 0x800) {
+                if (Capacity - Count < 2) {
+                    Status = UtfBufferTooSmall;
+                    break;
+                }
+                Bytes[Count++] = static_cast<unsigned char>(0xC0 | (Src[Index] >> 6));
+                Bytes[Count++] = static_cast<unsigned char>(0x80 | (Src[Index] & 0x3F));
+                ++Index;
+                continue;
+            }
+            unsigned int CodePoint = 0;
+            size_t Next = Index;
+            if (!DecodeUtf16(Src, Length, &Next, &CodePoint)) {
+                Status = UtfInvalidSequence;
+                break;
+            }
+            size_t Required = CodePoint < 0x800 ? 2 : (CodePoint < 0x10000 ? 3 : 4);
+            if (Capacity - Count < Required) {
+                Status = UtfBufferTooSmall;
+                break;
+            }
+            if (Required == 2) {
+                Bytes[Count++] = static_cast<unsigned char>(0xC0 | (CodePoint >> 6));
+            } else if (Required == 3) {
+                Bytes[Count++] = static_cast<unsigned char>(0xE0 | (CodePoint >> 12));
+                Bytes[Count++] = static_cast<unsigned char>(0x80 | ((CodePoint >> 6) & 0x3F));
+            } else {
+                Bytes[Count++] = static_cast<unsigned char>(0xF0 | (CodePoint >> 18));
+                Bytes[Count++] = static_cast<unsigned char>(0x80 | ((CodePoint >> 12) & 0x3F));
+                Bytes[Count++] = static_cast<unsigned char>(0x80 | ((CodePoint >> 6) & 0x3F));
+            }
+            Bytes[Count++] = static_cast<unsigned char>(0x80 | (CodePoint & 0x3F));
+            Index = Next;
+        }
+        if (Written) *Written = Count;
+        return Status;
+    }
+}
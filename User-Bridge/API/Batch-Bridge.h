@@ -0,0 +1,114 @@
+#pragma once
+
+/*
+    Depends on:
+    - Windows.h
+    - WdkTypes.h
+    - CtlTypes.h
+    - BatchTypes.h
+    - User-Bridge.h
+    - vector
+*/
+
+// Builder of batched requests for Batch::KbExecuteBatch:
+//
+//   KbBatch Batch;
+//   KB_READ_MSR_IN Input = {};
+//   Input.Index = 0x10;
+//   ULONG Entry = Batch.Add(Ctls::KbReadMsr, Input, sizeof(KB_READ_MSR_OUT));
+//   if (Batch.Execute() && Batch.IsSucceeded(Entry)) {
+//       auto Output = Batch.GetOutput<KB_READ_MSR_OUT>(Entry);
+//   }
+//
+class KbBatch final {
+private:
+    std::vector<UINT64> Buffer; // UINT64 granularity keeps all entries 8-bytes aligned
+    std::vector<ULONG> Offsets;
+    ULONG Flags;
+
+    PKB_BATCH_HEADER GetHeader() const {
+        return reinterpret_cast<PKB_BATCH_HEADER>(const_cast<UINT64*>(Buffer.data()));
+    }
+
+    PKB_BATCH_ENTRY GetEntry(ULONG EntryIndex) const {
+        if (EntryIndex >= Offsets.size()) return NULL;
+        return reinterpret_cast<PKB_BATCH_ENTRY>(
+            reinterpret_cast<PUCHAR>(GetHeader()) + Offsets[EntryIndex]
+        );
+    }
+public:
+    static constexpr ULONG InvalidEntry = 0xFFFFFFFF;
+
+    KbBatch(ULONG BatchFlags = KbBatchNoFlags) : Buffer(), Offsets(), Flags(BatchFlags) {
+        Clear();
+    }
+
+    ~KbBatch() = default;
+
+    VOID Clear() {
+        Buffer.assign(sizeof(KB_BATCH_HEADER) / sizeof(UINT64), 0);
+        Offsets.clear();
+        Batch::InitializeBatch(Buffer.data(), sizeof(KB_BATCH_HEADER), Flags);
+    }
+
+    // Returns index of the added entry or InvalidEntry:
+    ULONG Add(Ctls::KbCtlIndices Index, OPTIONAL const VOID* Input = NULL, ULONG InputSize = 0, ULONG OutputSize = 0)
+    {
+        ULONG CurrentSize = GetSize();
+        ULONG EntrySize = Batch::GetEntrySize(InputSize, OutputSize);
+        if (InputSize > Batch::MaxDataSize || OutputSize > Batch::MaxDataSize) return InvalidEntry;
+        if (CurrentSize > 0xFFFFFFFF - EntrySize) return InvalidEntry;
+
+        ULONG NewSize = CurrentSize + EntrySize;
+        Buffer.resize(NewSize / sizeof(UINT64), 0);
+
+        PKB_BATCH_ENTRY Entry = Batch::AppendEntry(Buffer.data(), NewSize, Index, Input, InputSize, OutputSize);
+        if (!Entry) {
+            Buffer.resize(CurrentSize / sizeof(UINT64));
+            return InvalidEntry;
+        }
+
+        Offsets.emplace_back(CurrentSize);
+        return static_cast<ULONG>(Offsets.size() - 1);
+    }
+
+    template <typename InputType>
+    ULONG Add(Ctls::KbCtlIndices Index, const InputType& Input, ULONG OutputSize = 0) {
+        return Add(Index, &Input, sizeof(Input), OutputSize);
+    }
+
+    BOOL Execute() {
+        if (Offsets.empty()) return TRUE;
+        return Batch::KbExecuteBatch(Buffer.data(), GetSize());
+    }
+
+    ULONG GetSize() const { return GetHeader()->TotalSize; }
+    ULONG GetCount() const { return static_cast<ULONG>(Offsets.size()); }
+    ULONG GetExecutedCount() const { return GetHeader()->ExecutedCount; }
+
+    WdkTypes::NTSTATUS GetStatus(ULONG EntryIndex) const {
+        PKB_BATCH_ENTRY Entry = GetEntry(EntryIndex);
+        return Entry ? Entry->Status : static_cast<WdkTypes::NTSTATUS>(0xC000000D); // STATUS_INVALID_PARAMETER
+    }
+
+    BOOL IsSucceeded(ULONG EntryIndex) const {
+        return static_cast<LONG>(GetStatus(EntryIndex)) >= 0; // NT_SUCCESS
+    }
+
+    ULONG GetResponseLength(ULONG EntryIndex) const {
+        PKB_BATCH_ENTRY Entry = GetEntry(EntryIndex);
+        return Entry ? Entry->ResponseLength : 0;
+    }
+
+    PVOID GetOutput(ULONG EntryIndex) const {
+        PKB_BATCH_ENTRY Entry = GetEntry(EntryIndex);
+        return Entry && Entry->OutputSize ? Batch::GetEntryOutput(Entry, Entry->InputSize) : NULL;
+    }
+
+    template <typename OutputType>
+    const OutputType* GetOutput(ULONG EntryIndex) const {
+        PKB_BATCH_ENTRY Entry = GetEntry(EntryIndex);
+        if (!Entry || Entry->OutputSize < sizeof(OutputType)) return NULL;
+        return static_cast<const OutputType*>(Batch::GetEntryOutput(Entry, Entry->InputSize));
+    }
+};
@@ -24,6 +24,7 @@ public:
     PVOID GetData() override { return static_cast<PVOID>(&Packet.Data); }
     ULONG GetSize() const override { return sizeof(Packet); }
 
+    const T& GetConstData() const { return Packet.Data; }
     ULONG GetReplyLength() const { return Packet.Header.ReplyLength; }
     ULONGLONG GetMessageId() const { return Packet.Header.MessageId; }
 };
@@ -5,23 +5,407 @@
     - Windows.h
     - fltUser.h
     - functional
+    - memory
+    - vector
+    - map
+    - string
+    - algorithm
     - WdkTypes.h
     - FltTypes.h
+    - FltFilterTypes.h
+    - FltFrameTypes.h
+    - FltRecordTypes.h
     - CommPort.h
+    - ListenerPool.h
 */
 
+// Compiles path prefixes and masks into KB_FLT_RULES_HEADER (see FltFilterTypes.h),
+// rules get sequential IDs returned by AddPrefix/AddMask:
+//   KbFltRuleSet Rules;
+//   ULONG System = Rules.AddPrefix(L"\\Device\\HarddiskVolume3\\Windows\\");
+//   ULONG Dlls = Rules.AddMask(L"*.dll");
+//   std::vector<BYTE> Compiled;
+//   Rules.Compile(Compiled);
+//   ULONG Ids[16];
+//   ULONG Count = FltFilter::MatchRules(Compiled.data(), Path, PathLength, Ids, 16);
+class KbFltRuleSet {
+private:
+    using TRIE_NODE = struct _TRIE_NODE {
+        std::map<WCHAR, std::unique_ptr<_TRIE_NODE>> Children; // By folded characters
+        std::vector<KB_FLT_RULE_ENTRY> Entries; // MaskOffset is an index in Masks until compilation
+    };
+
+    TRIE_NODE Prefixes;
+    TRIE_NODE Suffixes;
+    TRIE_NODE Infixes;
+    std::vector<KB_FLT_RULE_ENTRY> Unanchored;
+    std::vector<std::wstring> Masks; // Unmatched parts of masks
+    ULONG RulesCount;
+
+    static bool IsWildcard(WCHAR Char) {
+        return Char == L'*' || Char == L'?';
+    }
+
+    // Returns the node of the folded 'Key', reversed if 'Reverse':
+    static TRIE_NODE* Insert(TRIE_NODE* Root, const std::wstring& Key, bool Reverse) {
+        TRIE_NODE* Node = Root;
+        for (size_t i = 0; i < Key.length(); i++) {
+            WCHAR Char = FltFilter::FoldChar(Reverse ? Key[Key.length() - i - 1] : Key[i]);
+            auto& Child = Node->Children[Char];
+            if (!Child) Child = std::make_unique<TRIE_NODE>();
+            Node = Child.get();
+        }
+        return Node;
+    }
+
+    KB_FLT_RULE_ENTRY MakeEntry(OPTIONAL const std::wstring* Mask) {
+        KB_FLT_RULE_ENTRY Entry = {};
+        Entry.Id = RulesCount++;
+        Entry.MaskOffset = static_cast<ULONG>(Masks.size());
+        Entry.MaskLength = KbFltRuleNoMask;
+        if (Mask) {
+            Entry.MaskLength = static_cast<ULONG>(Mask->length());
+            Masks.emplace_back(*Mask);
+        }
+        return Entry;
+    }
+
+    static ULONG AppendChars(std::vector<WCHAR>& Chars, const std::wstring& Str) {
+        ULONG Offset = static_cast<ULONG>(Chars.size());
+        Chars.insert(Chars.end(), Str.begin(), Str.end());
+        return Offset;
+    }
+
+    // Nodes of the trie are appended breadth-first, so children of every node are consecutive,
+    // chains of nodes without entries and with a single child are merged into labels:
+    static bool AppendTrie(
+        const TRIE_NODE* Root,
+        std::vector<KB_FLT_RULE_NODE>& Nodes,
+        std::vector<const TRIE_NODE*>& Sources,
+        std::vector<WCHAR>& Chars
+    ) {
+        Nodes.push_back({});
+        Sources.emplace_back(Root);
+        for (size_t i = Nodes.size() - 1; i < Nodes.size(); i++) {
+            const TRIE_NODE* Source = Sources[i];
+            if (Source->Children.size() > MAXWORD) return false;
+            Nodes[i].FirstChild = static_cast<ULONG>(Nodes.size());
+            Nodes[i].ChildrenCount = static_cast<USHORT>(Source->Children.size());
+            for (const auto& Child : Source->Children) {
+                std::wstring Label(1, Child.first);
+                const TRIE_NODE* End = Child.second.get();
+                while (End->Entries.empty() && End->Children.size() == 1 && Label.length() < MAXWORD) {
+                    Label += End->Children.begin()->first;
+                    End = End->Children.begin()->second.get();
+                }
+                KB_FLT_RULE_NODE Node = {};
+                Node.LabelOffset = AppendChars(Chars, Label);
+                Node.LabelLength = static_cast<USHORT>(Label.length());
+                Nodes.emplace_back(Node);
+                Sources.emplace_back(End);
+            }
+        }
+        return true;
+    }
+public:
+    KbFltRuleSet() : Prefixes(), Suffixes(), Infixes(), Unanchored(), Masks(), RulesCount(0) {}
+    ~KbFltRuleSet() = default;
+
+    ULONG GetRulesCount() const {
+        return RulesCount;
+    }
+
+    // Case-insensitive for ASCII letters:
+    ULONG AddPrefix(const std::wstring& Prefix) {
+        TRIE_NODE* Node = Insert(&Prefixes, Prefix, false);
+        Node->Entries.emplace_back(MakeEntry(NULL));
+        return Node->Entries.back().Id;
+    }
+
+    // '*' matches any sequence, '?' matches any single character:
+    ULONG AddMask(const std::wstring& Mask) {
+        size_t First = 0;
+        while (First < Mask.length() && !IsWildcard(Mask[First])) First++;
+        size_t Last = Mask.length();
+        while (Last > 0 && !IsWildcard(Mask[Last - 1])) Last--;
+
+        KB_FLT_RULE_ENTRY Entry = {};
+        if (First > 0 || First == Mask.length()) {
+            // Literal head goes to the trie of prefixes, a mask without wildcards is matched as is:
+            std::wstring Rest = Mask.substr(First);
+            Entry = MakeEntry(&Rest);
+            Insert(&Prefixes, Mask.substr(0, First), false)->Entries.emplace_back(Entry);
+        } else if (Last < Mask.length()) {
+            std::wstring Rest = Mask.substr(0, Last);
+            Entry = MakeEntry(&Rest);
+            Insert(&Suffixes, Mask.substr(Last), true)->Entries.emplace_back(Entry);
+        } else {
+            // The longest literal part is the rarest one in paths:
+            size_t Infix = 0, InfixLength = 0;
+            for (size_t Begin = 0; Begin < Mask.length();) {
+                size_t End = Begin;
+                while (End < Mask.length() && !IsWildcard(Mask[End])) End++;
+                if (End - Begin > InfixLength) {
+                    Infix = Begin;
+                    InfixLength = End - Begin;
+                }
+                Begin = End + 1;
+            }
+            Entry = MakeEntry(&Mask);
+            if (InfixLength) Insert(&Infixes, Mask.substr(Infix, InfixLength), false)->Entries.emplace_back(Entry);
+            else Unanchored.emplace_back(Entry);
+        }
+        return Entry.Id;
+    }
+
+    bool IsEmpty() const {
+        return RulesCount == 0;
+    }
+
+    bool Compile(OUT std::vector<BYTE>& Compiled) const {
+        Compiled.clear();
+
+        std::vector<KB_FLT_RULE_NODE> Nodes;
+        std::vector<const TRIE_NODE*> Sources; // Trie nodes at the ends of labels
+        std::vector<WCHAR> Chars;
+        if (!AppendTrie(&Prefixes, Nodes, Sources, Chars)) return false;
+        ULONG ReverseRoot = static_cast<ULONG>(Nodes.size());
+        if (!AppendTrie(&Suffixes, Nodes, Sources, Chars)) return false;
+        ULONG InfixRoot = static_cast<ULONG>(Nodes.size());
+        if (!AppendTrie(&Infixes, Nodes, Sources, Chars)) return false;
+
+        // Masks are placed after labels, entries follow the order of their nodes:
+        std::vector<ULONG> MaskOffsets;
+        for (const auto& Mask : Masks) MaskOffsets.emplace_back(AppendChars(Chars, Mask));
+
+        std::vector<KB_FLT_RULE_ENTRY> Entries;
+        auto AppendEntry = [&](KB_FLT_RULE_ENTRY Entry) {
+            if (Entry.MaskLength != KbFltRuleNoMask) Entry.MaskOffset = MaskOffsets[Entry.MaskOffset];
+            else Entry.MaskOffset = 0;
+            Entries.emplace_back(Entry);
+        };
+        for (size_t i = 0; i < Nodes.size(); i++) {
+            Nodes[i].FirstEntry = static_cast<ULONG>(Entries.size());
+            for (const auto& Entry : Sources[i]->Entries) AppendEntry(Entry);
+        }
+        ULONG UnanchoredEntry = static_cast<ULONG>(Entries.size());
+        for (const auto& Entry : Unanchored) AppendEntry(Entry);
+
+        KB_FLT_RULES_HEADER Header = {};
+        Header.RulesCount = RulesCount;
+        Header.NodesCount = static_cast<ULONG>(Nodes.size());
+        Header.EntriesCount = static_cast<ULONG>(Entries.size());
+        Header.CharsCount = static_cast<ULONG>(Chars.size());
+        Header.ReverseRoot = ReverseRoot;
+        Header.InfixRoot = InfixRoot;
+        Header.UnanchoredEntry = UnanchoredEntry;
+
+        const BYTE* HeaderBytes = reinterpret_cast<const BYTE*>(&Header);
+        const BYTE* NodesBytes = reinterpret_cast<const BYTE*>(Nodes.data());
+        const BYTE* EntriesBytes = reinterpret_cast<const BYTE*>(Entries.data());
+        const BYTE* CharsBytes = reinterpret_cast<const BYTE*>(Chars.data());
+        Compiled.insert(Compiled.end(), HeaderBytes, HeaderBytes + sizeof(Header));
+        Compiled.insert(Compiled.end(), NodesBytes, NodesBytes + Nodes.size() * sizeof(KB_FLT_RULE_NODE));
+        Compiled.insert(Compiled.end(), EntriesBytes, EntriesBytes + Entries.size() * sizeof(KB_FLT_RULE_ENTRY));
+        Compiled.insert(Compiled.end(), CharsBytes, CharsBytes + Chars.size() * sizeof(WCHAR));
+
+        return FltFilter::IsRuleSetValid(Compiled.data(), static_cast<ULONG>(Compiled.size())) == TRUE;
+    }
+};
+
+// Builder of filter programs evaluated by the driver before sending events.
+// Conditions of the same kind are OR-ed, different kinds are AND-ed:
+//   KbFltFilter().Process(Pid).PathPrefix(L"C:\\Windows\\").PathMask(L"*.dll")
+// matches events of 'Pid' whose path starts with 'C:\Windows\' or ends with '.dll'.
+// Path conditions are checked last, so the driver obtains paths only for events
+// that passed all other conditions:
+class KbFltFilter {
+private:
+    using RANGE = struct {
+        ULONG Low;
+        ULONG High;
+    };
+
+    std::vector<UINT64> ProcessIds;
+    std::vector<RANGE> IoctlRanges;
+    std::vector<RANGE> SizeRanges;
+    std::vector<std::wstring> PathPrefixes;
+    std::vector<std::wstring> PathMasks;
+
+    static void AppendInstruction(
+        std::vector<KB_FLT_INSTRUCTION>& Instructions,
+        KB_FLT_OPCODE Opcode,
+        ULONG Offset,
+        ULONG Count,
+        UINT64 Low = 0,
+        UINT64 High = 0
+    ) {
+        KB_FLT_INSTRUCTION Instruction = {};
+        Instruction.Opcode = static_cast<USHORT>(Opcode);
+        Instruction.Offset = Offset;
+        Instruction.Count = Count;
+        Instruction.Low = Low;
+        Instruction.High = High;
+        Instructions.emplace_back(Instruction);
+    }
+
+    // Operands are aligned to ULONG:
+    static ULONG AppendData(std::vector<BYTE>& Data, const std::vector<BYTE>& Operand) {
+        Data.resize((Data.size() + sizeof(ULONG) - 1) & ~(sizeof(ULONG) - 1), 0);
+        ULONG Offset = static_cast<ULONG>(Data.size());
+        Data.insert(Data.end(), Operand.begin(), Operand.end());
+        return Offset;
+    }
+public:
+    KbFltFilter() = default;
+    ~KbFltFilter() = default;
+
+    KbFltFilter& Process(UINT64 ProcessId) {
+        ProcessIds.emplace_back(ProcessId);
+        return *this;
+    }
+
+    KbFltFilter& Ioctl(ULONG Low, ULONG High) {
+        IoctlRanges.push_back({ Low, High });
+        return *this;
+    }
+
+    KbFltFilter& Size(ULONG Low, ULONG High) {
+        SizeRanges.push_back({ Low, High });
+        return *this;
+    }
+
+    // Case-insensitive for ASCII letters:
+    KbFltFilter& PathPrefix(LPCWSTR Prefix) {
+        if (Prefix) PathPrefixes.emplace_back(Prefix);
+        return *this;
+    }
+
+    // '*' matches any sequence, '?' matches any single character:
+    KbFltFilter& PathMask(LPCWSTR Mask) {
+        if (Mask) PathMasks.emplace_back(Mask);
+        return *this;
+    }
+
+    bool IsEmpty() const {
+        return ProcessIds.empty() && IoctlRanges.empty() && SizeRanges.empty() && PathPrefixes.empty() && PathMasks.empty();
+    }
+
+    // Empty filter gives an empty program which accepts all events:
+    bool Compile(OUT std::vector<BYTE>& Program) const {
+        Program.clear();
+        if (IsEmpty()) return true;
+
+        std::vector<KB_FLT_INSTRUCTION> Instructions;
+        std::vector<BYTE> Data;
+        std::vector<size_t> GroupEnds; // Index after the last instruction of each group
+
+        // UINT64 operands go first to keep them aligned:
+        if (!ProcessIds.empty()) {
+            std::vector<UINT64> Sorted = ProcessIds;
+            std::sort(Sorted.begin(), Sorted.end());
+            Sorted.erase(std::unique(Sorted.begin(), Sorted.end()), Sorted.end());
+            const BYTE* Bytes = reinterpret_cast<const BYTE*>(Sorted.data());
+            Data.insert(Data.end(), Bytes, Bytes + Sorted.size() * sizeof(UINT64));
+            AppendInstruction(Instructions, KbFltOpProcessIn, 0, static_cast<ULONG>(Sorted.size()));
+            GroupEnds.emplace_back(Instructions.size());
+        }
+
+        if (!IoctlRanges.empty()) {
+            for (const auto& Range : IoctlRanges)
+                AppendInstruction(Instructions, KbFltOpIoctlRange, 0, 0, Range.Low, Range.High);
+            GroupEnds.emplace_back(Instructions.size());
+        }
+
+        if (!SizeRanges.empty()) {
+            for (const auto& Range : SizeRanges)
+                AppendInstruction(Instructions, KbFltOpSizeRange, 0, 0, Range.Low, Range.High);
+            GroupEnds.emplace_back(Instructions.size());
+        }
+
+        // All path conditions are compiled into one rule set, so they are matched by a single walk of the path:
+        if (!PathPrefixes.empty() || !PathMasks.empty()) {
+            KbFltRuleSet Rules;
+            for (const auto& Prefix : PathPrefixes) Rules.AddPrefix(Prefix);
+            for (const auto& Mask : PathMasks) Rules.AddMask(Mask);
+            std::vector<BYTE> Compiled;
+            if (!Rules.Compile(Compiled)) return false;
+            AppendInstruction(Instructions, KbFltOpPathRules, AppendData(Data, Compiled), static_cast<ULONG>(Compiled.size()));
+            GroupEnds.emplace_back(Instructions.size());
+        }
+
+        if (Instructions.size() > KbFltMaxInstructions) return false;
+
+        // Passed condition jumps to the next group, failed one tries the next alternative of its group:
+        size_t Index = 0;
+        for (size_t Group = 0; Group < GroupEnds.size(); Group++) {
+            size_t End = GroupEnds[Group];
+            USHORT NextGroup = Group + 1 < GroupEnds.size() ? static_cast<USHORT>(End) : KbFltAccept;
+            for (; Index < End; Index++) {
+                Instructions[Index].OnTrue = NextGroup;
+                Instructions[Index].OnFalse = Index + 1 < End ? static_cast<USHORT>(Index + 1) : KbFltReject;
+            }
+        }
+
+        KB_FLT_PROGRAM_HEADER Header = {};
+        Header.Signature = KB_FLT_PROGRAM_SIGNATURE;
+        Header.Version = KB_FLT_PROGRAM_VERSION;
+        Header.InstructionsCount = static_cast<USHORT>(Instructions.size());
+        Header.DataSize = static_cast<ULONG>(Data.size());
+
+        const BYTE* HeaderBytes = reinterpret_cast<const BYTE*>(&Header);
+        const BYTE* InstructionsBytes = reinterpret_cast<const BYTE*>(Instructions.data());
+        Program.insert(Program.end(), HeaderBytes, HeaderBytes + sizeof(Header));
+        Program.insert(Program.end(), InstructionsBytes, InstructionsBytes + Instructions.size() * sizeof(KB_FLT_INSTRUCTION));
+        Program.insert(Program.end(), Data.begin(), Data.end());
+
+        return FltFilter::IsProgramValid(Program.data(), static_cast<ULONG>(Program.size())) == TRUE;
+    }
+};
+
+// Builds KB_FLT_CONTEXT followed by the compiled filter, Client ID is of the current thread:
+inline bool KbFltBuildContext(KbFltTypes Type, ULONG Flags, OPTIONAL const KbFltFilter* Filter, OUT std::vector<BYTE>& Context) {
+    std::vector<BYTE> Program;
+    if (Filter && !Filter->Compile(Program)) return false;
+    if (sizeof(KB_FLT_CONTEXT) + Program.size() > MAXWORD) return false;
+
+    Context.assign(sizeof(KB_FLT_CONTEXT), 0);
+    Context.insert(Context.end(), Program.begin(), Program.end());
+
+    auto FltContext = reinterpret_cast<PKB_FLT_CONTEXT>(Context.data());
+    FltContext->Type = Type;
+    FltContext->Flags = Flags;
+    FltContext->Client.ProcessId = GetCurrentProcessId();
+    FltContext->Client.ThreadId = GetCurrentThreadId();
+    return true;
+}
+
+// File events (KbFltPre/Post Create, Read, Write and DeviceControl) are variable-length records,
+// listen to them with CommPortListener<KB_FLT_RECORD_BUFFER, Type>, parse every message by this function
+// and reply with ReplyPacket<KB_FLT_***_INFO> (driver takes only 'Status' from the reply):
+inline bool KbFltParseRecord(MessagePacket<KB_FLT_RECORD_BUFFER>& Message, KbFltTypes Type, OUT FltRecord::PRECORD Record) {
+    if (!FltRecord::Parse(Message.GetData(), sizeof(KB_FLT_RECORD_BUFFER), Record)) return false;
+    return Record->Header->Type == Type;
+}
+
 template <typename PacketDataType, KbFltTypes PacketType>
 class CommPortListener {
 public:
     using _Callback = std::function<void(CommPort& Port, MessagePacket<PacketDataType>& Message)>;
+
+    // Receives all events of a frame at once, only for KbPsProcess, KbPsThread and KbPsImage:
+    using _BatchCallback = std::function<void(CommPort& Port, const PacketDataType* Events, ULONG Count)>;
 private:
     CommPort Port;
     HANDLE hThread;
     _Callback Callback;
+    _BatchCallback BatchCallback;
 
     HRESULT ConnectStatus;
     HANDLE hSubscriptionEvent;
 
+    std::vector<BYTE> Context; // KB_FLT_CONTEXT and the optional filter program
+
     static bool CallCallbackSafe(CommPortListener* Self, MessagePacket<PacketDataType>& Message) {
         if (Self->Callback) {
             __try {
@@ -33,17 +417,47 @@ private:
         return true;
     }
 
+    static bool CallBatchCallbackSafe(CommPortListener* Self, const PacketDataType* Events, ULONG Count) {
+        if (Self->BatchCallback) {
+            __try {
+                Self->BatchCallback(Self->Port, Events, Count);
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static VOID ReceiveFrames(CommPortListener* Self) {
+        // Frame buffer is large, so it is reused for all messages:
+        auto Message = std::make_unique<MessagePacket<KB_FLT_FRAME>>();
+        HRESULT Status;
+        do {
+            Status = Self->Port.Recv(*Message);
+            if (SUCCEEDED(Status)) {
+                auto Frame = static_cast<PKB_FLT_FRAME>(Message->GetData());
+                if (FltFrame::IsFrameValid(Frame, sizeof(KB_FLT_FRAME), sizeof(PacketDataType)) && Frame->Header.Count) {
+                    CallBatchCallbackSafe(Self, FltFrame::GetRecords<PacketDataType>(Frame), Frame->Header.Count);
+                }
+            }
+        } while (SUCCEEDED(Status));
+    }
+
     static VOID WINAPI ListenerThread(CommPortListener* Self) {
-        KB_FLT_CONTEXT Context = {};
-        Context.Type = PacketType;
-        Context.Client.ProcessId = GetCurrentProcessId();
-        Context.Client.ThreadId = GetCurrentThreadId();
+        // Driver doesn't send events of the listener thread to this listener:
+        auto FltContext = reinterpret_cast<PKB_FLT_CONTEXT>(Self->Context.data());
+        FltContext->Client.ThreadId = GetCurrentThreadId();
 
         static LPCWSTR PortName = L"\\Kernel-Bridge";
-        Self->ConnectStatus = Self->Port.Connect(PortName, &Context, sizeof(Context));
+        Self->ConnectStatus = Self->Port.Connect(PortName, Self->Context.data(), static_cast<WORD>(Self->Context.size()));
         SetEvent(Self->hSubscriptionEvent);
         if (!SUCCEEDED(Self->ConnectStatus)) ExitThread(0);
 
+        if (FltContext->Flags & KbFltBatched) {
+            ReceiveFrames(Self);
+            ExitThread(0);
+        }
+
         HRESULT Status;
         do {
             MessagePacket<PacketDataType> Message;
@@ -54,18 +468,10 @@ private:
         } while (SUCCEEDED(Status));
         ExitThread(0);    
     }
-public:
-    CommPortListener() : Port(), hThread(NULL), Callback(NULL), ConnectStatus(ERROR_SUCCESS) {
-        hSubscriptionEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    }
-    ~CommPortListener() {
-        Unsubscribe();
-        CloseHandle(hSubscriptionEvent);    
-    } 
 
-    BOOL Subscribe(_Callback Listener) {
-        if (hThread != NULL || !Listener) return FALSE;
-        Callback = Listener;
+    BOOL Start(OPTIONAL const KbFltFilter* Filter, ULONG Flags) {
+        if (!KbFltBuildContext(PacketType, Flags, Filter, Context)) return FALSE;
+
         hThread = CreateThread(NULL, 0, reinterpret_cast<LPTHREAD_START_ROUTINE>(ListenerThread), this, 0, NULL);
         if (!hThread) return FALSE;
         WaitForSingleObject(hSubscriptionEvent, INFINITE);
@@ -78,6 +484,31 @@ public:
 
         return SUCCEEDED(ConnectStatus);    
     }
+public:
+    CommPortListener() : Port(), hThread(NULL), Callback(NULL), BatchCallback(NULL), ConnectStatus(ERROR_SUCCESS) {
+        hSubscriptionEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    ~CommPortListener() {
+        Unsubscribe();
+        CloseHandle(hSubscriptionEvent);    
+    } 
+
+    // Only events accepted by the 'Filter' are sent by the driver:
+    BOOL Subscribe(_Callback Listener, OPTIONAL const KbFltFilter* Filter = NULL) {
+        if (hThread != NULL || !Listener) return FALSE;
+        Callback = Listener;
+        BatchCallback = NULL;
+        return Start(Filter, KbFltNoFlags);
+    }
+
+    // Driver packs pending events into frames, so one message delivers many events:
+    BOOL Subscribe(_BatchCallback Listener, OPTIONAL const KbFltFilter* Filter = NULL) {
+        if (PacketType != KbPsProcess && PacketType != KbPsThread && PacketType != KbPsImage) return FALSE;
+        if (hThread != NULL || !Listener) return FALSE;
+        Callback = NULL;
+        BatchCallback = Listener;
+        return Start(Filter, KbFltBatched);
+    }
 
     VOID Unsubscribe() {
         if (!hThread) return;
@@ -86,4 +517,85 @@ public:
         CloseHandle(hThread);
         hThread = NULL;    
     }
-};
\ No newline at end of file
+};
+
+// Several workers receive messages from one port and reply independently,
+// so a slow callback doesn't hold back other events of the same type.
+// With 'KeyOf' (e.g. ProcessId of the event) events with the same key are handled in order:
+template <typename PacketDataType, KbFltTypes PacketType>
+class CommPortListenerPool {
+public:
+    using _Callback = std::function<void(CommPort& Port, MessagePacket<PacketDataType>& Message)>;
+    using _KeyOf = std::function<UINT64(const PacketDataType& Data)>;
+private:
+    CommPort Port;
+    ListenerPool<MessagePacket<PacketDataType>> Pool;
+    _Callback Callback;
+    std::vector<BYTE> Context;
+    BOOL Subscribed;
+
+    static bool CallCallbackSafe(CommPortListenerPool* Self, MessagePacket<PacketDataType>& Message) {
+        if (Self->Callback) {
+            __try {
+                Self->Callback(Self->Port, Message);
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+                return false;
+            }
+        }
+        return true;
+    }
+public:
+    CommPortListenerPool() : Port(), Pool(), Callback(NULL), Context(), Subscribed(FALSE) {}
+    ~CommPortListenerPool() {
+        Unsubscribe();
+    }
+
+    // Events of all threads of the current process aren't sent to the pool, so file I/O
+    // of workers inside callbacks doesn't come back to the pool (it would wait behind
+    // the key the worker is busy with and hold the driver until the send timeout):
+    BOOL Subscribe(ULONG WorkersCount, _Callback Listener, OPTIONAL _KeyOf KeyOf = NULL, OPTIONAL const KbFltFilter* Filter = NULL) {
+        if (Subscribed || !WorkersCount || !Listener) return FALSE;
+        if (!KbFltBuildContext(PacketType, KbFltSkipOwnProcess, Filter, Context)) return FALSE;
+
+        static LPCWSTR PortName = L"\\Kernel-Bridge";
+        if (!SUCCEEDED(Port.Connect(PortName, Context.data(), static_cast<WORD>(Context.size())))) return FALSE;
+
+        Callback = Listener;
+        typename ListenerPool<MessagePacket<PacketDataType>>::_KeyOf MessageKeyOf = NULL;
+        if (KeyOf) {
+            MessageKeyOf = [KeyOf](const MessagePacket<PacketDataType>& Message) -> UINT64 {
+                return KeyOf(Message.GetConstData());
+            };
+        }
+
+        Subscribed = Pool.Start(
+            WorkersCount,
+            [this](MessagePacket<PacketDataType>& Message) -> bool {
+                return SUCCEEDED(Port.Recv(Message));
+            },
+            [this](MessagePacket<PacketDataType>& Message) {
+                CallCallbackSafe(this, Message);
+            },
+            MessageKeyOf
+        );
+
+        if (!Subscribed) Port.Disconnect();
+        return Subscribed;
+    }
+
+    VOID Unsubscribe() {
+        if (!Subscribed) return;
+        Port.Disconnect();
+        Pool.Join();
+        Subscribed = FALSE;
+    }
+
+    ULONG GetWorkersCount() const {
+        return Pool.GetWorkersCount();
+    }
+
+    // Latencies from receiving of the event to the end of callback:
+    const LatencyHistogram* GetLatency(ULONG WorkerIndex) const {
+        return Pool.GetLatency(WorkerIndex);
+    }
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+/*
+    Depends on:
+    - WdkTypes.h (or any definitions of ULONG and UINT64)
+    - functional
+    - vector
+    - deque
+    - unordered_map
+    - memory
+    - atomic
+    - mutex
+    - thread
+    - chrono
+*/
+
+// Scheduling core of CommPortListenerPool, it knows nothing about fltUser.h:
+// every worker calls 'Receive' until it fails and handles received messages by itself.
+// With a key function, messages with the same key are handled one at a time in order of receiving:
+// workers receive one at a time and register the key of message before the next receive,
+// if the key is busy, the message is handed off to the worker that handles this key,
+// and the receiving worker goes back to 'Receive' without waiting. Handlers still run in parallel.
+
+// Latencies from receiving of the message to the end of its handler, log2 buckets of microseconds:
+class LatencyHistogram final {
+public:
+    static constexpr ULONG BucketsCount = 32;
+private:
+    std::atomic<UINT64> Buckets[BucketsCount];
+public:
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram(LatencyHistogram&&) = delete;
+    LatencyHistogram& operator = (const LatencyHistogram&) = delete;
+    LatencyHistogram& operator = (LatencyHistogram&&) = delete;
+
+    LatencyHistogram() {
+        Reset();
+    }
+
+    ~LatencyHistogram() = default;
+
+    static ULONG GetBucket(UINT64 Microseconds) {
+        ULONG Bucket = 0;
+        while (Microseconds > 1 && Bucket < BucketsCount - 1) {
+            Microseconds >>= 1;
+            Bucket++;
+        }
+        return Bucket;
+    }
+
+    // Bucket N holds latencies in [2^N, 2^(N+1)) microseconds (bucket 0 holds [0, 2)):
+    static UINT64 GetBucketLimit(ULONG Bucket) {
+        return static_cast<UINT64>(1) << (Bucket + 1);
+    }
+
+    void Record(UINT64 Microseconds) {
+        Buckets[GetBucket(Microseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        for (auto& Bucket : Buckets) Bucket.store(0, std::memory_order_relaxed);
+    }
+
+    UINT64 GetCount(ULONG Bucket) const {
+        return Bucket < BucketsCount ? Buckets[Bucket].load(std::memory_order_relaxed) : 0;
+    }
+
+    UINT64 GetTotal() const {
+        UINT64 Total = 0;
+        for (const auto& Bucket : Buckets) Total += Bucket.load(std::memory_order_relaxed);
+        return Total;
+    }
+
+    // Upper limit of the bucket that contains the percentile (0..100) in microseconds:
+    UINT64 GetPercentile(ULONG Percent) const {
+        UINT64 Total = GetTotal();
+        if (!Total) return 0;
+        UINT64 Threshold = (Total * (Percent > 100 ? 100 : Percent) + 99) / 100;
+        UINT64 Accumulated = 0;
+        for (ULONG i = 0; i < BucketsCount; i++) {
+            Accumulated += GetCount(i);
+            if (Accumulated >= Threshold && Accumulated) return GetBucketLimit(i);
+        }
+        return GetBucketLimit(BucketsCount - 1);
+    }
+};
+
+template <typename MessageType>
+class ListenerPool final {
+public:
+    // Blocks until the message is received, returns false when the port is closed:
+    using _Receive = std::function<bool(MessageType& Message)>;
+    using _Handler = std::function<void(MessageType& Message)>;
+    using _KeyOf = std::function<UINT64(const MessageType& Message)>;
+private:
+    using PENDING = struct {
+        MessageType Message;
+        std::chrono::steady_clock::time_point Received;
+    };
+
+    _Receive Receive;
+    _Handler Handler;
+    _KeyOf KeyOf;
+
+    std::vector<std::thread> Workers;
+    std::vector<std::unique_ptr<LatencyHistogram>> Latencies;
+
+    // Serializes receiving and registration of keys in the ordered mode:
+    std::mutex ReceiveLock;
+
+    // Keys that are handled now and their messages waiting for the handling worker:
+    std::mutex KeysLock;
+    std::unordered_map<UINT64, std::deque<PENDING>> BusyKeys;
+
+    void Handle(ULONG WorkerIndex, MessageType& Message, std::chrono::steady_clock::time_point Received) {
+        if (Handler) Handler(Message);
+        auto Elapsed = std::chrono::steady_clock::now() - Received;
+        Latencies[WorkerIndex]->Record(
+            static_cast<UINT64>(std::chrono::duration_cast<std::chrono::microseconds>(Elapsed).count())
+        );
+    }
+
+    // Returns true if the caller owns the key now, otherwise the message is handed off:
+    bool ClaimKey(UINT64 Key, PENDING& Pending) {
+        std::lock_guard<std::mutex> Lock(KeysLock);
+        auto Busy = BusyKeys.find(Key);
+        if (Busy != BusyKeys.end()) {
+            Busy->second.emplace_back(std::move(Pending));
+            return false;
+        }
+        BusyKeys.emplace(Key, std::deque<PENDING>());
+        return true;
+    }
+
+    // Handles the message and all messages of its key that arrive meanwhile:
+    void HandleOrdered(ULONG WorkerIndex, UINT64 Key, PENDING& Pending) {
+        Handle(WorkerIndex, Pending.Message, Pending.Received);
+
+        for (;;) {
+            PENDING Next;
+            {
+                std::lock_guard<std::mutex> Lock(KeysLock);
+                auto Busy = BusyKeys.find(Key);
+                if (Busy->second.empty()) {
+                    BusyKeys.erase(Busy);
+                    return;
+                }
+                Next = std::move(Busy->second.front());
+                Busy->second.pop_front();
+            }
+            Handle(WorkerIndex, Next.Message, Next.Received);
+        }
+    }
+
+    void WorkerThread(ULONG WorkerIndex) {
+        for (;;) {
+            PENDING Pending = {};
+            if (!KeyOf) {
+                if (!Receive(Pending.Message)) break;
+                Pending.Received = std::chrono::steady_clock::now();
+                Handle(WorkerIndex, Pending.Message, Pending.Received);
+                continue;
+            }
+
+            UINT64 Key = 0;
+            bool IsOwner = false;
+            {
+                std::lock_guard<std::mutex> Lock(ReceiveLock);
+                if (!Receive(Pending.Message)) break;
+                Pending.Received = std::chrono::steady_clock::now();
+                Key = KeyOf(Pending.Message);
+                IsOwner = ClaimKey(Key, Pending);
+            }
+            if (IsOwner) HandleOrdered(WorkerIndex, Key, Pending);
+        }
+    }
+public:
+    ListenerPool(const ListenerPool&) = delete;
+    ListenerPool(ListenerPool&&) = delete;
+    ListenerPool& operator = (const ListenerPool&) = delete;
+    ListenerPool& operator = (ListenerPool&&) = delete;
+
+    ListenerPool() = default;
+
+    ~ListenerPool() {
+        Join();
+    }
+
+    // 'KeyOf' is optional, without it messages are handled in any order:
+    bool Start(ULONG WorkersCount, _Receive Receiver, _Handler MessageHandler, OPTIONAL _KeyOf KeyFunction = nullptr) {
+        if (!Workers.empty() || !WorkersCount || !Receiver) return false;
+
+        Receive = Receiver;
+        Handler = MessageHandler;
+        KeyOf = KeyFunction;
+
+        Latencies.clear();
+        for (ULONG i = 0; i < WorkersCount; i++) {
+            Latencies.emplace_back(std::make_unique<LatencyHistogram>());
+        }
+
+        for (ULONG i = 0; i < WorkersCount; i++) {
+            Workers.emplace_back(&ListenerPool::WorkerThread, this, i);
+        }
+        return true;
+    }
+
+    // Waits for workers, 'Receive' must fail for all of them (e.g. the port is closed):
+    void Join() {
+        for (auto& Worker : Workers) {
+            if (Worker.joinable()) Worker.join();
+        }
+        Workers.clear();
+    }
+
+    ULONG GetWorkersCount() const {
+        return static_cast<ULONG>(Latencies.size());
+    }
+
+    const LatencyHistogram* GetLatency(ULONG WorkerIndex) const {
+        return WorkerIndex < Latencies.size() ? Latencies[WorkerIndex].get() : nullptr;
+    }
+};
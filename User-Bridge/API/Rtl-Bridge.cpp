@@ -1,11 +1,14 @@
 #include <Windows.h>
+#include <intrin.h>
 
 #include "Rtl-Bridge.h"
 
 // User-Bridge types:
 #include <WdkTypes.h>
 #include <CtlTypes.h>
+#include <LockStatsTypes.h>
 #include <User-Bridge.h>
+#include <UtfTypes.h>
 
 // PEUtils modules:
 #include <PEAnalyzer.h>
@@ -20,13 +23,23 @@ namespace KbRtl {
             PELoader Loader(
                 static_cast<HMODULE>(DriverImage),
                 [](LPCSTR LibName, LPCSTR FunctionName) -> PVOID {
-                    // Converting ANSI-name to Unicode-name:
-                    ULONG SymbolsCount = MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, FunctionName, -1, NULL, 0);
-                    std::wstring WideName(SymbolsCount, static_cast<WCHAR>(0x0000));
-                    MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, FunctionName, -1, const_cast<LPWSTR>(WideName.c_str()), SymbolsCount - 1);
+                    // Import names are ASCII (UTF-8 at most), names of usual length are converted on the stack:
+                    size_t NameLength = strlen(FunctionName);
+                    size_t WideLength = Utf::GetUtf16Length(FunctionName, NameLength);
+                    if (WideLength == Utf::InvalidLength) throw KbMapDrvImportNotResolved;
+
+                    WCHAR StackName[128];
+                    std::wstring HeapName;
+                    LPWSTR WideName = StackName;
+                    if (WideLength >= ARRAYSIZE(StackName)) {
+                        HeapName.resize(WideLength);
+                        WideName = &HeapName[0];
+                    }
+                    Utf::Utf8ToUtf16(FunctionName, NameLength, WideName, WideLength);
+                    WideName[WideLength] = L'\0';
 
                     WdkTypes::PVOID KernelAddress = NULL;
-                    BOOL Status = Stuff::KbGetKernelProcAddress(WideName.c_str(), &KernelAddress);
+                    BOOL Status = Stuff::KbGetKernelProcAddress(WideName, &KernelAddress);
                     if (!Status) throw KbMapDrvImportNotResolved;
                 
                     return reinterpret_cast<PVOID>(KernelAddress);
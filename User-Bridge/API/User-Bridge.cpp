@@ -1,7 +1,10 @@
 #include <Windows.h>
 
 #include "WdkTypes.h"
+#include "Atomics.h"
 #include "CtlTypes.h"
+#include "RingTypes.h"
+#include "LockStatsTypes.h"
 #include "User-Bridge.h"
 
 #include "DriversUtils.h"
@@ -60,6 +63,7 @@ namespace KbLoader {
     BOOL WINAPI KbUnload()
     {
         if (hDriver == INVALID_HANDLE_VALUE) return TRUE;
+        KbUnmapRings();
         CloseHandle(hDriver);
         return DeleteDriver(KbDriverName);
     }
@@ -767,6 +771,24 @@ namespace Processes {
             Input.Size = Size;
             return KbSendRequest(Ctls::KbWriteProcessMemory, &Input, sizeof(Input));
         }
+
+        BOOL WINAPI KbReadProcessMemoryVectored(ULONG ProcessId, IN OUT PKB_MEMORY_DESCRIPTOR Descriptors, ULONG Count) {
+            if (!ProcessId || !Descriptors || !Count) return FALSE;
+            KB_READ_WRITE_PROCESS_MEMORY_VECTORED_IN Input = {};
+            Input.ProcessId = ProcessId;
+            Input.Descriptors = reinterpret_cast<WdkTypes::PVOID>(Descriptors);
+            Input.Count = Count;
+            return KbSendRequest(Ctls::KbReadProcessMemoryVectored, &Input, sizeof(Input));
+        }
+
+        BOOL WINAPI KbWriteProcessMemoryVectored(ULONG ProcessId, IN OUT PKB_MEMORY_DESCRIPTOR Descriptors, ULONG Count) {
+            if (!ProcessId || !Descriptors || !Count) return FALSE;
+            KB_READ_WRITE_PROCESS_MEMORY_VECTORED_IN Input = {};
+            Input.ProcessId = ProcessId;
+            Input.Descriptors = reinterpret_cast<WdkTypes::PVOID>(Descriptors);
+            Input.Count = Count;
+            return KbSendRequest(Ctls::KbWriteProcessMemoryVectored, &Input, sizeof(Input));
+        }
     }
 
     namespace Apc {
@@ -844,4 +866,142 @@ namespace Stuff {
         Input.DriverNameSizeInBytes = static_cast<ULONG>(NameLength) * sizeof(WCHAR); // We're sure that Length <= 64
         return KbSendRequest(Ctls::KbCreateDriver, &Input, sizeof(Input));
     }
+}
+
+namespace Batch {
+    BOOL WINAPI KbExecuteBatch(IN OUT PVOID BatchBuffer, ULONG BatchSize)
+    {
+        if (!BatchBuffer || !BatchSize) return FALSE;
+        return KbSendRequest(Ctls::KbExecuteBatch, BatchBuffer, BatchSize, BatchBuffer, BatchSize);
+    }
+}
+
+namespace Rings {
+    static Producer<KB_RING_SUBMISSION> Submissions;
+    static Consumer<KB_RING_COMPLETION> Completions;
+
+    BOOL WINAPI KbSubmit(
+        Ctls::KbCtlIndices Index,
+        OPTIONAL IN PVOID Input,
+        ULONG InputSize,
+        OPTIONAL OUT PVOID Output,
+        ULONG OutputSize,
+        UINT64 UserData
+    ) {
+        if (!Submissions.IsAttached()) return FALSE;
+        if (InputSize > KB_RING_INLINE_INPUT_SIZE || (InputSize && !Input)) {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return FALSE;
+        }
+
+        PKB_RING_SUBMISSION Submission = Submissions.Reserve();
+        if (!Submission) {
+            SetLastError(ERROR_BUSY); // Submission ring is full
+            return FALSE;
+        }
+
+        Submission->UserData = UserData;
+        Submission->CtlIndex = Index;
+        Submission->InputSize = InputSize;
+        Submission->Output = reinterpret_cast<WdkTypes::PVOID>(Output);
+        Submission->OutputSize = OutputSize;
+        Submission->Reserved = 0;
+        if (InputSize) CopyMemory(Submission->Input, Input, InputSize);
+        Submissions.Commit();
+
+        // Only a worker that waits for submissions, a full completion ring is handled by reaping:
+        if (Submissions.IsWakeupNeeded()) KbSendRequest(Ctls::KbRingDoorbell);
+        return TRUE;
+    }
+
+    BOOL WINAPI KbReapCompletion(
+        OUT PUINT64 UserData,
+        OUT WdkTypes::NTSTATUS* Status,
+        OPTIONAL OUT PULONG ResponseLength
+    ) {
+        if (!Completions.IsAttached() || !UserData || !Status) return FALSE;
+
+        KB_RING_COMPLETION Completion = {};
+        if (!Completions.Pop(&Completion)) return FALSE;
+
+        *UserData = Completion.UserData;
+        *Status = Completion.Status;
+        if (ResponseLength) *ResponseLength = Completion.ResponseLength;
+
+        // Worker also sleeps when the completion ring is full, a worker that waits
+        // for submissions is waked up by KbSubmit, so reaping doesn't need a syscall:
+        if (Submissions.IsWakeupNeeded(KbRingNeedWakeup | KbRingCompletionsFull)) KbSendRequest(Ctls::KbRingDoorbell);
+        return TRUE;
+    }
+}
+
+namespace Diagnostics {
+    BOOL WINAPI KbGetLockStats(
+        OUT PKB_LOCK_STATS Stats,
+        ULONG Capacity,
+        OUT PULONG Count,
+        OPTIONAL OUT PULONG TotalCount,
+        BOOLEAN Reset
+    ) {
+        constexpr ULONG MaxCapacity = (0x7FFFFFFF - sizeof(KB_GET_LOCK_STATS_OUT)) / sizeof(KB_LOCK_STATS);
+        if (!Count || (Capacity && !Stats) || Capacity > MaxCapacity) return FALSE;
+
+        ULONG OutputSize = sizeof(KB_GET_LOCK_STATS_OUT) + Capacity * sizeof(KB_LOCK_STATS);
+        auto Output = static_cast<PKB_GET_LOCK_STATS_OUT>(HeapAlloc(GetProcessHeap(), 0, OutputSize));
+        if (!Output) return FALSE;
+
+        KB_GET_LOCK_STATS_IN Input = {};
+        Input.Reset = Reset;
+        BOOL Status = KbSendRequest(Ctls::KbGetLockStats, &Input, sizeof(Input), Output, OutputSize);
+        if (Status && Output->Count <= Capacity) {
+            if (Output->Count) CopyMemory(Stats, Output + 1, Output->Count * sizeof(KB_LOCK_STATS));
+            *Count = Output->Count;
+            if (TotalCount) *TotalCount = Output->TotalCount;
+        } else {
+            Status = FALSE;
+        }
+
+        HeapFree(GetProcessHeap(), 0, Output);
+        return Status;
+    }
+}
+
+namespace KbLoader {
+    BOOL WINAPI KbMapRings(ULONG SubmissionEntries, ULONG CompletionEntries)
+    {
+        if (Rings::Submissions.IsAttached()) {
+            SetLastError(ERROR_ALREADY_EXISTS);
+            return FALSE;
+        }
+
+        KB_CREATE_RINGS_IN Input = {};
+        KB_CREATE_RINGS_OUT Output = {};
+        Input.SubmissionEntries = SubmissionEntries;
+        Input.CompletionEntries = CompletionEntries;
+        BOOL Status = KbSendRequest(Ctls::KbCreateRings, &Input, sizeof(Input), &Output, sizeof(Output));
+        if (!Status) return FALSE;
+
+        auto SubmissionRing = reinterpret_cast<PKB_RING_HEADER>(Output.SubmissionRing);
+        auto CompletionRing = reinterpret_cast<PKB_RING_HEADER>(Output.CompletionRing);
+        if (
+            !Rings::IsRingValid(SubmissionRing, sizeof(KB_RING_SUBMISSION), SubmissionEntries) ||
+            !Rings::IsRingValid(CompletionRing, sizeof(KB_RING_COMPLETION), CompletionEntries)
+        ) {
+            KbSendRequest(Ctls::KbDestroyRings);
+            SetLastError(ERROR_INVALID_DATA);
+            return FALSE;
+        }
+
+        Rings::Submissions.Attach(SubmissionRing, SubmissionEntries);
+        Rings::Completions.Attach(CompletionRing, CompletionEntries);
+        return TRUE;
+    }
+
+    BOOL WINAPI KbUnmapRings()
+    {
+        if (!Rings::Submissions.IsAttached()) return TRUE;
+        Rings::Submissions.Detach();
+        Rings::Completions.Detach();
+        return KbSendRequest(Ctls::KbDestroyRings);
+    }
 }
\ No newline at end of file
@@ -4,6 +4,12 @@ namespace KbLoader {
     BOOL WINAPI KbLoadAsDriver(LPCWSTR DriverPath);
     BOOL WINAPI KbLoadAsFilter(LPCWSTR DriverPath, LPCWSTR Altitude);
     BOOL WINAPI KbUnload();
+
+    // Maps submission and completion rings (RingTypes.h) into the current process,
+    // it allows to send requests without syscalls through Rings::KbSubmit.
+    // Counts of entries must be a power of 2:
+    BOOL WINAPI KbMapRings(ULONG SubmissionEntries, ULONG CompletionEntries);
+    BOOL WINAPI KbUnmapRings();
 }
 
 namespace AddressRange {
@@ -230,6 +236,12 @@ namespace Processes {
         
         BOOL WINAPI KbReadProcessMemory(ULONG ProcessId, IN WdkTypes::PVOID BaseAddress, OUT PVOID Buffer, ULONG Size);
         BOOL WINAPI KbWriteProcessMemory(ULONG ProcessId, OUT WdkTypes::PVOID BaseAddress, IN PVOID Buffer, ULONG Size);
+
+        // Scatter-gather versions: the target process is attached once for all descriptors,
+        // status of each descriptor is written to its Status field.
+        // Returns TRUE only if all descriptors succeeded (see ScatterTypes.h for the rules):
+        BOOL WINAPI KbReadProcessMemoryVectored(ULONG ProcessId, IN OUT PKB_MEMORY_DESCRIPTOR Descriptors, ULONG Count);
+        BOOL WINAPI KbWriteProcessMemoryVectored(ULONG ProcessId, IN OUT PKB_MEMORY_DESCRIPTOR Descriptors, ULONG Count);
     }
 
     namespace Apc {
@@ -255,4 +267,45 @@ namespace Stuff {
     BOOL WINAPI KbStallExecutionProcessor(ULONG Microseconds);
     BOOL WINAPI KbBugCheck(ULONG Status);
     BOOL WINAPI KbCreateDriver(LPCWSTR DriverName, WdkTypes::PVOID DriverEntry);
+}
+
+namespace Batch {
+    // Executes all entries of the batch built by Batch::InitializeBatch/Batch::AppendEntry (BatchTypes.h)
+    // in one request, statuses and outputs of entries are written back into the 'BatchBuffer':
+    BOOL WINAPI KbExecuteBatch(IN OUT PVOID BatchBuffer, ULONG BatchSize);
+}
+
+namespace Rings {
+    // Pushes the request into the submission ring, 'Output' must be valid until its completion is reaped.
+    // Rings management and KbExecuteBatch complete with STATUS_NOT_SUPPORTED.
+    // KbSubmit and KbReapCompletion must be called from a single thread (or under a lock):
+    BOOL WINAPI KbSubmit(
+        Ctls::KbCtlIndices Index,
+        OPTIONAL IN PVOID Input, // KB_***_IN, up to KB_RING_INLINE_INPUT_SIZE bytes
+        ULONG InputSize,
+        OPTIONAL OUT PVOID Output,
+        ULONG OutputSize,
+        UINT64 UserData
+    );
+
+    // Returns FALSE if there are no completed requests:
+    BOOL WINAPI KbReapCompletion(
+        OUT PUINT64 UserData,
+        OUT WdkTypes::NTSTATUS* Status,
+        OPTIONAL OUT PULONG ResponseLength = NULL
+    );
+}
+
+namespace Diagnostics {
+    // Reads statistics of named locks of the driver (LockStatsTypes.h), the driver must be built
+    // with KB_LOCKS_INSTRUMENTED. Up to 'Capacity' entries are written, 'TotalCount' is the count of names,
+    // so the call can be repeated with a larger buffer. 'Reset' zeroes counters after the read,
+    // otherwise counters are monotonic and LockStats::GetDelta gives the activity between reads:
+    BOOL WINAPI KbGetLockStats(
+        OUT PKB_LOCK_STATS Stats,
+        ULONG Capacity,
+        OUT PULONG Count,
+        OPTIONAL OUT PULONG TotalCount = NULL,
+        BOOLEAN Reset = FALSE
+    );
 }
\ No newline at end of file